@@ -36,6 +36,7 @@ set(lwipcore_SRCS
     ${LWIP_DIR}/src/core/def.c
     ${LWIP_DIR}/src/core/dns.c
     ${LWIP_DIR}/src/core/inet_chksum.c
+    ${LWIP_DIR}/src/core/inet_chksum_simd.c
     ${LWIP_DIR}/src/core/ip.c
     ${LWIP_DIR}/src/core/mem.c
     ${LWIP_DIR}/src/core/memp.c
@@ -53,6 +54,8 @@ set(lwipcore_SRCS
     ${LWIP_DIR}/src/core/timeouts.c
     ${LWIP_DIR}/src/core/udp.c
     ${LWIP_DIR}/src/core/hmap.c
+    ${LWIP_DIR}/src/core/netml_tmr.c
+    ${LWIP_DIR}/src/core/netml_cc.c
     ${LWIP_DIR}/src/core/hash.c
     ${LWIP_DIR}/src/core/list.c
     ${LWIP_DIR}/src/core/util.c
@@ -108,6 +111,7 @@ set(lwipunix_SRCS
 	${LWIP_DIR}/src/unix/netif/sio.c
 	${LWIP_DIR}/src/unix/netif/tapif.c
 	${LWIP_DIR}/src/unix/netif/dpdkif.c
+	${LWIP_DIR}/src/unix/netif/packetif.c
 )
 
 ## 6LoWPAN
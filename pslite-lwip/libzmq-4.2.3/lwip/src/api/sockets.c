@@ -530,6 +530,10 @@ alloc_socket(struct netconn *newconn, int accepted)
        * (unless it has been created by accept()). */
       sockets[i].sendevent  = (NETCONNTYPE_GROUP(newconn->type) == NETCONN_TCP ? (accepted != 0) : 1);
       sockets[i].errevent   = 0;
+#if LWIP_NETML
+      sockets[i].ready_cb   = NULL;
+      sockets[i].ready_arg  = NULL;
+#endif
 #endif /* LWIP_SOCKET_SELECT || LWIP_SOCKET_POLL */
       return i + LWIP_SOCKET_OFFSET;
     }
@@ -611,7 +615,7 @@ free_socket(struct lwip_sock *sock, int is_tcp)
   }
 }
 
-#ifdef LWIP_NETML
+#if LWIP_NETML
 int lwip_setlocalid(int s, int id) {
 	struct lwip_sock *sock;
 
@@ -657,6 +661,106 @@ int lwip_setbypass(int s) {
 	return 0;
 }
 
+/**
+ * Return the readiness of a socket as LWIP_READY_* bits, -1 if s is not a
+ * socket. Unlike select, it neither blocks nor walks the other sockets.
+ */
+int
+lwip_readystate(int s)
+{
+  struct lwip_sock *sock;
+  int state = 0;
+  SYS_ARCH_DECL_PROTECT(lev);
+
+  sock = get_socket(s);
+  if (!sock) {
+    return -1;
+  }
+
+  SYS_ARCH_PROTECT(lev);
+  if (sock->lastdata.pbuf != NULL || sock->rcvevent > 0) {
+    state |= LWIP_READY_IN;
+  }
+  if (sock->sendevent) {
+    state |= LWIP_READY_OUT;
+  }
+  if (sock->errevent) {
+    state |= LWIP_READY_ERR;
+  }
+  SYS_ARCH_UNPROTECT(lev);
+  done_socket(sock);
+  return state;
+}
+
+/**
+ * Register cb to be called each time s becomes readable, writable or gets
+ * an error, NULL removes it. Events are only reported on these edges, the
+ * caller checks lwip_readystate() to find out what is still ready.
+ */
+int
+lwip_setreadycb(int s, lwip_ready_fn cb, void *arg)
+{
+  struct lwip_sock *sock;
+  SYS_ARCH_DECL_PROTECT(lev);
+
+  sock = get_socket(s);
+  if (!sock) {
+    return -1;
+  }
+
+  SYS_ARCH_PROTECT(lev);
+  sock->ready_cb = cb;
+  sock->ready_arg = arg;
+  SYS_ARCH_UNPROTECT(lev);
+  done_socket(sock);
+  return 0;
+}
+
+/**
+ * Non-blocking receive that hands the next received pbuf chain to the
+ * caller instead of copying it, the caller pbuf_free()s it when done.
+ * The window is reopened for the whole chain at once.
+ * Returns p->tot_len, 0 if the peer closed or -1 with errno set.
+ */
+ssize_t
+lwip_recv_pbuf(int s, struct pbuf **p)
+{
+  struct lwip_sock *sock;
+  err_t err;
+
+  *p = NULL;
+  sock = get_socket(s);
+  if (!sock) {
+    return -1;
+  }
+
+  if (NETCONNTYPE_GROUP(netconn_type(sock->conn)) != NETCONN_TCP) {
+    sock_set_errno(sock, err_to_errno(ERR_ARG));
+    done_socket(sock);
+    return -1;
+  }
+
+  /* left over by a copying recv */
+  if (sock->lastdata.pbuf) {
+    *p = sock->lastdata.pbuf;
+    sock->lastdata.pbuf = NULL;
+  } else {
+    err = netconn_recv_tcp_pbuf_flags(sock->conn, p,
+                                      NETCONN_NOAUTORCVD | NETCONN_DONTBLOCK);
+    if (err != ERR_OK) {
+      *p = NULL;
+      sock_set_errno(sock, err_to_errno(err));
+      done_socket(sock);
+      return err == ERR_CLSD ? 0 : -1;
+    }
+  }
+
+  netconn_tcp_recvd(sock->conn, (*p)->tot_len);
+  sock_set_errno(sock, 0);
+  done_socket(sock);
+  return (*p)->tot_len;
+}
+
 ssize_t
 lwip_send_netml(int s, const void *data, size_t size, int flags, int remote_id)
 {
@@ -2592,6 +2696,10 @@ event_callback(struct netconn *conn, enum netconn_evt evt, u16_t len)
 {
   int s, check_waiters;
   struct lwip_sock *sock;
+#if LWIP_NETML
+  lwip_ready_fn ready_cb;
+  void *ready_arg;
+#endif
   SYS_ARCH_DECL_PROTECT(lev);
 
   LWIP_UNUSED_ARG(len);
@@ -2659,6 +2767,12 @@ event_callback(struct netconn *conn, enum netconn_evt evt, u16_t len)
       break;
   }
 
+#if LWIP_NETML
+  /* check_waiters is only set when the socket became ready */
+  ready_cb = check_waiters ? sock->ready_cb : NULL;
+  ready_arg = sock->ready_arg;
+#endif
+
   if (sock->select_waiting && check_waiters) {
     /* Save which events are active */
     int has_recvevent, has_sendevent, has_errevent;
@@ -2671,6 +2785,11 @@ event_callback(struct netconn *conn, enum netconn_evt evt, u16_t len)
   } else {
     SYS_ARCH_UNPROTECT(lev);
   }
+#if LWIP_NETML
+  if (ready_cb) {
+    ready_cb(s, ready_arg);
+  }
+#endif
   done_socket(sock);
 }
 
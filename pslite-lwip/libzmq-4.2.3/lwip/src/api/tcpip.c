@@ -51,6 +51,7 @@
 #include "netif/ethernet.h"
 #include "lwip/tcp.h"
 #include <pthread.h>
+#include <sched.h>
 
 #define TCPIP_MSG_VAR_REF(name)     API_VAR_REF(name)
 #define TCPIP_MSG_VAR_DECLARE(name) API_VAR_DECLARE(struct tcpip_msg, name)
@@ -60,7 +61,9 @@
 /* global variables */
 static tcpip_init_done_fn tcpip_init_done;
 static void *tcpip_init_done_arg;
+#if !LWIP_TCPIP_RTC
 static sys_mbox_t tcpip_mbox;
+#endif /* !LWIP_TCPIP_RTC */
 
 #if LWIP_TCPIP_CORE_LOCKING
 /** The global semaphore to lock the stack. */
@@ -69,12 +72,47 @@ sys_mutex_t lock_tcpip_core;
 
 static void tcpip_thread_handle_msg(struct tcpip_msg *msg);
 
+#if LWIP_TCPIP_RTC
+#include "mlib/spsc.h"
+
+/* Run to completion: there is no tcpip_thread, the thread of the netif
+ * driver owns the stack and runs tcpip_rtc_poll(). Every other thread
+ * posts into a ring of its own, so posting takes no lock. */
+static struct spsc_ring *tcpip_rings[TCPIP_RTC_THREADS];
+/* rings handed out, a slot may still be NULL while its ring is created */
+static u32_t tcpip_nrings;
+static __thread struct spsc_ring *tcpip_ring;
+/* set by tcpip_init(), the first poll then runs tcpip_init_done */
+static u8_t tcpip_rtc_inited;
+static u8_t tcpip_rtc_running;
+/* set in the thread that runs tcpip_rtc_poll(), nobody else drains its ring */
+static __thread u8_t tcpip_rtc_self;
+/* what the tcpip thread posted while its ring was full, in order; only
+   that thread touches the list */
+static struct tcpip_msg *tcpip_rtc_overflow, *tcpip_rtc_overflow_tail;
+/* called after each post, the driver wakes the stack if it sleeps */
+static tcpip_rtc_wakeup_fn tcpip_rtc_wakeup;
+
+static err_t tcpip_rtc_post(void *msg, u8_t block);
+
+#define TCPIP_MBOX_VALID()                  1
+#define TCPIP_MBOX_POST(msg)                tcpip_rtc_post(msg, 1)
+#define TCPIP_MBOX_TRYPOST(msg)             tcpip_rtc_post(msg, 0)
+#define TCPIP_MBOX_TRYPOST_FROMISR(msg)     tcpip_rtc_post(msg, 0)
+#else /* LWIP_TCPIP_RTC */
+#define TCPIP_MBOX_VALID()                  sys_mbox_valid_val(tcpip_mbox)
+#define TCPIP_MBOX_POST(msg)                sys_mbox_post(&tcpip_mbox, msg)
+#define TCPIP_MBOX_TRYPOST(msg)             sys_mbox_trypost(&tcpip_mbox, msg)
+#define TCPIP_MBOX_TRYPOST_FROMISR(msg)     sys_mbox_trypost_fromisr(&tcpip_mbox, msg)
+#endif /* LWIP_TCPIP_RTC */
+
 #if LWIP_NETML
 #include "lwip/priv/tcp_priv.h"
 //#include <rte_hash.h>
 //#include <rte_hash_crc.h>
 #endif
 
+#if !LWIP_TCPIP_RTC
 #if !LWIP_TIMERS
 /* wait for a message with timers disabled (e.g. pass a timer-check trigger into tcpip_thread) */
 #define TCPIP_MBOX_FETCH(mbox, msg) sys_mbox_fetch(mbox, msg)
@@ -120,6 +158,7 @@ again:
   }
 }
 #endif /* !LWIP_TIMERS */
+#endif /* !LWIP_TCPIP_RTC */
 
 struct arp_entry_s {
 	struct eth_addr mac;
@@ -202,6 +241,7 @@ static void __init_arp_entries(void)
 	}
 }
 
+#if !LWIP_TCPIP_RTC
 /**
  * The main lwIP thread. This thread has exclusive access to lwIP core functions
  * (unless access to them is not locked). Other threads communicate with this
@@ -256,6 +296,159 @@ tcpip_thread(void *arg)
     tcpip_thread_handle_msg(msg);
   }
 }
+#else /* !LWIP_TCPIP_RTC */
+/**
+ * Post msg into the ring of the calling thread, waiting for room if block.
+ * The tcpip thread cannot wait for room in its own ring, nor handle msg
+ * inside the core call that posts it: when its ring is full, msg goes on
+ * the overflow list that the next tcpip_rtc_poll() drains.
+ */
+static err_t
+tcpip_rtc_post(void *msg, u8_t block)
+{
+  struct spsc_ring *r = tcpip_ring;
+
+  if (r == NULL) {
+    u32_t i = __atomic_fetch_add(&tcpip_nrings, 1, __ATOMIC_RELAXED);
+
+    if (i >= TCPIP_RTC_THREADS) {
+      LWIP_ASSERT("tcpip_rtc_post: too many threads", 0);
+      return ERR_MEM;
+    }
+    r = spsc_ring_create(TCPIP_RTC_RING_SIZE);
+    if (r == NULL) {
+      return ERR_MEM;
+    }
+    __atomic_store_n(&tcpip_rings[i], r, __ATOMIC_RELEASE);
+    tcpip_ring = r;
+  }
+  if (tcpip_rtc_self) {
+    struct tcpip_msg *m = (struct tcpip_msg *)msg;
+
+    /* behind the ones already on the list, whether or not the ring has room */
+    if (tcpip_rtc_overflow == NULL && spsc_ring_enqueue(r, msg)) {
+      return ERR_OK;
+    }
+    m->next = NULL;
+    if (tcpip_rtc_overflow == NULL) {
+      tcpip_rtc_overflow = m;
+    } else {
+      tcpip_rtc_overflow_tail->next = m;
+    }
+    tcpip_rtc_overflow_tail = m;
+    return ERR_OK;
+  }
+  while (!spsc_ring_enqueue(r, msg)) {
+    if (!block) {
+      return ERR_MEM;
+    }
+    sched_yield();
+  }
+  if (tcpip_rtc_wakeup != NULL) {
+    tcpip_rtc_wakeup();
+  }
+  return ERR_OK;
+}
+
+/**
+ * Whether a message waits for tcpip_rtc_poll(), for the thread of the
+ * stack before it sleeps. Pair it with a full barrier after announcing
+ * the sleep, the wakeup function reads the announcement after posting.
+ */
+u8_t
+tcpip_rtc_pending(void)
+{
+  u32_t i, n;
+
+  if (tcpip_rtc_overflow != NULL) {
+    return 1;
+  }
+  n = LWIP_MIN(__atomic_load_n(&tcpip_nrings, __ATOMIC_ACQUIRE), TCPIP_RTC_THREADS);
+  for (i = 0; i < n; i++) {
+    struct spsc_ring *r = __atomic_load_n(&tcpip_rings[i], __ATOMIC_ACQUIRE);
+
+    if (r != NULL && !spsc_ring_empty(r)) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/**
+ * Call wakeup after every message posted from now on, in the posting
+ * thread. The driver sets it to wake up the thread of the stack while it
+ * sleeps, before the other threads post.
+ */
+void
+tcpip_rtc_set_wakeup(tcpip_rtc_wakeup_fn wakeup)
+{
+  tcpip_rtc_wakeup = wakeup;
+}
+
+/**
+ * @ingroup lwip_os
+ * Run the stack for a round with LWIP_TCPIP_RTC: handle what the other
+ * threads posted, up to TCPIP_RTC_BURST messages each, and the expired
+ * timeouts. The thread that owns the stack calls it in its loop, the
+ * first call after tcpip_init() makes it the tcpip thread.
+ *
+ * @return the number of messages handled
+ */
+u32_t
+tcpip_rtc_poll(void)
+{
+  struct tcpip_msg *msg;
+  u32_t i, n, budget, done = 0;
+
+  if (!tcpip_rtc_running) {
+    if (!__atomic_load_n(&tcpip_rtc_inited, __ATOMIC_ACQUIRE)) {
+      return 0;
+    }
+    tcpip_rtc_running = 1;
+    tcpip_rtc_self = 1;
+    LWIP_MARK_TCPIP_THREAD();
+    if (tcpip_init_done != NULL) {
+      tcpip_init_done(tcpip_init_done_arg);
+    }
+    __init_arp_entries();
+  }
+  LWIP_TCPIP_THREAD_ALIVE();
+
+  n = LWIP_MIN(__atomic_load_n(&tcpip_nrings, __ATOMIC_ACQUIRE), TCPIP_RTC_THREADS);
+  for (i = 0; i < n; i++) {
+    struct spsc_ring *r = __atomic_load_n(&tcpip_rings[i], __ATOMIC_ACQUIRE);
+
+    if (r == NULL) {
+      continue;
+    }
+    for (budget = TCPIP_RTC_BURST; budget > 0; budget--) {
+      msg = (struct tcpip_msg *)spsc_ring_dequeue(r);
+      if (msg == NULL) {
+        break;
+      }
+      tcpip_thread_handle_msg(msg);
+      done++;
+    }
+  }
+  /* after the own ring, which holds the older posts; what the handlers
+     post meanwhile waits for the next round */
+  if (tcpip_rtc_overflow != NULL && (tcpip_ring == NULL || spsc_ring_empty(tcpip_ring))) {
+    msg = tcpip_rtc_overflow;
+    tcpip_rtc_overflow = NULL;
+    while (msg != NULL) {
+      struct tcpip_msg *next = msg->next;
+
+      tcpip_thread_handle_msg(msg);
+      msg = next;
+      done++;
+    }
+  }
+#if LWIP_TIMERS
+  sys_check_timeouts();
+#endif /* LWIP_TIMERS */
+  return done;
+}
+#endif /* !LWIP_TCPIP_RTC */
 
 /* Handle a single tcpip_msg
  * This is in its own function for access by tests only.
@@ -318,7 +511,7 @@ tcpip_thread_handle_msg(struct tcpip_msg *msg)
   }
 }
 
-#ifdef TCPIP_THREAD_TEST
+#if defined(TCPIP_THREAD_TEST) && !LWIP_TCPIP_RTC
 /** Work on queued items in single-threaded test mode */
 int
 tcpip_thread_poll_one(void)
@@ -358,7 +551,7 @@ tcpip_inpkt(struct pbuf *p, struct netif *inp, netif_input_fn input_fn)
 #else /* LWIP_TCPIP_CORE_LOCKING_INPUT */
   struct tcpip_msg *msg;
 
-  LWIP_ASSERT("Invalid mbox", sys_mbox_valid_val(tcpip_mbox));
+  LWIP_ASSERT("Invalid mbox", TCPIP_MBOX_VALID());
 
   msg = (struct tcpip_msg *)memp_malloc(MEMP_TCPIP_MSG_INPKT);
   if (msg == NULL) {
@@ -369,7 +562,7 @@ tcpip_inpkt(struct pbuf *p, struct netif *inp, netif_input_fn input_fn)
   msg->msg.inp.p = p;
   msg->msg.inp.netif = inp;
   msg->msg.inp.input_fn = input_fn;
-  if (sys_mbox_trypost(&tcpip_mbox, msg) != ERR_OK) {
+  if (TCPIP_MBOX_TRYPOST(msg) != ERR_OK) {
     memp_free(MEMP_TCPIP_MSG_INPKT, msg);
     return ERR_MEM;
   }
@@ -419,7 +612,7 @@ tcpip_callback(tcpip_callback_fn function, void *ctx)
 {
   struct tcpip_msg *msg;
 
-  LWIP_ASSERT("Invalid mbox", sys_mbox_valid_val(tcpip_mbox));
+  LWIP_ASSERT("Invalid mbox", TCPIP_MBOX_VALID());
 
   msg = (struct tcpip_msg *)memp_malloc(MEMP_TCPIP_MSG_API);
   if (msg == NULL) {
@@ -430,7 +623,7 @@ tcpip_callback(tcpip_callback_fn function, void *ctx)
   msg->msg.cb.function = function;
   msg->msg.cb.ctx = ctx;
 
-  sys_mbox_post(&tcpip_mbox, msg);
+  TCPIP_MBOX_POST(msg);
   return ERR_OK;
 }
 
@@ -455,7 +648,7 @@ tcpip_try_callback(tcpip_callback_fn function, void *ctx)
 {
   struct tcpip_msg *msg;
 
-  LWIP_ASSERT("Invalid mbox", sys_mbox_valid_val(tcpip_mbox));
+  LWIP_ASSERT("Invalid mbox", TCPIP_MBOX_VALID());
 
   msg = (struct tcpip_msg *)memp_malloc(MEMP_TCPIP_MSG_API);
   if (msg == NULL) {
@@ -466,7 +659,7 @@ tcpip_try_callback(tcpip_callback_fn function, void *ctx)
   msg->msg.cb.function = function;
   msg->msg.cb.ctx = ctx;
 
-  if (sys_mbox_trypost(&tcpip_mbox, msg) != ERR_OK) {
+  if (TCPIP_MBOX_TRYPOST(msg) != ERR_OK) {
     memp_free(MEMP_TCPIP_MSG_API, msg);
     return ERR_MEM;
   }
@@ -487,7 +680,7 @@ tcpip_timeout(u32_t msecs, sys_timeout_handler h, void *arg)
 {
   struct tcpip_msg *msg;
 
-  LWIP_ASSERT("Invalid mbox", sys_mbox_valid_val(tcpip_mbox));
+  LWIP_ASSERT("Invalid mbox", TCPIP_MBOX_VALID());
 
   msg = (struct tcpip_msg *)memp_malloc(MEMP_TCPIP_MSG_API);
   if (msg == NULL) {
@@ -498,7 +691,7 @@ tcpip_timeout(u32_t msecs, sys_timeout_handler h, void *arg)
   msg->msg.tmo.msecs = msecs;
   msg->msg.tmo.h = h;
   msg->msg.tmo.arg = arg;
-  sys_mbox_post(&tcpip_mbox, msg);
+  TCPIP_MBOX_POST(msg);
   return ERR_OK;
 }
 
@@ -514,7 +707,7 @@ tcpip_untimeout(sys_timeout_handler h, void *arg)
 {
   struct tcpip_msg *msg;
 
-  LWIP_ASSERT("Invalid mbox", sys_mbox_valid_val(tcpip_mbox));
+  LWIP_ASSERT("Invalid mbox", TCPIP_MBOX_VALID());
 
   msg = (struct tcpip_msg *)memp_malloc(MEMP_TCPIP_MSG_API);
   if (msg == NULL) {
@@ -524,7 +717,7 @@ tcpip_untimeout(sys_timeout_handler h, void *arg)
   msg->type = TCPIP_MSG_UNTIMEOUT;
   msg->msg.tmo.h = h;
   msg->msg.tmo.arg = arg;
-  sys_mbox_post(&tcpip_mbox, msg);
+  TCPIP_MBOX_POST(msg);
   return ERR_OK;
 }
 #endif /* LWIP_TCPIP_TIMEOUT && LWIP_TIMERS */
@@ -555,13 +748,13 @@ tcpip_send_msg_wait_sem(tcpip_callback_fn fn, void *apimsg, sys_sem_t *sem)
   TCPIP_MSG_VAR_DECLARE(msg);
 
   LWIP_ASSERT("semaphore not initialized", sys_sem_valid(sem));
-  LWIP_ASSERT("Invalid mbox", sys_mbox_valid_val(tcpip_mbox));
+  LWIP_ASSERT("Invalid mbox", TCPIP_MBOX_VALID());
 
   TCPIP_MSG_VAR_ALLOC(msg);
   TCPIP_MSG_VAR_REF(msg).type = TCPIP_MSG_API;
   TCPIP_MSG_VAR_REF(msg).msg.api_msg.function = fn;
   TCPIP_MSG_VAR_REF(msg).msg.api_msg.msg = apimsg;
-  sys_mbox_post(&tcpip_mbox, &TCPIP_MSG_VAR_REF(msg));
+  TCPIP_MBOX_POST(&TCPIP_MSG_VAR_REF(msg));
   sys_arch_sem_wait(sem, 0);
   TCPIP_MSG_VAR_FREE(msg);
   return ERR_OK;
@@ -597,7 +790,7 @@ tcpip_api_call(tcpip_api_call_fn fn, struct tcpip_api_call_data *call)
   }
 #endif /* LWIP_NETCONN_SEM_PER_THREAD */
 
-  LWIP_ASSERT("Invalid mbox", sys_mbox_valid_val(tcpip_mbox));
+  LWIP_ASSERT("Invalid mbox", TCPIP_MBOX_VALID());
 
   TCPIP_MSG_VAR_ALLOC(msg);
   TCPIP_MSG_VAR_REF(msg).type = TCPIP_MSG_API_CALL;
@@ -608,7 +801,7 @@ tcpip_api_call(tcpip_api_call_fn fn, struct tcpip_api_call_data *call)
 #else /* LWIP_NETCONN_SEM_PER_THREAD */
   TCPIP_MSG_VAR_REF(msg).msg.api_call.sem = &call->sem;
 #endif /* LWIP_NETCONN_SEM_PER_THREAD */
-  sys_mbox_post(&tcpip_mbox, &TCPIP_MSG_VAR_REF(msg));
+  TCPIP_MBOX_POST(&TCPIP_MSG_VAR_REF(msg));
   sys_arch_sem_wait(TCPIP_MSG_VAR_REF(msg).msg.api_call.sem, 0);
   TCPIP_MSG_VAR_FREE(msg);
 
@@ -675,8 +868,8 @@ tcpip_callbackmsg_delete(struct tcpip_callback_msg *msg)
 err_t
 tcpip_callbackmsg_trycallback(struct tcpip_callback_msg *msg)
 {
-  LWIP_ASSERT("Invalid mbox", sys_mbox_valid_val(tcpip_mbox));
-  return sys_mbox_trypost(&tcpip_mbox, msg);
+  LWIP_ASSERT("Invalid mbox", TCPIP_MBOX_VALID());
+  return TCPIP_MBOX_TRYPOST(msg);
 }
 
 /**
@@ -694,8 +887,8 @@ tcpip_callbackmsg_trycallback(struct tcpip_callback_msg *msg)
 err_t
 tcpip_callbackmsg_trycallback_fromisr(struct tcpip_callback_msg *msg)
 {
-  LWIP_ASSERT("Invalid mbox", sys_mbox_valid_val(tcpip_mbox));
-  return sys_mbox_trypost_fromisr(&tcpip_mbox, msg);
+  LWIP_ASSERT("Invalid mbox", TCPIP_MBOX_VALID());
+  return TCPIP_MBOX_TRYPOST_FROMISR(msg);
 }
 
 /**
@@ -714,6 +907,10 @@ tcpip_init(tcpip_init_done_fn initfunc, void *arg)
 
   tcpip_init_done = initfunc;
   tcpip_init_done_arg = arg;
+#if LWIP_TCPIP_RTC
+  /* the next tcpip_rtc_poll() of the netif driver runs initfunc */
+  __atomic_store_n(&tcpip_rtc_inited, 1, __ATOMIC_RELEASE);
+#else /* LWIP_TCPIP_RTC */
   if (sys_mbox_new(&tcpip_mbox, TCPIP_MBOX_SIZE) != ERR_OK) {
     LWIP_ASSERT("failed to create tcpip_thread mbox", 0);
   }
@@ -731,6 +928,7 @@ tcpip_init(tcpip_init_done_fn initfunc, void *arg)
 //
 //  LOCK_TCPIP_CORE();
   sys_thread_new(TCPIP_THREAD_NAME, tcpip_thread, NULL, TCPIP_THREAD_STACKSIZE, TCPIP_THREAD_PRIO);
+#endif /* LWIP_TCPIP_RTC */
 }
 
 /**
@@ -60,6 +60,10 @@
 # endif
 u16_t lwip_standard_chksum(const void *dataptr, int len);
 #endif
+#if LWIP_CHKSUM_SIMD && !defined LWIP_CHKSUM_ALGORITHM
+/* the fallback of inet_chksum_simd.c, and the reference of its tests */
+# define LWIP_CHKSUM_ALGORITHM 3
+#endif
 /* If none set: */
 #ifndef LWIP_CHKSUM_ALGORITHM
 # define LWIP_CHKSUM_ALGORITHM 0
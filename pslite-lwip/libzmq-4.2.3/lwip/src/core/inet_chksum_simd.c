@@ -0,0 +1,288 @@
+/**
+ * @file
+ * Internet checksum with SSE2/AVX2, LWIP_CHKSUM_SIMD
+ */
+
+#include "lwip/opt.h"
+
+#if LWIP_CHKSUM_SIMD
+
+#include <string.h>
+
+#include "lwip/def.h"
+#include "lwip/inet_chksum.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define CHKSUM_X86	1
+#include <immintrin.h>
+#else
+#define CHKSUM_X86	0
+#endif
+
+/*
+ * The sum is taken over 32-bit words in 64-bit lanes, which is the sum of
+ * the 16-bit words modulo 0xffff since 2^16 = 1 there. The loads are
+ * unaligned so an odd start needs no swapping, the result is in the byte
+ * order of the data as the one of lwip_standard_chksum().
+ */
+
+typedef u16_t (*chksum_fn)(const void *dataptr, int len);
+typedef u16_t (*chksum_copy_fn)(void *dst, const void *src, int len);
+
+/** Fold a sum of words to 16 bits */
+static inline u16_t
+chksum_fold(u64_t sum)
+{
+  sum = (sum & 0xffffffffULL) + (sum >> 32);
+  sum = (sum & 0xffffffffULL) + (sum >> 32);
+  sum = FOLD_U32T(sum);
+  sum = FOLD_U32T(sum);
+  return (u16_t)sum;
+}
+
+/** Add the less than a vector left at p to sum */
+static inline u64_t
+chksum_tail(const u8_t *p, int len, u64_t sum)
+{
+  u64_t w;
+  u32_t d;
+  u16_t h;
+
+  while (len >= 8) {
+    memcpy(&w, p, 8);
+    sum += (w & 0xffffffffULL) + (w >> 32);
+    p += 8;
+    len -= 8;
+  }
+  if (len >= 4) {
+    memcpy(&d, p, 4);
+    sum += d;
+    p += 4;
+    len -= 4;
+  }
+  if (len >= 2) {
+    memcpy(&h, p, 2);
+    sum += h;
+    p += 2;
+    len -= 2;
+  }
+  if (len > 0) {
+    /* the first byte of a word padded with zero */
+    h = 0;
+    memcpy(&h, p, 1);
+    sum += h;
+  }
+  return sum;
+}
+
+static u16_t
+chksum_scalar(const void *dataptr, int len)
+{
+  return lwip_standard_chksum(dataptr, len);
+}
+
+static u16_t
+chksum_copy_scalar(void *dst, const void *src, int len)
+{
+  MEMCPY(dst, src, len);
+  return lwip_standard_chksum(dst, len);
+}
+
+#if CHKSUM_X86
+__attribute__((target("sse2"))) static u16_t
+chksum_sse2(const void *dataptr, int len)
+{
+  const u8_t *p = (const u8_t *)dataptr;
+  const __m128i zero = _mm_setzero_si128();
+  __m128i acc0 = zero, acc1 = zero;
+  u64_t lanes[2];
+
+  while (len >= 32) {
+    __m128i a = _mm_loadu_si128((const __m128i *)p);
+    __m128i b = _mm_loadu_si128((const __m128i *)(p + 16));
+
+    acc0 = _mm_add_epi64(acc0, _mm_unpacklo_epi32(a, zero));
+    acc1 = _mm_add_epi64(acc1, _mm_unpackhi_epi32(a, zero));
+    acc0 = _mm_add_epi64(acc0, _mm_unpacklo_epi32(b, zero));
+    acc1 = _mm_add_epi64(acc1, _mm_unpackhi_epi32(b, zero));
+    p += 32;
+    len -= 32;
+  }
+  _mm_storeu_si128((__m128i *)lanes, _mm_add_epi64(acc0, acc1));
+  return chksum_fold(chksum_tail(p, len, lanes[0] + lanes[1]));
+}
+
+__attribute__((target("sse2"))) static u16_t
+chksum_copy_sse2(void *dst, const void *src, int len)
+{
+  const u8_t *s = (const u8_t *)src;
+  u8_t *d = (u8_t *)dst;
+  const __m128i zero = _mm_setzero_si128();
+  __m128i acc0 = zero, acc1 = zero;
+  u64_t lanes[2];
+
+  while (len >= 32) {
+    __m128i a = _mm_loadu_si128((const __m128i *)s);
+    __m128i b = _mm_loadu_si128((const __m128i *)(s + 16));
+
+    _mm_storeu_si128((__m128i *)d, a);
+    _mm_storeu_si128((__m128i *)(d + 16), b);
+    acc0 = _mm_add_epi64(acc0, _mm_unpacklo_epi32(a, zero));
+    acc1 = _mm_add_epi64(acc1, _mm_unpackhi_epi32(a, zero));
+    acc0 = _mm_add_epi64(acc0, _mm_unpacklo_epi32(b, zero));
+    acc1 = _mm_add_epi64(acc1, _mm_unpackhi_epi32(b, zero));
+    s += 32;
+    d += 32;
+    len -= 32;
+  }
+  MEMCPY(d, s, len);
+  _mm_storeu_si128((__m128i *)lanes, _mm_add_epi64(acc0, acc1));
+  return chksum_fold(chksum_tail(d, len, lanes[0] + lanes[1]));
+}
+
+__attribute__((target("avx2"))) static u16_t
+chksum_avx2(const void *dataptr, int len)
+{
+  const u8_t *p = (const u8_t *)dataptr;
+  const __m256i zero = _mm256_setzero_si256();
+  __m256i acc0 = zero, acc1 = zero;
+  __m128i acc;
+  u64_t lanes[2];
+
+  while (len >= 64) {
+    __m256i a = _mm256_loadu_si256((const __m256i *)p);
+    __m256i b = _mm256_loadu_si256((const __m256i *)(p + 32));
+
+    acc0 = _mm256_add_epi64(acc0, _mm256_unpacklo_epi32(a, zero));
+    acc1 = _mm256_add_epi64(acc1, _mm256_unpackhi_epi32(a, zero));
+    acc0 = _mm256_add_epi64(acc0, _mm256_unpacklo_epi32(b, zero));
+    acc1 = _mm256_add_epi64(acc1, _mm256_unpackhi_epi32(b, zero));
+    p += 64;
+    len -= 64;
+  }
+  acc0 = _mm256_add_epi64(acc0, acc1);
+  acc = _mm_add_epi64(_mm256_castsi256_si128(acc0), _mm256_extracti128_si256(acc0, 1));
+  _mm_storeu_si128((__m128i *)lanes, acc);
+  return chksum_fold(chksum_tail(p, len, lanes[0] + lanes[1]));
+}
+
+__attribute__((target("avx2"))) static u16_t
+chksum_copy_avx2(void *dst, const void *src, int len)
+{
+  const u8_t *s = (const u8_t *)src;
+  u8_t *d = (u8_t *)dst;
+  const __m256i zero = _mm256_setzero_si256();
+  __m256i acc0 = zero, acc1 = zero;
+  __m128i acc;
+  u64_t lanes[2];
+
+  while (len >= 64) {
+    __m256i a = _mm256_loadu_si256((const __m256i *)s);
+    __m256i b = _mm256_loadu_si256((const __m256i *)(s + 32));
+
+    _mm256_storeu_si256((__m256i *)d, a);
+    _mm256_storeu_si256((__m256i *)(d + 32), b);
+    acc0 = _mm256_add_epi64(acc0, _mm256_unpacklo_epi32(a, zero));
+    acc1 = _mm256_add_epi64(acc1, _mm256_unpackhi_epi32(a, zero));
+    acc0 = _mm256_add_epi64(acc0, _mm256_unpacklo_epi32(b, zero));
+    acc1 = _mm256_add_epi64(acc1, _mm256_unpackhi_epi32(b, zero));
+    s += 64;
+    d += 64;
+    len -= 64;
+  }
+  MEMCPY(d, s, len);
+  acc0 = _mm256_add_epi64(acc0, acc1);
+  acc = _mm_add_epi64(_mm256_castsi256_si128(acc0), _mm256_extracti128_si256(acc0, 1));
+  _mm_storeu_si128((__m128i *)lanes, acc);
+  return chksum_fold(chksum_tail(d, len, lanes[0] + lanes[1]));
+}
+#endif /* CHKSUM_X86 */
+
+static const struct {
+  const char *name;
+  chksum_fn chksum;
+  chksum_copy_fn copy;
+} chksum_impls[] = {
+#if CHKSUM_X86
+  { "avx2", chksum_avx2, chksum_copy_avx2 },
+  { "sse2", chksum_sse2, chksum_copy_sse2 },
+#endif
+  { "scalar", chksum_scalar, chksum_copy_scalar }
+};
+
+static chksum_fn chksum_impl = chksum_scalar;
+static chksum_copy_fn chksum_copy_impl = chksum_copy_scalar;
+static const char *chksum_impl_name = "scalar";
+
+static int
+chksum_supported(const char *name)
+{
+#if CHKSUM_X86
+  __builtin_cpu_init();
+  if (strcmp(name, "avx2") == 0) {
+    return __builtin_cpu_supports("avx2");
+  }
+  if (strcmp(name, "sse2") == 0) {
+    return __builtin_cpu_supports("sse2");
+  }
+#endif
+  return strcmp(name, "scalar") == 0;
+}
+
+/** The best routine of the CPU, before anything is sent */
+__attribute__((constructor)) static void
+chksum_select(void)
+{
+  size_t i;
+
+  for (i = 0; i < LWIP_ARRAYSIZE(chksum_impls); i++) {
+    if (lwip_simd_chksum_use(chksum_impls[i].name)) {
+      return;
+    }
+  }
+}
+
+/**
+ * Use the routine name, "avx2", "sse2" or "scalar", from now on, for the
+ * tests. By default the best one the CPU supports is used.
+ *
+ * @return 1 if it is used, 0 if the CPU does not support it
+ */
+u8_t
+lwip_simd_chksum_use(const char *name)
+{
+  size_t i;
+
+  for (i = 0; i < LWIP_ARRAYSIZE(chksum_impls); i++) {
+    if (strcmp(chksum_impls[i].name, name) == 0 && chksum_supported(name)) {
+      chksum_impl = chksum_impls[i].chksum;
+      chksum_copy_impl = chksum_impls[i].copy;
+      chksum_impl_name = chksum_impls[i].name;
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/** The name of the routine in use */
+const char *
+lwip_simd_chksum_name(void)
+{
+  return chksum_impl_name;
+}
+
+/** LWIP_CHKSUM: the non-inverted sum of len bytes at dataptr */
+u16_t
+lwip_simd_chksum(const void *dataptr, int len)
+{
+  return chksum_impl(dataptr, len);
+}
+
+/** LWIP_CHKSUM_COPY: MEMCPY returning the LWIP_CHKSUM of the data */
+u16_t
+lwip_simd_chksum_copy(void *dst, const void *src, u16_t len)
+{
+  return chksum_copy_impl(dst, src, len);
+}
+
+#endif /* LWIP_CHKSUM_SIMD */
@@ -57,6 +57,7 @@
 #include "lwip/nd6.h"
 #include "lwip/mld6.h"
 #include "lwip/api.h"
+#include "lwip/netml_tmr.h"
 
 #include "netif/ppp/ppp_opts.h"
 #include "netif/ppp/ppp_impl.h"
@@ -178,6 +179,12 @@ PACK_STRUCT_END
 #if (LWIP_PPP_API && (NO_SYS==1))
 #error "If you want to use PPP API, you have to define NO_SYS=0 in your lwipopts.h"
 #endif
+#if (LWIP_TCPIP_RTC && (NO_SYS || LWIP_TCPIP_CORE_LOCKING || LWIP_TCPIP_CORE_LOCKING_INPUT))
+#error "If you want to use LWIP_TCPIP_RTC, you have to define NO_SYS=0, LWIP_TCPIP_CORE_LOCKING=0 and LWIP_TCPIP_CORE_LOCKING_INPUT=0 in your lwipopts.h"
+#endif
+#if (LWIP_TCPIP_RTC && (TCPIP_RTC_RING_SIZE & (TCPIP_RTC_RING_SIZE - 1)))
+#error "TCPIP_RTC_RING_SIZE must be a power of two"
+#endif
 #if (LWIP_PPP_API && (PPP_SUPPORT==0))
 #error "If you want to use PPP API, you have to enable PPP_SUPPORT in your lwipopts.h"
 #endif
@@ -364,6 +371,9 @@ lwip_init(void)
 #if LWIP_TCP
   tcp_init();
 #endif /* LWIP_TCP */
+#if LWIP_NETML
+  netml_tmr_calibrate();
+#endif /* LWIP_NETML */
 #if LWIP_IGMP
   igmp_init();
 #endif /* LWIP_IGMP */
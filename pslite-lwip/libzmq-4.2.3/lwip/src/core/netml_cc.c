@@ -0,0 +1,288 @@
+/**
+ * @file
+ * Congestion control of the NETML data path
+ */
+
+#include "lwip/opt.h"
+
+#if LWIP_NETML
+
+#include <string.h>
+
+#include "lwip/def.h"
+#include "lwip/tcp.h"
+#include "lwip/netml.h"
+#include "lwip/netml_cc.h"
+
+#ifndef NETML_CC_DEFAULT
+#define NETML_CC_DEFAULT	netml_cc_none
+#endif
+/* Rate the pacer adds per observation window without marks */
+#ifndef NETML_CC_PACE_AI
+#define NETML_CC_PACE_AI	(NETML_CC_LINE_RATE / 100)
+#endif
+
+/* the end of an observation window, netml_cc_window() */
+#define NETML_CC_WIN_OPEN	0
+#define NETML_CC_WIN_CLEAN	1
+#define NETML_CC_WIN_MARKED	2
+
+static const struct netml_cc_ops *netml_cc_default = &NETML_CC_DEFAULT;
+
+/** Smoothed RTT of ic in microseconds, 0 before it is measured */
+static inline u32_t
+netml_cc_srtt(struct tcp_internal_id *ic)
+{
+  return (u32_t)(ic->sa_us >> 3);
+}
+
+static void
+netml_cc_window_start(struct tcp_internal_id *ic)
+{
+  ic->cc.win_acked = 0;
+  ic->cc.win_ce = 0;
+  ic->cc.win_start = netml_tmr_now();
+}
+
+/**
+ * Account an ACK to the observation window of ic, which ends once len
+ * bytes were acked in it. At its end, alpha moves towards the fraction of
+ * the bytes marked in it by 1/2^NETML_CC_DCTCP_G.
+ */
+static u8_t
+netml_cc_window(struct tcp_internal_id *ic, u32_t acked, u32_t ce, u32_t len)
+{
+  struct netml_cc *cc = &ic->cc;
+  u32_t frac;
+  u8_t marked;
+
+  cc->win_acked += acked;
+  cc->win_ce += LWIP_MIN(ce, acked);
+  if (cc->win_acked < len) {
+    return NETML_CC_WIN_OPEN;
+  }
+  frac = (u32_t)(((u64_t)cc->win_ce * NETML_CC_ALPHA_ONE) / cc->win_acked);
+  cc->alpha = cc->alpha - (cc->alpha >> NETML_CC_DCTCP_G) + (frac >> NETML_CC_DCTCP_G);
+  marked = cc->win_ce > 0;
+  netml_cc_window_start(ic);
+  return marked ? NETML_CC_WIN_MARKED : NETML_CC_WIN_CLEAN;
+}
+
+/** Whether ic reduced within the last RTT already */
+static u8_t
+netml_cc_cut_recently(struct tcp_internal_id *ic)
+{
+  return netml_tmr_now() - ic->cc.cut_us < netml_cc_srtt(ic);
+}
+
+/* DCTCP */
+
+static void
+dctcp_init(struct tcp_internal_id *ic)
+{
+  ic->cc.cwnd = NETML_CC_INIT_WND;
+  ic->cc.ssthresh = 0xffffffffU;
+  ic->cc.alpha = NETML_CC_ALPHA_ONE;
+  ic->cc.cut_us = netml_tmr_now();
+  netml_cc_window_start(ic);
+}
+
+static u8_t
+dctcp_can_send(struct tcp_internal_id *ic, u16_t len)
+{
+  /* a segment larger than the window still goes alone */
+  return ic->cc.inflight == 0 || ic->cc.inflight + len <= ic->cc.cwnd;
+}
+
+static void
+dctcp_acked(struct tcp_internal_id *ic, u32_t acked, u32_t ce)
+{
+  struct netml_cc *cc = &ic->cc;
+  u32_t mss = ic->pcb->mss;
+
+  if (netml_cc_window(ic, acked, ce, cc->cwnd) == NETML_CC_WIN_MARKED) {
+    u32_t cut = (u32_t)(((u64_t)cc->cwnd * cc->alpha) / (2 * NETML_CC_ALPHA_ONE));
+
+    cc->cwnd = LWIP_MAX(cc->cwnd - cut, mss);
+    cc->ssthresh = cc->cwnd;
+    cc->cut_us = netml_tmr_now();
+    return;
+  }
+  if (ce > 0) {
+    return;
+  }
+  if (cc->cwnd < cc->ssthresh) {
+    cc->cwnd += acked;
+  } else {
+    cc->cwnd += LWIP_MAX((u32_t)(((u64_t)mss * acked) / cc->cwnd), 1);
+  }
+  /* no more than that is ever queued */
+  cc->cwnd = LWIP_MIN(cc->cwnd, TCP_SND_BUF);
+}
+
+static void
+dctcp_lost(struct tcp_internal_id *ic)
+{
+  struct netml_cc *cc = &ic->cc;
+
+  if (netml_cc_cut_recently(ic)) {
+    return;
+  }
+  cc->ssthresh = LWIP_MAX(cc->cwnd >> 1, 2 * (u32_t)ic->pcb->mss);
+  cc->cwnd = cc->ssthresh;
+  cc->cut_us = netml_tmr_now();
+}
+
+const struct netml_cc_ops netml_cc_dctcp = {
+  "dctcp",
+  1,
+  dctcp_init,
+  dctcp_can_send,
+  NULL,
+  dctcp_acked,
+  dctcp_lost
+};
+
+/* Rate based pacer */
+
+static void
+pace_init(struct tcp_internal_id *ic)
+{
+  ic->cc.rate = NETML_CC_LINE_RATE;
+  ic->cc.tokens = NETML_CC_PACE_BURST;
+  ic->cc.tokens_us = netml_tmr_now();
+  ic->cc.alpha = NETML_CC_ALPHA_ONE;
+  ic->cc.cut_us = ic->cc.tokens_us;
+  netml_cc_window_start(ic);
+}
+
+static u8_t
+pace_can_send(struct tcp_internal_id *ic, u16_t len)
+{
+  struct netml_cc *cc = &ic->cc;
+  u32_t now = netml_tmr_now();
+  u64_t add;
+
+  add = ((u64_t)cc->rate * (now - cc->tokens_us)) / 1000000;
+  if (add > 0) {
+    cc->tokens = (u32_t)LWIP_MIN(cc->tokens + add, NETML_CC_PACE_BURST);
+    cc->tokens_us = now;
+  }
+  if (cc->tokens >= len) {
+    return 1;
+  }
+  /* held back until the bucket has enough */
+  netml_cc_resume(ic, (u32_t)(((u64_t)(len - cc->tokens) * 1000000) / cc->rate) + 1);
+  return 0;
+}
+
+static void
+pace_sent(struct tcp_internal_id *ic, u16_t len)
+{
+  ic->cc.tokens -= LWIP_MIN(ic->cc.tokens, len);
+}
+
+static void
+pace_acked(struct tcp_internal_id *ic, u32_t acked, u32_t ce)
+{
+  struct netml_cc *cc = &ic->cc;
+  /* about a RTT worth of bytes at the current rate */
+  u32_t len = (u32_t)LWIP_MAX(((u64_t)cc->rate * netml_cc_srtt(ic)) / 1000000,
+                              NETML_CC_PACE_BURST);
+
+  switch (netml_cc_window(ic, acked, ce, len)) {
+    case NETML_CC_WIN_MARKED:
+      cc->rate -= (u32_t)(((u64_t)cc->rate * cc->alpha) / (2 * NETML_CC_ALPHA_ONE));
+      cc->rate = LWIP_MAX(cc->rate, NETML_CC_MIN_RATE);
+      cc->cut_us = netml_tmr_now();
+      break;
+    case NETML_CC_WIN_CLEAN:
+      cc->rate = LWIP_MIN(cc->rate + NETML_CC_PACE_AI, NETML_CC_LINE_RATE);
+      break;
+    default:
+      break;
+  }
+}
+
+static void
+pace_lost(struct tcp_internal_id *ic)
+{
+  if (netml_cc_cut_recently(ic)) {
+    return;
+  }
+  ic->cc.rate = LWIP_MAX(ic->cc.rate >> 1, NETML_CC_MIN_RATE);
+  ic->cc.cut_us = netml_tmr_now();
+}
+
+const struct netml_cc_ops netml_cc_pace = {
+  "pace",
+  1,
+  pace_init,
+  pace_can_send,
+  pace_sent,
+  pace_acked,
+  pace_lost
+};
+
+const struct netml_cc_ops netml_cc_none = {
+  "none",
+  0,
+  NULL,
+  NULL,
+  NULL,
+  NULL,
+  NULL
+};
+
+static const struct netml_cc_ops *const netml_cc_all[] = {
+  &netml_cc_none,
+  &netml_cc_dctcp,
+  &netml_cc_pace
+};
+
+/** The controller called name, NULL if there is none */
+const struct netml_cc_ops *
+netml_cc_find(const char *name)
+{
+  size_t i;
+
+  for (i = 0; i < LWIP_ARRAYSIZE(netml_cc_all); i++) {
+    if (strcmp(netml_cc_all[i]->name, name) == 0) {
+      return netml_cc_all[i];
+    }
+  }
+  return NULL;
+}
+
+/**
+ * Select the controller of the pcbs created from now on. Call it before
+ * the tcpip thread starts.
+ */
+err_t
+netml_cc_set_default(const char *name)
+{
+  const struct netml_cc_ops *ops = netml_cc_find(name);
+
+  if (ops == NULL) {
+    return ERR_ARG;
+  }
+  netml_cc_default = ops;
+  return ERR_OK;
+}
+
+const struct netml_cc_ops *
+netml_cc_get_default(void)
+{
+  return netml_cc_default;
+}
+
+/** Restart the output to ic in us microseconds, unless it is due already */
+void
+netml_cc_resume(struct tcp_internal_id *ic, u32_t us)
+{
+  if (!netml_tmr_pending(&ic->cc.resume_tmr)) {
+    netml_tmr_add(&ic->cc.resume_tmr, us);
+  }
+}
+
+#endif /* LWIP_NETML */
@@ -0,0 +1,271 @@
+/**
+ * @file
+ * Timer wheel of the NETML data path
+ */
+
+#include "lwip/opt.h"
+
+#if LWIP_NETML
+
+#include "lwip/def.h"
+#include "lwip/netml_tmr.h"
+
+#include <time.h>
+#include <rte_cycles.h>
+
+/* how long netml_tmr_calibrate() counts the TSC without DPDK */
+#define NETML_TMR_CALIBRATE_NS	20000000
+
+/* set once by netml_tmr_calibrate() */
+static u64_t tsc_per_us;
+
+static struct netml_tmr *wheel[NETML_TMR_SLOTS];
+/* a bit per slot of the wheel, set while its list is not empty */
+#define NETML_TMR_WORDS		(NETML_TMR_SLOTS / 64)
+static u64_t occupied[NETML_TMR_WORDS];
+/* the next tick to run */
+static u64_t cur_tick;
+/* no timer expires before it, read by netml_tmr_due() from other threads */
+static volatile u64_t next_expire = ~(u64_t)0;
+
+static inline u64_t
+netml_rdtsc(void)
+{
+  u32_t lo, hi;
+
+  __asm__ __volatile__("rdtsc" : "=a" (lo), "=d" (hi));
+  return ((u64_t)hi << 32) | lo;
+}
+
+static inline u64_t
+netml_tick(void)
+{
+  return netml_rdtsc() / tsc_per_us / NETML_TMR_TICK_US;
+}
+
+static u64_t
+netml_ns(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (u64_t)ts.tv_sec * 1000000000ULL + (u64_t)ts.tv_nsec;
+}
+
+/**
+ * Measure the TSC frequency, called once by lwip_init(). DPDK knows it
+ * once the EAL is up, otherwise the TSC is counted against
+ * CLOCK_MONOTONIC for NETML_TMR_CALIBRATE_NS.
+ */
+void
+netml_tmr_calibrate(void)
+{
+  struct timespec ts = { 0, NETML_TMR_CALIBRATE_NS };
+  u64_t hz = rte_get_tsc_hz();
+  u64_t ns, tsc;
+
+  if (tsc_per_us != 0) {
+    return;
+  }
+  if (hz == 0) {
+    ns = netml_ns();
+    tsc = netml_rdtsc();
+    nanosleep(&ts, NULL);
+    tsc = netml_rdtsc() - tsc;
+    ns = netml_ns() - ns;
+    hz = tsc * 1000000000ULL / ns;
+  }
+  tsc_per_us = LWIP_MAX(hz / 1000000, 1);
+  LWIP_DEBUGF(TIMERS_DEBUG, ("netml_tmr_calibrate: %"U32_F" TSC cycles per us\n",
+                             (u32_t)tsc_per_us));
+}
+
+/** Current time in microseconds, it wraps */
+u32_t
+netml_tmr_now(void)
+{
+  return (u32_t)(netml_rdtsc() / tsc_per_us);
+}
+
+void
+netml_tmr_init(struct netml_tmr *t, netml_tmr_fn fn, void *arg)
+{
+  t->next = NULL;
+  t->pprev = NULL;
+  t->expire = 0;
+  t->fn = fn;
+  t->arg = arg;
+}
+
+static void
+netml_tmr_link(struct netml_tmr **head, struct netml_tmr *t)
+{
+  t->next = *head;
+  if (t->next != NULL) {
+    t->next->pprev = &t->next;
+  }
+  t->pprev = head;
+  *head = t;
+}
+
+/** Run t in us microseconds, t must not be pending */
+void
+netml_tmr_add(struct netml_tmr *t, u32_t us)
+{
+  u64_t now;
+  u32_t slot;
+
+  LWIP_ASSERT("netml_tmr_add: timer pending", !netml_tmr_pending(t));
+  LWIP_ASSERT("netml_tmr_add: TSC not calibrated", tsc_per_us != 0);
+
+  now = netml_tick();
+
+  if (cur_tick == 0) {
+    cur_tick = now;
+  }
+  t->expire = now + (us + NETML_TMR_TICK_US - 1) / NETML_TMR_TICK_US;
+  if (t->expire < cur_tick) {
+    t->expire = cur_tick;
+  }
+  slot = (u32_t)(t->expire & (NETML_TMR_SLOTS - 1));
+  netml_tmr_link(&wheel[slot], t);
+  occupied[slot / 64] |= (u64_t)1 << (slot % 64);
+  if (t->expire < next_expire) {
+    next_expire = t->expire;
+  }
+}
+
+void
+netml_tmr_del(struct netml_tmr *t)
+{
+  u32_t slot;
+
+  if (!netml_tmr_pending(t)) {
+    return;
+  }
+  *t->pprev = t->next;
+  if (t->next != NULL) {
+    t->next->pprev = t->pprev;
+  }
+  t->next = NULL;
+  t->pprev = NULL;
+  /* t may have been on the expired list of netml_tmr_poll() */
+  slot = (u32_t)(t->expire & (NETML_TMR_SLOTS - 1));
+  if (wheel[slot] == NULL) {
+    occupied[slot / 64] &= ~((u64_t)1 << (slot % 64));
+  }
+}
+
+/**
+ * Whether a timer may have expired, callable from any thread. No timer is
+ * pending before lwip_init(), the TSC is not read then.
+ */
+u8_t
+netml_tmr_due(void)
+{
+  u64_t next = next_expire;
+
+  return next != ~(u64_t)0 && netml_tick() >= next;
+}
+
+/**
+ * Microseconds until a timer may expire, 0 if one may have, 0xffffffff if
+ * none is pending. Callable from any thread, for the netif to sleep.
+ */
+u32_t
+netml_tmr_sleeptime(void)
+{
+  u64_t next = next_expire, now;
+
+  if (next == ~(u64_t)0) {
+    return 0xffffffffU;
+  }
+  now = netml_tick();
+  if (next <= now) {
+    return 0;
+  }
+  return (u32_t)LWIP_MIN((next - now) * NETML_TMR_TICK_US, 0xfffffffeU);
+}
+
+/* the ticks from tick to the next occupied slot of the wheel, that of
+   tick included, NETML_TMR_SLOTS if there is none */
+static u32_t
+netml_tmr_gap(u64_t tick)
+{
+  u32_t slot = (u32_t)(tick & (NETML_TMR_SLOTS - 1));
+  u32_t w = slot / 64, i;
+  u64_t bits = occupied[w] & (~(u64_t)0 << (slot % 64));
+
+  /* the word of slot comes again last, for the slots before it */
+  for (i = 1; bits == 0 && i <= NETML_TMR_WORDS; i++) {
+    bits = occupied[(w + i) % NETML_TMR_WORDS];
+  }
+  if (bits == 0) {
+    return NETML_TMR_SLOTS;
+  }
+  i = ((w + i - 1) % NETML_TMR_WORDS) * 64 + (u32_t)__builtin_ctzll(bits);
+  return (i - slot) & (NETML_TMR_SLOTS - 1);
+}
+
+/* the earliest expire of the pending timers, the timers of the later
+   rounds are checked again a round ahead */
+static u64_t
+netml_tmr_next(void)
+{
+  struct netml_tmr *t;
+  u64_t tick = cur_tick, end = cur_tick + NETML_TMR_SLOTS, next = ~(u64_t)0;
+  u32_t gap;
+
+  /* the occupied slots only, in the order of their ticks */
+  while ((gap = netml_tmr_gap(tick)) < end - tick) {
+    tick += gap;
+    for (t = wheel[tick & (NETML_TMR_SLOTS - 1)]; t != NULL; t = t->next) {
+      if (t->expire <= tick) {
+        return tick;
+      }
+      next = end;
+    }
+    tick++;
+  }
+  return next;
+}
+
+/** Run the expired timers, in the tcpip thread */
+void
+netml_tmr_poll(void *arg)
+{
+  struct netml_tmr *expired = NULL, *t, *next;
+  u64_t now = netml_tick();
+  u64_t n, i;
+
+  LWIP_UNUSED_ARG(arg);
+
+  if (cur_tick == 0 || now < cur_tick) {
+    return;
+  }
+  n = LWIP_MIN(now - cur_tick + 1, NETML_TMR_SLOTS);
+  for (i = 0; i < n; i++) {
+    for (t = wheel[(cur_tick + i) & (NETML_TMR_SLOTS - 1)]; t != NULL; t = next) {
+      next = t->next;
+      if (t->expire <= now) {
+        netml_tmr_del(t);
+        netml_tmr_link(&expired, t);
+      }
+    }
+  }
+  cur_tick = now + 1;
+  next_expire = ~(u64_t)0;
+
+  /* a timer function may add or delete timers, expired ones included */
+  while ((t = expired) != NULL) {
+    netml_tmr_del(t);
+    t->fn(t->arg);
+  }
+
+  n = netml_tmr_next();
+  if (n < next_expire) {
+    next_expire = n;
+  }
+}
+
+#endif /* LWIP_NETML */
@@ -118,6 +118,7 @@
 #if LWIP_NETML
 #include <rte_hash.h>
 #include <rte_hash_crc.h>
+#include "mlib/hash.h"
 
 //void *seq_tbls[NETML_MAX_SEQ_TBLS] = {NULL};
 //u8_t next_seq_tbl = 0;
@@ -222,7 +223,22 @@ tcp_init(void)
 void
 tcp_free(struct tcp_pcb *pcb)
 {
+#if LWIP_NETML
+  u16_t i;
+#endif
+
   LWIP_ASSERT("tcp_free: LISTEN", pcb->state != LISTEN);
+#if LWIP_NETML
+  hmap_destroy(&pcb->ack_index);
+  tcp_netml_peers_free(pcb);
+  hmap_destroy(&pcb->peers);
+  /* pbufs still on a segment are freed with it */
+  for (i = 0; i < pcb->hdr_used; i++) {
+    if (pcb->hdr_cache[i].p != NULL) {
+      pbuf_free(pcb->hdr_cache[i].p);
+    }
+  }
+#endif
 #if LWIP_TCP_PCB_NUM_EXT_ARGS
   tcp_ext_arg_invoke_callbacks_destroyed(pcb->ext_args);
 #endif
@@ -625,6 +641,9 @@ tcp_abandon(struct tcp_pcb *pcb, int reset)
     if (pcb->unsent != NULL) {
       tcp_segs_free(pcb->unsent);
     }
+#if LWIP_NETML
+    tcp_ack_index_clear(pcb);
+#endif
 #if TCP_QUEUE_OOSEQ
     if (pcb->ooseq != NULL) {
       tcp_segs_free(pcb->ooseq);
@@ -1031,7 +1050,9 @@ tcp_recved(struct tcp_pcb *pcb, u16_t len)
    * events (or more window to be available later) */
   if (wnd_inflation >= TCP_WND_UPDATE_THRESHOLD) {
     tcp_ack_now(pcb);
-//    tcp_output(pcb);
+    /* the window update, not at the next tcp_fasttmr: the sender may be
+       held back by the window */
+    tcp_output(pcb);
   }
 
   LWIP_DEBUGF(TCP_DEBUG, ("tcp_recved: received %"U16_F" bytes, wnd %"TCPWNDSIZE_F" (%"TCPWNDSIZE_F").\n",
@@ -1547,6 +1568,10 @@ tcp_fasttmr_start:
         tcp_output(pcb);
         tcp_clear_flags(pcb, TF_ACK_DELAY | TF_ACK_NOW);
       }
+#if LWIP_NETML
+      /* send coalesced ACKs the RX bursts left behind */
+      tcp_netml_ack_flush(pcb);
+#endif
       /* send pending FIN */
       if (pcb->flags & TF_CLOSEPEND) {
         LWIP_DEBUGF(TCP_DEBUG, ("tcp_fasttmr: pending FIN\n"));
@@ -1684,6 +1709,452 @@ tcp_seg_free(struct tcp_seg *seg)
   }
 }
 
+#if LWIP_NETML
+/**
+ * Index a NETML data segment queued on pcb by the ackno acknowledging it,
+ * its seqno and length must not change until it is removed.
+ */
+void
+tcp_ack_index_add(struct tcp_pcb *pcb, struct tcp_seg *seg)
+{
+  u32_t ackno = lwip_ntohl(seg->tcphdr->seqno) + TCP_TCPLEN(seg);
+
+  hmap_insert(&pcb->ack_index, &seg->ack_node, hash_int(ackno, 0));
+  seg->indexed = 1;
+}
+
+/** Remove seg from the index, if it is there, before it is freed */
+void
+tcp_ack_index_remove(struct tcp_pcb *pcb, struct tcp_seg *seg)
+{
+  if (seg->indexed) {
+    hmap_remove(&pcb->ack_index, &seg->ack_node);
+    seg->indexed = 0;
+  }
+}
+
+/** Return the indexed segment acknowledged by ackno, NULL if none */
+struct tcp_seg *
+tcp_ack_index_find(struct tcp_pcb *pcb, u32_t ackno)
+{
+  struct hmap_node *node;
+  struct tcp_seg *seg;
+
+  /* not HMAP_FOR_EACH_WITH_HASH: ack_node is not the first member, the
+     compiler drops its end check &seg->ack_node != NULL */
+  for (node = hmap_first_with_hash(&pcb->ack_index, hash_int(ackno, 0));
+       node != NULL; node = hmap_next_with_hash(node)) {
+    seg = CONTAINER_OF(node, struct tcp_seg, ack_node);
+    if (TCP_SEQ_EQ(lwip_ntohl(seg->tcphdr->seqno) + TCP_TCPLEN(seg), ackno)) {
+      return seg;
+    }
+  }
+  return NULL;
+}
+
+/** Empty the index, called once the queued segments are all freed */
+void
+tcp_ack_index_clear(struct tcp_pcb *pcb)
+{
+  hmap_destroy(&pcb->ack_index);
+  hmap_init(&pcb->ack_index);
+}
+
+static void tcp_netml_cc_resume(void *arg);
+
+/**
+ * Return the state of pcb for the peer with node id, it is allocated on
+ * the first use. NULL if out of memory.
+ */
+struct tcp_internal_id *
+tcp_netml_peer(struct tcp_pcb *pcb, u16_t id)
+{
+  struct tcp_internal_id *ic = pcb->last_peer;
+  size_t hash;
+
+  /* segments mostly come in runs from the same peer */
+  if (ic != NULL && ic->inid == id) {
+    return ic;
+  }
+
+  hash = hash_int(id, 0);
+  HMAP_FOR_EACH_WITH_HASH(ic, struct tcp_internal_id, node, hash, &pcb->peers) {
+    if (ic->inid == id) {
+      pcb->last_peer = ic;
+      return ic;
+    }
+  }
+
+  ic = (struct tcp_internal_id *)mem_malloc(sizeof(struct tcp_internal_id));
+  if (ic == NULL) {
+    LWIP_DEBUGF(TCP_DEBUG | LWIP_DBG_LEVEL_SERIOUS, ("tcp_netml_peer: no memory for peer %"U16_F"\n", id));
+    return NULL;
+  }
+  ic->nxtwish = 1;
+  ic->intseq = 1;
+  ic->inttunl = 1;
+  ic->intack = 1;
+  /* nothing older was sent to it */
+  ic->sack_seq = pcb->snd_lbb;
+  ic->inid = id;
+  ic->ack_pending = 0;
+  ic->ack_ce = 0;
+  ic->pcb = pcb;
+  ic->sa_us = 0;
+  ic->sv_us = 0;
+  ic->rto_us = NETML_RTO_INIT_US;
+  netml_tmr_init(&ic->rto_tmr, tcp_netml_rto, ic);
+  memset(&ic->cc, 0, sizeof(ic->cc));
+  netml_tmr_init(&ic->cc.resume_tmr, tcp_netml_cc_resume, ic);
+  if (pcb->netml_cc->init != NULL) {
+    pcb->netml_cc->init(ic);
+  }
+#if TCP_QUEUE_OOSEQ
+  ic->reorder = NULL;
+#endif
+  hmap_insert(&pcb->peers, &ic->node, hash);
+  pcb->last_peer = ic;
+  return ic;
+}
+
+/** Free the state of all peers of pcb */
+void
+tcp_netml_peers_free(struct tcp_pcb *pcb)
+{
+  struct tcp_internal_id *ic, *next;
+
+  HMAP_FOR_EACH_SAFE(ic, next, struct tcp_internal_id, node, &pcb->peers) {
+    hmap_remove(&pcb->peers, &ic->node);
+    netml_tmr_del(&ic->rto_tmr);
+    netml_tmr_del(&ic->cc.resume_tmr);
+#if TCP_QUEUE_OOSEQ
+    tcp_reorder_free(ic);
+#endif
+    mem_free(ic);
+  }
+  pcb->last_peer = NULL;
+  pcb->netml_acks = 0;
+}
+
+#if TCP_QUEUE_OOSEQ
+#define TCP_REORDER_SLOT(tunl)	(hash_int((tunl), 0) & (NETML_REORDER_SIZE - 1))
+
+/**
+ * Hold an out of order segment of peer ic, the reorder ring takes over p
+ * on ERR_OK. Returns ERR_ALREADY if the segment is held already and
+ * ERR_MEM if the ring is full, then the segment must not be acked.
+ */
+err_t
+tcp_reorder_insert(struct tcp_internal_id *ic, struct pbuf *p, u32_t tunl, u8_t agg)
+{
+  struct tcp_reorder *ro = ic->reorder;
+  struct tcp_reorder_ent *ent;
+  u8_t *link;
+  u8_t i;
+
+  if (ro == NULL) {
+    ro = (struct tcp_reorder *)mem_malloc(sizeof(struct tcp_reorder));
+    if (ro == NULL) {
+      return ERR_MEM;
+    }
+    for (i = 0; i < NETML_REORDER_SIZE; i++) {
+      ro->slot[i] = NETML_REORDER_NIL;
+      ro->ent[i].next = (u8_t)(i + 1 < NETML_REORDER_SIZE ? i + 1 : NETML_REORDER_NIL);
+    }
+    ro->free = 0;
+    ro->count = 0;
+    ic->reorder = ro;
+  }
+
+  link = &ro->slot[TCP_REORDER_SLOT(tunl)];
+  while (*link != NETML_REORDER_NIL) {
+    ent = &ro->ent[*link];
+    /* aggregated segments share the tunnel number of the next cold one */
+    if (!agg && !ent->agg && ent->tunl == tunl) {
+      return ERR_ALREADY;
+    }
+    link = &ent->next;
+  }
+  if (ro->free == NETML_REORDER_NIL) {
+    return ERR_MEM;
+  }
+
+  i = ro->free;
+  ent = &ro->ent[i];
+  ro->free = ent->next;
+  ent->p = p;
+  ent->tunl = tunl;
+  ent->agg = agg;
+  ent->next = NETML_REORDER_NIL;
+  *link = i;
+  ro->count++;
+  return ERR_OK;
+}
+
+/**
+ * Append the held segments of peer ic that are in order now to data,
+ * advancing ic->nxtwish past them. Returns the new head of data.
+ */
+struct pbuf *
+tcp_reorder_drain(struct tcp_internal_id *ic, struct pbuf *data)
+{
+  struct tcp_reorder *ro = ic->reorder;
+  struct tcp_reorder_ent *ent;
+  u8_t *link, *cold;
+  u8_t i;
+
+  while (ro != NULL && ro->count > 0) {
+    /* deliver the aggregated segments waiting on nxtwish before the cold
+       segment starting there */
+    cold = NULL;
+    link = &ro->slot[TCP_REORDER_SLOT(ic->nxtwish)];
+    while (*link != NETML_REORDER_NIL) {
+      ent = &ro->ent[*link];
+      if (ent->tunl != ic->nxtwish || !ent->agg) {
+        if (cold == NULL && ent->tunl == ic->nxtwish) {
+          cold = link;
+        }
+        link = &ent->next;
+        continue;
+      }
+      i = *link;
+      *link = ent->next;
+      if (data) {
+        pbuf_cat(data, ent->p);
+      } else {
+        data = ent->p;
+      }
+      ent->p = NULL;
+      ent->next = ro->free;
+      ro->free = i;
+      ro->count--;
+    }
+    if (cold == NULL) {
+      break;
+    }
+
+    i = *cold;
+    ent = &ro->ent[i];
+    *cold = ent->next;
+    ic->nxtwish = ent->tunl + ent->p->tot_len;
+    if (data) {
+      pbuf_cat(data, ent->p);
+    } else {
+      data = ent->p;
+    }
+    ent->p = NULL;
+    ent->next = ro->free;
+    ro->free = i;
+    ro->count--;
+  }
+  return data;
+}
+
+/** Free the segments held for peer ic and its reorder ring */
+void
+tcp_reorder_free(struct tcp_internal_id *ic)
+{
+  struct tcp_reorder *ro = ic->reorder;
+  u8_t s, i;
+
+  if (ro == NULL) {
+    return;
+  }
+  for (s = 0; s < NETML_REORDER_SIZE; s++) {
+    for (i = ro->slot[s]; i != NETML_REORDER_NIL; i = ro->ent[i].next) {
+      pbuf_free(ro->ent[i].p);
+    }
+  }
+  mem_free(ro);
+  ic->reorder = NULL;
+}
+#endif /* TCP_QUEUE_OOSEQ */
+
+/** Start the RTO timer of the peer seg was just sent to */
+void
+tcp_netml_rto_arm(struct tcp_pcb *pcb, struct tcp_seg *seg)
+{
+  struct tcp_internal_id *ic = tcp_netml_peer(pcb, lwip_ntohs(seg->inthdr->dst_id));
+
+  seg->sent_us = netml_tmr_now();
+  if (ic != NULL && !netml_tmr_pending(&ic->rto_tmr)) {
+    netml_tmr_add(&ic->rto_tmr, ic->rto_us);
+  }
+}
+
+/**
+ * seg is acked, update the RTT estimation of its peer from it unless it
+ * was retransmitted, and restart the RTO timer for the segments left.
+ */
+void
+tcp_netml_rtt(struct tcp_pcb *pcb, struct tcp_seg *seg)
+{
+  struct tcp_internal_id *ic = tcp_netml_peer(pcb, lwip_ntohs(seg->inthdr->dst_id));
+  s32_t m;
+
+  if (ic == NULL) {
+    return;
+  }
+  if (!seg->hasresent) {
+    /* as the estimation of tcp_receive() */
+    m = (s32_t)(netml_tmr_now() - seg->sent_us);
+    if (ic->sa_us == 0) {
+      ic->sa_us = m << 3;
+      ic->sv_us = m << 1;
+    } else {
+      m = m - (ic->sa_us >> 3);
+      ic->sa_us += m;
+      if (m < 0) {
+        m = -m;
+      }
+      m = m - (ic->sv_us >> 2);
+      ic->sv_us += m;
+    }
+    ic->rto_us = (u32_t)LWIP_MAX((ic->sa_us >> 3) + ic->sv_us, NETML_RTO_MIN_US);
+    ic->rto_us = LWIP_MIN(ic->rto_us, NETML_RTO_MAX_US);
+  }
+  netml_tmr_del(&ic->rto_tmr);
+  netml_tmr_add(&ic->rto_tmr, ic->rto_us);
+}
+
+/** The controller of peer ic let it send again */
+static void
+tcp_netml_cc_resume(void *arg)
+{
+  struct tcp_internal_id *ic = (struct tcp_internal_id *)arg;
+
+  tcp_output(ic->pcb);
+}
+
+/**
+ * Whether the controller of pcb lets data segment seg leave now, in
+ * tcp_output() pass. Once a segment to a peer is held back, the later ones
+ * to it are too for the rest of the pass so that they stay in order.
+ */
+u8_t
+tcp_netml_cc_can_send(struct tcp_pcb *pcb, struct tcp_seg *seg, u32_t pass)
+{
+  struct tcp_internal_id *ic;
+
+  if (pcb->netml_cc->can_send == NULL) {
+    return 1;
+  }
+  ic = tcp_netml_peer(pcb, lwip_ntohs(seg->inthdr->dst_id));
+  if (ic == NULL) {
+    return 1;
+  }
+  if (ic->cc.held == pass) {
+    return 0;
+  }
+  if (!pcb->netml_cc->can_send(ic, seg->len)) {
+    ic->cc.held = pass;
+    return 0;
+  }
+  return 1;
+}
+
+/** Data segment seg was sent and put on pcb->unacked */
+void
+tcp_netml_cc_sent(struct tcp_pcb *pcb, struct tcp_seg *seg)
+{
+  struct tcp_internal_id *ic = tcp_netml_peer(pcb, lwip_ntohs(seg->inthdr->dst_id));
+
+  if (ic == NULL) {
+    return;
+  }
+  ic->cc.inflight += seg->len;
+  if (pcb->netml_cc->sent != NULL) {
+    pcb->netml_cc->sent(ic, seg->len);
+  }
+}
+
+/** Data segment seg left pcb->unacked, acked or to be resent */
+void
+tcp_netml_cc_left(struct tcp_pcb *pcb, struct tcp_seg *seg)
+{
+  struct tcp_internal_id *ic = tcp_netml_peer(pcb, lwip_ntohs(seg->inthdr->dst_id));
+
+  if (ic != NULL) {
+    ic->cc.inflight -= LWIP_MIN(ic->cc.inflight, seg->len);
+  }
+}
+
+/** An ACK from ic freed acked bytes, ce of them were marked on the way */
+void
+tcp_netml_cc_acked(struct tcp_internal_id *ic, u32_t acked, u32_t ce)
+{
+  if (acked > 0 && ic->pcb->netml_cc->acked != NULL) {
+    ic->pcb->netml_cc->acked(ic, acked, ce);
+  }
+}
+
+/** Segments to ic were lost */
+void
+tcp_netml_cc_lost(struct tcp_internal_id *ic)
+{
+  if (ic->pcb->netml_cc->lost != NULL) {
+    ic->pcb->netml_cc->lost(ic);
+  }
+}
+
+/**
+ * Fill sack with the receive state of peer ic, echoed in the ACKs to it.
+ * The held segments are merged into ranges, the lowest ones are kept.
+ */
+void
+tcp_netml_sack(struct tcp_internal_id *ic, struct netml_sack *sack)
+{
+#if TCP_QUEUE_OOSEQ
+  struct tcp_reorder *ro = ic->reorder;
+  u32_t left[NETML_REORDER_SIZE], right[NETML_REORDER_SIZE];
+  u32_t l, r;
+  u8_t n = 0, s, i, k;
+#endif /* TCP_QUEUE_OOSEQ */
+
+  sack->cum = ic->nxtwish;
+  sack->num = 0;
+#if TCP_QUEUE_OOSEQ
+  if (ro == NULL || ro->count == 0) {
+    return;
+  }
+
+  /* insertion sort of the held cold segments by tunnel number */
+  for (s = 0; s < NETML_REORDER_SIZE; s++) {
+    for (i = ro->slot[s]; i != NETML_REORDER_NIL; i = ro->ent[i].next) {
+      if (ro->ent[i].agg) {
+        continue;
+      }
+      l = ro->ent[i].tunl;
+      r = l + ro->ent[i].p->tot_len;
+      for (k = n; k > 0 && TCP_SEQ_GT(left[k - 1], l); k--) {
+        left[k] = left[k - 1];
+        right[k] = right[k - 1];
+      }
+      left[k] = l;
+      right[k] = r;
+      n++;
+    }
+  }
+
+  for (i = 0; i < n; i++) {
+    if (sack->num > 0 && TCP_SEQ_LEQ(left[i], sack->blk[sack->num - 1].right)) {
+      /* adjacent to the last block */
+      if (TCP_SEQ_GT(right[i], sack->blk[sack->num - 1].right)) {
+        sack->blk[sack->num - 1].right = right[i];
+      }
+      continue;
+    }
+    if (sack->num == NETML_SACK_BLOCKS) {
+      break;
+    }
+    sack->blk[sack->num].left = left[i];
+    sack->blk[sack->num].right = right[i];
+    sack->num++;
+  }
+#endif /* TCP_QUEUE_OOSEQ */
+}
+#endif /* LWIP_NETML */
+
 /**
  * @ingroup tcp
  * Sets the priority of a connection.
@@ -1959,21 +2430,17 @@ tcp_alloc(u8_t prio)
 	pcb->is_bypass = 0;
 	pcb->local_id = UINT16_MAX;
 	pcb->is_init_netml = 0;
-
-	// initialize internal connection list
-	uint16_t t = 0;
-	for (t = 0; t < NETML_MAX_NODE; t++) {
-		struct tcp_internal_id *ic = &(pcb->internal_conn[t]);
-
-		ic->nxtwish = 1;
-		ic->intseq = 1;
-		ic->inttunl = 1;
-		ic->intack = 1;
-		ic->inid = t + 8;
-#if TCP_QUEUE_OOSEQ
-		ic->ooseq = NULL;
-#endif
+	hmap_init(&pcb->ack_index);
+	pcb->unsent_tail = NULL;
+	pcb->hdr_next = 0;
+	pcb->hdr_used = 0;
+	pcb->netml_acks = 0;
+	pcb->netml_cc = netml_cc_get_default();
+	if (pcb->netml_cc->ecn) {
+		pcb->tos |= NETML_ECN_ECT0;
 	}
+	hmap_init(&pcb->peers);
+	pcb->last_peer = NULL;
 	pcb->seq_history = NULL;
 #endif
 
@@ -2234,23 +2701,22 @@ tcp_pcb_purge(struct tcp_pcb *pcb)
     tcp_segs_free(pcb->unsent);
     tcp_segs_free(pcb->unacked);
     pcb->unacked = pcb->unsent = NULL;
+    TCP_UNSENT_TAIL_RESET(pcb);
 #if TCP_OVERSIZE
     pcb->unsent_oversize = 0;
 #endif /* TCP_OVERSIZE */
 
 #if LWIP_NETML
-	uint16_t t = 0;
-
-	for (t = 0; t < NETML_MAX_NODE; t++) {
-		struct tcp_internal_id *ic = &(pcb->internal_conn[t]);
-
 #if TCP_QUEUE_OOSEQ
-		if (ic->ooseq) {
-			tcp_segs_free(ic->ooseq);
-			ic->ooseq = NULL;
-		}
+	struct tcp_internal_id *ic;
 #endif
+
+	tcp_ack_index_clear(pcb);
+#if TCP_QUEUE_OOSEQ
+	HMAP_FOR_EACH(ic, struct tcp_internal_id, node, &pcb->peers) {
+		tcp_reorder_free(ic);
 	}
+#endif
 
 	if (!pcb->is_bypass && pcb->seq_history) {
 		rte_hash_free(pcb->seq_history);
@@ -65,7 +65,7 @@
 #include LWIP_HOOK_FILENAME
 #endif
 
-#ifdef LWIP_NETML
+#if LWIP_NETML
 #include <rte_hash.h>
 #include <rte_hash_crc.h>
 
@@ -141,6 +141,9 @@ static void remove_from_unsent(struct tcp_pcb *pcb, struct tcp_seg *seg);
 
 static void remove_from_unack(struct tcp_pcb *pcb, struct tcp_seg *seg)
 {
+  if (seg->indexed) {
+    tcp_netml_cc_left(pcb, seg);
+  }
   if (seg->prev == NULL && seg->next == NULL){
     pcb->unacked = NULL;
   } else if (seg->prev != NULL && seg->next == NULL) {
@@ -162,6 +165,7 @@ static void remove_from_unack(struct tcp_pcb *pcb, struct tcp_seg *seg)
 
 static void remove_from_unsent(struct tcp_pcb *pcb, struct tcp_seg *seg)
 {
+  TCP_UNSENT_TAIL_RESET(pcb);
   if (seg->prev == NULL && seg->next == NULL){
     pcb->unsent = NULL;
   } else if (seg->prev != NULL && seg->next == NULL) {
@@ -192,21 +196,148 @@ static inline u64_t rte_rdtsc(void)
 	return tsc.tsc_64;
 }
 
+/**
+ * Read the receive state a peer sends after the internal header of its
+ * cold ACKs, the acknos of the segments the ACK coalesces besides the one
+ * of the TCP header and how many of them were marked CE. p is the ACK with
+ * the headers removed. Returns 0 if it has none.
+ */
+static u8_t
+tcp_netml_parse_sack(struct pbuf *p, struct netml_sack *sack, u32_t *acks, u32_t *nacks,
+                     u32_t *ce)
+{
+  u32_t w[2 + 2 * NETML_SACK_BLOCKS + 1 + NETML_ACK_SEGS + 1];
+  u16_t len;
+  u32_t i, off;
+
+  if (p == NULL || p->tot_len < NETML_SACK_LEN(0)) {
+    return 0;
+  }
+  len = (u16_t)LWIP_MIN(p->tot_len, sizeof(w));
+  if (pbuf_copy_partial(p, w, len, 0) != len) {
+    return 0;
+  }
+  sack->cum = lwip_ntohl(w[0]);
+  sack->num = lwip_ntohl(w[1]);
+  if (sack->num > NETML_SACK_BLOCKS || len < NETML_SACK_LEN(sack->num)) {
+    return 0;
+  }
+  for (i = 0; i < sack->num; i++) {
+    sack->blk[i].left = lwip_ntohl(w[2 + 2 * i]);
+    sack->blk[i].right = lwip_ntohl(w[3 + 2 * i]);
+  }
+
+  *nacks = 0;
+  *ce = 0;
+  off = NETML_SACK_LEN(sack->num) / 4;
+  if (len >= NETML_SACK_LEN(sack->num) + NETML_ACKS_LEN(0)) {
+    *nacks = lwip_ntohl(w[off]);
+    if (*nacks >= NETML_ACK_SEGS ||
+        len < NETML_SACK_LEN(sack->num) + NETML_ACKS_LEN(*nacks)) {
+      *nacks = 0;
+      return 0;
+    }
+    for (i = 0; i < *nacks; i++) {
+      acks[i] = lwip_ntohl(w[off + 1 + i]);
+    }
+    if (len >= NETML_SACK_LEN(sack->num) + NETML_ACKS_LEN(*nacks) + NETML_ECE_LEN) {
+      *ce = lwip_ntohl(w[off + 1 + *nacks]);
+    }
+  }
+  return 1;
+}
+
+/** Free seg, acked by the peer in a coalesced ACK */
+static void
+tcp_netml_acked(struct tcp_pcb *pcb, struct tcp_seg *seg)
+{
+  if (seg->on_unacked) {
+    tcp_netml_rtt(pcb, seg);
+    remove_from_unack(pcb, seg);
+  } else {
+    remove_from_unsent(pcb, seg);
+  }
+  tcp_ack_index_remove(pcb, seg);
+  recv_acked = (tcpwnd_size_t)(recv_acked + seg->len);
+  pcb->snd_queuelen -= pbuf_clen(seg->p);
+  tcp_seg_free(seg);
+}
+
+/** Whether the peer holds the segment starting at tunl out of order */
+static u8_t
+tcp_netml_sacked(const struct netml_sack *sack, u32_t tunl)
+{
+  u32_t i;
+
+  for (i = 0; i < sack->num; i++) {
+    if (TCP_SEQ_GEQ(tunl, sack->blk[i].left) && TCP_SEQ_LT(tunl, sack->blk[i].right)) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/**
+ * RTO of peer ic: retransmit the segments sent to it that were not acked
+ * within its RTO, and restart the timer for the younger ones.
+ */
+void
+tcp_netml_rto(void *arg)
+{
+  struct tcp_internal_id *ic = (struct tcp_internal_id *)arg;
+  struct tcp_pcb *pcb = ic->pcb;
+  struct tcp_seg *seg, *next;
+  u32_t now = netml_tmr_now(), wait = 0, age, left;
+  u8_t resent = 0;
+
+  for (seg = pcb->unacked; seg != NULL; seg = next) {
+    next = seg->next;
+    if (!seg->indexed || lwip_ntohs(seg->inthdr->dst_id) != ic->inid) {
+      continue;
+    }
+    age = now - seg->sent_us;
+    if (age < ic->rto_us) {
+      left = ic->rto_us - age;
+    } else if (tcp_netml_seg_busy(seg)) {
+      /* the driver still holds it, try again on the next tick */
+      left = NETML_TMR_TICK_US;
+    } else {
+      remove_from_unack(pcb, seg);
+      tcp_rexmit_data(pcb, seg);
+      resent = 1;
+      continue;
+    }
+    if (wait == 0 || left < wait) {
+      wait = left;
+    }
+  }
+
+  if (resent) {
+    ic->rto_us = LWIP_MIN(ic->rto_us << 1, NETML_RTO_MAX_US);
+    tcp_netml_cc_lost(ic);
+    /* sending them starts the timer again */
+    tcp_output(pcb);
+  }
+  if (wait > 0 && !netml_tmr_pending(&ic->rto_tmr)) {
+    netml_tmr_add(&ic->rto_tmr, wait);
+  }
+}
+
 static void
 tcp_receive_data(struct tcp_pcb *pcb)
 {
 //  u32_t right_wnd_edge;
   s16_t m;
-  struct tcp_seg *next;
-#if TCP_QUEUE_OOSEQ
-  struct tcp_seg *prev, *cseg;
-#endif
+  struct tcp_seg *next, *prev;
   u64_t cur_tsc;
   u8_t found = 0;
-  u16_t historynum, intseq_wanted;
+  u16_t historynum;
   u32_t hkey;
   struct hmap_node *hnode, *tmphnode;
   u8_t init_flags = TCPH_OFFSET_FLAGS(tcphdr);
+  struct netml_sack sack;
+  u32_t acks[NETML_ACK_SEGS], nacks = 0, ce = 0, i;
+  u8_t has_sack = 0, lost_any = 0;
 
 #if 0  
   if (!pcb->is_init_netml) {
@@ -270,7 +401,11 @@ tcp_receive_data(struct tcp_pcb *pcb)
   }
 #endif
   /* find out the corresponding worker. */
-  worker = &(pcb->internal_conn[internalhdr->src_id - 8]);
+  worker = tcp_netml_peer(pcb, internalhdr->src_id);
+  if (worker == NULL) {
+    /* not acked, the peer resends it */
+    return;
+  }
 
 #if TCP_INPUT_DEBUG
 	LWIP_DEBUGF(TCP_INPUT_DEBUG, ("tcp_receive_data: packet is from id: %"U16_F"\n", worker->inid));
@@ -281,18 +416,21 @@ tcp_receive_data(struct tcp_pcb *pcb)
 
 //	u16_t acked;
 
-    /* Check unsent list if there is anything to acknowledge. */
-    for(next=pcb->unsent;next!=NULL;next=next->next){
-//	  fprintf(stdout, "[%s][%d]: cur ack %u, unsent pkt, len %u, ack %u\n",
-//					  __FILE__, __LINE__, ackno, TCP_TCPLEN(next),
-//					  lwip_ntohl(next->tcphdr->seqno) + TCP_TCPLEN(next));
-	  
-	  if (TCP_SEQ_EQ(lwip_ntohl(next->tcphdr->seqno) +
-					TCP_TCPLEN(next), ackno)){
+    has_sack = tcp_netml_parse_sack(inseg.p, &sack, acks, &nacks, &ce);
+    /* the older segments a coalesced ACK acknowledges */
+    for (i = 0; i < nacks; i++) {
+      next = tcp_ack_index_find(pcb, acks[i]);
+      if (next != NULL) {
+        tcp_netml_acked(pcb, next);
+      }
+    }
+
+    /* The TCP header acknowledges one segment, look it up by its ackno. */
+    next = tcp_ack_index_find(pcb, ackno);
+    if (next != NULL && !next->on_unacked) {
 		found=1;
 		remove_from_unsent(pcb,next);
-//		acked = (u16_t)(TCP_TCPLEN(next));
-//		pcb->snd_buf += acked;
+		tcp_ack_index_remove(pcb,next);
     	recv_acked = (tcpwnd_size_t)(recv_acked + next->len);
 		pcb->snd_queuelen -= pbuf_clen(next->p);
 		tcp_seg_free(next);
@@ -303,22 +441,17 @@ tcp_receive_data(struct tcp_pcb *pcb)
 			LWIP_ASSERT("tcp_receive_data: valid queue length", pcb->unacked != NULL ||
 						pcb->unsent != NULL);
 		}
-		break;
-	  }
 	}
+	else if (next != NULL) {
+		u32_t acked_seq = lwip_ntohl(next->tcphdr->seqno);
 
-    /* Check unack list if there is anything to acknowledge. */
-    for(next = pcb->unacked; next!=NULL;next=next->next){
-//	  fprintf(stdout, "[%s][%d]: cur ack %u, unack pkt, len %u, ack %u\n",
-//					  __FILE__, __LINE__, ackno, TCP_TCPLEN(next),
-//					  lwip_ntohl(next->tcphdr->seqno) + TCP_TCPLEN(next));
-	  if (TCP_SEQ_EQ(lwip_ntohl(next->tcphdr->seqno) +
-					TCP_TCPLEN(next), ackno)){
 		// Reset the number of retransmissions.
 		pcb->nrtx = 0;
 		pcb->rto = (s16_t)((pcb->sa >> 3) + pcb->sv);
 		found=1;
+		tcp_netml_rtt(pcb,next);
 		remove_from_unack(pcb,next);
+		tcp_ack_index_remove(pcb,next);
 		prev=next->prev;
 //		acked = (u16_t)(TCP_TCPLEN(next));
     	recv_acked = (tcpwnd_size_t)(recv_acked + next->len);
@@ -331,24 +464,66 @@ tcp_receive_data(struct tcp_pcb *pcb)
 			LWIP_ASSERT("tcp_receive_data: valid queue length", pcb->unacked != NULL ||
 						pcb->unsent != NULL);
 		}
-		while(prev!=NULL){
+		if (has_sack) {
+		  /* The peer told what it holds, only its cold segments it misses
+		   * are lost. The ones to other peers are checked on their own ACKs,
+		   * the hot ones carry no receive state and are resent as below. */
+		  while (prev != NULL &&
+				 TCP_SEQ_GEQ(lwip_ntohl(prev->tcphdr->seqno), worker->sack_seq)) {
+			struct tcp_seg *older = prev->prev;
+			u8_t lost;
+
+			if (INTH_HOT(TCPH_OFFSET_FLAGS(prev->tcphdr))) {
+			  lost = 1;
+			} else if (lwip_ntohs(prev->inthdr->dst_id) != worker->inid) {
+			  lost = 0;
+			} else {
+			  u32_t tunl = lwip_ntohl(prev->inthdr->int_tunlno);
+			  lost = !TCP_SEQ_LT(tunl, sack.cum) && !tcp_netml_sacked(&sack, tunl);
+			}
+			/* a segment the driver still holds stays on unacked, its
+			 * RTO resends it */
+			if (lost && prev->hasresent == 0 && !tcp_netml_seg_busy(prev)) {
+			  remove_from_unack(pcb,prev);
+			  tcp_rexmit_data(pcb,prev);
+			  lost_any = 1;
+			}
+			prev=older;
+		  }
+		  if (TCP_SEQ_GT(acked_seq, worker->sack_seq))
+			worker->sack_seq = acked_seq;
+		} else {
+		  /* The older unacked segments are lost, retransmit them. The ones
+		   * below gap_rexmit_seq were handled by an earlier ACK, stop there
+		   * rather than walking the whole list on every ACK. */
+		  while (prev != NULL &&
+				 TCP_SEQ_GEQ(lwip_ntohl(prev->tcphdr->seqno), pcb->gap_rexmit_seq)) {
+			/* tcp_rexmit_data() relinks prev into unsent */
+			struct tcp_seg *older = prev->prev;
 //			fprintf(stdout, "[%s][%d]: prev, prev->hasresent = %u\n",
 //					__FILE__, __LINE__, prev->hasresent);
-		  if(prev->hasresent==0){
-			remove_from_unack(pcb,prev);
-			tcp_rexmit_data(pcb,prev);
+			if(prev->hasresent==0 && !tcp_netml_seg_busy(prev)){
+			  remove_from_unack(pcb,prev);
+			  tcp_rexmit_data(pcb,prev);
+			  lost_any = 1;
+			}
+			prev=older;
 		  }
-		  prev=prev->prev;
 		}
+		if (TCP_SEQ_GT(acked_seq, pcb->gap_rexmit_seq))
+		  pcb->gap_rexmit_seq = acked_seq;
 		if(pcb->unacked == NULL)
           pcb->rtime = -1;
         else if (pcb->rtime < 0)
           pcb->rtime = 0;
 
         pcb->polltmr = 0;
-	  
-		break;
-	  }
+	}
+	/* the marked share of the acked bytes, the peer counts marked segments */
+	tcp_netml_cc_acked(worker, recv_acked,
+	                   ce > 0 ? (u32_t)(((u64_t)recv_acked * ce) / (nacks + 1)) : 0);
+	if (lost_any) {
+	  tcp_netml_cc_lost(worker);
 	}
     pcb->snd_buf = (tcpwnd_size_t)(pcb->snd_buf + recv_acked);
 	pcb->lastack = ackno;
@@ -412,60 +587,31 @@ tcp_receive_data(struct tcp_pcb *pcb)
 	{
       /* It means the first transmition, direct receive. */
 	  if (worker->nxtwish == internaltunl) { /* The received segment is in order. */
-        if (worker->ooseq == NULL){   /* There is nothing in ooseq, directly receive. */
-		  if (init_flags != NETML_AGG)
-	      	worker->nxtwish = internaltunl + inseg.p->tot_len;
-		  else {
-			worker->nxtwish = internaltunl;
-		  }
-          recv_data = inseg.p;
-		  inseg.p = NULL;
-	    } else {   /* If there is something in ooseq, insert and find whether it can chain more. */
-	      next = tcp_seg_copy(&inseg);
-	      next->next = worker->ooseq;
-		  worker->ooseq = next;
-		  intseq_wanted = worker->ooseq->inthdr->int_tunlno;
-	      while (worker->ooseq != NULL && worker->ooseq->inthdr->int_tunlno == intseq_wanted) {
-			u8_t tmp_flags = 0;
-
-		    cseg = worker->ooseq;
-		    if (recv_data) {
-              pbuf_cat(recv_data, cseg->p);
-            } else {
-              recv_data = cseg->p;
-            }
-			tmp_flags = TCPH_OFFSET_FLAGS(cseg->tcphdr);
-		    cseg->p = NULL;
-			
-			if (tmp_flags == NETML_AGG)
-				intseq_wanted = cseg->inthdr->int_tunlno;
-			else
-		    	intseq_wanted = cseg->inthdr->int_tunlno + cseg->len;
-		    worker->ooseq = cseg->next;
-		    memp_free(MEMP_TCP_SEG,cseg);
-		  }
-		  worker->nxtwish = intseq_wanted;
-	    }
+		if (init_flags != NETML_AGG)
+		  worker->nxtwish = internaltunl + inseg.p->tot_len;
+		recv_data = inseg.p;
+		inseg.p = NULL;
+#if TCP_QUEUE_OOSEQ
+		/* it may fill the hole in front of held segments, chain them. */
+		recv_data = tcp_reorder_drain(worker, recv_data);
+#endif /* TCP_QUEUE_OOSEQ */
 	  } else if (worker->nxtwish < internaltunl) {  /* The received segment is out of order. */
-	    if (worker->ooseq==NULL){  /* There is nothing in ooseq, direct insert. */
-	      worker->ooseq = tcp_seg_copy(&inseg);
-	    } else { /* else, insert it. */
-	      cseg = worker->ooseq;
-		  prev = NULL;
-	      while (cseg != NULL && cseg->inthdr->int_tunlno <= internaltunl) {
-		    prev=cseg;
-		    cseg=cseg->next;
-	      }
-		  if (cseg == NULL){
-		    prev->next=tcp_seg_copy(&inseg);
-		  } else if (prev == NULL){
-		    worker->ooseq = tcp_seg_copy(&inseg);
-		    worker->ooseq-> next = cseg;
-		  } else {
-		    prev->next = tcp_seg_copy(&inseg);
-		    prev->next->next = cseg;
-		  }
-	    }
+#if TCP_QUEUE_OOSEQ
+		err_t rerr = tcp_reorder_insert(worker, inseg.p, internaltunl,
+										(init_flags == NETML_AGG));
+
+		if (rerr == ERR_OK) {
+		  inseg.p = NULL;
+		} else if (rerr == ERR_MEM) {
+		  /* no room to hold it, don't ack so that it is resent. */
+		  LWIP_DEBUGF(TCP_INPUT_DEBUG, ("tcp_receive_data: reorder ring of %"U16_F" full, drop %"U32_F"\n",
+		                                worker->inid, internaltunl));
+		  return;
+		}
+#else
+		/* not held, don't ack so that it is resent. */
+		return;
+#endif /* TCP_QUEUE_OOSEQ */
 	  } else { /* The segment has been received. */
       /* do nothing */
 	  }
@@ -473,7 +619,14 @@ tcp_receive_data(struct tcp_pcb *pcb)
 endreceive:
     worker->intack = internalseq + tcplen;
     pcb->rcv_nxt = seqno + tcplen;   /* update the rcv_nxt and send ack */
-	tcp_send_empty_ack_netml(pcb, worker, (init_flags == NETML_AGG));
+	if (init_flags == NETML_AGG) {
+	  /* the switch needs every aggregated segment acked at once */
+	  tcp_send_empty_ack_netml(pcb, worker, 1);
+	} else {
+	  tcp_netml_ack_delay(pcb, worker,
+	                      ip4_current_header() != NULL &&
+	                      (IPH_TOS(ip4_current_header()) & NETML_ECN_MASK) == NETML_ECN_CE);
+	}
   }
 }
 
@@ -574,6 +727,26 @@ void tcp_netml_input(struct pbuf *p)
     tcp_input_pcb = pcb;
     tcp_receive_data(pcb);
 
+    /* wake up a writer waiting for send buffer, as tcp_input() does */
+    if (recv_acked > 0) {
+      u16_t acked16;
+#if LWIP_WND_SCALE
+      u32_t acked = recv_acked;
+      while (acked > 0) {
+        acked16 = (u16_t)LWIP_MIN(acked, 0xffffu);
+        acked -= acked16;
+#else
+      {
+        acked16 = recv_acked;
+#endif
+        TCP_EVENT_SENT(pcb, (u16_t)acked16, err);
+        if (err == ERR_ABRT) {
+          goto netmlaborted;
+        }
+      }
+      recv_acked = 0;
+    }
+
 	if (recv_data != NULL) {
       LWIP_ASSERT("pcb->refused_data == NULL", pcb->refused_data == NULL);
 	  LWIP_DEBUGF(TCP_INPUT_DEBUG, ("recv %u data\n", recv_data->tot_len));
@@ -1477,6 +1650,7 @@ tcp_process(struct tcp_pcb *pcb)
           rseg = pcb->unsent;
           LWIP_ASSERT("no segment to free", rseg != NULL);
           pcb->unsent = rseg->next;
+          TCP_UNSENT_TAIL_RESET(pcb);
         } else {
           pcb->unacked = rseg->next;
         }
@@ -1717,6 +1891,9 @@ tcp_free_acked_segments(struct tcp_pcb *pcb, struct tcp_seg *seg_list, const cha
 
     pcb->snd_queuelen = (u16_t)(pcb->snd_queuelen - clen);
     recv_acked = (tcpwnd_size_t)(recv_acked + next->len);
+#if LWIP_NETML
+    tcp_ack_index_remove(pcb, next);
+#endif
     tcp_seg_free(next);
 
     LWIP_DEBUGF(TCP_QLEN_DEBUG, ("%"TCPWNDSIZE_F" (after freeing %s)\n",
@@ -1894,6 +2071,7 @@ tcp_receive(struct tcp_pcb *pcb)
          ->unsent list after a retransmission, so these segments may
          in fact have been sent once. */
       pcb->unsent = tcp_free_acked_segments(pcb, pcb->unsent, "unsent", pcb->unacked);
+      TCP_UNSENT_TAIL_RESET(pcb);
 
       /* If there's nothing left to acknowledge, stop the retransmit
          timer, otherwise reset it to start again */
@@ -85,7 +85,7 @@
 #include LWIP_HOOK_FILENAME
 #endif
 
-#ifdef LWIP_NETML
+#if LWIP_NETML
 #include <rte_hash.h>
 #endif
 
@@ -184,6 +184,9 @@ tcp_create_segment(const struct tcp_pcb *pcb, struct pbuf *p, u8_t hdrflags,
   if (is_dat)
 	seg->len -= sizeof(struct internal_hdr);
   seg->hasresent = 0;
+  seg->on_unacked = 0;
+  seg->indexed = 0;
+  seg->hdr_cached = 0;
 #if TCP_OVERSIZE_DBGCHECK
   seg->oversize_left = 0;
 #endif /* TCP_OVERSIZE_DBGCHECK */
@@ -363,29 +366,103 @@ tcp_write_checks(struct tcp_pcb *pcb, u16_t len)
 }
 
 #if LWIP_NETML
+/**
+ * Get the pbufs of a NETML data segment: a header pbuf with room for hlen
+ * bytes of TCP options and internal header, chained to a PBUF_ROM pbuf
+ * referencing seglen bytes at data.
+ *
+ * The filled slots of pcb->hdr_cache are visited round robin. The pbufs of
+ * a slot are reused once the cache holds the only reference to them, that
+ * is the segment they were sent with has been freed. Segments are acked in
+ * about the order they were written, so the slot is usually free again;
+ * if not, all of them are in flight and a slot is added.
+ *
+ * @param cached set to 1 if the returned pbuf is referenced by the cache
+ * @return the header pbuf, NULL on memory error
+ */
+static struct pbuf *
+tcp_netml_hdr_pbuf(struct tcp_pcb *pcb, u16_t hlen, const u8_t *data,
+                   u16_t seglen, u8_t *cached)
+{
+  struct tcp_hdr_cache *hc = NULL;
+  struct pbuf *p, *p2;
+
+  *cached = 0;
+  if (pcb->hdr_used > 0) {
+    hc = &pcb->hdr_cache[pcb->hdr_next];
+    if (hc->p != NULL && hc->p->ref != 1) {
+      /* still in flight */
+      hc = NULL;
+    } else {
+      pcb->hdr_next = (u16_t)((pcb->hdr_next + 1) % pcb->hdr_used);
+    }
+  }
+  if (hc != NULL && hc->p != NULL) {
+    p = hc->p;
+    p2 = p->next;
+    if (hc->len == hlen && p2 != NULL && p2->ref == 1 && p2->next == NULL &&
+        p2->type_internal == (u8_t)PBUF_ROM) {
+      /* only the cache holds it, reset the pbufs as allocated */
+      ((struct pbuf_rom *)p2)->payload = data;
+      p2->len = p2->tot_len = seglen;
+      p->payload = hc->payload;
+      p->len = hlen;
+      p->tot_len = (u16_t)(hlen + seglen);
+      pbuf_ref(p);
+      *cached = 1;
+      return p;
+    }
+    /* changed by a split or the options, fill the slot again */
+    pbuf_free(p);
+    hc->p = NULL;
+  } else if (hc == NULL && pcb->hdr_used < NETML_HDR_CACHE) {
+    /* all the slots are in flight */
+    hc = &pcb->hdr_cache[pcb->hdr_used++];
+  }
+
+  /* Since the referenced data is available at least until it is sent
+   * out on the link (as it has to be ACKed by the remote party) we can
+   * safely use PBUF_ROM instead of PBUF_REF here. */
+  if ((p2 = pbuf_alloc(PBUF_TRANSPORT, seglen, PBUF_ROM)) == NULL) {
+    LWIP_DEBUGF(TCP_OUTPUT_DEBUG | LWIP_DBG_LEVEL_SERIOUS, ("tcp_write: could not allocate memory for zero-copy pbuf\n"));
+    return NULL;
+  }
+  ((struct pbuf_rom *)p2)->payload = data;
+  if ((p = pbuf_alloc(PBUF_TRANSPORT, hlen, PBUF_RAM)) == NULL) {
+    pbuf_free(p2);
+    LWIP_DEBUGF(TCP_OUTPUT_DEBUG | LWIP_DBG_LEVEL_SERIOUS, ("tcp_write: could not allocate memory for header pbuf\n"));
+    return NULL;
+  }
+  pbuf_cat(p, p2);
+
+  if (hc != NULL) {
+    /* keep it in the free slot */
+    hc->p = p;
+    hc->payload = p->payload;
+    hc->len = hlen;
+    p->flags |= PBUF_FLAG_NETML_HDR;
+    pbuf_ref(p);
+    *cached = 1;
+  }
+  return p;
+}
+
 err_t
 tcp_write_netml(struct tcp_pcb *pcb, const void *arg, u16_t len,
 				u16_t remote_id, u8_t is_hot)
 {
-  struct pbuf *concat_p = NULL;
   struct tcp_seg *last_unsent = NULL, *seg = NULL, *prev_seg = NULL, *queue = NULL;
   u16_t pos = 0; /* position in 'arg' data */
   u16_t queuelen;
+  u16_t hlen, max_len, nsegs;
   u8_t optlen;
   u8_t optflags = 0;
-  u16_t extendlen = 0;
-#if TCP_CHECKSUM_ON_COPY
-  u16_t concat_chksum = 0;
-  u8_t concat_chksum_swapped = 0;
-  u16_t concat_chksummed = 0;
-#endif /* TCP_CHECKSUM_ON_COPY */
+  u8_t cached;
   err_t err;
   u16_t mss_local;
+  u32_t intseq, inttunl;
 
   struct tcp_internal_id *tmpworker = NULL;
-  struct hmap_node *hnode = NULL;
-  u32_t hkey = 0;
-  struct internal_hdr inhdr;
 
   /* don't allocate segments bigger than half the maximum window we ever received */
   mss_local = LWIP_MIN(pcb->mss, TCPWND_MIN16(pcb->snd_wnd_max / 2));
@@ -406,7 +483,10 @@ tcp_write_netml(struct tcp_pcb *pcb, const void *arg, u16_t len,
   if (err != ERR_OK)
 	return err;
 
-  tmpworker = &pcb->internal_conn[remote_id];
+  tmpworker = tcp_netml_peer(pcb, remote_id);
+  if (tmpworker == NULL) {
+    goto memerr;
+  }
 
 #if LWIP_TCP_TIMESTAMPS
   if ((pcb->flags & TF_TIMESTAMP)) {
@@ -421,80 +501,51 @@ tcp_write_netml(struct tcp_pcb *pcb, const void *arg, u16_t len,
   {
     optlen = LWIP_TCP_OPT_LENGTH_SEGMENT(0, pcb);
   }
+  hlen = optlen + sizeof(struct internal_hdr);
+  max_len = mss_local - hlen;
+
+  /* Every segment takes a header and a data pbuf, check the queue length
+   * for all of them before building any. */
+  nsegs = (u16_t)((len + max_len - 1) / max_len);
+  if ((u32_t)queuelen + 2 * nsegs > LWIP_MIN(TCP_SND_QUEUELEN, TCP_SNDQUEUELEN_OVERFLOW)) {
+    LWIP_DEBUGF(TCP_OUTPUT_DEBUG | LWIP_DBG_LEVEL_SERIOUS, ("tcp_write: queue too long %"U16_F" (%d)\n",
+                queuelen, (int)TCP_SND_QUEUELEN));
+    goto memerr;
+  }
 
   /* Find the tail of the unsent queue. */
   if (pcb->unsent != NULL) {
-    /* @todo: this could be sped up by keeping last_unsent in the pcb */
-    for (last_unsent = pcb->unsent; last_unsent->next != NULL;
-         last_unsent = last_unsent->next);
+    last_unsent = pcb->unsent_tail;
+    if (last_unsent == NULL) {
+      for (last_unsent = pcb->unsent; last_unsent->next != NULL;
+           last_unsent = last_unsent->next);
+    }
+    LWIP_ASSERT("tcp_write_netml: unsent_tail is the tail", last_unsent->next == NULL);
   }
 
-  /* Create new segment */
+  intseq = tmpworker->intseq;
+  inttunl = tmpworker->inttunl;
+
+  /* Create new segments */
   while (pos < len) {
     struct pbuf *p;
-    u16_t left = len - pos;
-    u16_t max_len = mss_local - optlen - sizeof(struct internal_hdr);
-    u16_t seglen = LWIP_MIN(left, max_len);
-#if TCP_CHECKSUM_ON_COPY
-    u16_t chksum = 0;
-    u8_t chksum_swapped = 0;
-#endif /* TCP_CHECKSUM_ON_COPY */
+    u16_t seglen = LWIP_MIN(len - pos, max_len);
 
-    /* Copy is not set: First allocate a pbuf for holding the data.
-     * Since the referenced data is available at least until it is
-     * sent out on the link (as it has to be ACKed by the remote
-     * party) we can safely use PBUF_ROM instead of PBUF_REF here.
-     */
-    struct pbuf *p2;
-    if ((p2 = pbuf_alloc(PBUF_TRANSPORT, seglen,
-									PBUF_ROM)) == NULL) {
-	  LWIP_DEBUGF(TCP_OUTPUT_DEBUG | LWIP_DBG_LEVEL_SERIOUS, ("tcp_write: could not allocate memory for zero-copy pbuf\n"));
+    if ((p = tcp_netml_hdr_pbuf(pcb, hlen, (const u8_t *)arg + pos, seglen, &cached)) == NULL) {
       goto memerr;
     }
-    /* reference the non-volatile payload data */
-	((struct pbuf_rom *)p2)->payload = (const u8_t *)arg + pos;
-#if 0
-	/* allocate a pbuf for internal headers */
-	struct pbuf *p1 = NULL;
-	if ((p1 = pbuf_alloc(PBUF_TRANSPORT, sizeof(struct internal_hdr), PBUF_RAM)) == NULL) {
-		pbuf_free(p1);
-        LWIP_DEBUGF(TCP_OUTPUT_DEBUG | LWIP_DBG_LEVEL_SERIOUS, ("tcp_write: could not allocate memory for internal header pbuf\n"));
-        goto memerr;
-	}
-	pbuf_cat(p1 /* internal header */, p2 /* data */);
-#endif
-    /* Second, allocate a pbuf for the headers. */
-    if ((p = pbuf_alloc(PBUF_TRANSPORT, optlen + sizeof(struct internal_hdr), PBUF_RAM)) == NULL) {
-      /* If allocation fails, we have to deallocate the data pbuf as
-       * well. */
-		pbuf_free(p2);
-        LWIP_DEBUGF(TCP_OUTPUT_DEBUG | LWIP_DBG_LEVEL_SERIOUS, ("tcp_write: could not allocate memory for header pbuf\n"));
-        goto memerr;
-    }
-    /* Concatenate the headers and data pbufs together. */
-    pbuf_cat(p/*header + internal_hdr*/, p2/* data*/);
-
     queuelen += pbuf_clen(p);
 
-    /* Now that there are more segments queued, we check again if the
-     * length of the queue exceeds the configured maximum or
-     * overflows. */
-    if (queuelen > LWIP_MIN(TCP_SND_QUEUELEN, TCP_SNDQUEUELEN_OVERFLOW)) {
-      LWIP_DEBUGF(TCP_OUTPUT_DEBUG | LWIP_DBG_LEVEL_SERIOUS, ("tcp_write: queue too long %"U16_F" (%d)\n",
-                  queuelen, (int)TCP_SND_QUEUELEN));
-      pbuf_free(p);
-      goto memerr;
-    }
-
     if ((seg = tcp_create_segment(pcb, p, 0, pcb->snd_lbb + pos, optflags, 1)) == NULL) {
       goto memerr;
     }
+    seg->hdr_cached = cached;
 
 	seg->inthdr = (struct internal_hdr*)(p->payload + TCP_HLEN + optlen);
 	seg->inthdr->dst_id = lwip_htons(remote_id);
 	seg->inthdr->src_id = lwip_htons(pcb->local_id);
-	seg->inthdr->int_seqno = lwip_htonl(tmpworker->intseq);
-	seg->inthdr->int_tunlno = lwip_htonl(tmpworker->inttunl);
+	seg->inthdr->int_seqno = lwip_htonl(intseq);
+	seg->inthdr->int_tunlno = lwip_htonl(inttunl);
 
 	if (is_hot) {
 		TCPH_OFFSET_SETBIT(seg->tcphdr, NETML_HOT);
@@ -509,26 +560,23 @@ tcp_write_netml(struct tcp_pcb *pcb, const void *arg, u16_t len,
 //					lwip_ntohs(seg->tcphdr->src), pcb->local_id,
 //					lwip_ntohs(seg->tcphdr->dest), remote_id,
 //					lwip_ntohl(seg->tcphdr->seqno),
-//					tmpworker->intseq,
-//					tmpworker->inttunl, seglen);
+//					intseq, inttunl, seglen);
 
 	if (!is_hot)
-  		tmpworker->inttunl += seglen;
-	tmpworker->intseq += seglen;
+  		inttunl += seglen;
+	intseq += seglen;
 //	tcp_debug_print_netml(seg->tcphdr);
 
     /* first segment of to-be-queued data? */
     if (queue == NULL) {
       queue = seg;
-	  seg->prev = NULL;
-	  seg->next = NULL;
     } else {
       /* Attach the segment to the end of the queued segments */
       LWIP_ASSERT("prev_seg != NULL", prev_seg != NULL);
       prev_seg->next = seg;
-	  seg->prev = prev_seg;
-	  seg->next = NULL;
     }
+    seg->prev = prev_seg;
+    seg->next = NULL;
     /* remember last segment of to-be-queued data for next iteration */
     prev_seg = seg;
 
@@ -539,15 +587,25 @@ tcp_write_netml(struct tcp_pcb *pcb, const void *arg, u16_t len,
     pos += seglen;
   }
 
-  if (last_unsent == NULL) {
-    pcb->unsent = queue;
-  } else {
-    last_unsent->next = queue;
+  /* Append the whole batch to unsent at once */
+  if (queue != NULL) {
+    if (last_unsent == NULL) {
+      pcb->unsent = queue;
+    } else {
+      last_unsent->next = queue;
+      queue->prev = last_unsent;
+    }
+    pcb->unsent_tail = prev_seg;
+  }
+  for (seg = queue; seg != NULL; seg = seg->next) {
+    tcp_ack_index_add(pcb, seg);
   }
 
   /*
    * Finally update the pcb state.
    */
+  tmpworker->intseq = intseq;
+  tmpworker->inttunl = inttunl;
   pcb->snd_lbb += len;
   pcb->snd_buf -= len;
   pcb->snd_queuelen = queuelen;
@@ -571,9 +629,6 @@ memerr:
   tcp_set_flags(pcb, TF_NAGLEMEMERR);
   TCP_STATS_INC(tcp.memerr);
 
-  if (concat_p != NULL) {
-    pbuf_free(concat_p);
-  }
   if (queue != NULL) {
     tcp_segs_free(queue);
   }
@@ -582,6 +637,7 @@ memerr:
                 pcb->unsent != NULL);
   }
   LWIP_DEBUGF(TCP_QLEN_DEBUG | LWIP_DBG_STATE, ("tcp_write: %"S16_F" (with mem err)\n", pcb->snd_queuelen));
+  return ERR_MEM;
 }
 #endif /* LWIP_NETML */
 
@@ -1011,6 +1067,7 @@ tcp_write(struct tcp_pcb *pcb, const void *arg, u16_t len, u8_t apiflags)
   } else {
     last_unsent->next = queue;
   }
+  TCP_UNSENT_TAIL_RESET(pcb);
 
   /*
    * Finally update the pcb state.
@@ -1212,6 +1269,7 @@ tcp_split_unsent_seg(struct tcp_pcb *pcb, u16_t split)
   /* Finally insert remainder into queue after split (which stays head) */
   seg->next = useg->next;
   useg->next = seg;
+  TCP_UNSENT_TAIL_RESET(pcb);
 
 #if TCP_OVERSIZE
   /* If remainder is last segment on the unsent, ensure we clear the oversize amount
@@ -1348,6 +1406,7 @@ tcp_enqueue_flags(struct tcp_pcb *pcb, u8_t flags)
     for (useg = pcb->unsent; useg->next != NULL; useg = useg->next);
     useg->next = seg;
   }
+  TCP_UNSENT_TAIL_RESET(pcb);
 #if TCP_OVERSIZE
   /* The new unsent tail has no space */
   pcb->unsent_oversize = 0;
@@ -1474,6 +1533,12 @@ tcp_build_wnd_scale_option(u32_t *opts)
 }
 #endif
 
+#if LWIP_NETML
+/* Count of the tcp_output() passes, tcp_netml_cc_can_send() marks the held
+   back peers with it. 0 is the mark of a peer never held back. */
+static u32_t tcp_netml_pass;
+#endif
+
 /**
  * @ingroup tcp_raw
  * Find out what we can send and send it
@@ -1490,6 +1555,12 @@ tcp_output(struct tcp_pcb *pcb)
   err_t err;
   struct netif *netif;
   u8_t tcp_flags, netml_flags;
+#if LWIP_NETML
+  /* last segment held back on unsent, the later sendable ones are
+     unlinked from behind it */
+  struct tcp_seg *held = NULL;
+  u32_t pass;
+#endif
 #if TCP_CWND_DEBUG
   s16_t i = 0;
 #endif /* TCP_CWND_DEBUG */
@@ -1588,7 +1659,14 @@ tcp_output(struct tcp_pcb *pcb)
   }
   /* data available and window allows it to be sent? */
 #if LWIP_NETML
-  while (seg != NULL)
+  if (++tcp_netml_pass == 0) {
+    tcp_netml_pass = 1;
+  }
+  pass = tcp_netml_pass;
+  /* the congestion controller holds back the NETML segments below, the
+     window the bypass ones */
+  while (seg != NULL && (!pcb->is_bypass ||
+         lwip_ntohl(seg->tcphdr->seqno) - pcb->lastack + seg->len <= wnd))
 #else
   while (seg != NULL &&
          lwip_ntohl(seg->tcphdr->seqno) - pcb->lastack + seg->len <= wnd) 
@@ -1616,9 +1694,20 @@ tcp_output(struct tcp_pcb *pcb)
     ++i;
 #endif /* TCP_CWND_DEBUG */
 
-//    if (pcb->state != SYN_SENT) {
-//      TCPH_SET_FLAG(seg->tcphdr, TCP_ACK);
-//    }
+    /* the bypass segments are plain TCP, the peer takes its window and
+       acks from them; the NETML ones are acked apart */
+    if (pcb->is_bypass && pcb->state != SYN_SENT) {
+      TCPH_SET_FLAG(seg->tcphdr, TCP_ACK);
+    }
+#if LWIP_NETML
+    /* the congestion controller holds back the data to a congested peer,
+       the segments to the other peers behind it go on */
+    if (seg->indexed && !tcp_netml_cc_can_send(pcb, seg, pass)) {
+      held = seg;
+      seg = seg->next;
+      continue;
+    }
+#endif
 
     err = tcp_output_segment(seg, pcb, netif);
     if (err != ERR_OK) {
@@ -1630,7 +1719,24 @@ tcp_output(struct tcp_pcb *pcb)
 #if TCP_OVERSIZE_DBGCHECK
     seg->oversize_left = 0;
 #endif /* TCP_OVERSIZE_DBGCHECK */
+#if LWIP_NETML
+    /* unlink seg, the held back segments before it stay on unsent */
+    if (held == NULL) {
+      pcb->unsent = seg->next;
+    } else {
+      held->next = seg->next;
+    }
+    if (seg->next != NULL) {
+      seg->next->prev = held;
+    } else if (held != NULL) {
+      pcb->unsent_tail = held;
+    }
+#else
     pcb->unsent = seg->next;
+#endif
+    if (pcb->unsent == NULL) {
+      TCP_UNSENT_TAIL_RESET(pcb);
+    }
     if (pcb->state != SYN_SENT) {
       tcp_clear_flags(pcb, TF_ACK_DELAY | TF_ACK_NOW);
     }
@@ -1643,9 +1749,15 @@ tcp_output(struct tcp_pcb *pcb)
       seg->next = NULL;
 #if LWIP_NETML
 	  seg->prev = NULL;
+	  seg->on_unacked = 1;
 
 	  u8_t netml_flags = TCPH_OFFSET_FLAGS(seg->tcphdr);
 
+	  if (seg->indexed) {
+		tcp_netml_rto_arm(pcb, seg);
+		tcp_netml_cc_sent(pcb, seg);
+	  }
+
 	  if (netml_flags == NETML_COLD) {
 	  	TCPH_OFFSET_CLEAR(seg->tcphdr);
 		TCPH_OFFSET_SETBIT(seg->tcphdr, NETML_COLD_RE);
@@ -1693,10 +1805,10 @@ tcp_output(struct tcp_pcb *pcb)
     } else {
       tcp_seg_free(seg);
     }
-    seg = pcb->unsent;
 #if LWIP_NETML
-	if (pcb->unsent != NULL)
-		pcb->unsent->prev = NULL;
+    seg = held == NULL ? pcb->unsent : held->next;
+#else
+    seg = pcb->unsent;
 #endif
   }
 #if TCP_OVERSIZE
@@ -1728,7 +1840,11 @@ tcp_output_segment_busy(const struct tcp_seg *seg)
   /* We only need to check the first pbuf here:
      If a pbuf is queued for transmission, a driver calls pbuf_ref(),
      which only changes the ref count of the first pbuf */
+#if LWIP_NETML
+  if (seg->p->ref != 1 + seg->hdr_cached) {
+#else
   if (seg->p->ref != 1) {
+#endif
     /* other reference found */
     return 1;
   }
@@ -1953,6 +2069,18 @@ tcp_rexmit_rto_prepare(struct tcp_pcb *pcb)
     LWIP_DEBUGF(TCP_RTO_DEBUG, ("tcp_rexmit_rto: segment busy\n"));
     return ERR_VAL;
   }
+#if LWIP_NETML
+  for (seg = pcb->unacked; seg->next != NULL; seg = seg->next) {
+    if (seg->indexed) {
+      tcp_netml_cc_left(pcb, seg);
+    }
+    seg->on_unacked = 0;
+  }
+  if (seg->indexed) {
+    tcp_netml_cc_left(pcb, seg);
+  }
+  seg->on_unacked = 0;
+#endif
   /* concatenate unsent queue after unacked queue */
   seg->next = pcb->unsent;
 #if LWIP_NETML
@@ -1967,6 +2095,7 @@ tcp_rexmit_rto_prepare(struct tcp_pcb *pcb)
 #endif /* TCP_OVERSIZE_DBGCHECK */
   /* unsent queue is the concatenated queue (of unacked, unsent) */
   pcb->unsent = pcb->unacked;
+  TCP_UNSENT_TAIL_RESET(pcb);
   /* unacked queue is now empty */
   pcb->unacked = NULL;
 
@@ -2019,6 +2148,36 @@ tcp_rexmit_rto(struct tcp_pcb *pcb)
 }
 
 #if LWIP_NETML
+static tcp_netml_reclaim_fn tcp_netml_reclaim;
+
+/**
+ * Set the function a driver that references the segments until the NIC
+ * has sent them (DPDK zero copy TX) reclaims the sent ones with.
+ */
+void
+tcp_netml_set_reclaim(tcp_netml_reclaim_fn reclaim)
+{
+  tcp_netml_reclaim = reclaim;
+}
+
+/**
+ * Whether the driver still holds seg, once it reclaimed what the NIC has
+ * sent. It is not retransmitted then, the caller must leave it on unacked
+ * and try again later.
+ */
+u8_t
+tcp_netml_seg_busy(const struct tcp_seg *seg)
+{
+  if (!tcp_output_segment_busy(seg)) {
+    return 0;
+  }
+  if (tcp_netml_reclaim == NULL) {
+    return 1;
+  }
+  tcp_netml_reclaim();
+  return (u8_t)tcp_output_segment_busy(seg);
+}
+
 void
 tcp_rexmit_data(struct tcp_pcb *pcb, struct tcp_seg * seg)
 {
@@ -2027,12 +2186,15 @@ tcp_rexmit_data(struct tcp_pcb *pcb, struct tcp_seg * seg)
   struct tcp_hdr *tcphdr;
   u8_t netml_flags = 0;
 
-	if (tcp_output_segment_busy(seg)) {
-		fprintf(stdout, "[%s][%d]: segment busy\n", __FILE__, __LINE__);
-		return;
-	}
+  /* the callers leave busy segments on unacked */
+  if (tcp_output_segment_busy(seg)) {
+    LWIP_DEBUGF(TCP_RTO_DEBUG, ("tcp_rexmit_data: segment busy\n"));
+    return;
+  }
 
   seg->hasresent=1;
+  seg->on_unacked = 0;
+  TCP_UNSENT_TAIL_RESET(pcb);
 
   if(pcb->unsent == NULL){
 	pcb->unsent=seg;
@@ -2124,6 +2286,9 @@ tcp_rexmit(struct tcp_pcb *pcb)
   /* Move the first unacked segment to the unsent queue */
   /* Keep the unsent queue sorted. */
   pcb->unacked = seg->next;
+#if LWIP_NETML
+  seg->on_unacked = 0;
+#endif
 
   cur_seg = &(pcb->unsent);
   while (*cur_seg &&
@@ -2132,6 +2297,7 @@ tcp_rexmit(struct tcp_pcb *pcb)
   }
   seg->next = *cur_seg;
   *cur_seg = seg;
+  TCP_UNSENT_TAIL_RESET(pcb);
 #if TCP_OVERSIZE
   if (seg->next == NULL) {
     /* the retransmitted segment is last in unsent, so reset unsent_oversize */
@@ -2429,6 +2595,11 @@ tcp_send_empty_ack_netml(struct tcp_pcb *pcb, struct tcp_internal_id *tmpworker,
   u8_t num_sacks = 0;
   struct tcp_hdr *tcphdr = NULL;
   struct internal_hdr *tmp = NULL;
+  struct netml_sack sack;
+  u16_t sacklen = 0, acklen = 0;
+  u32_t ackno = pcb->rcv_nxt, intack = tmpworker->intack;
+  u32_t *sackw;
+  u32_t i, nacks = 0;
 
   LWIP_ASSERT("tcp_send_empty_ack: invalid pcb", pcb != NULL);
 
@@ -2442,7 +2613,21 @@ tcp_send_empty_ack_netml(struct tcp_pcb *pcb, struct tcp_internal_id *tmpworker,
 
 //  p = pbuf_alloc(PBUF_IP, TCP_HLEN + optlen + sizeof(struct internal_hdr), PBUF_RAM);
 
-  p = tcp_output_alloc_header(pcb, optlen, sizeof(struct internal_hdr),
+  /* the receive state goes after the internal header, the switch doesn't
+     parse TCP options beyond one word */
+  if (!is_agg) {
+    tcp_netml_sack(tmpworker, &sack);
+    sacklen = NETML_SACK_LEN(sack.num);
+    if (tmpworker->ack_pending > 0) {
+      /* the coalesced ACK of the pending segments */
+      nacks = tmpworker->ack_pending - 1;
+      ackno = tmpworker->ack_seq[nacks];
+      intack = tmpworker->ack_intack;
+    }
+    acklen = NETML_ACKS_LEN(nacks) + NETML_ECE_LEN;
+  }
+
+  p = tcp_output_alloc_header(pcb, optlen, sizeof(struct internal_hdr) + sacklen + acklen,
 				  lwip_htonl(pcb->snd_nxt));
 
   if (p == NULL) {
@@ -2456,7 +2641,7 @@ tcp_send_empty_ack_netml(struct tcp_pcb *pcb, struct tcp_internal_id *tmpworker,
   tcphdr->src = lwip_htons(pcb->local_port);
   tcphdr->dest = lwip_htons(pcb->remote_port);
   tcphdr->seqno = lwip_htonl(pcb->snd_nxt);
-  tcphdr->ackno = lwip_htonl(pcb->rcv_nxt);
+  tcphdr->ackno = lwip_htonl(ackno);
   TCPH_HDRLEN_FLAGS_SET(tcphdr, (5 + optlen / 4), TCP_ACK);
   tcphdr->chksum = 0;
   tcphdr->urgp = 0;
@@ -2471,10 +2656,26 @@ tcp_send_empty_ack_netml(struct tcp_pcb *pcb, struct tcp_internal_id *tmpworker,
 
   tmp = (struct internal_hdr *)(p->payload + TCP_HLEN + optlen);
 
-  tmp->int_seqno = lwip_htonl(tmpworker->intack);
+  tmp->int_seqno = lwip_htonl(intack);
   tmp->int_tunlno = lwip_htonl(tmpworker->inttunl);
   tmp->dst_id = lwip_htons(tmpworker->inid);
   tmp->src_id = lwip_htons(pcb->local_id);
+
+  if (sacklen) {
+    sackw = (u32_t *)(tmp + 1);
+    sackw[0] = lwip_htonl(sack.cum);
+    sackw[1] = lwip_htonl(sack.num);
+    for (i = 0; i < sack.num; i++) {
+      sackw[2 + 2 * i] = lwip_htonl(sack.blk[i].left);
+      sackw[3 + 2 * i] = lwip_htonl(sack.blk[i].right);
+    }
+    sackw += sacklen / 4;
+    sackw[0] = lwip_htonl(nacks);
+    for (i = 0; i < nacks; i++) {
+      sackw[1 + i] = lwip_htonl(tmpworker->ack_seq[i]);
+    }
+    sackw[1 + nacks] = lwip_htonl(tmpworker->ack_pending > 0 ? tmpworker->ack_ce : 0);
+  }
   
 #if LWIP_TCP_TIMESTAMPS
   pcb->ts_lastacksent = pcb->rcv_nxt;
@@ -2488,7 +2689,14 @@ tcp_send_empty_ack_netml(struct tcp_pcb *pcb, struct tcp_internal_id *tmpworker,
   LWIP_DEBUGF(TCP_OUTPUT_DEBUG,
               ("tcp_output: sending ACK for %"U32_F"\n", pcb->rcv_nxt));
   err = tcp_output_control_segment(pcb, p, &pcb->local_ip, &pcb->remote_ip);
-  if (err != ERR_OK) {
+  if (!is_agg) {
+    /* kept pending on errors, tcp_fasttmr flushes them again */
+    if (err == ERR_OK && tmpworker->ack_pending > 0) {
+      tmpworker->ack_pending = 0;
+      tmpworker->ack_ce = 0;
+      pcb->netml_acks--;
+    }
+  } else if (err != ERR_OK) {
     /* let tcp_fasttmr retry sending this ACK */
     fprintf(stdout, "[%s][%d]: retry sending ACK, err %d\n",
 			__FILE__, __LINE__, err);
@@ -2500,6 +2708,64 @@ tcp_send_empty_ack_netml(struct tcp_pcb *pcb, struct tcp_internal_id *tmpworker,
 
   return err;
 }
+
+/**
+ * Note the cold segment just received from peer ic to be acked, ce if it
+ * arrived congestion experienced. The ACKs of a peer are coalesced until
+ * NETML_ACK_SEGS segments are pending, the end of the RX burst or
+ * tcp_fasttmr, whichever comes first.
+ */
+void
+tcp_netml_ack_delay(struct tcp_pcb *pcb, struct tcp_internal_id *ic, u8_t ce)
+{
+  if (ic->ack_pending == NETML_ACK_SEGS) {
+    /* sending them failed before, the peer resends this one if it still does */
+    if (tcp_send_empty_ack_netml(pcb, ic, 0) != ERR_OK) {
+      return;
+    }
+  }
+  if (ic->ack_pending == 0) {
+    pcb->netml_acks++;
+  }
+  ic->ack_seq[ic->ack_pending++] = pcb->rcv_nxt;
+  ic->ack_intack = ic->intack;
+  ic->ack_ce += ce;
+  if (ic->ack_pending == NETML_ACK_SEGS) {
+    tcp_send_empty_ack_netml(pcb, ic, 0);
+  }
+}
+
+/** Send the coalesced ACKs pending on pcb */
+void
+tcp_netml_ack_flush(struct tcp_pcb *pcb)
+{
+  struct tcp_internal_id *ic;
+
+  if (pcb->netml_acks == 0) {
+    return;
+  }
+  HMAP_FOR_EACH(ic, struct tcp_internal_id, node, &pcb->peers) {
+    if (ic->ack_pending > 0) {
+      tcp_send_empty_ack_netml(pcb, ic, 0);
+    }
+  }
+}
+
+/**
+ * Send the coalesced ACKs pending on all pcbs, the netif calls it through
+ * tcpip_try_callback() at the end of an RX burst.
+ */
+void
+tcp_netml_ack_flush_all(void *arg)
+{
+  struct tcp_pcb *pcb;
+
+  LWIP_UNUSED_ARG(arg);
+
+  for (pcb = tcp_active_pcbs; pcb != NULL; pcb = pcb->next) {
+    tcp_netml_ack_flush(pcb);
+  }
+}
 #endif
 
 /**
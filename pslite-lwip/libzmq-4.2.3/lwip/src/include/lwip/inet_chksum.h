@@ -52,6 +52,15 @@
 #define FOLD_U32T(u)          ((u32_t)(((u) >> 16) + ((u) & 0x0000ffffUL)))
 #endif
 
+#if LWIP_CHKSUM_SIMD
+# ifndef LWIP_CHKSUM
+#  define LWIP_CHKSUM lwip_simd_chksum
+# endif
+# ifndef LWIP_CHKSUM_COPY
+#  define LWIP_CHKSUM_COPY(dst, src, len) lwip_simd_chksum_copy(dst, src, len)
+# endif
+#endif /* LWIP_CHKSUM_SIMD */
+
 #if LWIP_CHECKSUM_ON_COPY
 /** Function-like macro: same as MEMCPY but returns the checksum of copied data
     as u16_t */
@@ -76,6 +85,13 @@ u16_t inet_chksum_pbuf(struct pbuf *p);
 #if LWIP_CHKSUM_COPY_ALGORITHM
 u16_t lwip_chksum_copy(void *dst, const void *src, u16_t len);
 #endif /* LWIP_CHKSUM_COPY_ALGORITHM */
+#if LWIP_CHKSUM_SIMD
+u16_t lwip_standard_chksum(const void *dataptr, int len);
+u16_t lwip_simd_chksum(const void *dataptr, int len);
+u16_t lwip_simd_chksum_copy(void *dst, const void *src, u16_t len);
+u8_t  lwip_simd_chksum_use(const char *name);
+const char *lwip_simd_chksum_name(void);
+#endif /* LWIP_CHKSUM_SIMD */
 
 #if LWIP_IPV4
 u16_t inet_chksum_pseudo(struct pbuf *p, u8_t proto, u16_t proto_len,
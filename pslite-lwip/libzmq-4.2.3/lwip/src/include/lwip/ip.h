@@ -60,8 +60,15 @@ extern "C" {
 /** pbufs passed to IP must have a ref-count of 1 as their payload pointer
     gets altered as the packet is passed down the stack */
 #ifndef LWIP_IP_CHECK_PBUF_REF_COUNT_FOR_TX
+#if LWIP_NETML
+/* the reference of the tcp_write_netml header cache, it does not touch the
+   pbuf while its segment holds it */
+#define LWIP_IP_CHECK_PBUF_REF_COUNT_FOR_TX(p) LWIP_ASSERT("p->ref == 1", \
+  (p)->ref == 1 + (((p)->flags & PBUF_FLAG_NETML_HDR) != 0))
+#else
 #define LWIP_IP_CHECK_PBUF_REF_COUNT_FOR_TX(p) LWIP_ASSERT("p->ref == 1", (p)->ref == 1)
 #endif
+#endif
 
 #if LWIP_NETIF_USE_HINTS
 #define IP_PCB_NETIFHINT ;struct netif_hint netif_hints
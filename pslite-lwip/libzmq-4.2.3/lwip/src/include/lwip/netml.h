@@ -7,6 +7,8 @@
 #include "lwip/tcp.h"
 #include "lwip/pbuf.h"
 #include "lwip/err.h"
+#include "lwip/netml_tmr.h"
+#include "lwip/netml_cc.h"
 #include "mlib/hmap.h"
 
 #ifdef __cplusplus
@@ -56,20 +58,102 @@ PACK_STRUCT_END
 
 #define INTH_BYPASS(flags)	(flags == NETML_BYPASS)
 #define INTH_CTL(flags)		(flags == NETML_CTL || flags == NETML_CTL_SW)
+#define INTH_HOT(flags)		(flags == NETML_HOT || flags == NETML_HOT_RE)
 
 struct kv_pair {
 	struct hmap_node node;
 	u64_t value;
 };
 
+#if TCP_QUEUE_OOSEQ
+/* Out of order segments held per peer, must be a power of two below 255 */
+#define NETML_REORDER_SIZE	64
+#define NETML_REORDER_NIL	0xff
+
+struct tcp_reorder_ent {
+  struct pbuf *p;   /* the received pbuf, headers removed */
+  u32_t tunl;       /* its tunnel number */
+  u8_t agg;         /* an aggregated segment, it doesn't advance nxtwish */
+  u8_t next;        /* next entry of the slot, or of the free list */
+};
+
+/* Reorder ring of a peer: entries are hashed by tunnel number into slots,
+ * every slot keeps its entries in arrival order. */
+struct tcp_reorder {
+  u8_t slot[NETML_REORDER_SIZE];
+  u8_t free;
+  u8_t count;
+  struct tcp_reorder_ent ent[NETML_REORDER_SIZE];
+};
+#endif /* TCP_QUEUE_OOSEQ */
+
+/* Receive state of a peer, carried after the internal header of its cold
+ * ACKs so that the sender retransmits only what is missing: the tunnel
+ * bytes below cum are delivered, and the out of order ranges [left, right)
+ * are held. On the wire every field is a big endian u32_t and only num
+ * blocks are sent. */
+#define NETML_SACK_BLOCKS	4
+#define NETML_SACK_LEN(num)	(8 + 8 * (num))
+
+/* The ACKs of cold segments are coalesced per peer: the TCP header of an
+ * ACK acks the last segment, the acknos of the others follow the receive
+ * state as a count and a list of big endian u32_t. A last u32_t counts the
+ * acked segments that arrived congestion experienced. */
+#ifndef NETML_ACK_SEGS
+#define NETML_ACK_SEGS	8
+#endif
+#define NETML_ACKS_LEN(num)	(4 + 4 * (num))
+#define NETML_ECE_LEN		4
+
+struct netml_sack {
+  u32_t cum;
+  u32_t num;
+  struct {
+    u32_t left;
+    u32_t right;
+  } blk[NETML_SACK_BLOCKS];
+};
+
+/* Retransmission timeout of the data segments to a peer, in microseconds */
+#ifndef NETML_RTO_INIT_US
+#define NETML_RTO_INIT_US	5000
+#endif
+#ifndef NETML_RTO_MIN_US
+#define NETML_RTO_MIN_US	200
+#endif
+#ifndef NETML_RTO_MAX_US
+#define NETML_RTO_MAX_US	200000
+#endif
+
+/* A cached header pbuf of NETML data segments, its data pbuf stays chained */
+struct tcp_hdr_cache {
+  struct pbuf *p;
+  void *payload;  /* payload of p as allocated */
+  u16_t len;      /* header length p was allocated for */
+};
+
+/* NETML state of a pcb for one peer node, in tcp_pcb.peers */
 struct tcp_internal_id {
+  struct hmap_node node;  /* hashed by inid */
   u32_t nxtwish;
   u32_t intseq;
   u32_t intack;
   u32_t inttunl;
-  u16_t inid;
+  u32_t sack_seq;  /* segments to the peer below it were checked against its SACK */
+  u16_t inid;   /* node id of the peer */
+  u8_t ack_pending;  /* received segments not acked yet */
+  u32_t ack_intack;  /* intack of the last of them */
+  u32_t ack_seq[NETML_ACK_SEGS];  /* their TCP acknos */
+  u8_t ack_ce;  /* of them arrived with CE set */
+  struct tcp_pcb *pcb;
+  /* RTT estimation of the segments sent to it, scaled like tcp_pcb.sa and
+     tcp_pcb.sv but in microseconds */
+  s32_t sa_us, sv_us;
+  u32_t rto_us;
+  struct netml_tmr rto_tmr;
+  struct netml_cc cc;  /* congestion state of the segments sent to it */
 #if TCP_QUEUE_OOSEQ
-  struct tcp_seg *ooseq;    /* Received out of sequence segments. */
+  struct tcp_reorder *reorder;  /* Received out of sequence segments, allocated on the first one. */
 #endif /* TCP_QUEUE_OOSEQ */
 };
 
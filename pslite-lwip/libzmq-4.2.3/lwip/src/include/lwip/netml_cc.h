@@ -0,0 +1,101 @@
+#ifndef __LWIP_NETML_CC_H__
+#define __LWIP_NETML_CC_H__
+
+#include "lwip/opt.h"
+
+#if LWIP_NETML
+
+#include "lwip/arch.h"
+#include "lwip/err.h"
+#include "lwip/netml_tmr.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Congestion control of the NETML data segments. The NETML path sends what
+ * tcp_write_netml() queued regardless of the TCP windows, a controller
+ * decides per peer of a pcb whether the next segment to it may leave now.
+ * The controller of a pcb is the default one when it is created.
+ */
+
+/* ECN field of the IP TOS */
+#define NETML_ECN_MASK		0x03
+#define NETML_ECN_ECT0		0x02
+#define NETML_ECN_CE		0x03
+
+/* Window of a peer at start, in bytes */
+#ifndef NETML_CC_INIT_WND
+#define NETML_CC_INIT_WND	(10 * TCP_MSS)
+#endif
+/* Rate of the link, the pacer starts at it, in bytes per second */
+#ifndef NETML_CC_LINE_RATE
+#define NETML_CC_LINE_RATE	1250000000U
+#endif
+#ifndef NETML_CC_MIN_RATE
+#define NETML_CC_MIN_RATE	(NETML_CC_LINE_RATE / 1000)
+#endif
+/* Bytes the pacer may send back to back */
+#ifndef NETML_CC_PACE_BURST
+#define NETML_CC_PACE_BURST	(4 * TCP_MSS)
+#endif
+/* Gain of the estimation of the marked fraction, 1/2^NETML_CC_DCTCP_G */
+#define NETML_CC_DCTCP_G	4
+/* Scale of netml_cc.alpha */
+#define NETML_CC_ALPHA_ONE	1024
+
+struct tcp_internal_id;
+
+/* Congestion state of a peer, in tcp_internal_id */
+struct netml_cc {
+  u32_t inflight;   /* bytes of the segments to it on unacked */
+  u32_t cwnd;       /* window, bytes */
+  u32_t ssthresh;
+  u32_t alpha;      /* estimated fraction of CE marked bytes */
+  u32_t win_acked;  /* bytes acked in the current observation window */
+  u32_t win_ce;     /* of which were marked */
+  u32_t win_start;  /* netml_tmr_now() the window started */
+  u32_t cut_us;     /* netml_tmr_now() of the last reduction */
+  u32_t rate;       /* pacing rate, bytes per second */
+  u32_t tokens;     /* bytes the pacer may send */
+  u32_t tokens_us;  /* netml_tmr_now() tokens were refilled */
+  u32_t held;       /* tcp_output() pass a segment to it was held back in */
+  struct netml_tmr resume_tmr;  /* restarts the output of a held back peer */
+};
+
+struct netml_cc_ops {
+  const char *name;
+  /* mark the segments ECN capable */
+  u8_t ecn;
+  void (*init)(struct tcp_internal_id *ic);
+  /* whether a segment of len bytes may be sent to ic now. A controller
+     holding it back restarts the output with netml_cc_resume() or waits
+     for the next ACK from ic. */
+  u8_t (*can_send)(struct tcp_internal_id *ic, u16_t len);
+  void (*sent)(struct tcp_internal_id *ic, u16_t len);
+  /* an ACK from ic freed acked bytes, ce of them were congestion experienced */
+  void (*acked)(struct tcp_internal_id *ic, u32_t acked, u32_t ce);
+  /* segments to ic were lost */
+  void (*lost)(struct tcp_internal_id *ic);
+};
+
+/* No control, every segment is sent at once */
+extern const struct netml_cc_ops netml_cc_none;
+/* DCTCP: a window cut in proportion to the fraction of marked bytes */
+extern const struct netml_cc_ops netml_cc_dctcp;
+/* A token bucket paced at a rate cut in proportion to the marked bytes */
+extern const struct netml_cc_ops netml_cc_pace;
+
+const struct netml_cc_ops *netml_cc_find(const char *name);
+err_t netml_cc_set_default(const char *name);
+const struct netml_cc_ops *netml_cc_get_default(void);
+void  netml_cc_resume(struct tcp_internal_id *ic, u32_t us);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* LWIP_NETML */
+
+#endif /* __LWIP_NETML_CC_H__ */
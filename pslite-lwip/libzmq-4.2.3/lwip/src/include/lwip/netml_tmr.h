@@ -0,0 +1,55 @@
+#ifndef __LWIP_NETML_TMR_H__
+#define __LWIP_NETML_TMR_H__
+
+#include "lwip/opt.h"
+
+#if LWIP_NETML
+
+#include "lwip/arch.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Timer wheel of the NETML data path, clocked by the TSC. lwIP timers tick
+ * in milliseconds, far above the RTTs through the switch. The TSC rate is
+ * measured once by lwip_init(), not taken from CPU_HZ. The timers are
+ * run by netml_tmr_poll() in the tcpip thread, the netif polls
+ * netml_tmr_due() from its RX loop to know when to schedule it.
+ */
+#ifndef NETML_TMR_TICK_US
+#define NETML_TMR_TICK_US	8
+#endif
+/* must be a power of two, timers further than a round are checked again
+   every round until they expire */
+#define NETML_TMR_SLOTS		1024
+
+typedef void (*netml_tmr_fn)(void *arg);
+
+struct netml_tmr {
+  struct netml_tmr *next;
+  struct netml_tmr **pprev;  /* NULL when not pending */
+  u64_t expire;              /* in ticks */
+  netml_tmr_fn fn;
+  void *arg;
+};
+
+#define netml_tmr_pending(t)	((t)->pprev != NULL)
+
+void  netml_tmr_calibrate(void);
+void  netml_tmr_init(struct netml_tmr *t, netml_tmr_fn fn, void *arg);
+void  netml_tmr_add(struct netml_tmr *t, u32_t us);
+void  netml_tmr_del(struct netml_tmr *t);
+u32_t netml_tmr_now(void);
+u8_t  netml_tmr_due(void);
+u32_t netml_tmr_sleeptime(void);
+void  netml_tmr_poll(void *arg);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* LWIP_NETML */
+
+#endif /* __LWIP_NETML_TMR_H__ */
@@ -202,6 +202,42 @@
 #define LWIP_TCPIP_CORE_LOCKING_INPUT   0
 #endif
 
+/**
+ * LWIP_TCPIP_RTC==1: run the stack to completion in the thread of the netif
+ * driver instead of tcpip_thread. No thread is started, the driver calls
+ * tcpip_rtc_poll() in its loop and feeds its packets to the stack directly.
+ * The other threads post their messages into a lock free single producer
+ * ring of their own. Requires LWIP_TCPIP_CORE_LOCKING and
+ * LWIP_TCPIP_CORE_LOCKING_INPUT to be 0.
+ */
+#if !defined LWIP_TCPIP_RTC || defined __DOXYGEN__
+#define LWIP_TCPIP_RTC                  0
+#endif
+
+/**
+ * TCPIP_RTC_THREADS: the most threads that post to the stack with
+ * LWIP_TCPIP_RTC, each takes a ring on its first post.
+ */
+#if !defined TCPIP_RTC_THREADS || defined __DOXYGEN__
+#define TCPIP_RTC_THREADS               64
+#endif
+
+/**
+ * TCPIP_RTC_RING_SIZE: the messages a thread may have pending with
+ * LWIP_TCPIP_RTC, a power of two.
+ */
+#if !defined TCPIP_RTC_RING_SIZE || defined __DOXYGEN__
+#define TCPIP_RTC_RING_SIZE             1024
+#endif
+
+/**
+ * TCPIP_RTC_BURST: the messages of one thread tcpip_rtc_poll() handles
+ * before it turns to the next thread.
+ */
+#if !defined TCPIP_RTC_BURST || defined __DOXYGEN__
+#define TCPIP_RTC_BURST                 32
+#endif
+
 /**
  * SYS_LIGHTWEIGHT_PROT==1: enable inter-task protection (and task-vs-interrupt
  * protection) for certain critical regions during buffer allocation, deallocation
@@ -297,6 +333,13 @@
 #define MEM_SIZE                        1600
 #endif
 
+/**
+ * LWIP_NETML==1: the NETML data path of tcp_write_netml and the switch.
+ */
+#if !defined LWIP_NETML || defined __DOXYGEN__
+#define LWIP_NETML                      0
+#endif
+
 #if LWIP_NETML
 /**
  * MEMP_NUM_TCP_INTERNAL_ID: the number of simultaneously workers connected to this PS.
@@ -2362,6 +2405,15 @@
 #if !defined LWIP_CHECKSUM_ON_COPY || defined __DOXYGEN__
 #define LWIP_CHECKSUM_ON_COPY           0
 #endif
+
+/**
+ * LWIP_CHKSUM_SIMD==1: Use the SSE2/AVX2 routines of inet_chksum_simd.c
+ * for LWIP_CHKSUM and LWIP_CHKSUM_COPY, the best one the CPU supports is
+ * picked at startup. Other CPUs fall back to lwip_standard_chksum.
+ */
+#if !defined LWIP_CHKSUM_SIMD || defined __DOXYGEN__
+#define LWIP_CHKSUM_SIMD                0
+#endif
 /**
  * @}
  */
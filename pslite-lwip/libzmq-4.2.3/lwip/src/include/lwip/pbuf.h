@@ -181,6 +181,9 @@ typedef enum {
 #define PBUF_FLAG_LLMCAST   0x10U
 /** indicates this pbuf includes a TCP FIN flag */
 #define PBUF_FLAG_TCP_FIN   0x20U
+/** indicates the header cache of tcp_write_netml holds a reference to this
+    pbuf besides its segment */
+#define PBUF_FLAG_NETML_HDR 0x40U
 
 /** Main packet buffer struct */
 struct pbuf {
@@ -80,6 +80,11 @@ struct lwip_sock {
   u16_t errevent;
   /** counter of how many threads are waiting for this socket using select */
   SELWAIT_T select_waiting;
+#if LWIP_NETML
+  /** called by event_callback() when the socket may have become ready */
+  lwip_ready_fn ready_cb;
+  void *ready_arg;
+#endif
 #endif /* LWIP_SOCKET_SELECT || LWIP_SOCKET_POLL */
 #if LWIP_NETCONN_FULLDUPLEX
   /* counter of how many threads are using a struct lwip_sock (not the 'int') */
@@ -83,6 +83,40 @@ err_t			 tcp_send_empty_ack_netml (struct tcp_pcb *pcb,
 									struct tcp_internal_id *tmpworker,
 									u8_t is_agg);
 void			 tcp_rexmit_data (struct tcp_pcb *pcb, struct tcp_seg *seg);
+u8_t			 tcp_netml_seg_busy (const struct tcp_seg *seg);
+/* gives back the pbufs the driver is done with, for tcp_netml_seg_busy() */
+typedef void (*tcp_netml_reclaim_fn)(void);
+void			 tcp_netml_set_reclaim (tcp_netml_reclaim_fn reclaim);
+void			 tcp_ack_index_add (struct tcp_pcb *pcb, struct tcp_seg *seg);
+void			 tcp_ack_index_remove (struct tcp_pcb *pcb, struct tcp_seg *seg);
+struct tcp_seg	*tcp_ack_index_find (struct tcp_pcb *pcb, u32_t ackno);
+void			 tcp_ack_index_clear (struct tcp_pcb *pcb);
+struct tcp_internal_id *tcp_netml_peer (struct tcp_pcb *pcb, u16_t id);
+void			 tcp_netml_peers_free (struct tcp_pcb *pcb);
+#if TCP_QUEUE_OOSEQ
+err_t			 tcp_reorder_insert (struct tcp_internal_id *ic, struct pbuf *p,
+									u32_t tunl, u8_t agg);
+struct pbuf		*tcp_reorder_drain (struct tcp_internal_id *ic, struct pbuf *data);
+void			 tcp_reorder_free (struct tcp_internal_id *ic);
+#endif /* TCP_QUEUE_OOSEQ */
+void			 tcp_netml_sack (struct tcp_internal_id *ic, struct netml_sack *sack);
+void			 tcp_netml_ack_delay (struct tcp_pcb *pcb, struct tcp_internal_id *ic, u8_t ce);
+void			 tcp_netml_ack_flush (struct tcp_pcb *pcb);
+void			 tcp_netml_ack_flush_all (void *arg);
+void			 tcp_netml_rto_arm (struct tcp_pcb *pcb, struct tcp_seg *seg);
+void			 tcp_netml_rtt (struct tcp_pcb *pcb, struct tcp_seg *seg);
+void			 tcp_netml_rto (void *arg);
+u8_t			 tcp_netml_cc_can_send (struct tcp_pcb *pcb, struct tcp_seg *seg, u32_t pass);
+void			 tcp_netml_cc_sent (struct tcp_pcb *pcb, struct tcp_seg *seg);
+void			 tcp_netml_cc_left (struct tcp_pcb *pcb, struct tcp_seg *seg);
+void			 tcp_netml_cc_acked (struct tcp_internal_id *ic, u32_t acked, u32_t ce);
+void			 tcp_netml_cc_lost (struct tcp_internal_id *ic);
+
+/* Forget the cached tail of pcb->unsent, to be done whenever unsent is
+   relinked elsewhere than in tcp_write_netml */
+#define TCP_UNSENT_TAIL_RESET(pcb)	((pcb)->unsent_tail = NULL)
+#else
+#define TCP_UNSENT_TAIL_RESET(pcb)
 
 //#define NETML_MAX_SEQ_TBLS	5
 //extern void *seq_tbls[NETML_MAX_SEQ_TBLS];
@@ -293,6 +327,15 @@ struct tcp_seg {
   struct tcp_seg *prev;
   struct internal_hdr *inthdr;
   u8_t hasresent;
+  /* on pcb->unacked rather than pcb->unsent */
+  u8_t on_unacked;
+  /* in pcb->ack_index, hashed by the ackno acknowledging it */
+  u8_t indexed;
+  struct hmap_node ack_node;
+  /* p is from pcb->hdr_cache, which holds another reference */
+  u8_t hdr_cached;
+  /* netml_tmr_now() when it was last sent */
+  u32_t sent_us;
 #endif
 };
 
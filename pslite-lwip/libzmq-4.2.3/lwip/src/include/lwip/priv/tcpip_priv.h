@@ -159,6 +159,10 @@ struct tcpip_msg {
     } tmo;
 #endif /* LWIP_TCPIP_TIMEOUT && LWIP_TIMERS */
   } msg;
+#if LWIP_TCPIP_RTC
+  /* on the overflow list of the tcpip thread, see tcpip_rtc_post() */
+  struct tcpip_msg *next;
+#endif /* LWIP_TCPIP_RTC */
 };
 
 #ifdef __cplusplus
@@ -592,10 +592,22 @@ int fcntl(int s, int cmd, ...);
 #endif /* LWIP_POSIX_SOCKETS_IO_NAMES */
 #endif /* LWIP_COMPAT_SOCKETS == 2 */
 
-#ifdef LWIP_NETML
+#if LWIP_NETML
 int lwip_setlocalid(int s, int id);
 int lwip_setbypass(int s);
 ssize_t lwip_send_netml(int s, const void *dataptr, size_t size, int flags, int remote_id);
+ssize_t lwip_recv_pbuf(int s, struct pbuf **p);
+
+/* lwip_readystate() bits */
+#define LWIP_READY_IN   0x1
+#define LWIP_READY_OUT  0x2
+#define LWIP_READY_ERR  0x4
+
+/** Called from the lwIP core, with the core locked, when a socket may have
+ * become readable, writable or failed. Must not call back into lwIP. */
+typedef void (*lwip_ready_fn)(int s, void *arg);
+int lwip_readystate(int s);
+int lwip_setreadycb(int s, lwip_ready_fn cb, void *arg);
 #else
 #define lwip_setlocalid(s,id) (0)
 #define lwip_setbypass(s) (0)
@@ -338,12 +338,31 @@ struct tcp_pcb {
 
 #if LWIP_NETML
 
-#define NETML_MAX_NODE	128
-  struct tcp_internal_id internal_conn[NETML_MAX_NODE];
+  /* struct tcp_internal_id of the peers, allocated on their first segment */
+  struct hmap peers;
+  struct tcp_internal_id *last_peer;
 #define NETML_MAX_SEQ_NUM	1000000
   struct rte_hash *seq_history;
   u64_t last_tsc;
   u8_t is_init_netml;
+  /* NETML data segments on unsent and unacked, by the ackno acking them */
+  struct hmap ack_index;
+  /* the unacked segments below it were retransmitted for a gap already */
+  u32_t gap_rexmit_seq;
+  /* last segment on unsent for tcp_write_netml, NULL if not known */
+  struct tcp_seg *unsent_tail;
+#define NETML_HDR_CACHE	256
+  /* header pbufs of data segments, reused once the cache holds the only
+     reference to them. The first hdr_used slots are filled, one is added
+     only when the oldest is still in flight, so that an idle pcb does not
+     hold more pbufs than it had in flight. */
+  struct tcp_hdr_cache hdr_cache[NETML_HDR_CACHE];
+  u16_t hdr_next;
+  u16_t hdr_used;
+  /* number of peers with coalesced ACKs pending */
+  u16_t netml_acks;
+  /* congestion controller of the data segments to the peers */
+  const struct netml_cc_ops *netml_cc;
 #endif
 
   tcpwnd_size_t bytes_acked;
@@ -100,6 +100,14 @@ err_t  tcpip_timeout(u32_t msecs, sys_timeout_handler h, void *arg);
 err_t  tcpip_untimeout(sys_timeout_handler h, void *arg);
 #endif /* LWIP_TCPIP_TIMEOUT && LWIP_TIMERS */
 
+#if LWIP_TCPIP_RTC
+typedef void (*tcpip_rtc_wakeup_fn)(void);
+
+u32_t  tcpip_rtc_poll(void);
+u8_t   tcpip_rtc_pending(void);
+void   tcpip_rtc_set_wakeup(tcpip_rtc_wakeup_fn wakeup);
+#endif /* LWIP_TCPIP_RTC */
+
 #ifdef TCPIP_THREAD_TEST
 int tcpip_thread_poll_one(void);
 #endif
@@ -0,0 +1,94 @@
+#ifndef SPSC_H
+#define SPSC_H 1
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+
+/* A lock free ring of pointers between one producer thread and one
+ * consumer thread. The producer only writes 'tail' and the consumer only
+ * writes 'head', each keeps a cached copy of the other index on its own
+ * cache line so that the shared lines are read only when the cached copy
+ * says the ring is full or empty. */
+
+#define SPSC_CACHE_LINE 64
+
+struct spsc_ring {
+    /* Consumer side. */
+    size_t head;                /* Next slot to dequeue. */
+    size_t tail_cache;          /* Last 'tail' seen by the consumer. */
+    char pad0[SPSC_CACHE_LINE - 2 * sizeof(size_t)];
+
+    /* Producer side. */
+    size_t tail;                /* Next slot to enqueue. */
+    size_t head_cache;          /* Last 'head' seen by the producer. */
+    char pad1[SPSC_CACHE_LINE - 2 * sizeof(size_t)];
+
+    size_t mask;                /* Number of slots minus one. */
+    void *slot[];
+};
+
+/* Creates a ring of 'size' slots, a power of two. Returns NULL if out of
+ * memory. */
+static inline struct spsc_ring *spsc_ring_create(size_t size)
+{
+    struct spsc_ring *r;
+
+    if (size == 0 || (size & (size - 1)) != 0) {
+        return NULL;
+    }
+    if (posix_memalign((void **) &r, SPSC_CACHE_LINE,
+                       sizeof *r + size * sizeof r->slot[0]) != 0) {
+        return NULL;
+    }
+    r->head = r->tail_cache = 0;
+    r->tail = r->head_cache = 0;
+    r->mask = size - 1;
+    return r;
+}
+
+static inline void spsc_ring_destroy(struct spsc_ring *r)
+{
+    free(r);
+}
+
+/* Producer only. Returns false if the ring is full. */
+static inline bool spsc_ring_enqueue(struct spsc_ring *r, void *p)
+{
+    size_t tail = r->tail;
+
+    if (tail - r->head_cache > r->mask) {
+        r->head_cache = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+        if (tail - r->head_cache > r->mask) {
+            return false;
+        }
+    }
+    r->slot[tail & r->mask] = p;
+    __atomic_store_n(&r->tail, tail + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+/* Consumer only. Returns true if the ring is empty, without dequeuing. */
+static inline bool spsc_ring_empty(struct spsc_ring *r)
+{
+    return r->head == __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+}
+
+/* Consumer only. Returns NULL if the ring is empty. */
+static inline void *spsc_ring_dequeue(struct spsc_ring *r)
+{
+    size_t head = r->head;
+    void *p;
+
+    if (head == r->tail_cache) {
+        r->tail_cache = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+        if (head == r->tail_cache) {
+            return NULL;
+        }
+    }
+    p = r->slot[head & r->mask];
+    __atomic_store_n(&r->head, head + 1, __ATOMIC_RELEASE);
+    return p;
+}
+
+#endif /* spsc.h */
@@ -0,0 +1,16 @@
+#ifndef LWIP_PACKETIF_H
+#define LWIP_PACKETIF_H
+
+#include "lwip/netif.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+int init_packetif(const char *ifname);
+err_t packetif_device_init(struct netif*);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -14,6 +14,9 @@
 #include <signal.h>
 #include <stdbool.h>
 #include <sys/prctl.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
 
 
 #include "lwip/opt.h"
@@ -26,6 +29,11 @@
 #include "lwip/pbuf.h"
 #include "lwip/sys.h"
 #include "lwip/timeouts.h"
+#include "lwip/tcpip.h"
+#include "lwip/netml_tmr.h"
+#include "lwip/inet_chksum.h"
+#include "lwip/prot/ip4.h"
+#include "lwip/prot/tcp.h"
 #include "netif/etharp.h"
 #include "lwip/ethip6.h"
 #include "netif/dpdkif.h"
@@ -51,14 +59,58 @@
 #include <rte_ethdev.h>
 #include <rte_mempool.h>
 #include <rte_mbuf.h>
+#include <rte_memzone.h>
+#include <rte_version.h>
 
 #define RTE_LOGTYPE_L2FWD RTE_LOGTYPE_USER1
 
-#define NB_MBUF   4096
+#define NB_MBUF   8192
 
 #define MAX_PKT_BURST 32
+/* RX/TX queue pairs of port 0 at most, RSS spreads the flows over them */
+#define DPDK_MAX_QUEUES 8
+#define DPDK_NO_QUEUE UINT16_MAX
 #define MEMPOOL_CACHE_SIZE 128
 
+/* lwIP references the received frames in their mbufs instead of copying
+   them to PBUF_POOL pbufs */
+#ifndef DPDK_RX_ZEROCOPY
+#define DPDK_RX_ZEROCOPY 1
+#endif
+
+/* print the RX rate and the cycles per received frame of the lcore every
+   second */
+#ifndef DPDK_STATS
+#define DPDK_STATS 0
+#endif
+
+/* the payload of the TCP segments is sent in place, from mbufs of their own
+   pointing at it: in the lwIP heap, a memzone, or the NETML data the
+   application wrote from DPDK memory */
+#ifndef DPDK_TX_ZEROCOPY
+#define DPDK_TX_ZEROCOPY 1
+#endif
+/* the least bytes worth an mbuf of their own instead of a copy */
+#define DPDK_TX_ZC_MIN 256
+/* segments of a frame, most NICs take 8 */
+#define DPDK_TX_MAX_SEGS 8
+/* rounds of rte_eth_tx_burst for the frames a full TX ring refused before
+   they are dropped */
+#define DPDK_TX_RETRIES 4
+
+/* Idle polling: an lcore busy polls DPDK_IDLE_SPIN_US after the last
+   frame, then pauses between the polls, twice as long each time up to
+   DPDK_IDLE_PAUSE_MAX pauses. With ZMQ_DPDK_IDLE_US set and RX interrupts,
+   it sleeps on the RX interrupt of its queue after ZMQ_DPDK_IDLE_US. The
+   sleep ends at the next timer, after DPDK_IDLE_MAX_MS at most. Without
+   RX interrupts, or by default, the lcores keep polling with pauses. */
+#ifndef DPDK_IDLE_US
+#define DPDK_IDLE_US 0
+#endif
+#define DPDK_IDLE_SPIN_US 50
+#define DPDK_IDLE_PAUSE_MAX 1024
+#define DPDK_IDLE_MAX_MS 10
+
 struct arg_pass {
 	int coreid;
 	void * args;
@@ -73,15 +125,19 @@ struct arg_pass {
 static uint16_t nb_rxd = RTE_TEST_RX_DESC_DEFAULT;
 static uint16_t nb_txd = RTE_TEST_TX_DESC_DEFAULT;
 
+/* each queue is polled by an lcore of its own, ZMQ_DPDK_QUEUES of them */
+static uint16_t nb_queues = 1;
+static uint16_t lcore_queue[RTE_MAX_LCORE];
+
 
 /* ethernet addresses of ports */
 static struct ether_addr l2fwd_port_eth_addr;
 
-static const struct rte_eth_conf port_conf = {
+static struct rte_eth_conf port_conf = {
 	.rxmode = {
 		.split_hdr_size = 0,
 		.header_split   = 0, /**< Header Split disabled */
-		.hw_ip_checksum = 0, /**< IP checksum offload disabled */
+		.hw_ip_checksum = 0, /**< IP checksum offload, if the port has it */
 		.hw_vlan_filter = 0, /**< VLAN filtering disabled */
 		.jumbo_frame    = 0, /**< Jumbo Frame Support disabled */
 		.hw_strip_crc   = 1, /**< CRC stripped by hardware */
@@ -96,18 +152,177 @@ struct l2fwd_port_statistics {
 	uint64_t tx;
 	uint64_t rx;
 	uint64_t dropped;
+	uint64_t rx_copied;
+	uint64_t sleeps;
+	uint64_t rx_wakes;	/* sleeps the RX interrupt ended */
+	uint64_t wake_cycles;	/* from those to the first frame in lwIP */
 } __rte_cache_aligned;
-struct l2fwd_port_statistics port_statistics;
+struct l2fwd_port_statistics port_statistics[DPDK_MAX_QUEUES];
 
 struct rte_mempool * l2fwd_pktmbuf_pool = NULL;
 
+/* the frames of dpdk_output go out in bursts, from here */
+static struct rte_eth_dev_tx_buffer *tx_buffer[DPDK_MAX_QUEUES];
+/* the lcore of a queue sleeps, dpdk_output sends at once */
+static volatile int dpdk_asleep[DPDK_MAX_QUEUES];
+
+/* LWIP_RAM_HEAP_POINTER: a memzone the NIC reads from with
+   DPDK_TX_ZEROCOPY, set by init_dpdk before lwIP initializes the heap */
+LWIP_DECLARE_MEMORY_ALIGNED(dpdk_ram_heap_bss, MEM_SIZE + 4096);
+u8_t *dpdk_ram_heap = dpdk_ram_heap_bss;
+
+#if DPDK_TX_ZEROCOPY
+static int tx_zc = 0;
+/* mbufs with no data room, pointed at the payload they send */
+static struct rte_mempool *tx_ext_pool = NULL;
+static rte_iova_t heap_iova;
+static size_t heap_len;
+#endif
+
+/* lwIP leaves the TCP checksums of the port to dpdk_output, which computes
+   them while copying to the mbuf or has the NIC compute them, and the IP
+   checksums to the NIC if it can */
+#define DPDK_CHKSUM	(LWIP_CHECKSUM_CTRL_PER_NETIF && LWIP_CHKSUM_SIMD)
+
+#if DPDK_CHKSUM || DPDK_TX_ZEROCOPY
+/* the IPv4 header of the frame p, NULL for other frames */
+static struct ip_hdr *dpdk_ip_hdr(struct pbuf *p) {
+	struct eth_hdr *eth = (struct eth_hdr *)p->payload;
+	struct ip_hdr *iph = (struct ip_hdr *)((u8_t *)p->payload + SIZEOF_ETH_HDR);
+
+	if (p->len < SIZEOF_ETH_HDR + IP_HLEN || eth->type != PP_HTONS(ETHTYPE_IP) ||
+	    p->len < SIZEOF_ETH_HDR + IPH_HL_BYTES(iph))
+		return NULL;
+	return iph;
+}
+
+/* the TCP header after iph in p, NULL if it is not an unfragmented TCP
+   segment with its header in p */
+static struct tcp_hdr *dpdk_tcp_hdr(struct pbuf *p, struct ip_hdr *iph) {
+	u16_t l4 = SIZEOF_ETH_HDR + IPH_HL_BYTES(iph);
+
+	if (IPH_PROTO(iph) != IP_PROTO_TCP ||
+	    (IPH_OFFSET(iph) & PP_HTONS(IP_OFFMASK | IP_MF)) != 0 ||
+	    p->len < l4 + TCP_HLEN)
+		return NULL;
+	return (struct tcp_hdr *)((u8_t *)p->payload + l4);
+}
+#endif
+
+#if DPDK_CHKSUM
+/* checksum offloads of the port */
+static uint8_t tx_ol_ip = 0, tx_ol_tcp = 0, rx_ol_ip = 0;
+
+/* copy len bytes from src to dst, pos bytes into the TCP segment, and
+   return the sum of those in the segment */
+static u32_t dpdk_copy_chksum(u8_t *dst, const u8_t *src, u16_t len, int pos) {
+	u16_t sum;
+
+	if (pos < 0) {
+		rte_memcpy(dst, src, -pos);
+		dst -= pos;
+		src -= pos;
+		len += pos;
+		pos = 0;
+	}
+	sum = LWIP_CHKSUM_COPY(dst, src, len);
+	/* a sum from an odd position has its bytes swapped */
+	return (pos & 1) ? SWAP_BYTES_IN_WORD(sum) : sum;
+}
+
+#if DPDK_TX_ZEROCOPY
+/* the sum of the len bytes at data, pos bytes into the TCP segment */
+static u32_t dpdk_chksum_at(const void *data, u16_t len, int pos) {
+	u16_t sum = LWIP_CHKSUM(data, len);
+
+	return (pos & 1) ? SWAP_BYTES_IN_WORD(sum) : sum;
+}
+#endif
+
+/* finish the checksums of m, acc is the sum of its TCP segment if tcp */
+static void dpdk_tx_chksum(struct rte_mbuf *m, u16_t l3_len, int tcp, u32_t acc) {
+	struct ip_hdr *iph = rte_pktmbuf_mtod_offset(m, struct ip_hdr *, SIZEOF_ETH_HDR);
+	struct tcp_hdr *tcph = (struct tcp_hdr *)((u8_t *)iph + l3_len);
+
+	if (tx_ol_ip || (tcp && tx_ol_tcp)) {
+		m->l2_len = SIZEOF_ETH_HDR;
+		m->l3_len = l3_len;
+		m->ol_flags |= PKT_TX_IPV4;
+	}
+	if (tx_ol_ip)
+		m->ol_flags |= PKT_TX_IP_CKSUM;
+	if (!tcp)
+		return;
+
+	/* the pseudo header */
+	acc += (iph->src.addr & 0xffff) + (iph->src.addr >> 16);
+	acc += (iph->dest.addr & 0xffff) + (iph->dest.addr >> 16);
+	acc += PP_HTONS(IP_PROTO_TCP) + lwip_htons(lwip_ntohs(IPH_LEN(iph)) - l3_len);
+	acc = FOLD_U32T(acc);
+	acc = FOLD_U32T(acc);
+	if (tx_ol_tcp) {
+		/* the NIC adds the segment to the pseudo header sum */
+		m->ol_flags |= PKT_TX_TCP_CKSUM;
+		tcph->chksum = (u16_t)acc;
+	} else {
+		tcph->chksum = (u16_t)~acc;
+	}
+}
+#endif /* DPDK_CHKSUM */
+
 
-//dpdk receive function, receive from mbuf and call tcpip_input to send to protocol stack
-static void dpdk_input(struct rte_mbuf* m, struct netif* netif) {
+#if DPDK_RX_ZEROCOPY
+/* The pbuf_custom of a received frame lives in the private area of its
+   mbuf, right after the struct rte_mbuf */
+#define DPDK_MBUF_PRIV_SIZE \
+	RTE_ALIGN(sizeof(struct pbuf_custom), RTE_MBUF_PRIV_ALIGN)
+
+/* lwIP keeps the frames it references as long as they are on ooseq or
+   unread on a socket. Below this many free mbufs the frames are copied, so
+   that the RX ring and dpdk_output always get mbufs. */
+#define DPDK_RX_COPY_WATERMARK	(nb_queues * (nb_rxd + nb_txd + 2 * MAX_PKT_BURST))
+
+/* lwIP gave up the last reference to the frame, from any thread: the
+   mempool is multi-producer */
+static void dpdk_rx_pbuf_free(struct pbuf *p) {
+	rte_pktmbuf_free((struct rte_mbuf *)(void *)p - 1);
+}
+#endif
+
+//dpdk receive function, receive from mbuf and call input to send to protocol stack
+static void dpdk_input(struct rte_mbuf* m, struct netif* netif, uint16_t queue,
+		int copy, netif_input_fn input) {
 	
 	struct pbuf *p;
 	uint16_t len;
 	len = rte_pktmbuf_pkt_len(m);
+
+#if DPDK_CHKSUM
+	/* lwIP does not check the IP checksums the NIC does */
+	if (rx_ol_ip && (m->ol_flags & PKT_RX_IP_CKSUM_MASK) == PKT_RX_IP_CKSUM_BAD) {
+		rte_pktmbuf_free(m);
+		return;
+	}
+#endif
+
+#if DPDK_RX_ZEROCOPY
+	if (!copy && m->nb_segs == 1) {
+		struct pbuf_custom *pc = (struct pbuf_custom *)(m + 1);
+
+		pc->custom_free_function = dpdk_rx_pbuf_free;
+		p = pbuf_alloced_custom(PBUF_RAW, len, PBUF_REF, pc,
+					rte_pktmbuf_mtod(m, void *), rte_pktmbuf_data_len(m));
+		if (input(p, netif) != ERR_OK) {
+			LWIP_DEBUGF(NETIF_DEBUG, ("dpdk_input: input error\n"));
+			/* frees m */
+			pbuf_free(p);
+		}
+		return;
+	}
+	port_statistics[queue].rx_copied++;
+#else
+	LWIP_UNUSED_ARG(copy);
+#endif
 	p = pbuf_alloc(PBUF_RAW, len, PBUF_POOL);
 
 //	fprintf(stdout, "[%s][%d]: dpdk recv %u-byte packet\n",
@@ -116,7 +331,7 @@ static void dpdk_input(struct rte_mbuf* m, struct netif* netif) {
 		/*assuming 2048 bytes is enough for independent data packets*/
 		//p->payload = rte_pktmbuf_mtod(m, void *);	
 		pbuf_take(p, rte_pktmbuf_mtod(m, void *), len);
-		if(netif->input(p, netif) != ERR_OK) {
+		if(input(p, netif) != ERR_OK) {
 			LWIP_DEBUGF(NETIF_DEBUG, ("dpdk_input: input error\n"));
 			pbuf_free(p);
 			fprintf(stdout, "[%s][%d]: failed to handle input packet, len %u\n",
@@ -132,60 +347,614 @@ static void dpdk_input(struct rte_mbuf* m, struct netif* netif) {
 
 }
 
+/* the TX queue of the calling thread: the one of its lcore, queue 0 for
+   the application threads */
+static inline uint16_t dpdk_tx_queue(void) {
+	unsigned lcore = rte_lcore_id();
+
+	if (lcore < RTE_MAX_LCORE && lcore_queue[lcore] != DPDK_NO_QUEUE)
+		return lcore_queue[lcore];
+	return 0;
+}
+
+/* the frames a full TX ring left in the tx_buffer of the queue userdata,
+   retried before they are dropped */
+static void dpdk_tx_unsent(struct rte_mbuf **unsent, uint16_t count, void *userdata) {
+	uint16_t queue = (uint16_t)(uintptr_t)userdata;
+	uint16_t sent = 0, n;
+	int retry = 0;
+
+	while (sent < count && retry < DPDK_TX_RETRIES) {
+		n = rte_eth_tx_burst(0, queue, unsent + sent, count - sent);
+		if (n == 0) {
+			retry++;
+			rte_pause();
+		}
+		sent += n;
+	}
+	port_statistics[queue].tx += sent;
+	port_statistics[queue].dropped += count - sent;
+	for (; sent < count; sent++)
+		rte_pktmbuf_free(unsent[sent]);
+}
+
+/* send what dpdk_output buffered for the queue arg, in the tcpip thread or
+   holding its lock */
+static void dpdk_tx_flush(void *arg) {
+	uint16_t queue = (uint16_t)(uintptr_t)arg;
+
+	port_statistics[queue].tx += rte_eth_tx_buffer_flush(0, queue, tx_buffer[queue]);
+}
+
+#if DPDK_TX_ZEROCOPY
+/* The mbufs of tx_ext_pool point at the memory of a pbuf, kept in their
+   private area. External buffers need DPDK 18.05, so the pool has no cache
+   and its ops give the pbuf back as the mbuf returns to it, once the NIC
+   is done with it, in the thread that sends, or drops, as dpdk_output
+   does. */
+#define DPDK_TX_EXT_PRIV_SIZE \
+	RTE_ALIGN(sizeof(struct pbuf *), RTE_MBUF_PRIV_ALIGN)
+#define DPDK_TX_EXT_OPS "lwip_tx_ext"
+
+/* the ops that keep the mbufs of tx_ext_pool */
+static const struct rte_mempool_ops *tx_ext_ring_ops;
+
+static int dpdk_tx_ext_alloc(struct rte_mempool *mp) {
+	return tx_ext_ring_ops->alloc(mp);
+}
+
+static void dpdk_tx_ext_free(struct rte_mempool *mp) {
+	tx_ext_ring_ops->free(mp);
+}
+
+static int dpdk_tx_ext_enqueue(struct rte_mempool *mp, void * const *obj_table,
+		unsigned int n) {
+	unsigned int i;
+
+	/* populating the pool, the private areas are not set yet */
+	for (i = 0; mp == tx_ext_pool && i < n; i++) {
+		struct pbuf **q = (struct pbuf **)((struct rte_mbuf *)obj_table[i] + 1);
+
+		if (*q != NULL) {
+			pbuf_free(*q);
+			*q = NULL;
+		}
+	}
+	return tx_ext_ring_ops->enqueue(mp, obj_table, n);
+}
+
+static int dpdk_tx_ext_dequeue(struct rte_mempool *mp, void **obj_table,
+		unsigned int n) {
+	return tx_ext_ring_ops->dequeue(mp, obj_table, n);
+}
+
+static unsigned dpdk_tx_ext_get_count(const struct rte_mempool *mp) {
+	return tx_ext_ring_ops->get_count(mp);
+}
+
+static const struct rte_mempool_ops tx_ext_ops = {
+	.name = DPDK_TX_EXT_OPS,
+	.alloc = dpdk_tx_ext_alloc,
+	.free = dpdk_tx_ext_free,
+	.enqueue = dpdk_tx_ext_enqueue,
+	.dequeue = dpdk_tx_ext_dequeue,
+	.get_count = dpdk_tx_ext_get_count,
+};
+
+MEMPOOL_REGISTER_OPS(tx_ext_ops);
+
+/* tx_ext_pool as rte_pktmbuf_pool_create makes a pool, on the ring ops
+   any thread may put to */
+static struct rte_mempool *dpdk_tx_ext_pool_create(void) {
+	struct rte_pktmbuf_pool_private priv;
+	struct rte_mempool *mp;
+	unsigned i;
+
+	for (i = 0; i < rte_mempool_ops_table.num_ops; i++) {
+		if (strcmp(rte_mempool_ops_table.ops[i].name, "ring_mp_mc") == 0)
+			tx_ext_ring_ops = &rte_mempool_ops_table.ops[i];
+	}
+	if (tx_ext_ring_ops == NULL)
+		return NULL;
+	mp = rte_mempool_create_empty("ext_mbuf_pool", NB_MBUF,
+		sizeof(struct rte_mbuf) + DPDK_TX_EXT_PRIV_SIZE, 0,
+		sizeof(priv), rte_socket_id(), 0);
+	if (mp == NULL)
+		return NULL;
+	memset(&priv, 0, sizeof(priv));
+	priv.mbuf_priv_size = DPDK_TX_EXT_PRIV_SIZE;
+	if (rte_mempool_set_ops_byname(mp, DPDK_TX_EXT_OPS, NULL) != 0)
+		goto fail;
+	rte_pktmbuf_pool_init(mp, &priv);
+	if (rte_mempool_populate_default(mp) < 0)
+		goto fail;
+	/* clears the private areas too */
+	rte_mempool_obj_iter(mp, rte_pktmbuf_init, NULL);
+	return mp;
+
+fail:
+	rte_mempool_free(mp);
+	return NULL;
+}
+
+/* the IOVA of the len bytes at data if the NIC can read them in one piece,
+   in the lwIP heap or other DPDK memory, RTE_BAD_IOVA otherwise */
+static rte_iova_t dpdk_tx_iova(const u8_t *data, u16_t len) {
+	const struct rte_memseg *ms;
+
+	if (data >= dpdk_ram_heap && data + len <= dpdk_ram_heap + heap_len)
+		return heap_iova + (data - dpdk_ram_heap);
+#if RTE_VERSION >= RTE_VERSION_NUM(18, 5, 0, 0)
+	ms = rte_mem_virt2memseg(data, NULL);
+	if (ms != NULL && ms->iova != RTE_BAD_IOVA &&
+	    data + len <= (const u8_t *)ms->addr + ms->len)
+		return ms->iova + (data - (const u8_t *)ms->addr);
+#else
+	unsigned i;
+
+	/* the segments are IOVA contiguous */
+	ms = rte_eal_get_physmem_layout();
+	for (i = 0; i < RTE_MAX_MEMSEG && ms[i].addr != NULL; i++) {
+		if (data >= (const u8_t *)ms[i].addr &&
+		    data + len <= (const u8_t *)ms[i].addr + ms[i].len)
+			return ms[i].iova + (data - (const u8_t *)ms[i].addr);
+	}
+#endif
+	return RTE_BAD_IOVA;
+}
+
+/* the len bytes of q at data, at iova for the NIC, in an mbuf of their
+   own, q referenced until the NIC is done with them */
+static struct rte_mbuf *dpdk_tx_attach(struct pbuf *q, u8_t *data,
+		rte_iova_t iova, u16_t len) {
+	struct rte_mbuf *e = rte_pktmbuf_alloc(tx_ext_pool);
+
+	if (e == NULL)
+		return NULL;
+	*(struct pbuf **)(e + 1) = q;
+	pbuf_ref(q);
+	e->buf_addr = data;
+	e->buf_iova = iova;
+	e->buf_len = len;
+	e->data_off = 0;
+	e->data_len = len;
+	return e;
+}
+
+/* the bytes of q to copy, the headers of the frame and small pbufs or those
+   the NIC cannot read, the rest of q is attached from *iova */
+static u16_t dpdk_tx_copy_len(struct pbuf *q, u16_t hdr, rte_iova_t *iova) {
+	if (!tx_zc || hdr + DPDK_TX_ZC_MIN > q->len)
+		return q->len;
+	*iova = dpdk_tx_iova((const u8_t *)q->payload + hdr, q->len - hdr);
+	return *iova != RTE_BAD_IOVA ? hdr : q->len;
+}
+
+#if LWIP_NETML
+/* for tcp_netml_seg_busy(): the mbufs the NIC has sent go back to their
+   pools, those of tx_ext_pool with the pbufs of the segments */
+static void dpdk_tx_reclaim(void) {
+#if LWIP_TCPIP_RTC
+	/* the stack sends on the queue of its lcore only */
+	rte_eth_tx_done_cleanup(0, dpdk_tx_queue(), 0);
+#else
+	uint16_t queue;
+
+	/* the queues send holding the core lock or in the tcpip thread */
+	for (queue = 0; queue < nb_queues; queue++)
+		rte_eth_tx_done_cleanup(0, queue, 0);
+#endif
+}
+#endif
+#endif /* DPDK_TX_ZEROCOPY */
+
+/* Queue p on the tx_buffer of the caller, sent when it is full or at the
+   end of the round of its dpdk_thread. The pbufs are copied to the mbuf, with DPDK_TX_ZEROCOPY the
+   TCP payload in the lwIP heap is attached to the segments after it. */
 static err_t dpdk_output(struct netif *netif, struct pbuf *p) {
 	LWIP_UNUSED_ARG(netif);
 
 	struct pbuf *q;
-
-	struct rte_mbuf *m;
-	int sent = 0;
-	m=rte_pktmbuf_alloc(l2fwd_pktmbuf_pool);
-
-	if (p->tot_len > rte_pktmbuf_tailroom(m)) {
-       perror("tapif: packet too large");
-       return ERR_IF;
-  	}
+	struct rte_mbuf *m, *tail;
+	uint16_t queue = dpdk_tx_queue();
+	u32_t offset = 0;
+	u16_t len;
+
+	m = rte_pktmbuf_alloc(l2fwd_pktmbuf_pool);
+	if (m == NULL) {
+		port_statistics[queue].dropped++;
+		return ERR_MEM;
+	}
+	tail = m;
 //	fprintf(stdout, "[%s][%d]: %u bytes to send\n",
 //					__FILE__, __LINE__, p->tot_len);
 
-	u64_t offset=0;
-	  //assuming only one packet in pbuf *p, if there is something wrong, change here.
-	for(q = p; q != NULL; q = q->next) {
-	    rte_memcpy(rte_pktmbuf_mtod_offset(m, void *,offset),
-		   	(void *)q->payload,q->len);
-      	m->pkt_len+=q->len;
-      	m->data_len+=q->len;
-      	offset+=q->len;
-    }
+#if DPDK_CHKSUM || DPDK_TX_ZEROCOPY
+	struct ip_hdr *iph = dpdk_ip_hdr(p);
+	struct tcp_hdr *tcph = iph != NULL ? dpdk_tcp_hdr(p, iph) : NULL;
+	u16_t l4 = iph != NULL ? SIZEOF_ETH_HDR + IPH_HL_BYTES(iph) : 0;
+#endif
+#if DPDK_TX_ZEROCOPY
+	/* the headers are copied, the whole first pbuf unless it is TCP */
+	u16_t hdr = tcph != NULL ? l4 + TCPH_HDRLEN_BYTES(tcph) : p->len;
+#endif
+#if DPDK_CHKSUM
+	/* the TCP checksum is summed while copying from the TCP header on */
+	int sw_tcp = tcph != NULL && !tx_ol_tcp;
+	u32_t acc = 0;
+
+	if (tcph != NULL)
+		tcph->chksum = 0;
+#endif
+	for (q = p; q != NULL; q = q->next) {
+		u8_t *dst;
+#if DPDK_TX_ZEROCOPY
+		rte_iova_t iova = RTE_BAD_IOVA;
+#endif
+
+		len = q->len;
+#if DPDK_TX_ZEROCOPY
+		len = dpdk_tx_copy_len(q, q == p ? hdr : 0, &iova);
+#endif
+		if (len > rte_pktmbuf_tailroom(tail)) {
+			struct rte_mbuf *c;
+
+			/* a segment of its own after an attached one, frames
+			   larger than an mbuf are not sent */
+			if (tail == m || m->nb_segs >= DPDK_TX_MAX_SEGS ||
+			    (c = rte_pktmbuf_alloc(l2fwd_pktmbuf_pool)) == NULL)
+				goto drop;
+			tail->next = c;
+			tail = c;
+			m->nb_segs++;
+			if (len > rte_pktmbuf_tailroom(tail))
+				goto drop;
+		}
+		dst = rte_pktmbuf_mtod_offset(tail, u8_t *, tail->data_len);
+#if DPDK_CHKSUM
+		if (sw_tcp && offset + len > l4)
+			acc += dpdk_copy_chksum(dst, (const u8_t *)q->payload, len, (int)offset - l4);
+		else
+#endif
+		rte_memcpy(dst, q->payload, len);
+		tail->data_len += len;
+		m->pkt_len += len;
+		offset += len;
+
+#if DPDK_TX_ZEROCOPY
+		if (len < q->len) {
+			u8_t *data = (u8_t *)q->payload + len;
+			struct rte_mbuf *e;
+
+			len = q->len - len;
+			if (m->nb_segs >= DPDK_TX_MAX_SEGS ||
+			    (e = dpdk_tx_attach(q, data, iova, len)) == NULL)
+				goto drop;
+#if DPDK_CHKSUM
+			if (sw_tcp)
+				acc += dpdk_chksum_at(data, len, (int)offset - l4);
+#endif
+			tail->next = e;
+			tail = e;
+			m->nb_segs++;
+			m->pkt_len += len;
+			offset += len;
+		}
+#endif
+	}
+
+#if DPDK_CHKSUM
+	if (iph != NULL)
+		dpdk_tx_chksum(m, l4 - SIZEOF_ETH_HDR, tcph != NULL, acc);
+#endif
 
 //	fprintf(stdout, "[%lu][%s][%d]: dpdk send %u-byte packet\n",
 //					pthread_self(), __FILE__, __LINE__, m->pkt_len);
-      
-	/* signal that packet should be sent(); */
-	sent = rte_eth_tx_burst(0, 0, &m, 1);
-    if (sent)
-		port_statistics.tx += sent;
 
+	port_statistics[queue].tx += rte_eth_tx_buffer(0, queue, tx_buffer[queue], m);
+	/* an application thread sends while the lcore sleeps */
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (dpdk_asleep[queue])
+		dpdk_tx_flush((void *)(uintptr_t)queue);
 	return ERR_OK;
+
+drop:
+	/* gives the attached pbufs back too */
+	rte_pktmbuf_free(m);
+	port_statistics[queue].dropped++;
+	return ERR_MEM;
+}
+
+#if LWIP_TCPIP_RTC
+/* set by dpdk_device_init, which runs in the dpdk_thread of queue 0 */
+static struct netif *dpdk_netif = NULL;
+
+/* the input of the other queues, to the tcpip thread on the ring of their
+   lcore */
+static err_t dpdk_input_post(struct pbuf *p, struct netif *netif) {
+	return tcpip_inpkt(p, netif, ethernet_input);
+}
+
+#define DPDK_INPUT_LOCK()
+#define DPDK_INPUT_UNLOCK()
+#else
+#if LWIP_NETML
+static volatile int tmr_posted = 0;
+
+static void dpdk_tmr_poll(void *arg) {
+	tmr_posted = 0;
+	netml_tmr_poll(arg);
+}
+#endif
+#if !LWIP_TCPIP_CORE_LOCKING
+static volatile int flush_posted[DPDK_MAX_QUEUES];
+
+static void dpdk_tx_flush_posted(void *arg) {
+	flush_posted[(uintptr_t)arg] = 0;
+	dpdk_tx_flush(arg);
+}
+#endif
+#if LWIP_TCPIP_CORE_LOCKING_INPUT
+/* a burst is input under one lock, not a lock per frame as tcpip_input */
+#define DPDK_INPUT_LOCK()	LOCK_TCPIP_CORE()
+#define DPDK_INPUT_UNLOCK()	UNLOCK_TCPIP_CORE()
+#else
+#define DPDK_INPUT_LOCK()
+#define DPDK_INPUT_UNLOCK()
+#endif
+#endif
+
+/* the idle polling of an lcore */
+struct dpdk_idle {
+	uint64_t last_rx;	/* rte_rdtsc() of the last frame or message */
+	uint64_t woke;		/* rte_rdtsc() the RX interrupt woke it, or 0 */
+	unsigned pauses;
+	int intr;		/* it sleeps on the RX interrupt of its queue */
+};
+
+static uint64_t idle_spin_cycles, idle_sleep_cycles;
+static int rx_intr = 0;
+/* wake_fd wakes up the lcore of a queue */
+static int wake_fd[DPDK_MAX_QUEUES];
+static struct rte_epoll_event wake_ev[DPDK_MAX_QUEUES];
+
+static void dpdk_wakeup(uint16_t queue) {
+	uint64_t one = 1;
+
+	/* after what the caller posted, against the check in dpdk_sleep */
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (dpdk_asleep[queue] && write(wake_fd[queue], &one, sizeof(one)) < 0)
+		LWIP_DEBUGF(NETIF_DEBUG, ("dpdk_wakeup: %d\n", errno));
+}
+
+#if LWIP_TCPIP_RTC
+/* a thread posted to the tcpip thread, the lcore of queue 0 */
+static void dpdk_rtc_wakeup(void) {
+	dpdk_wakeup(0);
+}
+#endif
+
+static void dpdk_idle_init(struct dpdk_idle *idle, uint16_t queue) {
+	memset(idle, 0, sizeof(*idle));
+	idle->last_rx = rte_rdtsc();
+	if (idle_sleep_cycles == 0)
+		return;
+
+	/* it keeps polling if any of them fails */
+	wake_fd[queue] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	wake_ev[queue].epdata.event = EPOLLIN;
+	idle->intr = rx_intr && wake_fd[queue] >= 0 &&
+		rte_epoll_ctl(RTE_EPOLL_PER_THREAD, EPOLL_CTL_ADD, wake_fd[queue],
+			      &wake_ev[queue]) == 0 &&
+		rte_eth_dev_rx_intr_ctl_q(0, queue, RTE_EPOLL_PER_THREAD,
+					  RTE_INTR_EVENT_ADD, NULL) == 0;
+	if (idle->intr)
+		printf("lcore %u queue %u: sleeps after %u us idle, woken by RX interrupts\n",
+				rte_lcore_id(), queue,
+				(unsigned)(idle_sleep_cycles * 1000000 / rte_get_tsc_hz()));
+	else
+		printf("lcore %u queue %u: no RX interrupts, polls\n", rte_lcore_id(), queue);
+}
+
+/* whether the lcore has work, once it announced its sleep */
+static int dpdk_pending(uint16_t queue) {
+#if LWIP_TCPIP_RTC
+	if (queue == 0 && tcpip_rtc_pending())
+		return 1;
+#endif
+	/* frames from before the interrupt was enabled, unknown for the
+	   PMDs without a count, the timeout bounds their wait */
+	if (rte_eth_rx_queue_count(0, queue) > 0)
+		return 1;
+	return tx_buffer[queue]->length > 0;
+}
+
+/* sleep until a frame, a post, the next timer or DPDK_IDLE_MAX_MS */
+static void dpdk_sleep(struct dpdk_idle *idle, uint16_t queue) {
+	struct rte_epoll_event ev[2];
+	u32_t timeout = DPDK_IDLE_MAX_MS;
+	uint64_t v;
+	int i, n = 0;
+
+#if LWIP_TCPIP_RTC && LWIP_TIMERS
+	if (queue == 0)
+		timeout = LWIP_MIN(timeout, sys_timeouts_sleeptime());
+#endif
+#if LWIP_NETML
+	/* the timers added by other threads meanwhile wait for the timeout */
+	if (queue == 0)
+		timeout = LWIP_MIN(timeout, netml_tmr_sleeptime() / 1000);
+#endif
+	if (timeout == 0)
+		return;
+
+	dpdk_asleep[queue] = 1;
+	rte_eth_dev_rx_intr_enable(0, queue);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (!dpdk_pending(queue))
+		n = rte_epoll_wait(RTE_EPOLL_PER_THREAD, ev, 2, (int)timeout);
+	dpdk_asleep[queue] = 0;
+	rte_eth_dev_rx_intr_disable(0, queue);
+	if (read(wake_fd[queue], &v, sizeof(v)) < 0 && errno != EAGAIN)
+		LWIP_DEBUGF(NETIF_DEBUG, ("dpdk_sleep: %d\n", errno));
+
+	port_statistics[queue].sleeps++;
+	for (i = 0; i < n; i++) {
+		if (ev[i].fd != wake_fd[queue])
+			idle->woke = rte_rdtsc();
+	}
+}
+
+/* after an empty round: keep polling, pause or sleep */
+static void dpdk_idle(struct dpdk_idle *idle, uint16_t queue) {
+	uint64_t idle_cycles = rte_rdtsc() - idle->last_rx;
+	unsigned i;
+
+	if (idle->intr && idle_cycles >= idle_sleep_cycles) {
+		dpdk_sleep(idle, queue);
+		return;
+	}
+	if (idle_cycles < idle_spin_cycles)
+		return;
+	for (i = 0; i < idle->pauses; i++)
+		rte_pause();
+	idle->pauses = LWIP_MIN(2 * idle->pauses + 1, DPDK_IDLE_PAUSE_MAX);
+}
+
+/* a round that had work: back to busy polling */
+static void dpdk_busy(struct dpdk_idle *idle, uint16_t queue) {
+	idle->last_rx = rte_rdtsc();
+	idle->pauses = 0;
+	if (idle->woke != 0) {
+		port_statistics[queue].rx_wakes++;
+		port_statistics[queue].wake_cycles += idle->last_rx - idle->woke;
+		idle->woke = 0;
+	}
 }
 
 static int dpdk_thread(void *arg) {
 	prctl(PR_SET_NAME,"dpdk_thread");
-	RTE_LOG(INFO, L2FWD, "dpdk_thread entering main loop\n");
-	unsigned i, nb_rx, sent;
+	unsigned i, nb_rx;
 	struct rte_mbuf *pkts_burst[MAX_PKT_BURST];
 	struct netif* netif = (struct netif *) arg;
+	uint16_t queue = lcore_queue[rte_lcore_id()];
+	void *flush_arg = (void *)(uintptr_t)queue;
+	netif_input_fn input;
+	struct dpdk_idle idle;
+	int copy = 1;
+	u32_t posted = 0;
+#if DPDK_STATS
+	uint64_t hz = rte_get_timer_hz(), next = rte_rdtsc() + hz;
+	uint64_t start, busy = 0, rx = 0, copied = 0;
+#endif
 //	uint64_t interval = rte_get_timer_hz() / 4, last_ts = 0, ts = 0;
 
+	if (queue == DPDK_NO_QUEUE)
+		return 0;
+	RTE_LOG(INFO, L2FWD, "dpdk_thread entering main loop, queue %u\n", queue);
+	dpdk_idle_init(&idle, queue);
+#if LWIP_TCPIP_RTC
+	input = queue == 0 ? ethernet_input : dpdk_input_post;
+#elif LWIP_TCPIP_CORE_LOCKING_INPUT
+	input = ethernet_input;
+#else
+	input = netif->input;
+#endif
+
 	while (1) {
-		port_statistics.tx += sent;
-		nb_rx = rte_eth_rx_burst(0, 0,
+#if LWIP_TCPIP_RTC
+		/* the lcore of queue 0 is the tcpip thread, it runs what the
+		   application threads and the other lcores posted and the
+		   timeouts between the bursts */
+		if (queue == 0)
+			posted = tcpip_rtc_poll();
+		netif = __atomic_load_n(&dpdk_netif, __ATOMIC_ACQUIRE);
+		if (netif == NULL)
+			continue;
+#endif
+		nb_rx = rte_eth_rx_burst(0, queue,
 					pkts_burst, MAX_PKT_BURST);
-		port_statistics.rx += nb_rx;
-
-		for (i = 0; i < nb_rx; i++) {
-			dpdk_input(pkts_burst[i], netif); 
+		port_statistics[queue].rx += nb_rx;
+
+#if DPDK_RX_ZEROCOPY
+		if (nb_rx > 0)
+			copy = rte_mempool_avail_count(l2fwd_pktmbuf_pool) <= DPDK_RX_COPY_WATERMARK;
+#endif
+#if DPDK_STATS
+		start = rte_rdtsc();
+#endif
+		if (nb_rx > 0) {
+			DPDK_INPUT_LOCK();
+			for (i = 0; i < nb_rx; i++) {
+				dpdk_input(pkts_burst[i], netif, queue, copy, input);
+			}
+#if LWIP_NETML && !LWIP_TCPIP_RTC && LWIP_TCPIP_CORE_LOCKING_INPUT
+			/* acks what the burst brought in one go */
+			tcp_netml_ack_flush_all(NULL);
+#endif
+			DPDK_INPUT_UNLOCK();
+		}
+#if DPDK_STATS
+		if (nb_rx > 0)
+			busy += rte_rdtsc() - start;
+		if (start >= next) {
+			uint64_t n = port_statistics[queue].rx - rx;
+
+			struct l2fwd_port_statistics *st = &port_statistics[queue];
+
+			printf("lcore %u queue %u: rx %" PRIu64 " pkt/s, %" PRIu64 " cycles/pkt, copied %" PRIu64
+					", %" PRIu64 " sleeps, %" PRIu64 " us from RX interrupt to lwIP\n",
+					rte_lcore_id(), queue, n, n > 0 ? busy / n : 0,
+					st->rx_copied - copied, st->sleeps,
+					st->rx_wakes > 0 ? st->wake_cycles * 1000000 / rte_get_tsc_hz() / st->rx_wakes : 0);
+			rx = port_statistics[queue].rx;
+			copied = port_statistics[queue].rx_copied;
+			busy = 0;
+			next = start + hz;
+		}
+#endif
+#if LWIP_TCPIP_RTC && LWIP_NETML
+		/* the frames of the other queues came in with the posted */
+		if (queue == 0 && (nb_rx > 0 || posted > 0))
+			tcp_netml_ack_flush_all(NULL);
+		if (queue == 0 && netml_tmr_due())
+			netml_tmr_poll(NULL);
+#elif LWIP_NETML
+#if !LWIP_TCPIP_CORE_LOCKING_INPUT
+		/* queued behind the burst, acks what it brought in one go */
+		if (nb_rx > 0)
+			tcpip_try_callback(tcp_netml_ack_flush_all, NULL);
+#endif
+		/* the RTO timers are too fine for the lwIP timeouts */
+		if (queue == 0 && !tmr_posted && netml_tmr_due()) {
+			tmr_posted = 1;
+			if (tcpip_try_callback(dpdk_tmr_poll, NULL) != ERR_OK)
+				tmr_posted = 0;
 		}
+#endif
+
+		/* what the round sent, or the application threads since the
+		   last one */
+		if (tx_buffer[queue]->length > 0) {
+#if LWIP_TCPIP_RTC
+			dpdk_tx_flush(flush_arg);
+#elif LWIP_TCPIP_CORE_LOCKING
+			LOCK_TCPIP_CORE();
+			dpdk_tx_flush(flush_arg);
+			UNLOCK_TCPIP_CORE();
+#else
+			if (!flush_posted[queue]) {
+				flush_posted[queue] = 1;
+				if (tcpip_try_callback(dpdk_tx_flush_posted, flush_arg) != ERR_OK)
+					flush_posted[queue] = 0;
+			}
+#endif
+		}
+
+		if (nb_rx > 0 || posted > 0)
+			dpdk_busy(&idle, queue);
+		else
+			dpdk_idle(&idle, queue);
 
 //		ts = rte_rdtsc();
 //		if (ts - last_ts >= interval) {
@@ -210,6 +979,10 @@ err_t dpdk_device_init(struct netif* netif) {
 	netif->mtu = 1500;
 	netif->hwaddr_len = 6;
     netif->flags = NETIF_FLAG_BROADCAST | NETIF_FLAG_ETHARP | NETIF_FLAG_IGMP; /*Not enabling ETHARP on this, so might need to change netif->output */
+#if DPDK_CHKSUM
+	NETIF_SET_CHECKSUM_CTRL(netif, NETIF_CHECKSUM_ENABLE_ALL & ~(NETIF_CHECKSUM_GEN_TCP |
+		(tx_ol_ip ? NETIF_CHECKSUM_GEN_IP : 0) | (rx_ol_ip ? NETIF_CHECKSUM_CHECK_IP : 0)));
+#endif
 
 
 	netif->hwaddr[0]=l2fwd_port_eth_addr.addr_bytes[0];
@@ -227,7 +1000,11 @@ err_t dpdk_device_init(struct netif* netif) {
 					netif->hwaddr[4], netif->hwaddr[5]);
 
 	netif_set_link_up(netif);
+#if LWIP_TCPIP_RTC
+	__atomic_store_n(&dpdk_netif, netif, __ATOMIC_RELEASE);
+#else
 	rte_eal_mp_remote_launch(dpdk_thread, (int *)netif, SKIP_MASTER);
+#endif
 
 	struct arg_pass tmparg;
     tmparg.coreid = 1;
@@ -296,17 +1073,30 @@ init_dpdk(void)
 {
 	struct rte_eth_dev_info dev_info;
 	int ret;
-	uint16_t nb_ports;
-	//unsigned rx_lcore_id;
-
-	/* init EAL */
+	uint16_t nb_ports, queue;
+	unsigned lcore_id;
+
+	/* init EAL, with an lcore per queue besides the master */
+	const char *queues = getenv("ZMQ_DPDK_QUEUES");
+	const char *vdev = getenv("ZMQ_DPDK_VDEV");
+	const char *idle_us = getenv("ZMQ_DPDK_IDLE_US");
+	int nq = queues != NULL ? atoi(queues) : 1;
 	int val = 3;
-	char *str[3];
+	char *str[4];
 	str[0] = "netml";
 	char tmpstr1[] = "-c";
 	str[1] = tmpstr1;
-	char tmpstr2[] = "3";
+	char tmpstr2[16];
+	nq = LWIP_MIN(LWIP_MAX(nq, 1), DPDK_MAX_QUEUES);
+	snprintf(tmpstr2, sizeof(tmpstr2), "%x", (1U << (nq + 1)) - 1);
 	str[2] = tmpstr2;
+	/* a software port instead of the NIC, e.g. net_tap0 for a multi-queue
+	   port on a tap interface */
+	char tmpstr3[256];
+	if (vdev != NULL) {
+		snprintf(tmpstr3, sizeof(tmpstr3), "--vdev=%s", vdev);
+		str[val++] = tmpstr3;
+	}
 	
 	ret = rte_eal_init(val, str);
 	if (ret < 0)
@@ -320,22 +1110,113 @@ init_dpdk(void)
 
 	/* create the mbuf pool */
 	l2fwd_pktmbuf_pool = rte_pktmbuf_pool_create("mbuf_pool", NB_MBUF,
-		MEMPOOL_CACHE_SIZE, 0, RTE_MBUF_DEFAULT_BUF_SIZE,
-		rte_socket_id());
+		MEMPOOL_CACHE_SIZE,
+#if DPDK_RX_ZEROCOPY
+		DPDK_MBUF_PRIV_SIZE,
+#else
+		0,
+#endif
+		RTE_MBUF_DEFAULT_BUF_SIZE, rte_socket_id());
 	if (l2fwd_pktmbuf_pool == NULL)
 		rte_exit(EXIT_FAILURE, "Cannot init mbuf pool\n");
 
+#if DPDK_TX_ZEROCOPY
+	/* lwIP allocates its heap in tcpip_init, after this. The memzones
+	   are IOVA contiguous before DPDK 18.05 */
+	const struct rte_memzone *mz = rte_memzone_reserve("lwip_heap",
+		sizeof(dpdk_ram_heap_bss), rte_socket_id(),
+#ifdef RTE_MEMZONE_IOVA_CONTIG
+		RTE_MEMZONE_IOVA_CONTIG
+#else
+		0
+#endif
+		);
+	if (mz != NULL) {
+		dpdk_ram_heap = (u8_t *)mz->addr;
+		heap_iova = mz->iova;
+		heap_len = mz->len;
+	}
+	tx_ext_pool = dpdk_tx_ext_pool_create();
+	if (tx_ext_pool == NULL)
+		rte_exit(EXIT_FAILURE, "Cannot init external mbuf pool\n");
+#endif
+
 	/*
-	 * Each logical core is assigned a dedicated TX queue on each port.
+	 * Each logical core is assigned a dedicated RX and TX queue on port 0.
 	 */
 	rte_eth_dev_info_get(0, &dev_info);
 
-	printf("lcore 1: RX port 0 \n");
+	nb_queues = LWIP_MIN(LWIP_MIN(dev_info.max_rx_queues, dev_info.max_tx_queues),
+			     rte_lcore_count() - 1);
+	nb_queues = LWIP_MIN(nb_queues, DPDK_MAX_QUEUES);
+
+	idle_sleep_cycles = (idle_us != NULL ? strtoull(idle_us, NULL, 10) : DPDK_IDLE_US) *
+		rte_get_tsc_hz() / 1000000;
+	idle_spin_cycles = DPDK_IDLE_SPIN_US * rte_get_tsc_hz() / 1000000;
+	/* the lcores sleep on them when idle */
+	port_conf.intr_conf.rxq = idle_sleep_cycles > 0;
+	if (nb_queues == 0)
+		rte_exit(EXIT_FAILURE, "No lcore to poll port 0 - bye\n");
+	for (lcore_id = 0; lcore_id < RTE_MAX_LCORE; lcore_id++)
+		lcore_queue[lcore_id] = DPDK_NO_QUEUE;
+	queue = 0;
+	RTE_LCORE_FOREACH_SLAVE(lcore_id) {
+		if (queue < nb_queues)
+			lcore_queue[lcore_id] = queue++;
+	}
+	if (nb_queues > 1) {
+		/* the flows, and so the zmq connections, stick to a queue */
+		port_conf.rxmode.mq_mode = ETH_MQ_RX_RSS;
+		port_conf.rx_adv_conf.rss_conf.rss_key = NULL;
+		port_conf.rx_adv_conf.rss_conf.rss_hf =
+			(ETH_RSS_IP | ETH_RSS_TCP) & dev_info.flow_type_rss_offloads;
+	}
+
+#if DPDK_CHKSUM
+	tx_ol_ip = (dev_info.tx_offload_capa & DEV_TX_OFFLOAD_IPV4_CKSUM) != 0;
+	tx_ol_tcp = (dev_info.tx_offload_capa & DEV_TX_OFFLOAD_TCP_CKSUM) != 0;
+	rx_ol_ip = (dev_info.rx_offload_capa & DEV_RX_OFFLOAD_IPV4_CKSUM) != 0;
+	port_conf.rxmode.hw_ip_checksum = rx_ol_ip;
+	/* the full TX path, the simple one has no checksum offloads */
+	if (tx_ol_ip || tx_ol_tcp)
+		dev_info.default_txconf.txq_flags &= ~ETH_TXQ_FLAGS_NOXSUMTCP;
+	printf("checksum offload: tx ip %u tcp %u, rx ip %u, software %s\n",
+			tx_ol_ip, tx_ol_tcp, rx_ol_ip, lwip_simd_chksum_name());
+#endif
+
+#if DPDK_TX_ZEROCOPY
+	/* the payload goes in segments of its own */
+	tx_zc = (dev_info.tx_offload_capa & DEV_TX_OFFLOAD_MULTI_SEGS) != 0;
+	if (tx_zc) {
+		/* the attached mbufs come from tx_ext_pool */
+		dev_info.default_txconf.txq_flags &= ~(ETH_TXQ_FLAGS_NOMULTSEGS |
+			ETH_TXQ_FLAGS_NOMULTMEMP | ETH_TXQ_FLAGS_NOREFCOUNT);
+		dev_info.default_txconf.offloads &= ~DEV_TX_OFFLOAD_MBUF_FAST_FREE;
+		dev_info.default_txconf.offloads |= DEV_TX_OFFLOAD_MULTI_SEGS;
+		port_conf.txmode.offloads |= DEV_TX_OFFLOAD_MULTI_SEGS;
+#if LWIP_NETML
+		tcp_netml_set_reclaim(dpdk_tx_reclaim);
+#endif
+	}
+	printf("zero copy tx: %s, lwIP heap %s\n", tx_zc ? "on" : "off",
+			tx_zc && mz != NULL ? "in place" : "copied");
+#endif
+
+	RTE_LCORE_FOREACH_SLAVE(lcore_id) {
+		if (lcore_queue[lcore_id] != DPDK_NO_QUEUE)
+			printf("lcore %u: RX port 0 queue %u\n", lcore_id, lcore_queue[lcore_id]);
+	}
 
 	/* init port 0 */
 	printf("Initializing port 0 ... \n");
 	fflush(stdout);
-	ret = rte_eth_dev_configure(0, 1, 1, &port_conf);
+	ret = rte_eth_dev_configure(0, nb_queues, nb_queues, &port_conf);
+	if (ret < 0 && port_conf.intr_conf.rxq) {
+		/* the lcores keep polling instead */
+		port_conf.intr_conf.rxq = 0;
+		ret = rte_eth_dev_configure(0, nb_queues, nb_queues, &port_conf);
+	}
+	rx_intr = port_conf.intr_conf.rxq;
 	if (ret < 0)
 		rte_exit(EXIT_FAILURE, "Cannot configure device: err=%d, port=0\n", ret);
 
@@ -346,22 +1227,41 @@ init_dpdk(void)
 
 		rte_eth_macaddr_get(0,&l2fwd_port_eth_addr);
 
-	/* init one RX queue */
-	fflush(stdout);
-	ret = rte_eth_rx_queue_setup(0, 0, nb_rxd,
-					   rte_eth_dev_socket_id(0),
-					   NULL,
-					   l2fwd_pktmbuf_pool);
-	if (ret < 0)
-		rte_exit(EXIT_FAILURE, "rte_eth_rx_queue_setup:err=%d, port=0\n", ret);
-
-	/* init one TX queue on each port */
-	fflush(stdout);
-	ret = rte_eth_tx_queue_setup(0, 0, nb_txd, rte_eth_dev_socket_id(0), NULL);
-	if (ret < 0)
-		rte_exit(EXIT_FAILURE, "rte_eth_tx_queue_setup:err=%d, 0-0\n", ret);
+	for (queue = 0; queue < nb_queues; queue++) {
+		/* init one RX queue */
+		fflush(stdout);
+		ret = rte_eth_rx_queue_setup(0, queue, nb_rxd,
+						   rte_eth_dev_socket_id(0),
+						   NULL,
+						   l2fwd_pktmbuf_pool);
+		if (ret < 0)
+			rte_exit(EXIT_FAILURE, "rte_eth_rx_queue_setup:err=%d, port=0, queue=%u\n",
+					ret, queue);
+
+		/* init one TX queue */
+		fflush(stdout);
+		ret = rte_eth_tx_queue_setup(0, queue, nb_txd, rte_eth_dev_socket_id(0),
+					     &dev_info.default_txconf);
+		if (ret < 0)
+			rte_exit(EXIT_FAILURE, "rte_eth_tx_queue_setup:err=%d, 0-%u\n",
+					ret, queue);
 
 		/* Initialize TX buffers */
+		tx_buffer[queue] = rte_zmalloc_socket("tx_buffer",
+				RTE_ETH_TX_BUFFER_SIZE(MAX_PKT_BURST), 0,
+				rte_eth_dev_socket_id(0));
+		if (tx_buffer[queue] == NULL)
+			rte_exit(EXIT_FAILURE, "Cannot allocate buffer for tx on port 0 queue %u\n",
+					queue);
+
+		rte_eth_tx_buffer_init(tx_buffer[queue], MAX_PKT_BURST);
+
+		ret = rte_eth_tx_buffer_set_err_callback(tx_buffer[queue], dpdk_tx_unsent,
+				(void *)(uintptr_t)queue);
+		if (ret < 0)
+			rte_exit(EXIT_FAILURE,
+			"Cannot set error callback for tx buffer on port 0 queue %u\n", queue);
+	}
 
 	/* Start device */
 	ret = rte_eth_dev_start(0);
@@ -382,10 +1282,17 @@ init_dpdk(void)
 			l2fwd_port_eth_addr.addr_bytes[5]);
 
 		/* initialize port stats */
-	memset(&port_statistics, 0, sizeof(port_statistics));
+	memset(port_statistics, 0, sizeof(port_statistics));
 
 	check_port_link_status();
 
+#if LWIP_TCPIP_RTC
+	if (idle_sleep_cycles > 0)
+		tcpip_rtc_set_wakeup(dpdk_rtc_wakeup);
+	/* the stack runs in the lcore from tcpip_init on */
+	rte_eal_mp_remote_launch(dpdk_thread, NULL, SKIP_MASTER);
+#endif
+
 	ret = 0;
 	return ret;
 }
@@ -0,0 +1,611 @@
+/*
+ * An AF_PACKET netif, the DPDK-free way to run the stack on a kernel
+ * interface such as one end of a veth pair.
+ *
+ * Each queue is a packet socket with a TPACKET_V3 RX ring: the kernel fills
+ * blocks of frames and hands a block over once it is full or
+ * PACKETIF_BLOCK_TOV_MS after its first frame, a block is input under one
+ * lock. With ZMQ_PACKET_QUEUES > 1 the sockets join a PACKET_FANOUT group
+ * that spreads the flows over them by hash, as RSS does for the DPDK
+ * queues. The frames are sent from the TX ring of the first socket, one
+ * send() hands the kernel all the frames marked since the last one.
+ */
+
+/* ppoll() */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <net/if.h>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/socket.h>
+#include <linux/if_ether.h>
+#include <linux/if_packet.h>
+
+#include "lwip/opt.h"
+#include "lwip/debug.h"
+#include "lwip/def.h"
+#include "lwip/pbuf.h"
+#include "lwip/inet_chksum.h"
+#include "lwip/prot/ip4.h"
+#include "lwip/sys.h"
+#include "lwip/timeouts.h"
+#include "lwip/tcpip.h"
+#include "lwip/netml_tmr.h"
+#include "netif/etharp.h"
+#include "netif/packetif.h"
+#include "lwip/priv/tcp_priv.h"
+
+/* the RX ring of a queue, PACKETIF_BLOCK_NR blocks of PACKETIF_BLOCK_SIZE
+   bytes; at a low rate a frame waits up to PACKETIF_BLOCK_TOV_MS in its
+   block */
+#ifndef PACKETIF_BLOCK_SIZE
+#define PACKETIF_BLOCK_SIZE (1 << 18)
+#endif
+#ifndef PACKETIF_BLOCK_NR
+#define PACKETIF_BLOCK_NR 64
+#endif
+#ifndef PACKETIF_BLOCK_TOV_MS
+#define PACKETIF_BLOCK_TOV_MS 1
+#endif
+#define PACKETIF_FRAME_SIZE 2048
+
+/* the TX ring, frames of PACKETIF_FRAME_SIZE bytes */
+#define PACKETIF_TX_FRAME_NR 1024
+/* where the kernel takes the frame from in a TX slot */
+#define PACKETIF_TX_DATA (TPACKET3_HDRLEN - sizeof(struct sockaddr_ll))
+/* the frames sent while inputting a block are handed to the kernel every
+   PACKETIF_TX_BURST frames and at its end */
+#define PACKETIF_TX_BURST 32
+
+#define PACKETIF_MAX_QUEUES 8
+/* the longest a queue sleeps in poll(), it bounds the wait of the timers
+   added by other threads meanwhile */
+#define PACKETIF_POLL_MAX_MS 10
+
+/* print the rates of each queue every second */
+#ifndef PACKETIF_STATS
+#define PACKETIF_STATS 0
+#endif
+
+struct packetif_queue {
+	int fd;
+	u8_t *rx_ring;
+	unsigned block;		/* the next block of rx_ring */
+	uint64_t rx;
+	uint64_t rx_blocks;
+	uint64_t dropped;
+	uint64_t sleeps;
+} __attribute__((aligned(64)));
+
+static struct packetif_queue queues[PACKETIF_MAX_QUEUES];
+static unsigned nb_queues = 1;
+/* the threads take their queue in turn, sys_thread_new() of the unix port
+   pins the thread it is given an argument */
+static unsigned next_queue;
+static int ifindex;
+static int if_mtu;
+static u8_t if_hwaddr[ETH_HWADDR_LEN];
+
+/* of the socket of queue 0, NULL if the kernel has no TPACKET_V3 TX ring,
+   before Linux 4.11: the frames are sent one by one then */
+static u8_t *tx_ring = NULL;
+static unsigned tx_head;
+static volatile unsigned tx_pending;
+static uint64_t tx, tx_dropped;
+/* the thread is inputting a block, what it sends waits for its end */
+static __thread int in_round;
+
+static struct netif * volatile packetif_netif = NULL;
+
+#if LWIP_TCPIP_RTC
+/* the thread of queue 0 is the tcpip thread, wake_fd wakes it up when a
+   thread posts to it while it sleeps */
+static volatile int asleep = 0;
+static int wake_fd = -1;
+
+/* the input of the other queues, to the tcpip thread */
+static err_t packetif_input_post(struct pbuf *p, struct netif *netif) {
+	return tcpip_inpkt(p, netif, ethernet_input);
+}
+
+static void packetif_rtc_wakeup(void) {
+	uint64_t one = 1;
+
+	/* after what the caller posted, against the check in packetif_sleep */
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (asleep && write(wake_fd, &one, sizeof(one)) < 0)
+		LWIP_DEBUGF(NETIF_DEBUG, ("packetif_rtc_wakeup: %d\n", errno));
+}
+
+#define PACKETIF_INPUT_LOCK()
+#define PACKETIF_INPUT_UNLOCK()
+#else
+#if LWIP_NETML
+static volatile int tmr_posted = 0;
+
+static void packetif_tmr_poll(void *arg) {
+	tmr_posted = 0;
+	netml_tmr_poll(arg);
+}
+#endif
+#if LWIP_TCPIP_CORE_LOCKING_INPUT
+/* a block is input under one lock, not a lock per frame as tcpip_input */
+#define PACKETIF_INPUT_LOCK()	LOCK_TCPIP_CORE()
+#define PACKETIF_INPUT_UNLOCK()	UNLOCK_TCPIP_CORE()
+#else
+#define PACKETIF_INPUT_LOCK()
+#define PACKETIF_INPUT_UNLOCK()
+#endif
+#endif
+
+/* tcp_output_segment leaves the TCP checksum to the netif, as it does to
+   dpdk_output: sum the segment of the len bytes frame where it was copied */
+static void packetif_tcp_chksum(u8_t *frame, u16_t len) {
+	struct eth_hdr *eth = (struct eth_hdr *)frame;
+	struct ip_hdr *iph = (struct ip_hdr *)(frame + SIZEOF_ETH_HDR);
+	struct tcp_hdr *tcph;
+	u16_t l3_len, l4_len;
+	u32_t acc;
+
+	if (len < SIZEOF_ETH_HDR + IP_HLEN || eth->type != PP_HTONS(ETHTYPE_IP) ||
+	    IPH_PROTO(iph) != IP_PROTO_TCP ||
+	    (IPH_OFFSET(iph) & PP_HTONS(IP_OFFMASK | IP_MF)) != 0)
+		return;
+	l3_len = IPH_HL_BYTES(iph);
+	l4_len = (u16_t)(lwip_ntohs(IPH_LEN(iph)) - l3_len);
+	if (l4_len < TCP_HLEN || SIZEOF_ETH_HDR + l3_len + l4_len > len)
+		return;
+	tcph = (struct tcp_hdr *)((u8_t *)iph + l3_len);
+
+	tcph->chksum = 0;
+	acc = LWIP_CHKSUM(tcph, l4_len);
+	/* the pseudo header */
+	acc += (iph->src.addr & 0xffff) + (iph->src.addr >> 16);
+	acc += (iph->dest.addr & 0xffff) + (iph->dest.addr >> 16);
+	acc += PP_HTONS(IP_PROTO_TCP) + lwip_htons(l4_len);
+	acc = FOLD_U32T(acc);
+	acc = FOLD_U32T(acc);
+	tcph->chksum = (u16_t)~acc;
+}
+
+/* hand the kernel the frames marked in the TX ring */
+static void packetif_kick(void) {
+	tx_pending = 0;
+	if (sendto(queues[0].fd, NULL, 0, MSG_DONTWAIT, NULL, 0) < 0 &&
+			errno != EAGAIN && errno != ENOBUFS)
+		LWIP_DEBUGF(NETIF_DEBUG, ("packetif_kick: %d\n", errno));
+}
+
+/* without TX ring, called under the lock of the stack as packetif_output */
+static err_t packetif_send(struct pbuf *p) {
+	static u8_t frame[PACKETIF_FRAME_SIZE];
+
+	pbuf_copy_partial(p, frame, p->tot_len, 0);
+	packetif_tcp_chksum(frame, p->tot_len);
+	if (send(queues[0].fd, frame, p->tot_len, MSG_DONTWAIT) < 0) {
+		tx_dropped++;
+		return ERR_MEM;
+	}
+	tx++;
+	return ERR_OK;
+}
+
+static err_t packetif_output(struct netif *netif, struct pbuf *p) {
+	struct tpacket3_hdr *h;
+
+	LWIP_UNUSED_ARG(netif);
+	if (p->tot_len > PACKETIF_FRAME_SIZE - PACKETIF_TX_DATA) {
+		tx_dropped++;
+		return ERR_BUF;
+	}
+	if (tx_ring == NULL)
+		return packetif_send(p);
+
+	h = (struct tpacket3_hdr *)(tx_ring + (size_t)tx_head * PACKETIF_FRAME_SIZE);
+	if (__atomic_load_n(&h->tp_status, __ATOMIC_ACQUIRE) != TP_STATUS_AVAILABLE) {
+		/* the ring is full of frames the kernel did not send yet */
+		packetif_kick();
+		if (__atomic_load_n(&h->tp_status, __ATOMIC_ACQUIRE) != TP_STATUS_AVAILABLE) {
+			tx_dropped++;
+			return ERR_MEM;
+		}
+	}
+	pbuf_copy_partial(p, (u8_t *)h + PACKETIF_TX_DATA, p->tot_len, 0);
+	packetif_tcp_chksum((u8_t *)h + PACKETIF_TX_DATA, p->tot_len);
+	h->tp_len = p->tot_len;
+	h->tp_snaplen = p->tot_len;
+	h->tp_next_offset = 0;
+	__atomic_store_n(&h->tp_status, TP_STATUS_SEND_REQUEST, __ATOMIC_RELEASE);
+	tx_head = (tx_head + 1) % PACKETIF_TX_FRAME_NR;
+	tx++;
+
+	if (!in_round || ++tx_pending >= PACKETIF_TX_BURST)
+		packetif_kick();
+	return ERR_OK;
+}
+
+static void packetif_input(struct packetif_queue *q, struct tpacket3_hdr *h,
+		struct netif *netif, netif_input_fn input) {
+	struct sockaddr_ll *sll = (struct sockaddr_ll *)((u8_t *)h + TPACKET_ALIGN(sizeof(*h)));
+	struct pbuf *p;
+
+	/* what this host sends on the interface, ours included */
+	if (sll->sll_pkttype == PACKET_OUTGOING)
+		return;
+	if (h->tp_snaplen < h->tp_len || h->tp_snaplen > 0xffff) {
+		q->dropped++;
+		return;
+	}
+	p = pbuf_alloc(PBUF_RAW, (u16_t)h->tp_snaplen, PBUF_POOL);
+	if (p == NULL) {
+		q->dropped++;
+		return;
+	}
+	pbuf_take(p, (u8_t *)h + h->tp_mac, (u16_t)h->tp_snaplen);
+	if (input(p, netif) != ERR_OK) {
+		pbuf_free(p);
+		q->dropped++;
+	}
+}
+
+static struct tpacket_block_desc *packetif_block(struct packetif_queue *q) {
+	return (struct tpacket_block_desc *)(q->rx_ring + (size_t)q->block * PACKETIF_BLOCK_SIZE);
+}
+
+static int packetif_rx_ready(struct packetif_queue *q) {
+	return __atomic_load_n(&packetif_block(q)->hdr.bh1.block_status, __ATOMIC_ACQUIRE) &
+			TP_STATUS_USER;
+}
+
+/* input the blocks the kernel handed over, returns the number of frames */
+static unsigned packetif_rx(struct packetif_queue *q, struct netif *netif, netif_input_fn input) {
+	unsigned n = 0;
+
+	while (packetif_rx_ready(q)) {
+		struct tpacket_block_desc *bd = packetif_block(q);
+		struct tpacket3_hdr *h = (struct tpacket3_hdr *)((u8_t *)bd + bd->hdr.bh1.offset_to_first_pkt);
+		u32_t i, nb = bd->hdr.bh1.num_pkts;
+
+		PACKETIF_INPUT_LOCK();
+		for (i = 0; i < nb; i++) {
+			packetif_input(q, h, netif, input);
+			h = (struct tpacket3_hdr *)((u8_t *)h + h->tp_next_offset);
+		}
+#if LWIP_NETML && !LWIP_TCPIP_RTC && LWIP_TCPIP_CORE_LOCKING_INPUT
+		/* acks what the block brought in one go */
+		tcp_netml_ack_flush_all(NULL);
+#endif
+		PACKETIF_INPUT_UNLOCK();
+
+		__atomic_store_n(&bd->hdr.bh1.block_status, TP_STATUS_KERNEL, __ATOMIC_RELEASE);
+		q->block = (q->block + 1) % PACKETIF_BLOCK_NR;
+		q->rx_blocks++;
+		n += nb;
+	}
+	q->rx += n;
+	return n;
+}
+
+/* give the blocks back unread, before there is a netif to input them */
+static void packetif_rx_drop(struct packetif_queue *q) {
+	while (packetif_rx_ready(q)) {
+		struct tpacket_block_desc *bd = packetif_block(q);
+
+		q->dropped += bd->hdr.bh1.num_pkts;
+		__atomic_store_n(&bd->hdr.bh1.block_status, TP_STATUS_KERNEL, __ATOMIC_RELEASE);
+		q->block = (q->block + 1) % PACKETIF_BLOCK_NR;
+	}
+}
+
+/* sleep until a block, a post, the next timer or PACKETIF_POLL_MAX_MS */
+static void packetif_sleep(struct packetif_queue *q, unsigned queue) {
+	struct pollfd fds[2];
+	struct timespec ts;
+	u64_t timeout = PACKETIF_POLL_MAX_MS * 1000;
+	nfds_t nfds = 1;
+	uint64_t v;
+
+#if LWIP_TCPIP_RTC && LWIP_TIMERS
+	if (queue == 0)
+		timeout = LWIP_MIN(timeout, (u64_t)sys_timeouts_sleeptime() * 1000);
+#endif
+#if LWIP_NETML
+	if (queue == 0)
+		timeout = LWIP_MIN(timeout, netml_tmr_sleeptime());
+#endif
+	if (timeout == 0)
+		return;
+
+	fds[0].fd = q->fd;
+	fds[0].events = POLLIN | POLLERR;
+#if LWIP_TCPIP_RTC
+	if (queue == 0) {
+		fds[1].fd = wake_fd;
+		fds[1].events = POLLIN;
+		nfds = 2;
+		asleep = 1;
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+		if (tcpip_rtc_pending()) {
+			asleep = 0;
+			return;
+		}
+	}
+#endif
+	if (!packetif_rx_ready(q)) {
+		/* the timers are finer than the milliseconds of poll() */
+		ts.tv_sec = timeout / 1000000;
+		ts.tv_nsec = (long)(timeout % 1000000) * 1000;
+		if (ppoll(fds, nfds, &ts, NULL) < 0 && errno != EINTR)
+			LWIP_DEBUGF(NETIF_DEBUG, ("packetif_sleep: %d\n", errno));
+		q->sleeps++;
+	}
+#if LWIP_TCPIP_RTC
+	if (queue == 0) {
+		asleep = 0;
+		if (read(wake_fd, &v, sizeof(v)) < 0 && errno != EAGAIN)
+			LWIP_DEBUGF(NETIF_DEBUG, ("packetif_sleep: %d\n", errno));
+	}
+#else
+	LWIP_UNUSED_ARG(v);
+#endif
+}
+
+static void packetif_thread(void *arg) {
+	unsigned queue = __atomic_fetch_add(&next_queue, 1, __ATOMIC_RELAXED);
+	struct packetif_queue *q = &queues[queue];
+	struct netif *netif;
+	netif_input_fn input;
+	unsigned nb_rx;
+	u32_t posted = 0;
+#if PACKETIF_STATS
+	u32_t next = sys_now() + 1000;
+	uint64_t rx = 0, blocks = 0, sent = 0;
+#endif
+
+	LWIP_UNUSED_ARG(arg);
+	prctl(PR_SET_NAME, "packetif_thread");
+#if LWIP_TCPIP_RTC
+	input = queue == 0 ? ethernet_input : packetif_input_post;
+#elif LWIP_TCPIP_CORE_LOCKING_INPUT
+	input = ethernet_input;
+#else
+	input = packetif_netif->input;
+#endif
+
+	while (1) {
+#if LWIP_TCPIP_RTC
+		/* as the lcore of DPDK queue 0, it runs what was posted and
+		   the timeouts between the blocks */
+		if (queue == 0)
+			posted = tcpip_rtc_poll();
+#endif
+		netif = __atomic_load_n(&packetif_netif, __ATOMIC_ACQUIRE);
+		if (netif == NULL) {
+			/* tcpip_init has not added it yet, a post wakes queue 0 */
+			packetif_rx_drop(q);
+			if (posted == 0)
+				packetif_sleep(q, queue);
+			continue;
+		}
+
+		in_round = 1;
+		nb_rx = packetif_rx(q, netif, input);
+#if LWIP_TCPIP_RTC && LWIP_NETML
+		if (queue == 0 && (nb_rx > 0 || posted > 0))
+			tcp_netml_ack_flush_all(NULL);
+		if (queue == 0 && netml_tmr_due())
+			netml_tmr_poll(NULL);
+#elif LWIP_NETML
+#if !LWIP_TCPIP_CORE_LOCKING_INPUT
+		if (nb_rx > 0)
+			tcpip_try_callback(tcp_netml_ack_flush_all, NULL);
+#endif
+		if (queue == 0 && !tmr_posted && netml_tmr_due()) {
+			tmr_posted = 1;
+			if (tcpip_try_callback(packetif_tmr_poll, NULL) != ERR_OK)
+				tmr_posted = 0;
+		}
+#endif
+		in_round = 0;
+		if (tx_pending > 0)
+			packetif_kick();
+
+#if PACKETIF_STATS
+		if ((s32_t)(sys_now() - next) >= 0) {
+			printf("packetif queue %u: rx %" PRIu64 " pkt/s in %" PRIu64 " blocks, tx %" PRIu64
+					" pkt/s, %" PRIu64 " rx dropped, %" PRIu64 " tx dropped, %" PRIu64 " sleeps\n",
+					queue, q->rx - rx, q->rx_blocks - blocks, queue == 0 ? tx - sent : 0,
+					q->dropped, tx_dropped, q->sleeps);
+			rx = q->rx;
+			blocks = q->rx_blocks;
+			sent = tx;
+			next = sys_now() + 1000;
+		}
+#endif
+		if (nb_rx == 0 && posted == 0)
+			packetif_sleep(q, queue);
+	}
+}
+
+/* the socket of a queue with its rings, bound to the interface */
+static int packetif_open(struct packetif_queue *q, int with_tx) {
+	struct tpacket_req3 req;
+	struct sockaddr_ll sll;
+	size_t rx_len, tx_len = 0;
+	int ver = TPACKET_V3, one = 1;
+	u8_t *ring;
+
+	q->fd = socket(AF_PACKET, SOCK_RAW, htons(ETH_P_ALL));
+	if (q->fd < 0) {
+		perror("packetif: socket");
+		return -1;
+	}
+	if (setsockopt(q->fd, SOL_PACKET, PACKET_VERSION, &ver, sizeof(ver)) < 0) {
+		perror("packetif: TPACKET_V3");
+		return -1;
+	}
+
+	memset(&req, 0, sizeof(req));
+	req.tp_block_size = PACKETIF_BLOCK_SIZE;
+	req.tp_block_nr = PACKETIF_BLOCK_NR;
+	req.tp_frame_size = PACKETIF_FRAME_SIZE;
+	req.tp_frame_nr = PACKETIF_BLOCK_SIZE / PACKETIF_FRAME_SIZE * PACKETIF_BLOCK_NR;
+	req.tp_retire_blk_tov = PACKETIF_BLOCK_TOV_MS;
+	if (setsockopt(q->fd, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req)) < 0) {
+		perror("packetif: PACKET_RX_RING");
+		return -1;
+	}
+	rx_len = (size_t)PACKETIF_BLOCK_SIZE * PACKETIF_BLOCK_NR;
+
+	if (with_tx) {
+		memset(&req, 0, sizeof(req));
+		req.tp_block_size = PACKETIF_BLOCK_SIZE;
+		req.tp_block_nr = PACKETIF_TX_FRAME_NR / (PACKETIF_BLOCK_SIZE / PACKETIF_FRAME_SIZE);
+		req.tp_frame_size = PACKETIF_FRAME_SIZE;
+		req.tp_frame_nr = PACKETIF_TX_FRAME_NR;
+		if (setsockopt(q->fd, SOL_PACKET, PACKET_TX_RING, &req, sizeof(req)) == 0)
+			tx_len = (size_t)req.tp_block_size * req.tp_block_nr;
+		else
+			fprintf(stderr, "[%s][%d]: no TPACKET_V3 TX ring (%s), sending frame by frame\n",
+					__FILE__, __LINE__, strerror(errno));
+		/* straight to the driver, as the DPDK frames */
+		if (setsockopt(q->fd, SOL_PACKET, PACKET_QDISC_BYPASS, &one, sizeof(one)) < 0)
+			LWIP_DEBUGF(NETIF_DEBUG, ("packetif: no PACKET_QDISC_BYPASS\n"));
+	}
+#ifdef PACKET_IGNORE_OUTGOING
+	/* Linux 4.20, packetif_input skips them otherwise */
+	setsockopt(q->fd, SOL_PACKET, PACKET_IGNORE_OUTGOING, &one, sizeof(one));
+#endif
+
+	ring = (u8_t *)mmap(NULL, rx_len + tx_len, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, q->fd, 0);
+	if (ring == MAP_FAILED) {
+		perror("packetif: mmap");
+		return -1;
+	}
+	q->rx_ring = ring;
+	if (tx_len > 0)
+		tx_ring = ring + rx_len;
+
+	memset(&sll, 0, sizeof(sll));
+	sll.sll_family = AF_PACKET;
+	sll.sll_protocol = htons(ETH_P_ALL);
+	sll.sll_ifindex = ifindex;
+	if (bind(q->fd, (struct sockaddr *)&sll, sizeof(sll)) < 0) {
+		perror("packetif: bind");
+		return -1;
+	}
+
+	if (nb_queues > 1) {
+		/* the flow hash keeps the frames of a connection on a queue */
+		int fanout = (getpid() & 0xffff) | (PACKET_FANOUT_HASH << 16);
+
+		if (setsockopt(q->fd, SOL_PACKET, PACKET_FANOUT, &fanout, sizeof(fanout)) < 0) {
+			perror("packetif: PACKET_FANOUT");
+			return -1;
+		}
+	}
+	return 0;
+}
+
+err_t packetif_device_init(struct netif* netif) {
+	unsigned i;
+
+	netif->name[0] = 'p';
+	netif->name[1] = 'k';
+	netif->output = etharp_output;
+	netif->linkoutput = packetif_output;
+	netif->mtu = (u16_t)LWIP_MIN(if_mtu, 1500);
+	netif->flags = NETIF_FLAG_BROADCAST | NETIF_FLAG_ETHARP | NETIF_FLAG_IGMP;
+	memcpy(netif->hwaddr, if_hwaddr, ETH_HWADDR_LEN);
+	netif->hwaddr_len = ETH_HWADDR_LEN;
+
+	fprintf(stdout, "[%s][%d]: packet device MAC addr %02X:%02X:%02X:%02X:%02X:%02X\n",
+					__FILE__, __LINE__,
+					netif->hwaddr[0], netif->hwaddr[1],
+					netif->hwaddr[2], netif->hwaddr[3],
+					netif->hwaddr[4], netif->hwaddr[5]);
+
+	netif_set_link_up(netif);
+	__atomic_store_n(&packetif_netif, netif, __ATOMIC_RELEASE);
+#if !LWIP_TCPIP_RTC
+	for (i = 0; i < nb_queues; i++)
+		sys_thread_new("packetif_thread", packetif_thread, NULL,
+				DEFAULT_THREAD_STACKSIZE, DEFAULT_THREAD_PRIO);
+#else
+	LWIP_UNUSED_ARG(i);
+#endif
+	return ERR_OK;
+}
+
+/*
+ * Open ZMQ_PACKET_QUEUES, 1 by default, packet sockets on ifname. The
+ * kernel should have no address of the stack on it.
+ */
+int init_packetif(const char *ifname) {
+	const char *env = getenv("ZMQ_PACKET_QUEUES");
+	struct ifreq ifr;
+	unsigned i;
+	int fd;
+
+	if (env != NULL)
+		nb_queues = LWIP_MIN(LWIP_MAX(atoi(env), 1), PACKETIF_MAX_QUEUES);
+
+	fd = socket(AF_INET, SOCK_DGRAM, 0);
+	if (fd < 0) {
+		perror("packetif: socket");
+		return -1;
+	}
+	memset(&ifr, 0, sizeof(ifr));
+	strncpy(ifr.ifr_name, ifname, IFNAMSIZ - 1);
+	if (ioctl(fd, SIOCGIFINDEX, &ifr) < 0) {
+		fprintf(stderr, "packetif: no interface %s\n", ifname);
+		close(fd);
+		return -1;
+	}
+	ifindex = ifr.ifr_ifindex;
+	if (ioctl(fd, SIOCGIFHWADDR, &ifr) < 0) {
+		perror("packetif: SIOCGIFHWADDR");
+		close(fd);
+		return -1;
+	}
+	memcpy(if_hwaddr, ifr.ifr_hwaddr.sa_data, ETH_HWADDR_LEN);
+	if_mtu = ioctl(fd, SIOCGIFMTU, &ifr) < 0 ? 1500 : ifr.ifr_mtu;
+	close(fd);
+
+	for (i = 0; i < nb_queues; i++) {
+		if (packetif_open(&queues[i], i == 0) < 0)
+			return -1;
+	}
+	printf("packetif %s: %u queues, %u blocks of %u KB, %s\n", ifname, nb_queues,
+			PACKETIF_BLOCK_NR, PACKETIF_BLOCK_SIZE >> 10,
+			tx_ring != NULL ? "TX ring" : "no TX ring");
+
+#if LWIP_TCPIP_RTC
+	wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (wake_fd < 0) {
+		perror("packetif: eventfd");
+		return -1;
+	}
+	tcpip_rtc_set_wakeup(packetif_rtc_wakeup);
+	/* the stack runs in the thread of queue 0 from tcpip_init on */
+	for (i = 0; i < nb_queues; i++)
+		sys_thread_new("packetif_thread", packetif_thread, NULL,
+				DEFAULT_THREAD_STACKSIZE, DEFAULT_THREAD_PRIO);
+#endif
+	return 0;
+}
@@ -90,8 +90,18 @@ get_monotonic_time(struct timespec *ts)
 #endif
 }
 
+/* The core lock and the protection are taken by every zmq I/O thread and
+ * the dpdk thread for short sections, spin a little before sleeping. */
+#ifdef PTHREAD_ADAPTIVE_MUTEX_INITIALIZER_NP
+#define SYS_MUTEX_INITIALIZER PTHREAD_ADAPTIVE_MUTEX_INITIALIZER_NP
+#define SYS_MUTEX_TYPE PTHREAD_MUTEX_ADAPTIVE_NP
+#else
+#define SYS_MUTEX_INITIALIZER PTHREAD_MUTEX_INITIALIZER
+#define SYS_MUTEX_TYPE PTHREAD_MUTEX_DEFAULT
+#endif
+
 #if SYS_LIGHTWEIGHT_PROT
-static pthread_mutex_t lwprot_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t lwprot_mutex = SYS_MUTEX_INITIALIZER;
 static pthread_t lwprot_thread = (pthread_t)0xDEAD;
 static int lwprot_count = 0;
 #endif /* SYS_LIGHTWEIGHT_PROT */
@@ -623,7 +633,11 @@ sys_mutex_new(struct sys_mutex **mutex)
 
   mtx = (struct sys_mutex *)malloc(sizeof(struct sys_mutex));
   if (mtx != NULL) {
-    pthread_mutex_init(&(mtx->mutex), NULL);
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, SYS_MUTEX_TYPE);
+    pthread_mutex_init(&(mtx->mutex), &attr);
+    pthread_mutexattr_destroy(&attr);
     *mutex = mtx;
     return ERR_OK;
   }
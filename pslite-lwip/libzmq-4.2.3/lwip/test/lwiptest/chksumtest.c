@@ -0,0 +1,137 @@
+/* C runtime includes */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* lwIP core includes */
+#include "lwip/opt.h"
+
+#include "lwip/def.h"
+#include "lwip/inet_chksum.h"
+
+/*
+ * The checksum routines of LWIP_CHKSUM_SIMD against lwip_standard_chksum:
+ * every length up to MAX_LEN at every alignment of the source and of the
+ * destination of the copy, on random data and on all ones, then the
+ * throughput of each routine the CPU supports on some frame sizes.
+ *
+ * usage: chksumtest [MB per measurement]
+ */
+
+#define MAX_LEN		2048
+#define MAX_ALIGN	8
+#define BIG_LEN		0xffff
+
+static const char *const impls[] = { "scalar", "sse2", "avx2" };
+static const int bench_lens[] = { 20, 64, 512, 1460, 9000, BIG_LEN };
+
+static u8_t src[BIG_LEN + MAX_ALIGN], dst[BIG_LEN + MAX_ALIGN];
+
+static int
+check(const char *name, int sa, int da, int len)
+{
+	u16_t ref = lwip_standard_chksum(src + sa, len);
+	u16_t sum = lwip_simd_chksum(src + sa, len);
+
+	if (sum != ref) {
+		fprintf(stderr, "%s: sum of %d bytes at +%d is %04x instead of %04x\n",
+				name, len, sa, sum, ref);
+		return 1;
+	}
+	memset(dst, 0x5a, sizeof(dst));
+	sum = lwip_simd_chksum_copy(dst + da, src + sa, (u16_t)len);
+	if (sum != ref || memcmp(dst + da, src + sa, len) != 0 ||
+	    (da > 0 && dst[da - 1] != 0x5a) || dst[da + len] != 0x5a) {
+		fprintf(stderr, "%s: copy of %d bytes from +%d to +%d is wrong, sum %04x instead of %04x\n",
+				name, len, sa, da, sum, ref);
+		return 1;
+	}
+	return 0;
+}
+
+static int
+test(const char *name)
+{
+	int sa, da, len, i;
+
+	for (i = 0; i < (int)sizeof(src); i++)
+		src[i] = (u8_t)rand();
+	for (len = 0; len <= MAX_LEN; len++)
+		for (sa = 0; sa < MAX_ALIGN; sa++)
+			for (da = 0; da < MAX_ALIGN; da += 3)
+				if (check(name, sa, da, len))
+					return 1;
+	if (check(name, 1, 0, BIG_LEN - 1) || check(name, 0, 1, BIG_LEN - 1))
+		return 1;
+
+	/* the largest sums, the carries of every word */
+	memset(src, 0xff, sizeof(src));
+	for (len = 0; len <= MAX_LEN; len += 7)
+		if (check(name, len % MAX_ALIGN, 0, len))
+			return 1;
+	return check(name, 0, 0, BIG_LEN - 1) || check(name, 3, 5, BIG_LEN - 1);
+}
+
+static double
+now_sec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Gbit/s of iters checksums, or copies, of len bytes */
+static double
+bench(int len, int copy, long iters)
+{
+	volatile u16_t sink = 0;
+	double start;
+	long i;
+
+	start = now_sec();
+	for (i = 0; i < iters; i++) {
+		if (copy)
+			sink += lwip_simd_chksum_copy(dst, src, (u16_t)len);
+		else
+			sink += lwip_simd_chksum(src, len);
+	}
+	(void)sink;
+	return (double)len * iters * 8 / (now_sec() - start) / 1e9;
+}
+
+int main(int argc, char *argv[])
+{
+	long bytes = 1L << 30;
+	const char *best;
+	size_t i, j;
+	int failed = 0;
+
+	if (argc > 1)
+		bytes = atol(argv[1]) << 20;
+	srand(1);
+	best = lwip_simd_chksum_name();
+	fprintf(stdout, "default routine: %s\n", best);
+
+	for (i = 0; i < LWIP_ARRAYSIZE(impls); i++) {
+		if (!lwip_simd_chksum_use(impls[i])) {
+			fprintf(stdout, "%s: not supported\n", impls[i]);
+			continue;
+		}
+		if (test(impls[i])) {
+			failed = 1;
+			continue;
+		}
+		fprintf(stdout, "%s: ok\n", impls[i]);
+		for (j = 0; j < LWIP_ARRAYSIZE(bench_lens); j++) {
+			int len = bench_lens[j];
+			long iters = LWIP_MAX(bytes / len, 1);
+
+			fprintf(stdout, "  %5d bytes: sum %6.1f Gbit/s, copy %6.1f Gbit/s\n",
+					len, bench(len, 0, iters), bench(len, 1, iters));
+		}
+	}
+	lwip_simd_chksum_use(best);
+	return failed;
+}
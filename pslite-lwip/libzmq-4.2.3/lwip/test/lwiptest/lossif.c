@@ -0,0 +1,216 @@
+#include <stdlib.h>
+
+#include "lwip/opt.h"
+#include "lwip/ip4.h"
+#include "lwip/prot/ip4.h"
+#include "lwip/prot/tcp.h"
+#include "lwip/tcp.h"
+#include "lwip/pbuf.h"
+#include "lwip/inet_chksum.h"
+#include "lwip/tcpip.h"
+#include "lwip/netml.h"
+#include "lwip/priv/tcp_priv.h"
+
+#include "lossif.h"
+
+/* count the NETML data segments, data carries no ACK flag */
+static void
+lossif_count(struct lossif *lif, struct pbuf *p)
+{
+	u8_t hdr[IP_HLEN_MAX + TCP_HLEN];
+	struct ip_hdr *iph = (struct ip_hdr *)hdr;
+	struct tcp_hdr *tcph;
+	u16_t len, hlen;
+	u8_t flags;
+
+	len = pbuf_copy_partial(p, hdr, sizeof(hdr), 0);
+	if (len < IP_HLEN || IPH_PROTO(iph) != IP_PROTO_TCP)
+		return;
+	hlen = IPH_HL_BYTES(iph);
+	if (len < hlen + TCP_HLEN)
+		return;
+	tcph = (struct tcp_hdr *)(hdr + hlen);
+	if (TCPH_FLAGS(tcph) & TCP_ACK)
+		return;
+
+	flags = TCPH_OFFSET_FLAGS(tcph);
+	if (flags == NETML_COLD || flags == NETML_COLD_RE)
+		lif->data++;
+	if (flags == NETML_COLD_RE)
+		lif->rexmit++;
+}
+
+/* the packets delivered to lif since its last RX burst, input in one go
+   as a DPDK RX burst is, then the coalesced ACKs are flushed */
+static void
+lossif_rx(void *arg)
+{
+	struct lossif *lif = (struct lossif *)arg;
+
+	lif->rx_posted = 0;
+	while (lif->rx_len > 0) {
+		struct pbuf *p = lif->rxq[lif->rx_head];
+
+		lif->rx_head = (lif->rx_head + 1) % LOSSIF_QUEUE;
+		lif->rx_len--;
+		if (ip_input(p, lif->netif) != ERR_OK)
+			pbuf_free(p);
+	}
+	tcp_netml_ack_flush_all(NULL);
+}
+
+/* called with the core locked, in the output of the stack: the peer must
+   not input p right away, it is queued and input from a callback */
+static void
+lossif_deliver(struct lossif *lif, struct pbuf *p)
+{
+	struct lossif *peer = (struct lossif *)lif->peer->state;
+
+	if (peer->rx_len == LOSSIF_QUEUE) {
+		lif->dropped++;
+		pbuf_free(p);
+		return;
+	}
+	peer->rxq[(peer->rx_head + peer->rx_len) % LOSSIF_QUEUE] = p;
+	peer->rx_len++;
+	if (!peer->rx_posted && tcpip_try_callback(lossif_rx, peer) == ERR_OK)
+		peer->rx_posted = 1;
+}
+
+/* set CE in an ECN capable packet, p is a contiguous copy */
+static void
+lossif_mark(struct lossif *lif, struct pbuf *p)
+{
+	struct ip_hdr *iph = (struct ip_hdr *)p->payload;
+	u8_t tos = IPH_TOS(iph);
+
+	if ((tos & NETML_ECN_MASK) == 0 || (tos & NETML_ECN_MASK) == NETML_ECN_CE)
+		return;
+	IPH_TOS_SET(iph, tos | NETML_ECN_CE);
+	IPH_CHKSUM_SET(iph, 0);
+	IPH_CHKSUM_SET(iph, inet_chksum(iph, IPH_HL_BYTES(iph)));
+	lif->marked++;
+}
+
+/* deliver the packets that left the bottleneck by now */
+static void
+lossif_dequeue(struct lossif *lif, u32_t now)
+{
+	while (lif->qlen > 0 && (s32_t)(now - lif->q[lif->qhead].depart) >= 0) {
+		struct pbuf *p = lif->q[lif->qhead].p;
+
+		lif->qhead = (lif->qhead + 1) % LOSSIF_QUEUE;
+		lif->qlen--;
+		lif->qbytes -= p->tot_len;
+		lossif_deliver(lif, p);
+	}
+}
+
+static void
+lossif_drain(void *arg)
+{
+	struct lossif *lif = (struct lossif *)arg;
+	u32_t now = netml_tmr_now();
+
+	lossif_dequeue(lif, now);
+	if (lif->qlen > 0 && !netml_tmr_pending(&lif->qtmr))
+		netml_tmr_add(&lif->qtmr, lif->q[lif->qhead].depart - now);
+}
+
+static void
+lossif_enqueue(struct lossif *lif, struct pbuf *p)
+{
+	u32_t now = netml_tmr_now(), start;
+
+	lossif_dequeue(lif, now);
+	if (lif->qlen == LOSSIF_QUEUE ||
+		(lif->qlimit > 0 && lif->qbytes + p->tot_len > lif->qlimit)) {
+		lif->dropped++;
+		lif->qdropped++;
+		pbuf_free(p);
+		return;
+	}
+	if (lif->ecn_k > 0 && lif->qbytes > lif->ecn_k)
+		lossif_mark(lif, p);
+
+	start = (s32_t)(lif->busy_until - now) > 0 ? lif->busy_until : now;
+	lif->busy_until = start + (u32_t)(((u64_t)p->tot_len * 1000000) / lif->rate);
+	lif->q[(lif->qhead + lif->qlen) % LOSSIF_QUEUE].p = p;
+	lif->q[(lif->qhead + lif->qlen) % LOSSIF_QUEUE].depart = lif->busy_until;
+	lif->qlen++;
+	lif->qbytes += p->tot_len;
+	if (lif->qbytes > lif->qmax)
+		lif->qmax = lif->qbytes;
+	if (!netml_tmr_pending(&lif->qtmr))
+		netml_tmr_add(&lif->qtmr, lif->q[lif->qhead].depart - now);
+}
+
+static err_t
+lossif_output(struct netif *netif, struct pbuf *p, const ip4_addr_t *ipaddr)
+{
+	struct lossif *lif = (struct lossif *)netif->state;
+	struct pbuf *q;
+
+	LWIP_UNUSED_ARG(ipaddr);
+
+	lif->sent++;
+	lossif_count(lif, p);
+	if ((u32_t)(rand() % 1000) < lif->loss) {
+		lif->dropped++;
+		return ERR_OK;
+	}
+
+	/* the stack keeps p, the peer gets a copy */
+	q = pbuf_clone(PBUF_LINK, PBUF_RAM, p);
+	if (q == NULL)
+		return ERR_MEM;
+	if (lif->rate > 0)
+		lossif_enqueue(lif, q);
+	else
+		lossif_deliver(lif, q);
+	return ERR_OK;
+}
+
+err_t
+lossif_init(struct netif *netif)
+{
+	static u8_t num = 0;
+	struct lossif *lif = (struct lossif *)netif->state;
+
+	netml_tmr_init(&lif->qtmr, lossif_drain, lif);
+	lif->netif = netif;
+	netif->name[0] = 'l';
+	netif->name[1] = 's';
+	netif->num = num++;
+	netif->mtu = 1500;
+	netif->flags = NETIF_FLAG_LINK_UP;
+	netif->output = lossif_output;
+	return ERR_OK;
+}
+
+void
+lossif_link(struct netif *a, struct netif *b)
+{
+	((struct lossif *)a->state)->peer = b;
+	((struct lossif *)b->state)->peer = a;
+}
+
+/* Both netifs are local, route by the source address so that the packets
+ * go through the link instead of the loopback. */
+struct netif *
+lossif_route(const ip4_addr_t *src, const ip4_addr_t *dest)
+{
+	struct netif *netif;
+
+	LWIP_UNUSED_ARG(dest);
+
+	/* no source, e.g. etharp_add_static_entry(): the routing table */
+	if (src == NULL)
+		return NULL;
+	NETIF_FOREACH(netif) {
+		if (netif->output == lossif_output &&
+			ip4_addr_cmp(src, netif_ip4_addr(netif)))
+			return netif;
+	}
+	return NULL;
+}
@@ -0,0 +1,51 @@
+#ifndef LWIP_HDR_TEST_LOSSIF
+#define LWIP_HDR_TEST_LOSSIF
+
+#include "lwip/netif.h"
+#include "lwip/ip4_addr.h"
+#include "lwip/netml_tmr.h"
+
+/* Packets a bottleneck holds at most */
+#define LOSSIF_QUEUE	1024
+
+/* A pair of netifs linked back to back, every packet sent on one is
+ * received on the other unless it is dropped. With a rate, the link out
+ * of a netif is a bottleneck: the packets wait in a queue of qlimit bytes
+ * and leave at the rate, those finding more than ecn_k bytes queued are
+ * marked CE if they are ECN capable. */
+struct lossif {
+	struct netif *netif;
+	struct netif *peer;
+	u32_t loss;		/* packets dropped out of 1000 */
+	u32_t rate;		/* bytes per second, 0 for no bottleneck */
+	u32_t qlimit;	/* bytes */
+	u32_t ecn_k;	/* bytes, 0 not to mark */
+	u32_t sent;		/* IP packets */
+	u32_t dropped;
+	u32_t qdropped;	/* of them, by a full queue */
+	u32_t marked;
+	u32_t qmax;		/* most bytes queued */
+	u32_t data;		/* NETML cold data segments */
+	u32_t rexmit;	/* of them, retransmissions */
+
+	/* the bottleneck queue */
+	struct {
+		struct pbuf *p;
+		u32_t depart;	/* netml_tmr_now() it leaves */
+	} q[LOSSIF_QUEUE];
+	u32_t qhead, qlen;
+	u32_t qbytes;
+	u32_t busy_until;	/* the link sends the queued packets until then */
+	struct netml_tmr qtmr;
+
+	/* the packets received, until lossif_rx inputs them */
+	struct pbuf *rxq[LOSSIF_QUEUE];
+	u32_t rx_head, rx_len;
+	u8_t rx_posted;
+};
+
+err_t lossif_init(struct netif *netif);
+void lossif_link(struct netif *a, struct netif *b);
+struct netif *lossif_route(const ip4_addr_t *src, const ip4_addr_t *dest);
+
+#endif /* LWIP_HDR_TEST_LOSSIF */
@@ -235,6 +235,8 @@
  * LWIP_ARP==1: Enable ARP functionality.
  */
 #define LWIP_ARP                        1
+/* tcpip_init adds 13 static entries, packetiftest resolves its peer */
+#define ARP_TABLE_SIZE					64
 
 #define ETHARP_SUPPORT_STATIC_ENTRIES	1
 
@@ -452,6 +454,16 @@
  */
 #define SO_REUSE                        0
 
+/*
+   ----------------------------------------
+   ---------- Checksum options ------------
+   ----------------------------------------
+*/
+/**
+ * LWIP_CHKSUM_SIMD==1: SSE2/AVX2 checksum routines.
+ */
+#define LWIP_CHKSUM_SIMD                1
+
 /*
    ----------------------------------------
    ---------- Statistics options ----------
@@ -479,8 +491,15 @@
    ---------------------------------------
 */
 
+#ifdef LWIPTEST_RTC
+/* netmltest_rtc: the stack runs to completion in a polling thread */
+#define LWIP_TCPIP_RTC    1
+#define LWIP_TCPIP_CORE_LOCKING    0
+#define LWIP_TCPIP_CORE_LOCKING_INPUT    0
+#else
 #define LWIP_TCPIP_CORE_LOCKING    1
 #define LWIP_TCPIP_CORE_LOCKING_INPUT    1
+#endif
 
 #if !NO_SYS
 void sys_check_core_locking(void);
@@ -496,4 +515,10 @@ void sys_unlock_tcpip_core(void);
 #endif
 #endif
 
+#ifdef LWIPTEST_LOSSIF
+/* netmltest routes by source address over its pair of lossy netifs */
+#define LWIP_HOOK_FILENAME "lossif.h"
+#define LWIP_HOOK_IP4_ROUTE_SRC(src, dest) lossif_route(src, dest)
+#endif
+
 #endif /* LWIP_LWIPOPTS_H */
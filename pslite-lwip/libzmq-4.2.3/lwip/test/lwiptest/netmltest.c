@@ -0,0 +1,403 @@
+/* C runtime includes */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+/* lwIP core includes */
+#include "lwip/opt.h"
+
+#include "lwip/sys.h"
+#include "lwip/debug.h"
+#include "lwip/init.h"
+#include "lwip/tcpip.h"
+#include "lwip/netif.h"
+#include "lwip/sockets.h"
+#include "lwip/netml_tmr.h"
+#include "lwip/netml_cc.h"
+
+#include "lossif.h"
+
+/*
+ * NETML over a lossy link: workers (nodes 9, 11, ...) push to a server
+ * (node 8) in the same process over a pair of lossy netifs, the server
+ * answers every push. The latency percentiles of the pushes and the
+ * segments sent, dropped and retransmitted are reported. Every push is
+ * filled with a pattern of its worker, sequence and offset that the server
+ * checks, the reply echoes its head; the test fails on a mismatch or on a
+ * push or reply that never came.
+ *
+ * With a rate, the link from the workers to the server is a bottleneck
+ * with a queue of the given size that marks CE above the ECN threshold.
+ * The workers push at the same time, an incast into that queue.
+ * ZMQ_NETML_CC selects the congestion controller as for zmq_lwip_init().
+ *
+ * netmltest_rtc runs the stack to completion in a polling thread, as the
+ * DPDK lcore does with LWIP_TCPIP_RTC, instead of in tcpip_thread behind
+ * the core lock. Run both with several workers to compare the latencies.
+ *
+ * usage: netmltest [loss per 1000] [messages] [workers] [rate Mbit/s]
+ *                  [queue KB] [ECN threshold KB]
+ */
+
+#define SERVER_IP	"10.0.2.1"
+#define CLIENT_IP	"10.0.1.1"
+#define SERVER_PORT	3170
+#define LOCAL_MASK	"255.255.255.0"
+
+#define SERVER_ID	8
+#define CLIENT_ID(k)	(9 + 2 * (k))
+#define MAX_CLIENTS	16
+
+#define MSG_LEN		4096
+#define REPLY_LEN	16
+
+static struct netif server_if, client_if;
+static struct lossif server_lif, client_lif;
+static sys_sem_t listen_sem, accept_sem, pushed_sem, done_sem;
+static int num_msgs = 1000, num_clients = 1;
+static int server_socks[MAX_CLIENTS], client_socks[MAX_CLIENTS];
+static u32_t *latency;
+static volatile int tmr_posted, done;
+/* the pushes and replies received of each worker, the corrupted ones */
+static int pushes[MAX_CLIENTS], replies[MAX_CLIENTS];
+static volatile u32_t mismatches;
+/* sys_thread_new() of this port pins the thread if given an argument, the
+   handlers and the workers take their index from these */
+static int next_handler, next_client;
+/* the semaphores of this port are binary, these count the signals */
+static int nb_pushed, nb_closed;
+
+/* word j of push i of worker k */
+static u32_t
+pattern(int k, int i, int j)
+{
+	return ((u32_t)k << 24) ^ ((u32_t)i * (MSG_LEN / 4) + (u32_t)j);
+}
+
+static void
+fill(u32_t *w, int len, int k, int i)
+{
+	int j;
+
+	for (j = 0; j < len / 4; j++)
+		w[j] = pattern(k, i, j);
+}
+
+/* counts and reports a mismatch of what worker k got or sent as push i */
+static void
+check(const u32_t *w, int len, int k, int i, const char *what)
+{
+	int j;
+
+	for (j = 0; j < len / 4; j++) {
+		if (w[j] != pattern(k, i, j)) {
+			if (__atomic_fetch_add(&mismatches, 1, __ATOMIC_RELAXED) < 10)
+				fprintf(stderr, "worker %d %s %d: word %d is %08x, not %08x\n",
+						k, what, i, j, w[j], pattern(k, i, j));
+			return;
+		}
+	}
+}
+
+static void
+test_init(void *arg)
+{
+	sys_sem_t *init_sem = (sys_sem_t *)arg;
+	ip4_addr_t sip, cip, netmask;
+
+	ip4addr_aton(SERVER_IP, &sip);
+	ip4addr_aton(CLIENT_IP, &cip);
+	ip4addr_aton(LOCAL_MASK, &netmask);
+
+	netif_add(&server_if, &sip, &netmask, IP4_ADDR_ANY4, &server_lif, lossif_init, tcpip_input);
+	netif_add(&client_if, &cip, &netmask, IP4_ADDR_ANY4, &client_lif, lossif_init, tcpip_input);
+	lossif_link(&server_if, &client_if);
+	netif_set_up(&server_if);
+	netif_set_up(&client_if);
+
+	sys_sem_signal(init_sem);
+}
+
+/* answers the pushes of worker k */
+static void
+handler_thread(void *arg)
+{
+	int k = __atomic_fetch_add(&next_handler, 1, __ATOMIC_RELAXED);
+	int csock = server_socks[k];
+	u32_t buf[MSG_LEN / 4];
+	int ret, i, len;
+
+	LWIP_UNUSED_ARG(arg);
+	for (i = 0; i < num_msgs; i++) {
+		for (len = 0; len < MSG_LEN; len += ret) {
+			ret = lwip_recv(csock, (char *)buf + len, MSG_LEN - len, 0);
+			if (ret <= 0) {
+				fprintf(stderr, "failed to recv data, err %d\n", errno);
+				goto close_handler;
+			}
+		}
+		check(buf, MSG_LEN, k, i, "push");
+		pushes[k]++;
+		for (len = 0; len < REPLY_LEN; len += ret) {
+			ret = lwip_send_netml(csock, (char *)buf + len, REPLY_LEN - len, LWIP_MSG_NETML, CLIENT_ID(k));
+			if (ret < 0) {
+				fprintf(stderr, "failed to send reply, err %d\n", errno);
+				goto close_handler;
+			}
+		}
+	}
+
+close_handler:
+
+	lwip_close(csock);
+	__atomic_add_fetch(&nb_closed, 1, __ATOMIC_RELEASE);
+	sys_sem_signal(&done_sem);
+}
+
+static void
+server_thread(void *arg)
+{
+	struct lwip_sockaddr_in addr;
+	int sock, ret, k;
+
+	LWIP_UNUSED_ARG(arg);
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = LWIP_AF_INET;
+	addr.sin_port = lwip_htons(SERVER_PORT);
+	addr.sin_addr.s_addr = ipaddr_addr(SERVER_IP);
+
+	sock = lwip_socket(LWIP_AF_INET, LWIP_SOCK_STREAM, 0);
+	LWIP_ASSERT("socket sock >= 0", sock >= 0);
+	ret = lwip_bind(sock, (struct lwip_sockaddr *)&addr, sizeof(addr));
+	LWIP_ASSERT("bind ret == 0", ret == 0);
+	ret = lwip_listen(sock, 0);
+	LWIP_ASSERT("listen ret == 0", ret == 0);
+	sys_sem_signal(&listen_sem);
+
+	/* the workers connect one after the other, worker k comes k-th */
+	for (k = 0; k < num_clients; k++) {
+		server_socks[k] = lwip_accept(sock, NULL, NULL);
+		LWIP_ASSERT("accept server_socks[k] >= 0", server_socks[k] >= 0);
+		lwip_setlocalid(server_socks[k], SERVER_ID);
+		sys_sem_signal(&accept_sem);
+	}
+	lwip_close(sock);
+
+	for (k = 0; k < num_clients; k++) {
+		sys_thread_new("netml_handler", handler_thread, NULL, 0, 0);
+	}
+}
+
+static int
+client_connect(int k)
+{
+	struct lwip_sockaddr_in addr;
+	int sock, ret;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = LWIP_AF_INET;
+	addr.sin_addr.s_addr = ipaddr_addr(CLIENT_IP);
+
+	sock = lwip_socket(LWIP_AF_INET, LWIP_SOCK_STREAM, 0);
+	LWIP_ASSERT("socket sock >= 0", sock >= 0);
+	lwip_setlocalid(sock, CLIENT_ID(k));
+	/* bound to the client netif, see lossif_route() */
+	ret = lwip_bind(sock, (struct lwip_sockaddr *)&addr, sizeof(addr));
+	LWIP_ASSERT("bind ret == 0", ret == 0);
+
+	addr.sin_port = lwip_htons(SERVER_PORT);
+	addr.sin_addr.s_addr = ipaddr_addr(SERVER_IP);
+	ret = lwip_connect(sock, (struct lwip_sockaddr *)&addr, sizeof(addr));
+	LWIP_ASSERT("connect ret == 0", ret == 0);
+	LWIP_UNUSED_ARG(ret);
+	return sock;
+}
+
+/* pushes of worker k */
+static void
+client_thread(void *arg)
+{
+	int k = __atomic_fetch_add(&next_client, 1, __ATOMIC_RELAXED);
+	int sock = client_socks[k];
+	u32_t *lat = latency + k * num_msgs;
+	u32_t buf[MSG_LEN / 4];
+	int ret, i, len;
+
+	LWIP_UNUSED_ARG(arg);
+	for (i = 0; i < num_msgs; i++) {
+		u32_t start = netml_tmr_now();
+
+		fill(buf, MSG_LEN, k, i);
+		for (len = 0; len < MSG_LEN; len += ret) {
+			ret = lwip_send_netml(sock, (char *)buf + len, MSG_LEN - len, LWIP_MSG_NETML, SERVER_ID);
+			if (ret < 0) {
+				fprintf(stderr, "failed to send data, err %d\n", errno);
+				goto client_done;
+			}
+		}
+		for (len = 0; len < REPLY_LEN; len += ret) {
+			ret = lwip_recv(sock, (char *)buf + len, REPLY_LEN - len, 0);
+			if (ret <= 0) {
+				fprintf(stderr, "failed to recv reply, err %d\n", errno);
+				goto client_done;
+			}
+		}
+		lat[i] = netml_tmr_now() - start;
+		check(buf, REPLY_LEN, k, i, "reply");
+		replies[k]++;
+	}
+
+client_done:
+	__atomic_add_fetch(&nb_pushed, 1, __ATOMIC_RELEASE);
+	sys_sem_signal(&pushed_sem);
+}
+
+#if LWIP_TCPIP_RTC
+/* the lcore of a DPDK netif runs the stack and the timer wheel, do it here */
+static void
+tmr_thread(void *arg)
+{
+	LWIP_UNUSED_ARG(arg);
+	while (!done) {
+		tcpip_rtc_poll();
+		if (netml_tmr_due())
+			netml_tmr_poll(NULL);
+	}
+}
+#else
+/* the RX loop of a DPDK netif polls the timer wheel, do it here */
+static void
+tmr_poll(void *arg)
+{
+	LWIP_UNUSED_ARG(arg);
+	tmr_posted = 0;
+	netml_tmr_poll(NULL);
+}
+
+static void
+tmr_thread(void *arg)
+{
+	LWIP_UNUSED_ARG(arg);
+	while (!done) {
+		if (!tmr_posted && netml_tmr_due()) {
+			tmr_posted = 1;
+			if (tcpip_try_callback(tmr_poll, NULL) != ERR_OK)
+				tmr_posted = 0;
+		}
+		usleep(NETML_TMR_TICK_US);
+	}
+}
+#endif
+
+/* until count reaches the number of workers */
+static void
+wait_all(sys_sem_t *sem, int *count)
+{
+	while (__atomic_load_n(count, __ATOMIC_ACQUIRE) < num_clients)
+		sys_sem_wait(sem);
+}
+
+static int
+cmp_u32(const void *a, const void *b)
+{
+	u32_t x = *(const u32_t *)a, y = *(const u32_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+int main(int argc, char *argv[])
+{
+	sys_sem_t init_sem;
+	const char *cc;
+	u32_t start;
+	int k, n, lost = 0;
+	err_t err;
+
+	if (argc > 1)
+		server_lif.loss = client_lif.loss = (u32_t)atoi(argv[1]);
+	if (argc > 2)
+		num_msgs = atoi(argv[2]);
+	if (argc > 3)
+		num_clients = LWIP_MIN(LWIP_MAX(atoi(argv[3]), 1), MAX_CLIENTS);
+	if (argc > 4) {
+		client_lif.rate = (u32_t)atoi(argv[4]) * 125000;
+		client_lif.qlimit = 64 * 1024;
+	}
+	if (argc > 5)
+		client_lif.qlimit = (u32_t)atoi(argv[5]) * 1024;
+	if (argc > 6)
+		client_lif.ecn_k = (u32_t)atoi(argv[6]) * 1024;
+	cc = getenv("ZMQ_NETML_CC");
+	if (cc != NULL && netml_cc_set_default(cc) != ERR_OK) {
+		fprintf(stderr, "unknown congestion controller %s\n", cc);
+		return 1;
+	}
+	srand(1);
+	n = num_clients * num_msgs;
+	latency = (u32_t *)calloc(n, sizeof(u32_t));
+
+	err = sys_sem_new(&init_sem, 0);
+	LWIP_ASSERT("failed to create init_sem", err == ERR_OK);
+	err = sys_sem_new(&listen_sem, 0);
+	LWIP_ASSERT("failed to create listen_sem", err == ERR_OK);
+	err = sys_sem_new(&accept_sem, 0);
+	LWIP_ASSERT("failed to create accept_sem", err == ERR_OK);
+	err = sys_sem_new(&pushed_sem, 0);
+	LWIP_ASSERT("failed to create pushed_sem", err == ERR_OK);
+	err = sys_sem_new(&done_sem, 0);
+	LWIP_ASSERT("failed to create done_sem", err == ERR_OK);
+	LWIP_UNUSED_ARG(err);
+
+	tcpip_init(test_init, &init_sem);
+	/* with LWIP_TCPIP_RTC it runs test_init */
+	sys_thread_new("netml_tmr", tmr_thread, NULL, 0, 0);
+	sys_sem_wait(&init_sem);
+	sys_sem_free(&init_sem);
+
+	sys_thread_new("netml_server", server_thread, NULL, 0, 0);
+	sys_sem_wait(&listen_sem);
+
+	for (k = 0; k < num_clients; k++) {
+		client_socks[k] = client_connect(k);
+		sys_sem_wait(&accept_sem);
+	}
+
+	start = sys_now();
+	for (k = 0; k < num_clients; k++)
+		sys_thread_new("netml_client", client_thread, NULL, 0, 0);
+	wait_all(&pushed_sem, &nb_pushed);
+	start = sys_now() - start;
+	wait_all(&done_sem, &nb_closed);
+	for (k = 0; k < num_clients; k++)
+		lwip_close(client_socks[k]);
+	done = 1;
+
+	qsort(latency, n, sizeof(u32_t), cmp_u32);
+	fprintf(stdout, "loss %u/1000, %d workers x %d x %d bytes in %u ms, cc %s\n",
+			client_lif.loss, num_clients, num_msgs, MSG_LEN, start,
+			netml_cc_get_default()->name);
+	fprintf(stdout, "push latency us: p50 %u, p99 %u, p99.9 %u, max %u\n",
+			latency[n / 2], latency[n * 99 / 100],
+			latency[n * 999 / 1000], latency[n - 1]);
+	fprintf(stdout, "client: sent %u, dropped %u, data %u, retransmitted %u, %u data segments/s\n",
+			client_lif.sent, client_lif.dropped, client_lif.data, client_lif.rexmit,
+			(u32_t)((u64_t)client_lif.data * 1000 / LWIP_MAX(start, 1)));
+	if (client_lif.rate > 0)
+		fprintf(stdout, "bottleneck: %u Mbit/s, queue max %u of %u bytes, dropped %u, marked %u\n",
+				client_lif.rate / 125000, client_lif.qmax, client_lif.qlimit,
+				client_lif.qdropped, client_lif.marked);
+	fprintf(stdout, "server: sent %u, dropped %u\n",
+			server_lif.sent, server_lif.dropped);
+
+	for (k = 0; k < num_clients; k++)
+		lost += (num_msgs - pushes[k]) + (num_msgs - replies[k]);
+	if (mismatches > 0 || lost > 0) {
+		fprintf(stdout, "FAILED: %u corrupted, %d pushes and replies lost\n",
+				mismatches, lost);
+		return 1;
+	}
+	return 0;
+}
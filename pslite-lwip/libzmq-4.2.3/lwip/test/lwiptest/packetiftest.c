@@ -0,0 +1,278 @@
+/* C runtime includes */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/prctl.h>
+#include <sys/wait.h>
+
+/* lwIP core includes */
+#include "lwip/opt.h"
+
+#include "lwip/sys.h"
+#include "lwip/debug.h"
+#include "lwip/init.h"
+#include "lwip/tcpip.h"
+#include "lwip/netif.h"
+#include "lwip/sockets.h"
+#include "lwip/netml_tmr.h"
+#include "netif/etharp.h"
+#include "netif/packetif.h"
+
+/*
+ * packetif on both ends of a veth pair: the test forks a stack with an echo
+ * server on one end, and sends messages to it from a stack on the other,
+ * through the AF_PACKET rings of packetif both ways. The connection is a
+ * bypass one, plain TCP without NETML as the scheduler connections of
+ * ps-lite; the peer is a stack and not a kernel socket, as the stack leaves
+ * the ACK flag off its data segments. Every message is filled with a pattern of its sequence and
+ * offset that the echo is checked against; the test fails on a mismatch or
+ * on an echo that never came. The round trip percentiles are reported.
+ *
+ * The pair is set up as root beforehand, without kernel addresses:
+ *
+ *   ip link add pkt0 type veth peer name pkt1
+ *   ip link set pkt0 up && ip link set pkt1 up
+ *
+ * packetiftest_rtc runs the stacks to completion in the thread of queue 0,
+ * as with LWIP_TCPIP_RTC. ZMQ_PACKET_QUEUES spreads the frames over
+ * several packet sockets.
+ *
+ * usage: packetiftest [messages] [interface] [echo interface]
+ */
+
+#define STACK_IP	"10.0.3.1"
+#define ECHO_IP		"10.0.3.2"
+#define ECHO_PORT	3171
+#define LOCAL_MASK	"255.255.255.0"
+
+#define MSG_LEN		4096
+
+static struct netif packet_if;
+static const char *stack_ip;
+static int num_msgs = 1000;
+static u32_t *latency;
+static volatile u32_t mismatches;
+
+static void
+test_init(void *arg)
+{
+	sys_sem_t *init_sem = (sys_sem_t *)arg;
+	ip4_addr_t ip, netmask;
+
+	ip4addr_aton(stack_ip, &ip);
+	ip4addr_aton(LOCAL_MASK, &netmask);
+
+#if LWIP_TCPIP_RTC
+	/* the thread of queue 0 is the tcpip thread */
+	netif_add(&packet_if, &ip, &netmask, IP4_ADDR_ANY4, NULL, packetif_device_init, ethernet_input);
+#else
+	netif_add(&packet_if, &ip, &netmask, IP4_ADDR_ANY4, NULL, packetif_device_init, tcpip_input);
+#endif
+	netif_set_default(&packet_if);
+	netif_set_up(&packet_if);
+
+	sys_sem_signal(init_sem);
+}
+
+static u32_t
+pattern(int i, int j)
+{
+	return (u32_t)i * (MSG_LEN / 4) + (u32_t)j;
+}
+
+/* the stack of ip on the interface ifname */
+static int
+stack_start(const char *ifname, const char *ip)
+{
+	sys_sem_t init_sem;
+	err_t err;
+
+	if (init_packetif(ifname) < 0) {
+		fprintf(stderr, "no packet sockets on %s, see packetiftest.c\n", ifname);
+		return -1;
+	}
+	err = sys_sem_new(&init_sem, 0);
+	LWIP_ASSERT("failed to create init_sem", err == ERR_OK);
+	LWIP_UNUSED_ARG(err);
+	stack_ip = ip;
+	/* with LWIP_TCPIP_RTC the thread of queue 0 runs test_init */
+	tcpip_init(test_init, &init_sem);
+	sys_sem_wait(&init_sem);
+	sys_sem_free(&init_sem);
+	return 0;
+}
+
+/* echoes what the client sends, writes to ready_fd once it listens */
+static int
+echo_server(int ready_fd)
+{
+	struct lwip_sockaddr_in addr;
+	char buf[MSG_LEN];
+	int lsock, csock, ret;
+
+	lsock = lwip_socket(LWIP_AF_INET, LWIP_SOCK_STREAM, 0);
+	LWIP_ASSERT("socket lsock >= 0", lsock >= 0);
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = LWIP_AF_INET;
+	addr.sin_port = lwip_htons(ECHO_PORT);
+	addr.sin_addr.s_addr = ipaddr_addr(ECHO_IP);
+	if (lwip_bind(lsock, (struct lwip_sockaddr *)&addr, sizeof(addr)) < 0 ||
+	    lwip_listen(lsock, 1) < 0) {
+		fprintf(stderr, "failed to listen on %s:%d, err %d\n", ECHO_IP, ECHO_PORT, errno);
+		return 1;
+	}
+	if (write(ready_fd, "", 1) != 1)
+		return 1;
+	close(ready_fd);
+
+	csock = lwip_accept(lsock, NULL, NULL);
+	if (csock < 0) {
+		fprintf(stderr, "failed to accept, err %d\n", errno);
+		return 1;
+	}
+	while ((ret = lwip_recv(csock, buf, sizeof(buf), 0)) > 0) {
+		if (lwip_send(csock, buf, ret, 0) != ret)
+			break;
+	}
+	lwip_close(csock);
+	lwip_close(lsock);
+	return 0;
+}
+
+/* the first 10 words of buf that are not those of message i */
+static void
+check(const u32_t *buf, int i)
+{
+	int j;
+
+	for (j = 0; j < MSG_LEN / 4; j++) {
+		if (buf[j] != pattern(i, j) && mismatches++ < 10)
+			fprintf(stderr, "message %d: word %d is %08x, not %08x\n",
+					i, j, buf[j], pattern(i, j));
+	}
+}
+
+/* the messages that came back */
+static int
+client(void)
+{
+	struct lwip_sockaddr_in addr;
+	u32_t buf[MSG_LEN / 4];
+	int sock, ret, i, j, len;
+
+	sock = lwip_socket(LWIP_AF_INET, LWIP_SOCK_STREAM, 0);
+	LWIP_ASSERT("socket sock >= 0", sock >= 0);
+	/* the SYN makes the accepted connection a bypass one too */
+	lwip_setbypass(sock);
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = LWIP_AF_INET;
+	addr.sin_port = lwip_htons(ECHO_PORT);
+	addr.sin_addr.s_addr = ipaddr_addr(ECHO_IP);
+	if (lwip_connect(sock, (struct lwip_sockaddr *)&addr, sizeof(addr)) < 0) {
+		fprintf(stderr, "failed to connect to %s:%d, err %d\n", ECHO_IP, ECHO_PORT, errno);
+		return 0;
+	}
+
+	for (i = 0; i < num_msgs; i++) {
+		u32_t start = netml_tmr_now();
+
+		for (j = 0; j < MSG_LEN / 4; j++)
+			buf[j] = pattern(i, j);
+		for (len = 0; len < MSG_LEN; len += ret) {
+			ret = lwip_send(sock, (char *)buf + len, MSG_LEN - len, 0);
+			if (ret <= 0) {
+				fprintf(stderr, "failed to send, err %d\n", errno);
+				goto out;
+			}
+		}
+		memset(buf, 0, sizeof(buf));
+		for (len = 0; len < MSG_LEN; len += ret) {
+			ret = lwip_recv(sock, (char *)buf + len, MSG_LEN - len, 0);
+			if (ret <= 0) {
+				fprintf(stderr, "failed to recv, err %d\n", errno);
+				goto out;
+			}
+		}
+		check(buf, i);
+		latency[i] = netml_tmr_now() - start;
+	}
+out:
+	lwip_close(sock);
+	return i;
+}
+
+static int
+cmp_u32(const void *a, const void *b)
+{
+	u32_t x = *(const u32_t *)a, y = *(const u32_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+int main(int argc, char *argv[])
+{
+	const char *ifname = "pkt0", *echo_ifname = "pkt1";
+	int ready[2], status, echo_failed;
+	pid_t echo_pid;
+	u32_t start;
+	char c;
+	int n;
+
+	if (argc > 1)
+		num_msgs = LWIP_MAX(atoi(argv[1]), 1);
+	if (argc > 2)
+		ifname = argv[2];
+	if (argc > 3)
+		echo_ifname = argv[3];
+	latency = (u32_t *)calloc(num_msgs, sizeof(u32_t));
+
+	/* the echo server is a stack of its own, forked before any thread */
+	if (pipe(ready) < 0) {
+		perror("pipe");
+		return 1;
+	}
+	echo_pid = fork();
+	if (echo_pid < 0) {
+		perror("fork");
+		return 1;
+	}
+	if (echo_pid == 0) {
+		close(ready[0]);
+		prctl(PR_SET_PDEATHSIG, SIGKILL);
+		if (stack_start(echo_ifname, ECHO_IP) < 0)
+			_exit(1);
+		_exit(echo_server(ready[1]));
+	}
+	close(ready[1]);
+
+	if (stack_start(ifname, STACK_IP) < 0 || read(ready[0], &c, 1) != 1) {
+		kill(echo_pid, SIGKILL);
+		waitpid(echo_pid, NULL, 0);
+		return 1;
+	}
+	close(ready[0]);
+
+	start = sys_now();
+	n = client();
+	start = sys_now() - start;
+
+	/* the server is done once the client closed */
+	echo_failed = waitpid(echo_pid, &status, 0) < 0 ||
+			!WIFEXITED(status) || WEXITSTATUS(status) != 0;
+
+	qsort(latency, n, sizeof(u32_t), cmp_u32);
+	fprintf(stdout, "%s: %d x %d bytes echoed in %u ms\n", ifname, n, MSG_LEN, start);
+	if (n > 0)
+		fprintf(stdout, "round trip us: p50 %u, p99 %u, max %u\n",
+				latency[n / 2], latency[n * 99 / 100], latency[n - 1]);
+
+	if (mismatches > 0 || n < num_msgs || echo_failed) {
+		fprintf(stdout, "FAILED: %u corrupted, %d messages lost%s\n",
+				mismatches, num_msgs - n, echo_failed ? ", echo server failed" : "");
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,205 @@
+/*
+    Copyright (c) 2007-2016 Contributors as noted in the AUTHORS file
+
+    This file is part of libzmq, the ZeroMQ core engine in C++.
+
+    libzmq is free software; you can redistribute it and/or modify it under
+    the terms of the GNU Lesser General Public License (LGPL) as published
+    by the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    As a special exception, the Contributors give you permission to link
+    this library with independent modules to produce an executable,
+    regardless of the license terms of these independent modules, and to
+    copy and distribute the resulting executable under terms of your choice,
+    provided that you also meet, for each linked independent module, the
+    terms and conditions of the license of that module. An independent
+    module is a module which is not derived from or based on this library.
+    If you modify this library, you must extend this exception to your
+    version of the library.
+
+    libzmq is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public
+    License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+//  Fan-out throughput over the NetML data path. One sender pushes messages
+//  round robin to N receivers through the switch, the receivers may be made
+//  slow with a per-message delay to see how much they hold back the others.
+//
+//    fanout_thr recv <ip> <gw> <mask> <switch-uri> <local-id>
+//                    <message-count> [<delay-us>]
+//    fanout_thr send <ip> <gw> <mask> <switch-uri> <local-id>
+//                    <message-size> <message-count> <remote-id>...
+
+#include "../include/zmq.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+//  The receivers take the identity frame as the sender's node id.
+static char identity [8];
+
+static void *open_socket (void *ctx, const char *connect_to, int local_id)
+{
+    void *s = zmq_socket (ctx, ZMQ_DEALER);
+    if (!s) {
+        printf ("error in zmq_socket: %s\n", zmq_strerror (errno));
+        return NULL;
+    }
+
+    snprintf (identity, sizeof identity, "ps%04d", local_id);
+    zmq_setsockopt (s, ZMQ_IDENTITY, identity, strlen (identity));
+    zmq_set_localid (s, local_id);
+
+    if (zmq_connect (s, connect_to) != 0) {
+        printf ("error in zmq_connect: %s\n", zmq_strerror (errno));
+        return NULL;
+    }
+    return s;
+}
+
+static int recv_side (void *s, int message_count, int delay)
+{
+    zmq_msg_t msg;
+    void *watch = NULL;
+    unsigned long elapsed;
+    size_t bytes = 0;
+    int i;
+
+    int rc = zmq_msg_init (&msg);
+    if (rc != 0) {
+        printf ("error in zmq_msg_init: %s\n", zmq_strerror (errno));
+        return -1;
+    }
+
+    for (i = 0; i != message_count; i++) {
+        do {
+            rc = zmq_msg_recv (&msg, s, 0);
+            if (rc < 0) {
+                printf ("error in zmq_msg_recv: %s\n", zmq_strerror (errno));
+                return -1;
+            }
+            bytes += rc;
+        } while (zmq_msg_more (&msg));
+
+        //  Start on the first message, the connection setup doesn't count.
+        if (i == 0)
+            watch = zmq_stopwatch_start ();
+        if (delay)
+            usleep (delay);
+    }
+
+    elapsed = zmq_stopwatch_stop (watch);
+    if (elapsed == 0)
+        elapsed = 1;
+    zmq_msg_close (&msg);
+
+    printf ("message count: %d\n", message_count);
+    printf ("mean throughput: %d [msg/s]\n",
+        (int) ((double) message_count / (double) elapsed * 1000000));
+    printf ("mean throughput: %.3f [Mb/s]\n",
+        (double) bytes * 8 / (double) elapsed);
+    return 0;
+}
+
+static int send_side (void *ctx, void *s, int message_size, int message_count,
+    int *remotes, int num_remotes)
+{
+    zmq_msg_t msg;
+    void *watch;
+    unsigned long elapsed;
+    int i;
+
+    char *body = (char *) calloc (message_size, 1);
+    if (!body) {
+        printf ("failed to allocate %d bytes\n", message_size);
+        return -1;
+    }
+
+    watch = zmq_stopwatch_start ();
+
+    for (i = 0; i != message_count; i++) {
+        uint16_t remote = (uint16_t) remotes [i % num_remotes];
+
+        //  Same framing as the ps-lite van: identity, then the body.
+        zmq_msg_init_data (&msg, identity, strlen (identity), NULL, NULL,
+            remote);
+        if (zmq_msg_send (&msg, s, ZMQ_SNDMORE | ZMQ_DATA) < 0) {
+            printf ("error in zmq_msg_send: %s\n", zmq_strerror (errno));
+            return -1;
+        }
+        zmq_msg_init_data (&msg, body, message_size, NULL, NULL, remote);
+        if (zmq_msg_send (&msg, s, ZMQ_DATA) < 0) {
+            printf ("error in zmq_msg_send: %s\n", zmq_strerror (errno));
+            return -1;
+        }
+    }
+
+    //  Linger until everything is handed to lwIP.
+    zmq_close (s);
+    zmq_ctx_term (ctx);
+
+    elapsed = zmq_stopwatch_stop (watch);
+    if (elapsed == 0)
+        elapsed = 1;
+    free (body);
+
+    printf ("receivers: %d\n", num_remotes);
+    printf ("message size: %d [B]\n", message_size);
+    printf ("message count: %d\n", message_count);
+    printf ("mean throughput: %d [msg/s]\n",
+        (int) ((double) message_count / (double) elapsed * 1000000));
+    printf ("mean throughput: %.3f [Mb/s]\n",
+        (double) message_count * message_size * 8 / (double) elapsed);
+    return 0;
+}
+
+int main (int argc, char *argv [])
+{
+    bool is_send = argc > 1 && strcmp (argv [1], "send") == 0;
+    bool is_recv = argc > 1 && strcmp (argv [1], "recv") == 0;
+
+    if (!(is_recv && (argc == 8 || argc == 9)) && !(is_send && argc >= 10)) {
+        printf ("usage: fanout_thr recv <ip> <gw> <mask> <switch-uri> "
+            "<local-id> <message-count> [<delay-us>]\n"
+            "       fanout_thr send <ip> <gw> <mask> <switch-uri> "
+            "<local-id> <message-size> <message-count> <remote-id>...\n");
+        return 1;
+    }
+
+    if (zmq_global_init (argv [2], argv [3], argv [4]) != 0) {
+        printf ("error in zmq_global_init\n");
+        return -1;
+    }
+
+    void *ctx = zmq_ctx_new ();
+    if (!ctx) {
+        printf ("error in zmq_ctx_new: %s\n", zmq_strerror (errno));
+        return -1;
+    }
+    void *s = open_socket (ctx, argv [5], atoi (argv [6]));
+    if (!s)
+        return -1;
+
+    if (is_recv) {
+        int rc = recv_side (s, atoi (argv [7]), argc == 9 ? atoi (argv [8]) : 0);
+        zmq_close (s);
+        zmq_ctx_term (ctx);
+        return rc;
+    }
+
+    int num_remotes = argc - 9;
+    int *remotes = (int *) malloc (num_remotes * sizeof (int));
+    for (int i = 0; i < num_remotes; i++)
+        remotes [i] = atoi (argv [9 + i]);
+    int rc = send_side (ctx, s, atoi (argv [7]), atoi (argv [8]),
+        remotes, num_remotes);
+    free (remotes);
+    return rc;
+}
@@ -65,6 +65,11 @@ namespace zmq
         //  unnecessary network stack traversals.
         out_batch_size = 8192,
 
+        //  Smallest frame an engine refers to in the receive buffers of the
+        //  network stack instead of copying it. Such a frame holds its
+        //  whole buffer until the message is closed.
+        in_zerocopy_min = 256,
+
         //  Maximal delta between high and low watermark.
         max_wm_delta = 1024,
 
@@ -45,11 +45,12 @@
 #include "err.hpp"
 #include "config.hpp"
 #include "i_poll_events.hpp"
+#include "lwip/sockets.h"
 
 zmq::epoll_t::epoll_t (const zmq::ctx_t &ctx_, bool lwip) :
     ctx(ctx_),
     stopping (false),
-	maxfd (0)
+	ready_active (false)
 {
 #ifdef ZMQ_USE_EPOLL_CLOEXEC
     //  Setting this option result in sane behaviour when exec() functions
@@ -61,6 +62,20 @@ zmq::epoll_t::epoll_t (const zmq::ctx_t &ctx_, bool lwip) :
 #endif
     errno_assert (epoll_fd != -1);
 	is_lwip = lwip;
+
+	if (is_lwip) {
+		//  Start asleep, so that the first socket lwIP reports signals us.
+		const bool ok = ready_pipe.check_read ();
+		zmq_assert (!ok);
+
+		//  A NULL data.ptr tells the signal from the poll entries.
+		memset (&ready_ev, 0, sizeof (ready_ev));
+		ready_ev.events = EPOLLIN;
+		ready_ev.data.ptr = NULL;
+		int rc = epoll_ctl (epoll_fd, EPOLL_CTL_ADD,
+						ready_signaler.get_fd (), &ready_ev);
+		errno_assert (rc != -1);
+	}
 }
 
 zmq::epoll_t::~epoll_t ()
@@ -118,13 +133,15 @@ zmq::epoll_t::handle_t zmq::epoll_t::add_fd_lwip (fd_t fd_, i_poll_events *event
     pe->fd = fd_;
     pe->events = events_;
 
-	fds_sync.lock();
 	lwip_entries.push_back(pe);
-	FD_SET(fd_, &fds_set.error);
+	if (lwip_table.size() <= (size_t)fd_)
+		lwip_table.resize(fd_ + 1, NULL);
+	lwip_table[fd_] = pe;
 
-	if (maxfd < (fd_+1))
-		maxfd = fd_ + 1;
-	fds_sync.unlock();
+	int rc = lwip_setreadycb(fd_, lwip_ready_cb, this);
+	errno_assert(rc == 0);
+	//  errors are reported without any interest, check it once
+	mark_ready(pe);
 
     //  Increase the load metric of the thread.
     adjust_load (1);
@@ -147,42 +164,25 @@ void zmq::epoll_t::rm_fd (handle_t handle_)
     adjust_load (-1);
 }
 
-zmq::epoll_t::poll_entry_t *
-zmq::epoll_t::find_entry_by_fd (lwip_entries_t &entries, fd_t fd)
-{
-	for (unsigned i = 0; i < entries.size(); i++) {
-		if (entries[i]->fd == fd)
-			return entries[i];
-	}
-
-	return NULL;
-}
-
 void zmq::epoll_t::rm_fd_lwip (handle_t handle_)
 {
 	lwip_entries_t::iterator it;
-	fd_t fd;
 	poll_entry_t *pe = (poll_entry_t *)handle_;
+	fd_t fd = pe->fd;
 
-	fds_sync.lock();
-
-	fd = pe->fd;
-
-	for (it = lwip_entries.begin(); it != lwip_entries.end(); it++) {
-		if ((*it)->fd == fd)
-			break;
-	}
-
-	if (it == lwip_entries.end()) {
-		fds_sync.unlock();
+	it = std::find(lwip_entries.begin(), lwip_entries.end(), pe);
+	if (it == lwip_entries.end())
 		return;
-	}
 
-    (*it)->fd = retired_fd;
-	fds_set.remove_fd(fd);
+	//  lwIP may still report it once, the fd is looked up in lwip_table
+	lwip_setreadycb(fd, NULL, NULL);
+	lwip_table[fd] = NULL;
 	lwip_entries.erase(it);
-
-	fds_sync.unlock();
+	lwip_ready.erase(std::remove(lwip_ready.begin(), lwip_ready.end(), pe),
+					lwip_ready.end());
+	//  skipped if it is in the round being handled
+	pe->ready = false;
+    pe->fd = retired_fd;
 
     retired_sync.lock ();
     retired.push_back (pe);
@@ -204,9 +204,8 @@ void zmq::epoll_t::set_pollin_lwip (handle_t handle_)
 {
     poll_entry_t *pe = (poll_entry_t*) handle_;
 
-	fds_sync.lock();
-	FD_SET(pe->fd, &fds_set.read);
-	fds_sync.unlock();
+	pe->ev.events |= EPOLLIN;
+	mark_ready(pe);
 }
 
 void zmq::epoll_t::reset_pollin (handle_t handle_)
@@ -220,9 +219,7 @@ void zmq::epoll_t::reset_pollin (handle_t handle_)
 void zmq::epoll_t::reset_pollin_lwip (handle_t handle_)
 {
     poll_entry_t *pe = (poll_entry_t*) handle_;
-	fds_sync.lock();
-	FD_CLR(pe->fd, &fds_set.read);
-	fds_sync.unlock();
+	pe->ev.events &= ~((short) EPOLLIN);
 }
 
 void zmq::epoll_t::set_pollout (handle_t handle_)
@@ -237,9 +234,8 @@ void zmq::epoll_t::set_pollout_lwip (handle_t handle_)
 {
     poll_entry_t *pe = (poll_entry_t*) handle_;
 
-	fds_sync.lock();
-	FD_SET(pe->fd, &fds_set.write);
-	fds_sync.unlock();
+	pe->ev.events |= EPOLLOUT;
+	mark_ready(pe);
 }
 
 void zmq::epoll_t::reset_pollout (handle_t handle_)
@@ -254,9 +250,7 @@ void zmq::epoll_t::reset_pollout_lwip (handle_t handle_)
 {
     poll_entry_t *pe = (poll_entry_t*) handle_;
 
-	fds_sync.lock();
-	FD_CLR(pe->fd, &fds_set.write);
-	fds_sync.unlock();
+	pe->ev.events &= ~((short) EPOLLOUT);
 }
 
 void zmq::epoll_t::start ()
@@ -277,12 +271,12 @@ int zmq::epoll_t::max_fds ()
     return -1;
 }
 
-void zmq::epoll_t::handle_epoll()
+void zmq::epoll_t::handle_epoll(int timeout_)
 {
 	int n = 0;
 	epoll_event ev_buf[max_io_events];
 
-	n = epoll_wait(epoll_fd, ev_buf, max_io_events, 0);
+	n = epoll_wait(epoll_fd, ev_buf, max_io_events, timeout_);
 	if (n == -1) {
 		errno_assert(errno == EINTR);
 		return;
@@ -291,6 +285,13 @@ void zmq::epoll_t::handle_epoll()
     for (int i = 0; i < n; i ++) {
         struct poll_entry_t *pe = ((poll_entry_t*) ev_buf [i].data.ptr);
 
+		//  lwIP reported ready sockets, handle_lwip picks them up
+		if (pe == NULL) {
+			ready_signaler.recv ();
+			ready_active = true;
+			continue;
+		}
+
         if (pe->fd == retired_fd)
   			continue;
         if (ev_buf [i].events & (EPOLLERR | EPOLLHUP)) {
@@ -309,96 +310,73 @@ void zmq::epoll_t::handle_epoll()
     }
 }
 
-void zmq::epoll_t::handle_lwip()
+void zmq::epoll_t::lwip_ready_cb (int fd_, void *arg_)
 {
-	if (lwip_entries.empty())
-		return;
-
-	struct fd_ev {
-		struct poll_entry_t *pe;
-		int type;
-	};
+	epoll_t *self = (epoll_t *) arg_;
 
-	enum {
-		FD_EV_READ = 0,
-		FD_EV_WRITE,
-		FD_EV_ERROR
-	};
-
-	struct fd_ev events[max_io_events];
-	int n = 0;
-
-	struct timeval tv;
-
-	tv.tv_sec = 0;
-	tv.tv_usec = 0;
-
-	fds_sync.lock();
-
-	fds_set_t local_fds = fds_set;
-	int rc = lwip_select (maxfd+1, &local_fds.read, &local_fds.write, &local_fds.error, &tv);
+	self->ready_pipe.write (fd_, false);
+	if (!self->ready_pipe.flush ())
+		self->ready_signaler.send ();
+}
 
-	if (rc == -1) {
-		errno_assert(errno == EINTR);
-		fds_sync.unlock();
+void zmq::epoll_t::mark_ready (poll_entry_t *pe_)
+{
+	if (pe_->ready)
 		return;
+	pe_->ready = true;
+	lwip_ready.push_back(pe_);
+}
+
+void zmq::epoll_t::handle_lwip()
+{
+	//  Collect the sockets lwIP reported. Once the pipe is empty lwIP
+	//  signals us again for the next one.
+	if (ready_active) {
+		fd_t fd;
+
+		while (ready_pipe.read (&fd)) {
+			if (fd >= 0 && (size_t)fd < lwip_table.size() && lwip_table[fd])
+				mark_ready(lwip_table[fd]);
+		}
+		ready_active = false;
 	}
-	if (rc == 0) {
-		fds_sync.unlock();
+
+	if (lwip_ready.empty())
 		return;
-	}
 
-	for (unsigned i = 0; i < lwip_entries.size(); i++) {
-		poll_entry_t *entry = lwip_entries[i];
+	lwip_entries_t entries;
+	entries.swap(lwip_ready);
 
-		if (entry->fd == retired_fd)
-			continue;
+	for (unsigned i = 0; i < entries.size(); i++) {
+		poll_entry_t *pe = entries[i];
 
-		if (entry->fd > maxfd)
+		//  removed while handling the previous ones
+		if (!pe->ready)
 			continue;
+		pe->ready = false;
 
-		if (FD_ISSET(entry->fd, &local_fds.read)) {
-			events[n].type = FD_EV_READ;
-			events[n].pe = entry;
-			n++;
-			if (n == max_io_events) {
-				fprintf(stdout, "[%s][%d]: exceed max event limit\n",
-								__FILE__, __LINE__);
-				break;
-			}
-		}
-		if (FD_ISSET(entry->fd, &local_fds.write)) {
-			events[n].type = FD_EV_WRITE;
-			events[n].pe = entry;
-			n++;
-			if (n == max_io_events) {
-				fprintf(stdout, "[%s][%d]: exceed max event limit\n",
-								__FILE__, __LINE__);
-				break;
-			}
-		}
-		if (FD_ISSET(entry->fd, &local_fds.error)) {
-			events[n].type = FD_EV_ERROR;
-			events[n].pe = entry;
-			n++;
-			if (n == max_io_events) {
-				fprintf(stdout, "[%s][%d]: exceed max event limit\n",
-								__FILE__, __LINE__);
-				break;
-			}
-		}
-	}
-	fds_sync.unlock();
+		int state = lwip_readystate(pe->fd);
+		if (state < 0)
+			continue;
 
-	for (int i = 0; i < n; i++) {
-		struct fd_ev *ev = &events[i];
+		if ((state & LWIP_READY_ERR) ||
+				((state & LWIP_READY_IN) && (pe->ev.events & EPOLLIN)))
+			pe->events->in_event();
+		if (pe->fd == retired_fd)
+			continue;
 
-		if (ev->pe->fd == retired_fd)
+		if ((state & LWIP_READY_OUT) && (pe->ev.events & EPOLLOUT))
+			pe->events->out_event();
+		if (pe->fd == retired_fd)
 			continue;
-		if (ev->type == FD_EV_READ || ev->type == FD_EV_ERROR)
-			ev->pe->events->in_event();
-		else
-			ev->pe->events->out_event();
+
+		//  lwIP only reports edges. What is still ready after the handlers
+		//  is looked at again in the next round.
+		state = lwip_readystate(pe->fd);
+		if (state > 0 && ((state & LWIP_READY_ERR) ||
+				((state & LWIP_READY_IN) && (pe->ev.events & EPOLLIN)) ||
+				((state & LWIP_READY_OUT) && (pe->ev.events & EPOLLOUT))))
+			mark_ready(pe);
 	}
 }
 
@@ -407,9 +385,16 @@ void zmq::epoll_t::loop_epoll ()
     while (!stopping) {
 
         //  Execute any due timers.
-//        int timeout = (int) execute_timers ();
+        int timeout = (int) execute_timers ();
+
+		//  Block until the next timer, a kernel fd or lwIP wakes us up,
+		//  unless some lwIP sockets are still ready.
+		if (is_lwip && !lwip_ready.empty())
+			timeout = 0;
+		else if (timeout == 0)
+			timeout = -1;
 
-		handle_epoll();
+		handle_epoll(timeout);
 
 		if (is_lwip)
 			handle_lwip();
@@ -451,35 +436,5 @@ void zmq::epoll_t::lwip_routine (void *arg_)
 	((epoll_t *)arg_)->loop_lwip();
 }
 
-zmq::epoll_t::fds_set_t::fds_set_t ()
-{
-    FD_ZERO (&read);
-    FD_ZERO (&write);
-    FD_ZERO (&error);
-}
-
-zmq::epoll_t::fds_set_t::fds_set_t (const fds_set_t &other_)
-{
-    memcpy (&read, &other_.read, sizeof other_.read);
-    memcpy (&write, &other_.write, sizeof other_.write);
-    memcpy (&error, &other_.error, sizeof other_.error);
-}
-
-zmq::epoll_t::fds_set_t &zmq::epoll_t::fds_set_t::
-operator= (const fds_set_t &other_)
-{
-    memcpy (&read, &other_.read, sizeof other_.read);
-    memcpy (&write, &other_.write, sizeof other_.write);
-    memcpy (&error, &other_.error, sizeof other_.error);
-    return *this;
-}
-
-void zmq::epoll_t::fds_set_t::remove_fd (const fd_t &fd_)
-{
-    FD_CLR (fd_, &read);
-    FD_CLR (fd_, &write);
-    FD_CLR (fd_, &error);
-}
-
 
 #endif
@@ -42,6 +42,8 @@
 #include "thread.hpp"
 #include "poller_base.hpp"
 #include "mutex.hpp"
+#include "ypipe.hpp"
+#include "signaler.hpp"
 
 namespace zmq
 {
@@ -101,6 +103,8 @@ namespace zmq
             fd_t fd;
             epoll_event ev;
             zmq::i_poll_events *events;
+            //  lwIP socket only: true while it is in lwip_ready
+            bool ready;
         };
 
         //  List of retired event sources.
@@ -120,36 +124,34 @@ namespace zmq
 		mutex_t retired_lwip_sync;
 
 
-		/*  lwip thread */
-		fd_t maxfd;
-
 		bool is_lwip;
 
-    	//  Internal state.
-    	struct fds_set_t
-    	{
-        	fds_set_t ();
-        	fds_set_t (const fds_set_t &other_);
-        	fds_set_t &operator= (const fds_set_t &other_);
-        	//  Convenience method to descriptor from all sets.
-        	void remove_fd (const fd_t &fd_);
+		typedef std::vector<poll_entry_t *> lwip_entries_t;
+		lwip_entries_t lwip_entries;
 
-        	fd_set read;
-        	fd_set write;
-        	fd_set error;
-    	};
+		//  lwIP sockets indexed by fd, NULL if not registered
+		lwip_entries_t lwip_table;
 
-		struct fds_set_t fds_set;
+		//  lwIP sockets to look at in the next round: reported by lwIP,
+		//  given a new interest, or still ready after the last round.
+		lwip_entries_t lwip_ready;
 
-		typedef std::vector<poll_entry_t *> lwip_entries_t;
-		lwip_entries_t lwip_entries;
+		//  Sockets reported ready by lwIP. lwIP writes it with its core
+		//  locked, so there is one writer at a time, and wakes us up
+		//  through the signaler when we are asleep, like mailbox_t.
+		enum { ready_pipe_granularity = 256 };
+		ypipe_t <fd_t, ready_pipe_granularity> ready_pipe;
+		signaler_t ready_signaler;
+		epoll_event ready_ev;
+		bool ready_active;
 
-		mutex_t fds_sync;
+		//  Called by lwIP when a registered socket became ready.
+		static void lwip_ready_cb (int fd_, void *arg_);
 
-		static poll_entry_t *
-				find_entry_by_fd (lwip_entries_t &entries, fd_t fd);
+		//  Queue the socket for the next round.
+		void mark_ready (poll_entry_t *pe_);
 
-		void handle_epoll();
+		void handle_epoll(int timeout_);
 		void handle_lwip();
 
         epoll_t (const epoll_t&);
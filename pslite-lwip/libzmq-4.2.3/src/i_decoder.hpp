@@ -30,6 +30,7 @@
 #ifndef __ZMQ_I_DECODER_HPP_INCLUDED__
 #define __ZMQ_I_DECODER_HPP_INCLUDED__
 
+#include "macros.hpp"
 #include "stdint.hpp"
 
 namespace zmq
@@ -56,6 +57,22 @@ namespace zmq
 
         virtual msg_t *msg () = 0;
 
+        //  Lets the frames lying wholly within [data_, data_ + size_)
+        //  refer to that memory instead of copying it. ref_ (hint_) is
+        //  called for each such message, ffn_ (data, hint_) when it is
+        //  closed. data_ NULL goes back to copying. Returns false if the
+        //  decoder always copies.
+        virtual bool set_external (unsigned char *data_, size_t size_,
+                    void (*ffn_) (void *, void *), void (*ref_) (void *),
+                    void *hint_)
+        {
+            LIBZMQ_UNUSED (data_);
+            LIBZMQ_UNUSED (size_);
+            LIBZMQ_UNUSED (ffn_);
+            LIBZMQ_UNUSED (ref_);
+            LIBZMQ_UNUSED (hint_);
+            return false;
+        }
 
     };
 
@@ -13,14 +13,18 @@
 #include "lwip/tcpip.h"
 #include "lwip/sockets.h"
 #include "lwip/netif.h"
+#include "lwip/netml_cc.h"
 #include "netif/etharp.h"
+#include "netif/ethernet.h"
 #include "netif/dpdkif.h"
+#include "netif/packetif.h"
 #include "zmqlwip.h"
 
 /* Host IP configuration */
 static ip4_addr_t ipaddr, netmask, gateway;
 
 static struct netif netdev;
+static netif_init_fn netdev_init = dpdk_device_init;
 
 static unsigned is_init = 0;
 
@@ -32,7 +36,12 @@ lwip_port_init(void *arg)
 
 	sem = (sys_sem_t *)arg;
 
-	netif_add(&netdev, &ipaddr, &netmask, &gateway, NULL, dpdk_device_init, tcpip_input);
+#if LWIP_TCPIP_RTC
+	/* dpdk_thread, or packetif_thread, is the tcpip thread, it inputs the frames directly */
+	netif_add(&netdev, &ipaddr, &netmask, &gateway, NULL, netdev_init, ethernet_input);
+#else
+	netif_add(&netdev, &ipaddr, &netmask, &gateway, NULL, netdev_init, tcpip_input);
+#endif
 	netif_set_default(&netdev);
 	netif_set_up(&netdev);
 
@@ -47,7 +56,15 @@ int zmq_lwip_init(const char *ip, const char *gw, const char *mask) {
 
 	int ret = 0;
 
-	ret = init_dpdk();
+	/* AF_PACKET on a kernel interface, a veth for instance, instead of
+	   the DPDK port */
+	const char *ifname = getenv("ZMQ_PACKET_IF");
+	if (ifname != NULL) {
+		ret = init_packetif(ifname);
+		netdev_init = packetif_device_init;
+	} else {
+		ret = init_dpdk();
+	}
 	if (ret < 0)
 		return -1;
 
@@ -69,6 +86,13 @@ int zmq_lwip_init(const char *ip, const char *gw, const char *mask) {
 	fprintf(stdout, "Lwip TCP/IP initialize: %s(%u) %s %s\n",
 					ip, ipaddr.addr, gw, mask);
 
+	/* congestion controller of the NETML data, none by default */
+	const char *cc = getenv("ZMQ_NETML_CC");
+	if (cc != NULL && netml_cc_set_default(cc) != ERR_OK) {
+		fprintf(stderr, "Unknown NETML congestion controller %s\n", cc);
+		return -1;
+	}
+
 	sys_sem_t sem;
 
 	if (sys_sem_new(&sem, 0) != ERR_OK) {
@@ -132,6 +132,17 @@
  */
 #define MEM_SIZE                        40960000
 
+/**
+ * LWIP_RAM_HEAP_POINTER: the heap is in DMA-able memory of the DPDK netif,
+ * which sends the TCP payload in it without copying.
+ */
+#define LWIP_RAM_HEAP_POINTER           dpdk_ram_heap
+#ifdef __cplusplus
+extern "C" unsigned char *dpdk_ram_heap;
+#else
+extern unsigned char *dpdk_ram_heap;
+#endif
+
 /*
    ------------------------------------------------
    ---------- Internal Memory Pool Sizes ----------
@@ -415,6 +426,12 @@
  */
 #define PBUF_POOL_BUFSIZE               LWIP_MEM_ALIGN_SIZE(TCP_MSS+40+PBUF_LINK_HLEN)
 
+/**
+ * LWIP_SUPPORT_CUSTOM_PBUF==1: the DPDK netif hands the received frames to
+ * lwIP in their mbufs, as custom pbufs.
+ */
+#define LWIP_SUPPORT_CUSTOM_PBUF        1
+
 /*
    ------------------------------------
    ---------- LOOPIF options ----------
@@ -453,6 +470,22 @@
  */
 #define SO_REUSE                        1
 
+/*
+   ----------------------------------------
+   ---------- Checksum options ------------
+   ----------------------------------------
+*/
+/**
+ * LWIP_CHKSUM_SIMD==1: SSE2/AVX2 checksum routines.
+ */
+#define LWIP_CHKSUM_SIMD                1
+/**
+ * LWIP_CHECKSUM_CTRL_PER_NETIF==1: the DPDK netif computes the TCP checksum
+ * while copying to the mbuf, or has the NIC do it, and leaves out IP
+ * checksums the NIC offloads.
+ */
+#define LWIP_CHECKSUM_CTRL_PER_NETIF    1
+
 /*
    ----------------------------------------
    ---------- Statistics options ----------
@@ -480,8 +513,19 @@
    ---------------------------------------
 */
 
+/* Run the stack to completion in the DPDK lcore instead of a tcpip_thread
+   behind the core lock, the other threads post to it over SPSC rings */
+#ifndef LWIP_TCPIP_RTC
+#define LWIP_TCPIP_RTC    0
+#endif
+
+#if LWIP_TCPIP_RTC
+#define LWIP_TCPIP_CORE_LOCKING    0
+#define LWIP_TCPIP_CORE_LOCKING_INPUT    0
+#else
 #define LWIP_TCPIP_CORE_LOCKING    1
 #define LWIP_TCPIP_CORE_LOCKING_INPUT    1
+#endif
 
 #if !NO_SYS
 void sys_check_core_locking(void);
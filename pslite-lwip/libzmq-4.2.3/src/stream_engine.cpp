@@ -63,6 +63,7 @@
 #include "wire.hpp"
 
 #include "lwipopts.h"
+#include "lwip/pbuf.h"
 
 zmq::stream_engine_t::stream_engine_t (fd_t fd_, const options_t &options_,
                                        const std::string &endpoint_) :
@@ -72,12 +73,14 @@ zmq::stream_engine_t::stream_engine_t (fd_t fd_, const options_t &options_,
     inpos (NULL),
     insize (0),
     decoder (NULL),
+    zerocopy_in (false),
+    inpbuf (NULL),
 	outpos (NULL),
 	outsize (0),
 	encoder (NULL),
-	last_remote (UINT16_MAX),
-	is_msg_end (true),
-	is_hot (false),
+	pulling (NULL),
+	next_output (0),
+	queued_bytes (0),
     metadata (NULL),
     handshaking (true),
     greeting_size (v2_greeting_size),
@@ -177,8 +180,12 @@ zmq::stream_engine_t::~stream_engine_t ()
     }
 
 	LIBZMQ_DELETE(encoder);
+	for (unsigned i = 0; i < outputs.size(); i++)
+		LIBZMQ_DELETE(outputs[i]);
     LIBZMQ_DELETE(decoder);
     LIBZMQ_DELETE(mechanism);
+	if (inpbuf)
+		pbuf_free(inpbuf);
 }
 
 void zmq::stream_engine_t::plug (io_thread_t *io_thread_,
@@ -205,6 +212,7 @@ void zmq::stream_engine_t::plug (io_thread_t *io_thread_,
 
 	decoder = new (std::nothrow)v2_decoder_t(in_batch_size, options.maxmsgsize);
 	alloc_assert(decoder);
+	zerocopy_in = decoder->set_external(NULL, 0, NULL, NULL, NULL);
 
 	encoder = new (std::nothrow)v2_encoder_t(out_batch_size);
 	alloc_assert(encoder);
@@ -284,6 +292,23 @@ void zmq::stream_engine_t::in_event ()
     }
 
     //  If there's no data to process in the buffer... 
+    if (!insize && zerocopy_in) {
+        struct pbuf *p;
+        const int rc = tcp_read_pbuf (s, &p);
+
+        if (rc == 0) {
+            errno = EPIPE;
+            error (connection_error);
+            return;
+        }
+        if (rc == -1) {
+            if (errno != EAGAIN)
+                error (connection_error);
+            return;
+        }
+        set_inpbuf (p);
+    }
+    else
     if (!insize) {
 
         //  Retrieve the buffer and read as much data as possible.
@@ -330,7 +355,11 @@ void zmq::stream_engine_t::in_event ()
 //						__FILE__, __LINE__, processed);
         inpos += processed;
         insize -= processed;
-        if (rc == 0 || rc == -1)
+        if (!insize && inpbuf)
+            next_pbuf ();
+        if (rc == 0)
+            continue;
+        if (rc == -1)
             break;
         rc = (this->*process_msg) (decoder->msg ());
         if (rc == -1)
@@ -352,106 +381,255 @@ void zmq::stream_engine_t::in_event ()
     session->flush ();
 }
 
-void zmq::stream_engine_t::data_out_event()
+static void free_pbuf_msg (void *, void *hint_)
 {
-	bool is_clear = false;
+    pbuf_free ((struct pbuf *) hint_);
+}
 
-	if (!is_id_set && socket->get_localid() != UINT16_MAX) {
-		lwip_setlocalid(s, socket->get_localid());
-		is_id_set = true;
-		fprintf(stdout, "[%s][%d]: set local id %u\n",
-						__FILE__, __LINE__, socket->get_localid());
-	}
+static void ref_pbuf_msg (void *hint_)
+{
+    pbuf_ref ((struct pbuf *) hint_);
+}
 
-	while (!is_clear) {
-		outpos = NULL;
-		outsize = encoder->encode(&outpos, 0);
+//  Starts decoding the pbuf chain p, skipping empty pbufs.
+void zmq::stream_engine_t::set_inpbuf (struct pbuf *p)
+{
+    inpbuf = p;
+    if (inpbuf && !inpbuf->len) {
+        next_pbuf ();
+        return;
+    }
+    if (inpbuf) {
+        inpos = (unsigned char *) inpbuf->payload;
+        insize = inpbuf->len;
+        decoder->set_external (inpos, insize, free_pbuf_msg, ref_pbuf_msg,
+            inpbuf);
+    }
+    else {
+        insize = 0;
+        decoder->set_external (NULL, 0, NULL, NULL, NULL);
+    }
+}
 
-#if 0
-		if (has_remain) {
-			encoder->load_msg(&tx_msg);
+//  Releases the decoded pbuf and goes on with the rest of its chain.
+void zmq::stream_engine_t::next_pbuf ()
+{
+    struct pbuf *next = inpbuf->next;
 
-			unsigned char *bufptr = outpos + outsize;
-			size_t n = encoder->encode(&bufptr, out_batch_size - outsize);
+    //  Detach the rest first, the messages still referring to this pbuf
+    //  must not hold the whole chain.
+    if (next) {
+        pbuf_ref (next);
+        pbuf_dechain (inpbuf);
+    }
+    pbuf_free (inpbuf);
+    set_inpbuf (next);
+}
 
-			zmq_assert(n > 0);
-			if (outpos == NULL)
-				outpos = bufptr;
-			outsize += n;
+zmq::stream_engine_t::outctl::outctl(uint16_t id_) :
+	id(id_),
+	outpos(NULL),
+	outsize(0),
+	is_hot(false),
+	cur(NULL),
+	queued(0)
+{
+	encoder = new (std::nothrow)v2_encoder_t(out_batch_size);
+	alloc_assert(encoder);
+	int rc = msg.init();
+	errno_assert(rc == 0);
+}
 
-			if (!(tx_msg.flags() & msg_t::more)) {
-				is_msg_end = true;
-			}
+zmq::stream_engine_t::outctl::~outctl()
+{
+	std::deque<msg_t> *queues[] = {&hot, &cold, &pending};
+
+	for (unsigned i = 0; i < 3; i++) {
+		for (std::deque<msg_t>::iterator it = queues[i]->begin();
+						it != queues[i]->end(); ++it) {
+			int rc = it->close();
+			errno_assert(rc == 0);
 		}
-#endif
-		while (outsize < (size_t)out_batch_size) {
-			uint16_t remote = 0;
-			uint8_t flags;
+	}
+	LIBZMQ_DELETE(encoder);
+	int rc = msg.close();
+	errno_assert(rc == 0);
+}
 
-			if ((this->*next_msg)(&tx_msg) == -1)
+bool zmq::stream_engine_t::outctl::encode()
+{
+	outpos = NULL;
+	outsize = encoder->encode(&outpos, 0);
+
+	while (outsize < (size_t)out_batch_size) {
+		if (cur == NULL) {
+			// between two messages, the hot ones go first
+			std::deque<msg_t> *q = hot.empty() ? &cold : &hot;
+
+			if (q->empty())
 				break;
-			remote = tx_msg.get_remote_id();
-			flags = tx_msg.flags();
-//			fprintf(stdout, "[%s][%d]: load data msg, target %u, size %lu,"
-//							" flags %x\n", __FILE__, __LINE__,
-//							remote, tx_msg.size(), flags);
-
-			if (last_remote == UINT16_MAX)
-				last_remote = remote;
-			else if (last_remote != remote) {
-				fprintf(stderr, "[%s][%d]: different target!!!\n", __FILE__, __LINE__);
-				zmq_assert(last_remote == remote);
-			}
+			// one write carries either hot or cold data
+			if (outsize && is_hot != (q == &hot))
+				break;
+			cur = q;
+			is_hot = (q == &hot);
+		}
 
-			encoder->load_msg(&tx_msg);
+		// only complete messages are queued, cur can't run dry in between
+		zmq_assert(!cur->empty());
+		bool more = (cur->front().flags() & msg_t::more) ? true : false;
+		int rc = msg.move(cur->front());
+		errno_assert(rc == 0);
+		cur->pop_front();
+		queued -= msg.size();
+
+		encoder->load_msg(&msg);
+		unsigned char *bufptr = outpos + outsize;
+		size_t n = encoder->encode(&bufptr, out_batch_size - outsize);
+
+		zmq_assert(n > 0);
+		if (outpos == NULL)
+			outpos = bufptr;
+		outsize += n;
+
+		if (!more) {
+			cur = NULL;
+			// the switch parses one message at the start of a hot
+			// packet, so a hot message is written alone
+			if (is_hot)
+				break;
+		}
+	}
+	return outsize > 0;
+}
 
-			unsigned char *bufptr = outpos + outsize;
-			size_t n = encoder->encode(&bufptr, out_batch_size - outsize);
+bool zmq::stream_engine_t::pull_data()
+{
+	while (queued_bytes < (size_t)max_queued_bytes) {
+		if ((this->*next_msg)(&tx_msg) == -1)
+			return true;
 
-			zmq_assert(n > 0);
-			if (outpos == NULL)
-				outpos = bufptr;
-			outsize += n;
+		uint8_t flags = tx_msg.flags();
+		size_t size = tx_msg.size();
+		outctl *out = pulling;
 
-			if (!(flags & msg_t::more)) {
-//				fprintf(stdout, "[%s][%d]: end of the message to %u\n",
-//								__FILE__, __LINE__, remote);
-				is_msg_end = true;
-				is_hot = (flags & msg_t::netml_hotdata) ? true : false;
-				break;
-			}
-			else
-				is_msg_end = false;
+		if (!(flags & msg_t::netml_data)) {
+			fprintf(stderr, "[%s][%d]: data path send control message\n",
+							__FILE__, __LINE__);
 		}
 
-		if (outsize && is_msg_end) {
-			int nbytes = 0;
-			unsigned nsent = 0;
-
-			while (nsent < outsize) {
-				nbytes = tcp_write(s, outpos, outsize, last_remote, is_hot);
-				if (nbytes < 0) {
-					fprintf(stdout, "[%s][%d]: failed to send\n", __FILE__, __LINE__);
-					reset_pollout_lwip(handle);
-					return;
-				}
-
-				if (nbytes == 0) {
-//					fprintf(stdout, "[%s][%d]: block 10 us\n", __FILE__, __LINE__);
-					usleep(10);
-				}
-				else {
-					nsent += nbytes;
-					outpos += nbytes;
-					outsize -= nbytes;
-				}
+		// the first frame tells the destination of the whole message
+		if (out == NULL) {
+			uint16_t remote = tx_msg.get_remote_id();
+
+			if (remote == UINT16_MAX) {
+				fprintf(stderr, "[%s][%d]: unknown target, drop the frame\n",
+								__FILE__, __LINE__);
+				int rc = tx_msg.close();
+				errno_assert(rc == 0);
+				rc = tx_msg.init();
+				errno_assert(rc == 0);
+				continue;
+			}
+
+			std::map<uint16_t, unsigned>::iterator it = targets.find(remote);
+			if (it == targets.end()) {
+				out = new (std::nothrow)outctl(remote);
+				alloc_assert(out);
+				targets.insert(std::pair<uint16_t, unsigned>(
+								remote, outputs.size()));
+				outputs.push_back(out);
+			}
+			else {
+				out = outputs[it->second];
 			}
-			last_remote = UINT16_MAX;
 		}
-		else if (outsize == 0) {
-			is_clear = true;
-			break;
+
+		out->pending.push_back(tx_msg);
+		int rc = tx_msg.init();
+		errno_assert(rc == 0);
+		out->queued += size;
+		queued_bytes += size;
+
+		if (flags & msg_t::more) {
+			pulling = out;
+			continue;
 		}
+
+		// the message is complete, its last frame tells hot or cold.
+		// msg_t is moved by copying it and dropping the original.
+		std::deque<msg_t> &q = (flags & msg_t::netml_hotdata) ?
+				out->hot : out->cold;
+		q.insert(q.end(), out->pending.begin(), out->pending.end());
+		out->pending.clear();
+		pulling = NULL;
+	}
+	return false;
+}
+
+void zmq::stream_engine_t::data_out_event()
+{
+	if (!is_id_set && socket->get_localid() != UINT16_MAX) {
+		lwip_setlocalid(s, socket->get_localid());
+		is_id_set = true;
+		fprintf(stdout, "[%s][%d]: set local id %u\n",
+						__FILE__, __LINE__, socket->get_localid());
+	}
+
+	bool drained = pull_data();
+
+	// one write per destination in a round, until nothing is left. When
+	// lwIP runs out of send buffer we return and wait for the poller, lwIP
+	// marks the socket writable again from its sent callback.
+	bool progress = true;
+	while (progress) {
+		progress = false;
+		unsigned n = outputs.size();
+
+		for (unsigned i = 0; i < n; i++) {
+			unsigned k = (next_output + i) % n;
+			outctl *out = outputs[k];
+
+			if (!out->outsize) {
+				size_t queued = out->queued;
+				bool has_data = out->encode();
+
+				queued_bytes -= queued - out->queued;
+				if (!has_data)
+					continue;
+			}
+
+			int nbytes = tcp_write(s, out->outpos, out->outsize,
+							out->id, out->is_hot);
+			if (nbytes < 0) {
+				fprintf(stdout, "[%s][%d]: failed to send\n", __FILE__, __LINE__);
+				reset_pollout_lwip(handle);
+				return;
+			}
+			if (nbytes == 0) {
+				// start from this destination when writable again
+				next_output = k;
+				return;
+			}
+
+			out->outpos += nbytes;
+			out->outsize -= nbytes;
+			progress = true;
+		}
+		if (n)
+			next_output = (next_output + 1) % n;
+
+		// the writes above made room for more messages
+		size_t before = queued_bytes;
+		drained = pull_data();
+		if (queued_bytes != before)
+			progress = true;
+	}
+
+	// all sent, the session restarts the output when it has more
+	if (drained && queued_bytes == 0) {
+		output_stopped = true;
+		reset_pollout_lwip(handle);
 	}
 }
 
@@ -482,11 +660,11 @@ void zmq::stream_engine_t::ctl_out_event()
 			outsize += n;
 		}
 
-//		if (!output->outsize) {
-//			output_stopped = true;
-//			reset_pollout_lwip(handle);
-//			return;
-//		}
+		if (!outsize) {
+			output_stopped = true;
+			reset_pollout_lwip(handle);
+			return;
+		}
 	}
 
 	if (outsize) {
@@ -501,147 +679,6 @@ void zmq::stream_engine_t::ctl_out_event()
 	}
 }
 
-#if 0
-bool zmq::stream_engine_t::can_handle_data()
-{
-	for (unsigned i = 0; i < num_target; i++) {
-		if (outputs[i].outsize >= (size_t)out_batch_size) {
-			return false;
-		}
-		if (outputs[i].hotoutsize >= (size_t)out_batch_size) {
-			return false;
-		}
-	}
-	return true;
-}
-
-bool zmq::stream_engine_t::has_data()
-{
-	for (unsigned i = 0; i < num_target; i++) {
-		if (outputs[i].outsize > 0)
-			return true;
-		if (outputs[i].hotoutsize > 0)
-			return true;
-	}
-	return false;
-}
-
-void zmq::stream_engine_t::data_out_event()
-{
-	unsigned i = 0;
-
-	if (!is_id_set && socket->get_localid() != UINT16_MAX) {
-		lwip_setlocalid(s, socket->get_localid());
-		is_id_set = true;
-//		fprintf(stdout, "[%s][%d]: set local id %u\n",
-//						__FILE__, __LINE__, socket->get_localid());
-	}
-
-	if (!has_data()) {
-		for (i = 0; i < num_target; i++) {
-			outputs[i].outpos = NULL;
-			outputs[i].outsize = outputs[i].encoder->encode(
-							&outputs[i].outpos, 0);
-			outputs[i].hotoutpos = NULL;
-			outputs[i].hotoutsize = outputs[i].hotencoder->encode(
-							&outputs[i].hotoutpos, 0);
-		}
-
-		while (can_handle_data()) {
-			if ((this->*next_msg)(&tx_msg) == -1)
-				break;
-//			fprintf(stdout, "[%s][%d]: load data msg , target %u, size %lu, flags %x\n",
-//							__FILE__, __LINE__,
-//							tx_msg.get_remote_id(),
-//							tx_msg.size(),
-//							tx_msg.flags());
-			if (!(tx_msg.flags() & msg_t::netml_data)) {
-				fprintf(stderr, "[%s][%d]: data path send control message\n",
-								__FILE__, __LINE__);
-			}
-
-			outctl *out = NULL;
-			std::map<uint16_t, unsigned>::iterator it =
-					targets.find(tx_msg.get_remote_id());
-			if (it == targets.end()) {
-				outputs.push_back(outctl(tx_msg.get_remote_id()));
-				out = &(outputs[num_target]);
-
-				out->encoder = new (std::nothrow)v2_encoder_t(out_batch_size);
-				alloc_assert(out->encoder);
-
-				out->hotencoder = new (std::nothrow)v2_encoder_t(out_batch_size);
-				alloc_assert(out->hotencoder);
-
-				targets.insert(std::pair<uint16_t, unsigned>(
-						tx_msg.get_remote_id(), num_target));
-				num_target++;
-			}
-			else {
-				out = &outputs[it->second];
-			}
-
-			if (tx_msg.flags() & msg_t::netml_hotdata) {
-				out->hotencoder->load_msg(&tx_msg);
-				unsigned char *bufptr = out->hotoutpos + out->hotoutsize;
-				size_t n = out->hotencoder->encode(&bufptr,
-								out_batch_size - out->hotoutsize);
-
-				zmq_assert(n > 0);
-				if (out->hotoutpos == NULL)
-					out->hotoutpos = bufptr;
-				out->hotoutsize += n;
-			}
-			else {
-				out->encoder->load_msg(&tx_msg);
-				unsigned char *bufptr = out->outpos + out->outsize;
-				size_t n = out->encoder->encode(&bufptr,
-								out_batch_size - out->outsize);
-
-				zmq_assert(n > 0);
-				if (out->outpos == NULL)
-					out->outpos = bufptr;
-				out->outsize += n;
-			}
-		}
-
-//		if (!has_data()) {
-//			output_stopped = true;
-//			reset_pollout_lwip(handle);
-//			return;
-//		}
-	}
-
-	for (unsigned i = 0; i < num_target; i++) {
-		outctl *out = &outputs[i];
-
-		if (out->outsize) {
-			int nbytes = tcp_write(s, out->outpos, out->outsize, out->id);
-
-			if (nbytes == -1) {
-				reset_pollout_lwip(handle);
-				return;
-			}
-
-			out->outpos += nbytes;
-			out->outsize -= nbytes;
-		}
-		if (out->hotoutsize) {
-			int nbytes = tcp_write(s, out->hotoutpos, out->hotoutsize,
-							out->id, true /* hot */);
-
-			if (nbytes == -1) {
-				reset_pollout_lwip(handle);
-				return;
-			}
-
-			out->hotoutpos += nbytes;
-			out->hotoutsize -= nbytes;
-		}
-	}
-}
-#endif
-
 void zmq::stream_engine_t::out_event()
 {
 	zmq_assert(!io_error);
@@ -791,7 +828,11 @@ void zmq::stream_engine_t::restart_input ()
         zmq_assert (processed <= insize);
         inpos += processed;
         insize -= processed;
-        if (rc == 0 || rc == -1)
+        if (!insize && inpbuf)
+            next_pbuf ();
+        if (rc == 0)
+            continue;
+        if (rc == -1)
             break;
         rc = (this->*process_msg) (decoder->msg ());
         if (rc == -1)
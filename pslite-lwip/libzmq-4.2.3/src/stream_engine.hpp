@@ -31,6 +31,9 @@
 #define __ZMQ_STREAM_ENGINE_HPP_INCLUDED__
 
 #include <stddef.h>
+#include <deque>
+#include <map>
+#include <vector>
 
 #include "fd.hpp"
 #include "i_engine.hpp"
@@ -40,6 +43,9 @@
 #include "options.hpp"
 #include "socket_base.hpp"
 #include "metadata.hpp"
+#include "config.hpp"
+
+struct pbuf;
 
 namespace zmq
 {
@@ -129,10 +135,10 @@ namespace zmq
         int process_heartbeat_message(msg_t * msg_);
         int produce_pong_message(msg_t * msg_);
 
-		bool can_handle_data();
-		bool has_data();
 		void ctl_out_event();
 		void data_out_event();
+		//  Returns true if the session has no more messages.
+		bool pull_data();
 
         //  Underlying socket.
         fd_t s;
@@ -148,42 +154,67 @@ namespace zmq
         size_t insize;
         i_decoder *decoder;
 
+        //  True if the decoder refers to the received pbufs rather than
+        //  copying them, inpbuf is then the chain being decoded.
+        bool zerocopy_in;
+        struct pbuf *inpbuf;
+        void next_pbuf ();
+        void set_inpbuf (struct pbuf *p);
+
 		bool is_ctl;
 
 		unsigned char *outpos;
 		size_t outsize;
 		i_encoder *encoder;
 
-		uint16_t last_remote;
-		bool is_msg_end;
-		bool is_hot;
-
-#if 0
+		//  Output queues of one destination on the data path. Every
+		//  destination has its own encoder and its hot messages overtake
+		//  the cold ones at message boundaries. All destinations share
+		//  the lwIP send buffer of the connection to the switch.
 		class outctl {
 		public:
+			outctl(uint16_t id_);
+			~outctl();
+
+			//  Encode the next batch, it never mixes hot and cold data
+			//  and holds at most one hot message. Returns false if there
+			//  is nothing to send.
+			bool encode();
+
+			uint16_t id;
+			i_encoder *encoder;
+			//  the frame being encoded
+			msg_t msg;
 			unsigned char *outpos;
 			size_t outsize;
-			i_encoder *encoder;
-			unsigned char *hotoutpos;
-			size_t hotoutsize;
-			i_encoder *hotencoder;
-			uint16_t id;
-
-			outctl(uint16_t id_ = UINT16_MAX) :
-					outpos(NULL), outsize(0), encoder(NULL),
-					hotoutpos(NULL), hotoutsize(0), hotencoder(NULL),
-					id(id_) {};
+			//  whether outpos holds hot data
+			bool is_hot;
+			//  the queue of the message being encoded, NULL between
+			//  messages
+			std::deque<msg_t> *cur;
+			//  complete messages, one frame per entry
+			std::deque<msg_t> hot;
+			std::deque<msg_t> cold;
+			//  frames of a message still being pulled from the session
+			std::deque<msg_t> pending;
+			//  bytes queued in hot, cold and pending
+			size_t queued;
+
+		private:
+			outctl(const outctl&);
+			const outctl &operator = (const outctl&);
 		};
 
-		std::vector<outctl> outputs;
-
-		// for control path
-		outctl *output;
+		//  Stop pulling from the session above this many queued bytes.
+		enum { max_queued_bytes = 64 * out_batch_size };
 
-		// for data path
-		unsigned num_target;
+		std::vector<outctl *> outputs;
 		std::map<uint16_t, unsigned> targets;
-#endif
+		//  the destination of the message being pulled
+		outctl *pulling;
+		//  the destination to write first in the next round
+		unsigned next_output;
+		size_t queued_bytes;
 		bool is_id_set = false;
 
         //  Metadata to be attached to received messages. May be NULL.
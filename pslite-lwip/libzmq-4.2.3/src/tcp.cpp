@@ -318,6 +318,20 @@ int zmq::tcp_read (fd_t s_, void *data_, size_t size_)
 #endif
 }
 
+int zmq::tcp_read_pbuf (fd_t s_, struct pbuf **p_)
+{
+    const ssize_t rc = lwip_recv_pbuf (s_, p_);
+
+    if (rc == -1) {
+        errno_assert (errno != EBADF
+                   && errno != ENOTSOCK);
+        if (errno == EWOULDBLOCK || errno == EINTR)
+            errno = EAGAIN;
+    }
+
+    return static_cast <int> (rc);
+}
+
 void zmq::tcp_assert_tuning_error (zmq::fd_t s_, int rc_)
 {
     if (rc_ == 0)
@@ -32,6 +32,8 @@
 
 #include "fd.hpp"
 
+struct pbuf;
+
 namespace zmq
 {
 
@@ -62,6 +64,10 @@ namespace zmq
     //  Zero indicates the peer has closed the connection.
     int tcp_read (fd_t s_, void *data_, size_t size_);
 
+    //  Takes the received pbuf chain instead of copying it, the caller
+    //  frees it. Returns its length, 0 or -1 as tcp_read does.
+    int tcp_read_pbuf (fd_t s_, struct pbuf **p_);
+
     //  Asserts that an internal error did not occur.  Does not assert
     //  on network errors such as reset or aborted connections.
     void tcp_assert_tuning_error (fd_t s_, int rc_);
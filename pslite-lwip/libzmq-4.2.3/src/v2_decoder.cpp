@@ -34,6 +34,7 @@
 
 #include "v2_protocol.hpp"
 #include "v2_decoder.hpp"
+#include "config.hpp"
 #include "likely.hpp"
 #include "wire.hpp"
 #include "err.hpp"
@@ -42,7 +43,12 @@ zmq::v2_decoder_t::v2_decoder_t (size_t bufsize_, int64_t maxmsgsize_) :
     shared_message_memory_allocator( bufsize_),
     decoder_base_t <v2_decoder_t, shared_message_memory_allocator> (this),
     msg_flags (0),
-    maxmsgsize (maxmsgsize_)
+    maxmsgsize (maxmsgsize_),
+    ext_data (NULL),
+    ext_size (0),
+    ext_ffn (NULL),
+    ext_ref (NULL),
+    ext_hint (NULL)
 {
     int rc = in_progress.init ();
     errno_assert (rc == 0);
@@ -57,6 +63,17 @@ zmq::v2_decoder_t::~v2_decoder_t ()
     errno_assert (rc == 0);
 }
 
+bool zmq::v2_decoder_t::set_external (unsigned char *data_, size_t size_,
+        void (*ffn_) (void *, void *), void (*ref_) (void *), void *hint_)
+{
+    ext_data = data_;
+    ext_size = size_;
+    ext_ffn = ffn_;
+    ext_ref = ref_;
+    ext_hint = hint_;
+    return true;
+}
+
 int zmq::v2_decoder_t::flags_ready (unsigned char const*)
 {
     msg_flags = 0;
@@ -115,9 +132,22 @@ int zmq::v2_decoder_t::size_ready(uint64_t msg_size, unsigned char const* read_p
     int rc = in_progress.close();
     assert(rc == 0);
 
+    if (ext_data) {
+        // decoding external memory, refer to it if the whole frame is there
+        // and large enough to be worth holding it, copy otherwise
+        if (msg_size >= in_zerocopy_min &&
+                read_pos + msg_size <= ext_data + ext_size) {
+            rc = in_progress.init_data ((unsigned char *) read_pos,
+                    static_cast <size_t> (msg_size), ext_ffn, ext_hint);
+            if (rc == 0)
+                ext_ref (ext_hint);
+        }
+        else
+            rc = in_progress.init_size (static_cast <size_t> (msg_size));
+    }
     // the current message can exceed the current buffer. We have to copy the buffer
     // data into a new message and complete it in the next receive.
-
+    else
     if (unlikely ((unsigned char*)read_pos + msg_size > (data() + size())))
     {
         // a new message has started, but the size would exceed the pre-allocated arena
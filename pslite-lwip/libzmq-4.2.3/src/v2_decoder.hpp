@@ -49,6 +49,9 @@ namespace zmq
 
         //  i_decoder interface.
         virtual msg_t *msg () { return &in_progress; }
+        virtual bool set_external (unsigned char *data_, size_t size_,
+                    void (*ffn_) (void *, void *), void (*ref_) (void *),
+                    void *hint_);
 
     private:
 
@@ -66,6 +69,13 @@ namespace zmq
 
         const int64_t maxmsgsize;
 
+        //  External memory being decoded, see set_external.
+        unsigned char *ext_data;
+        size_t ext_size;
+        void (*ext_ffn) (void *, void *);
+        void (*ext_ref) (void *);
+        void *ext_hint;
+
         v2_decoder_t (const v2_decoder_t&);
         void operator = (const v2_decoder_t&);
     };
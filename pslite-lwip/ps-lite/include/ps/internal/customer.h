@@ -96,6 +96,8 @@ class Customer {
   std::mutex tracker_mu_;
   std::condition_variable tracker_cond_;
   std::vector<std::pair<int, int>> tracker_;
+  /** \brief the time each request was issued, only kept if metrics are on */
+  std::vector<uint64_t> tracker_start_;
 
   Postoffice *office;
 
@@ -98,7 +98,7 @@ struct Node {
  */
 struct Control {
   /** \brief empty constructor */
-  Control() : cmd(EMPTY) { }
+  Control() : cmd(EMPTY), barrier_count(1) { }
   /** \brief return true is empty */
   inline bool empty() const { return cmd == EMPTY; }
   /** \brief get debug string */
@@ -113,7 +113,10 @@ struct Control {
       for (const Node& n : node) ss << " " << n.DebugString();
       ss << " }";
     }
-    if (cmd == BARRIER) ss << ", barrier_group=" << barrier_group;
+    if (cmd == BARRIER) {
+      ss << ", barrier_group=" << barrier_group
+         << ", barrier_count=" << barrier_count;
+    }
     if (cmd == ACK) ss << ", msg_sig=" << msg_sig;
     return ss.str();
   }
@@ -125,6 +128,8 @@ struct Control {
   std::vector<Node> node;
   /** \brief the node group for a barrier, such as kWorkerGroup */
   int barrier_group;
+  /** \brief the number of nodes a barrier request is sent for */
+  int barrier_count;
   /** message signature */
   uint64_t msg_sig;
 };
@@ -140,7 +145,8 @@ struct Meta {
   /** \brief default constructor */
   Meta() : head(kEmpty), customer_id(kEmpty), timestamp(kEmpty),
            sender(kEmpty), recver(kEmpty),
-           request(false), push(false), simple_app(false) {}
+           request(false), push(false), simple_app(false), seq(kEmpty),
+           is_hot(false), arrival(0) {}
   std::string DebugString() const {
     std::stringstream ss;
     if (sender == Node::kEmpty) {
@@ -151,6 +157,7 @@ struct Meta {
     ss <<  " => " << recver;
     ss << ". Meta: request=" << request;
     if (timestamp != kEmpty) ss << ", timestamp=" << timestamp;
+    if (seq != kEmpty) ss << ", seq=" << seq;
     if (!control.empty()) {
       ss << ", control={ " << control.DebugString() << " }";
     } else {
@@ -183,6 +190,8 @@ struct Meta {
   bool push;
   /** \brief whether or not it's for SimpleApp */
   bool simple_app;
+  /** \brief per receiver sequence number, set by the resender */
+  int seq;
   /** \brief an string body */
   std::string body;
   /** \brief data type of message.data[i] */
@@ -191,6 +200,8 @@ struct Meta {
   Control control;
 
   bool is_hot;
+  /** \brief local time the van received it, in ns. not sent */
+  uint64_t arrival;
 };
 /**
  * \brief messages that communicated amaong nodes.
@@ -0,0 +1,135 @@
+/**
+ *  Copyright (c) 2015 by Contributors
+ */
+#ifndef PS_INTERNAL_METRICS_H_
+#define PS_INTERNAL_METRICS_H_
+#include <stdint.h>
+#include <mutex>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <thread>
+#include <string>
+#include <ostream>
+#include <unordered_map>
+namespace ps {
+
+/**
+ * \brief log2 histogram, bucket i counts the values in [2^(i-1), 2^i)
+ */
+class Histogram {
+ public:
+  static const int kNumBuckets = 65;
+
+  void Add(uint64_t v) {
+    ++count_;
+    sum_ += v;
+    if (v > max_) max_ = v;
+    ++buckets_[v ? 64 - __builtin_clzll(v) : 0];
+  }
+  void Merge(const Histogram& h);
+  /** \brief write it as a json object */
+  void Dump(std::ostream& os) const;
+
+ private:
+  uint64_t count_ = 0;
+  uint64_t sum_ = 0;
+  uint64_t max_ = 0;
+  uint64_t buckets_[kNumBuckets] = {0};
+};
+
+/**
+ * \brief process wide counters and histograms of the van and customers
+ *
+ * Enabled by PS_METRICS_FILE. Every thread records into its own slot, and the
+ * slots are merged when dumped. A json line is appended to PS_METRICS_FILE
+ * every PS_METRICS_INTERVAL seconds, on SIGUSR2 and at exit.
+ */
+class Metrics {
+ public:
+  enum Hist {
+    /** time spent in Van::Send, ns */
+    kSendDelay,
+    /** time a message waits in a batch, ns */
+    kBatchDelay,
+    /** time from the van receiving a message to the customer handling it, ns */
+    kRecvDelay,
+    /** sent message size, bytes */
+    kSendSize,
+    /** received message size, bytes */
+    kRecvSize,
+    /** time spent in Postoffice::Barrier, ns */
+    kBarrierDelay,
+    /** time for a van to start and get its node id, ns */
+    kStartDelay,
+    /** time from the process start to its first push request, ns */
+    kFirstPush,
+    kNumHists
+  };
+  enum Counter {
+    kSendMsgs, kSendBytes, kRecvMsgs, kRecvBytes,
+    kHotMsgs, kHotBytes, kColdMsgs, kColdBytes,
+    kNumCounters
+  };
+
+  /** \brief return the singleton instance */
+  static Metrics* Get() {
+    static Metrics inst;
+    return &inst;
+  }
+  ~Metrics();
+
+  bool enabled() const { return enabled_; }
+  /** \brief monotonic time in ns */
+  static uint64_t Now();
+
+  void Add(Hist h, uint64_t v) {
+    Local* l = local();
+    std::lock_guard<std::mutex> lk(l->mu);
+    l->hist[h].Add(v);
+  }
+  void Inc(Counter c, uint64_t v = 1) {
+    Local* l = local();
+    std::lock_guard<std::mutex> lk(l->mu);
+    l->counter[c] += v;
+  }
+  /** \brief round trip time of a request, ns */
+  void AddRTT(int customer_id, bool push, uint64_t v) {
+    Local* l = local();
+    std::lock_guard<std::mutex> lk(l->mu);
+    l->rtt[customer_id * 2 + push].Add(v);
+  }
+  /** \brief record the time to the first push, only the first call counts */
+  void FirstPush() {
+    if (!first_push_.exchange(true)) Add(kFirstPush, Now() - start_);
+  }
+  /** \brief append the merged metrics to the file */
+  void Dump();
+
+ private:
+  Metrics();
+  void Dumping();
+
+  /** the slot of a thread, its lock is only contended while dumping */
+  struct Local {
+    std::mutex mu;
+    Histogram hist[kNumHists];
+    uint64_t counter[kNumCounters] = {0};
+    /** customer_id * 2 + push -> rtt */
+    std::unordered_map<int, Histogram> rtt;
+  };
+  Local* local();
+
+  bool enabled_ = false;
+  uint64_t start_;
+  std::atomic<bool> first_push_{false};
+  std::string file_;
+  int interval_ = 0;
+  std::mutex mu_;
+  std::vector<std::unique_ptr<Local>> locals_;
+  std::atomic<bool> exit_{false};
+  std::unique_ptr<std::thread> dump_thread_;
+};
+
+}  // namespace ps
+#endif  // PS_INTERNAL_METRICS_H_
@@ -8,6 +8,7 @@
 #include <vector>
 #include <map>
 #include <pthread.h>
+#include <condition_variable>
 #include "ps/range.h"
 #include "ps/internal/env.h"
 #include "ps/internal/customer.h"
@@ -149,6 +150,10 @@ class Postoffice {
    * \param node_id the barrier group id
    */
   void Barrier(int node_id);
+  /**
+   * \brief wake up the thread waiting in \ref Barrier
+   */
+  void BarrierDone();
   /**
    * \brief process a control message, called by van
    * \param the received message
@@ -180,6 +185,8 @@ class Postoffice {
 
   Van* van_;
   mutable std::mutex mu_;
+  /** \brief signaled when a customer is added */
+  mutable std::condition_variable customer_cond_;
   std::unordered_map<int, Customer*> customers_;
   std::unordered_map<int, std::vector<int>> node_ids_;
   std::vector<Range> server_key_ranges_;
@@ -238,6 +245,17 @@ class Postctl {
 		int verbose() const { return verbose_; }
 
 		void addThread(int id, Postoffice *po);
+		/** \brief called by a task once it has registered to the scheduler */
+		void TaskStarted();
+		/**
+		 * \brief a local task arrives at a barrier of group
+		 * \return the number of local tasks in the group if po is the
+		 * last one to arrive, which sends the request for all of them.
+		 * 0 otherwise
+		 */
+		int ArriveBarrier(int group, Postoffice *po);
+		/** \brief release the local tasks waiting at a barrier of group */
+		void ReleaseBarrier(int group);
 		int startTasks(int argc, char *argv[]);
 
 //		Postoffice *GetOffice(void);
@@ -250,6 +268,14 @@ class Postctl {
   		std::vector<Posttask *> tasklist;
 		std::map<int, Postoffice *> taskmap;
 		pthread_mutex_t map_lock;
+		/** the local tasks arrived at a barrier, per group */
+		std::map<int, std::vector<Postoffice *>> barrier_arrived;
+		pthread_mutex_t barrier_lock;
+		/** the number of tasks registered to the scheduler */
+		unsigned num_started_;
+		std::mutex started_mu_;
+		std::condition_variable started_cond_;
+		unsigned LocalMembers(int group);
 		int local_workers_, num_workers_;
 		int local_servers_, num_servers_;
 		int verbose_;
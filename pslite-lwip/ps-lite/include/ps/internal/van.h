@@ -11,6 +11,8 @@
 #include <memory>
 #include <atomic>
 #include <ctime>
+#include <chrono>
+#include <condition_variable>
 #include "ps/base.h"
 #include "ps/internal/message.h"
 namespace ps {
@@ -21,6 +23,10 @@ class Postoffice;
  *
  * If environment variable PS_RESEND is set to be 1, then van will resend a
  * message if it no ACK messsage is received within PS_RESEND_TIMEOUT millisecond
+ *
+ * If PS_BATCH_BYTES is set, small cold data messages to the same node are
+ * packed into one message, which is sent once it reaches PS_BATCH_BYTES or
+ * PS_BATCH_DELAY_US microseconds after its first message was packed.
  */
 class Van {
  public:
@@ -94,6 +100,11 @@ class Van {
    * \return the number of bytes sent
    */
   virtual int SendMsg(const Message& msg) = 0;
+  /**
+   * \brief whether servers and workers connect to each other directly,
+   * otherwise data goes through the switch
+   */
+  virtual bool PeerToPeer() const { return false; }
   /**
    * \brief pack meta into a string
    */
@@ -118,8 +129,26 @@ class Van {
   void ReceivingData();
   /** thread function for heartbeat */
   void Heartbeat();
+  /** set ready_ and wake up \ref Start */
+  void SetReady(bool ready);
+  /** \brief the entries of all that node needs in its ADD_NODE reply */
+  void NodeTable(const std::vector<Node>& all, const Node& node,
+                 std::vector<Node>* table);
+  /** thread function for sending batches whose deadline expired */
+  void Flushing();
+  /**
+   * \brief pack a data message into the batch of its receiver
+   * \return the number of bytes packed. 0 if msg cannot be batched
+   */
+  int AddToBatch(const Message& msg);
+  /** \brief send the batch to recver, batch_mu_ must be held */
+  void FlushBatch(int recver);
+  /** \brief split a received batch into the messages packed in it */
+  void Unbatch(const Message& batch, std::vector<Message>* msgs);
   /** whether it is ready for sending */
   std::atomic<bool> ready_{false};
+  std::mutex ready_mu_;
+  std::condition_variable ready_cond_;
   std::atomic<size_t> send_bytes_{0};
   size_t recv_bytes_ = 0;
   int num_servers_ = 0;
@@ -131,10 +160,25 @@ class Van {
   /** the thread for sending heartbeat */
   std::unique_ptr<std::thread> heartbeat_thread_;
   std::vector<int> barrier_count_;
+  /** the nodes which sent a barrier request, per group */
+  std::vector<std::vector<int>> barrier_reps_;
   /** msg resender */
   Resender* resender_ = nullptr;
   int drop_rate_ = 0;
   std::atomic<int> timestamp_{0};
+  /** messages packed for one receiver */
+  struct Batch {
+    std::shared_ptr<std::vector<char>> buf;
+    std::chrono::steady_clock::time_point deadline;
+  };
+  /** flush a batch once it reaches this size, 0 disables batching */
+  size_t batch_bytes_ = 0;
+  std::chrono::microseconds batch_delay_{50};
+  std::unordered_map<int, Batch> batches_;
+  std::mutex batch_mu_;
+  std::condition_variable batch_cond_;
+  bool batch_stop_ = false;
+  std::unique_ptr<std::thread> flush_thread_;
   DISALLOW_COPY_AND_ASSIGN(Van);
 };
 }  // namespace ps
@@ -3,6 +3,7 @@
  */
 #include "ps/internal/customer.h"
 #include "ps/internal/postoffice.h"
+#include "ps/internal/metrics.h"
 namespace ps {
 
 const int Node::kEmpty = std::numeric_limits<int>::max();
@@ -27,6 +28,7 @@ int Customer::NewRequest(int recver) {
   std::lock_guard<std::mutex> lk(tracker_mu_);
   int num = office->GetNodeIDs(recver).size();
   tracker_.push_back(std::make_pair(num, 0));
+  if (Metrics::Get()->enabled()) tracker_start_.push_back(Metrics::Now());
   return tracker_.size() - 1;
 }
 
@@ -55,10 +57,18 @@ void Customer::Receiving() {
         recv.meta.control.cmd == Control::TERMINATE) {
       break;
     }
+    if (recv.meta.arrival) {
+      Metrics::Get()->Add(Metrics::kRecvDelay, Metrics::Now() - recv.meta.arrival);
+    }
     recv_handle_(recv);
     if (!recv.meta.request) {
       std::lock_guard<std::mutex> lk(tracker_mu_);
-      tracker_[recv.meta.timestamp].second++;
+      auto& t = tracker_[recv.meta.timestamp];
+      t.second++;
+      if (t.first == t.second && (size_t)recv.meta.timestamp < tracker_start_.size()) {
+        Metrics::Get()->AddRTT(id_, recv.meta.push,
+                               Metrics::Now() - tracker_start_[recv.meta.timestamp]);
+      }
       tracker_cond_.notify_all();
     }
   }
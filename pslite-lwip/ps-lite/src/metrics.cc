@@ -0,0 +1,131 @@
+/**
+ *  Copyright (c) 2015 by Contributors
+ */
+#include <signal.h>
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include "ps/internal/metrics.h"
+#include "ps/internal/env.h"
+#include "ps/internal/utils.h"
+namespace ps {
+
+static volatile sig_atomic_t dump_requested = 0;
+
+static void DumpSignal(int sig) {
+  dump_requested = 1;
+}
+
+void Histogram::Merge(const Histogram& h) {
+  count_ += h.count_;
+  sum_ += h.sum_;
+  if (h.max_ > max_) max_ = h.max_;
+  for (int i = 0; i < kNumBuckets; ++i) buckets_[i] += h.buckets_[i];
+}
+
+void Histogram::Dump(std::ostream& os) const {
+  int last = kNumBuckets - 1;
+  while (last > 0 && !buckets_[last]) --last;
+  os << "{\"count\":" << count_ << ",\"sum\":" << sum_
+     << ",\"max\":" << max_ << ",\"buckets\":[";
+  for (int i = 0; i <= last; ++i) os << (i ? "," : "") << buckets_[i];
+  os << "]}";
+}
+
+Metrics::Metrics() {
+  start_ = Now();
+  const char* val = Environment::Get()->find("PS_METRICS_FILE");
+  if (!val || !*val) return;
+  file_ = val;
+  interval_ = GetEnv("PS_METRICS_INTERVAL", 10);
+  enabled_ = true;
+  signal(SIGUSR2, DumpSignal);
+  dump_thread_ = std::unique_ptr<std::thread>(
+      new std::thread(&Metrics::Dumping, this));
+}
+
+Metrics::~Metrics() {
+  if (!enabled_) return;
+  exit_ = true;
+  dump_thread_->join();
+  Dump();
+}
+
+uint64_t Metrics::Now() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+Metrics::Local* Metrics::local() {
+  static thread_local Local* l = nullptr;
+  if (!l) {
+    std::lock_guard<std::mutex> lk(mu_);
+    locals_.emplace_back(new Local);
+    l = locals_.back().get();
+  }
+  return l;
+}
+
+void Metrics::Dump() {
+  Histogram hist[kNumHists];
+  uint64_t counter[kNumCounters] = {0};
+  std::unordered_map<int, Histogram> rtt;
+  {
+    std::lock_guard<std::mutex> lk(mu_);
+    for (auto& l : locals_) {
+      std::lock_guard<std::mutex> llk(l->mu);
+      for (int i = 0; i < kNumHists; ++i) hist[i].Merge(l->hist[i]);
+      for (int i = 0; i < kNumCounters; ++i) counter[i] += l->counter[i];
+      for (const auto& it : l->rtt) rtt[it.first].Merge(it.second);
+    }
+  }
+
+  static const char* hist_names[kNumHists] = {
+    "send_delay_ns", "batch_delay_ns", "recv_delay_ns",
+    "send_size", "recv_size", "barrier_ns", "start_ns",
+    "first_push_ns"
+  };
+  static const char* counter_names[kNumCounters] = {
+    "send_msgs", "send_bytes", "recv_msgs", "recv_bytes",
+    "hot_msgs", "hot_bytes", "cold_msgs", "cold_bytes"
+  };
+  std::stringstream ss;
+  ss << "{\"time\":" << std::chrono::duration_cast<std::chrono::milliseconds>(
+      std::chrono::system_clock::now().time_since_epoch()).count();
+  for (int i = 0; i < kNumCounters; ++i) {
+    ss << ",\"" << counter_names[i] << "\":" << counter[i];
+  }
+  for (int i = 0; i < kNumHists; ++i) {
+    ss << ",\"" << hist_names[i] << "\":";
+    hist[i].Dump(ss);
+  }
+  ss << ",\"rtt_ns\":[";
+  bool first = true;
+  for (const auto& it : rtt) {
+    ss << (first ? "" : ",") << "{\"customer_id\":" << it.first / 2
+       << ",\"push\":" << it.first % 2 << ",\"hist\":";
+    it.second.Dump(ss);
+    ss << "}";
+    first = false;
+  }
+  ss << "]}\n";
+
+  std::ofstream out(file_, std::ios::app);
+  out << ss.str();
+}
+
+void Metrics::Dumping() {
+  auto last = std::chrono::steady_clock::now();
+  while (!exit_) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    auto now = std::chrono::steady_clock::now();
+    if (dump_requested ||
+        (interval_ > 0 && now - last >= std::chrono::seconds(interval_))) {
+      dump_requested = 0;
+      last = now;
+      Dump();
+    }
+  }
+}
+
+}  // namespace ps
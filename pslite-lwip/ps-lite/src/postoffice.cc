@@ -9,6 +9,7 @@
 #include "ps/internal/postoffice.h"
 #include "ps/internal/message.h"
 #include "ps/base.h"
+#include "ps/internal/metrics.h"
 
 #include "src/model/lr/lr_worker.h"
 #include "src/model/fm/fm_worker.h"
@@ -104,8 +105,12 @@ Postctl::Postctl() {
 //  is_server_ = role == "server";
 //  is_scheduler_ = role == "scheduler";
   verbose_ = GetEnv("PS_VERBOSE", 0);
+  num_started_ = 0;
+  // the time to first push is counted from here
+  Metrics::Get();
 
   pthread_mutex_init(&map_lock, NULL);
+  pthread_mutex_init(&barrier_lock, NULL);
 }
 
 Postctl::~Postctl() {
@@ -132,6 +137,53 @@ int Postctl::init(void) {
 }
 
 
+unsigned Postctl::LocalMembers(int group)
+{
+	unsigned n = 0;
+
+	for (auto t : tasklist) {
+		if ((t->role == TASK_SCHEDULER && (group & kScheduler)) ||
+			(t->role == TASK_SERVER && (group & kServerGroup)) ||
+			(t->role == TASK_WORKER && (group & kWorkerGroup)))
+			n++;
+	}
+	return n;
+}
+
+int Postctl::ArriveBarrier(int group, Postoffice *po)
+{
+	int n = 0;
+
+	pthread_mutex_lock(&barrier_lock);
+	auto& arrived = barrier_arrived[group];
+	arrived.push_back(po);
+	if (arrived.size() == LocalMembers(group))
+		n = arrived.size();
+	pthread_mutex_unlock(&barrier_lock);
+	return n;
+}
+
+void Postctl::ReleaseBarrier(int group)
+{
+	std::vector<Postoffice *> arrived;
+
+	pthread_mutex_lock(&barrier_lock);
+	arrived.swap(barrier_arrived[group]);
+	pthread_mutex_unlock(&barrier_lock);
+
+	for (auto po : arrived)
+		po->BarrierDone();
+}
+
+void Postctl::TaskStarted()
+{
+	{
+		std::lock_guard<std::mutex> lk(started_mu_);
+		num_started_++;
+	}
+	started_cond_.notify_all();
+}
+
 void Postctl::addThread(int id, Postoffice *po)
 {
 	pthread_mutex_lock(&map_lock);
@@ -234,7 +286,11 @@ int Postctl::startTasks(int argc, char *argv[]) {
 				fprintf(stderr, "Failed to create task thread\n");
 				return -1;
 			}
-    		std::this_thread::sleep_for(std::chrono::milliseconds(1000));
+			// start the next task once this one has registered to the
+			// scheduler, the timeout only guards against a task that dies
+			std::unique_lock<std::mutex> lk(started_mu_);
+			started_cond_.wait_for(lk, std::chrono::milliseconds(1000),
+							[this, i] { return num_started_ > i; });
 		}
 	}
 
@@ -256,7 +312,9 @@ Posttask::Posttask(int s, int w, unsigned r, int v)
 }
 
 Postoffice::Postoffice(int servers, int workers, unsigned role, int v) {
-	van_ = Van::Create("zmq", this);
+	const char *van_type = Environment::Get()->find("PS_VAN_TYPE");
+
+	van_ = Van::Create(van_type ? van_type : "zmq", this);
 	num_servers_ = servers;
 	num_workers_ = workers;
 
@@ -303,7 +361,9 @@ void Postoffice::Start(const char* argv0, const bool do_barrier) {
   }
 
   // start van
+  uint64_t start = Metrics::Get()->enabled() ? Metrics::Now() : 0;
   van_->Start();
+  if (start) Metrics::Get()->Add(Metrics::kStartDelay, Metrics::Now() - start);
   // record start time
   start_time_ = time(NULL);
 
@@ -321,10 +381,13 @@ void Postoffice::Finalize(const bool do_barrier) {
 
 
 void Postoffice::AddCustomer(Customer* customer) {
-  std::lock_guard<std::mutex> lk(mu_);
-  int id = CHECK_NOTNULL(customer)->id();
-  CHECK_EQ(customers_.count(id), (size_t)0) << "id " << id << " already exists";
-  customers_[id] = customer;
+  {
+    std::lock_guard<std::mutex> lk(mu_);
+    int id = CHECK_NOTNULL(customer)->id();
+    CHECK_EQ(customers_.count(id), (size_t)0) << "id " << id << " already exists";
+    customers_[id] = customer;
+  }
+  customer_cond_.notify_all();
 }
 
 
@@ -336,19 +399,12 @@ void Postoffice::RemoveCustomer(Customer* customer) {
 
 
 Customer* Postoffice::GetCustomer(int id, int timeout) const {
-  Customer* obj = nullptr;
-  for (int i = 0; i < timeout*1000+1; ++i) {
-    {
-      std::lock_guard<std::mutex> lk(mu_);
-      const auto it = customers_.find(id);
-      if (it != customers_.end()) {
-        obj = it->second;
-        break;
-      }
-    }
-    std::this_thread::sleep_for(std::chrono::milliseconds(1));
-  }
-  return obj;
+  std::unique_lock<std::mutex> lk(mu_);
+  customer_cond_.wait_for(lk, std::chrono::seconds(timeout), [this, id] {
+      return customers_.find(id) != customers_.end();
+    });
+  const auto it = customers_.find(id);
+  return it != customers_.end() ? it->second : nullptr;
 }
 
 void Postoffice::Barrier(int node_group) {
@@ -362,19 +418,38 @@ void Postoffice::Barrier(int node_group) {
     CHECK(node_group & kServerGroup);
   }
 
-  std::unique_lock<std::mutex> ulk(barrier_mu_);
-  barrier_done_ = false;
-  Message req;
-  req.meta.recver = kScheduler;
-  req.meta.request = true;
-  req.meta.control.cmd = Control::BARRIER;
-  req.meta.control.barrier_group = node_group;
-  req.meta.timestamp = van_->GetTimestamp();
-  CHECK_GT(van_->Send(req), 0);
+  uint64_t start = Metrics::Get()->enabled() ? Metrics::Now() : 0;
+  {
+    std::lock_guard<std::mutex> lk(barrier_mu_);
+    barrier_done_ = false;
+  }
+
+  // the last local node of the group to arrive tells the scheduler for all
+  // of them, and the reply releases all of them
+  int count = Postctl::Get()->ArriveBarrier(node_group, this);
+  if (count > 0) {
+    Message req;
+    req.meta.recver = kScheduler;
+    req.meta.request = true;
+    req.meta.control.cmd = Control::BARRIER;
+    req.meta.control.barrier_group = node_group;
+    req.meta.control.barrier_count = count;
+    req.meta.timestamp = van_->GetTimestamp();
+    CHECK_GT(van_->Send(req), 0);
+  }
 
+  std::unique_lock<std::mutex> ulk(barrier_mu_);
   barrier_cond_.wait(ulk, [this] {
       return barrier_done_;
     });
+  if (start) Metrics::Get()->Add(Metrics::kBarrierDelay, Metrics::Now() - start);
+}
+
+void Postoffice::BarrierDone() {
+  barrier_mu_.lock();
+  barrier_done_ = true;
+  barrier_mu_.unlock();
+  barrier_cond_.notify_all();
 }
 
 const std::vector<Range>& Postoffice::GetServerKeyRanges() {
@@ -392,10 +467,7 @@ void Postoffice::Manage(const Message& recv) {
   CHECK(!recv.meta.control.empty());
   const auto& ctrl = recv.meta.control;
   if (ctrl.cmd == Control::BARRIER && !recv.meta.request) {
-    barrier_mu_.lock();
-    barrier_done_ = true;
-    barrier_mu_.unlock();
-    barrier_cond_.notify_all();
+    Postctl::Get()->ReleaseBarrier(ctrl.barrier_group);
   }
 }
 
@@ -5,12 +5,23 @@
 #define PS_RESENDER_H_
 #include <chrono>
 #include <vector>
-#include <unordered_set>
+#include <algorithm>
+#include <map>
 #include <unordered_map>
 namespace ps {
 
 /**
  * \brief resend a messsage if no ack is received within a given time
+ *
+ * Every message sent to a node gets the next sequence number of that node.
+ * The receiver keeps a fixed size window per sender: all sequence numbers
+ * below base are received, and a bitmap marks the received ones in
+ * [base, base + kWindow). ACKs are cumulative: msg_sig carries base in the
+ * high 32 bits and the received bits of base+1 ... base+32 in the low 32
+ * bits. They are sent every kAckBatch messages or on the next timer tick.
+ *
+ * Retransmission deadlines live in a timer wheel ticking every timeout/16
+ * ms, so the monitor only visits the messages that are due.
  */
 class Resender {
  public:
@@ -21,6 +32,8 @@ class Resender {
     timeout_ = timeout;
     max_num_retry_ = max_num_retry;
     van_ = van;
+    tick_ = std::max(1, timeout / 16);
+    last_tick_ = Now().count() / tick_;
     monitor_ = new std::thread(&Resender::Monitoring, this);
   }
   ~Resender() {
@@ -31,21 +44,23 @@ class Resender {
   }
 
   /**
-   * \brief add an outgoining message
+   * \brief add an outgoining message, and assign it a sequence number
    *
+   * a message already having a sequence number is a resent one
    */
-  void AddOutgoing(const Message& msg) {
-    if (msg.meta.control.cmd == Control::ACK) return;
-    CHECK_NE(msg.meta.timestamp, Meta::kEmpty) << msg.DebugString();
-    auto key = GetKey(msg);
+  void AddOutgoing(Message* msg) {
+    if (msg->meta.control.cmd == Control::ACK) return;
+    if (msg->meta.seq != Meta::kEmpty) return;
+    int recver = msg->meta.recver;
     std::lock_guard<std::mutex> lk(mu_);
-    // already buffered, which often due to call Send by the monitor thread
-    if (send_buff_.find(key) != send_buff_.end()) return;
+    int seq = next_seq_[recver]++;
+    msg->meta.seq = seq;
 
-    auto& ent = send_buff_[key];
-    ent.msg = msg;
+    auto& ent = send_buff_[recver][seq];
+    ent.msg = *msg;
     ent.send = Now();
     ent.num_retry = 0;
+    Schedule(recver, seq, ent.send + Time(timeout_));
   }
 
   /**
@@ -57,26 +72,33 @@ class Resender {
     if (msg.meta.control.cmd == Control::TERMINATE) {
       return false;
     } else if (msg.meta.control.cmd == Control::ACK) {
-      mu_.lock();
-      auto key = msg.meta.control.msg_sig;
-      auto it = send_buff_.find(key);
-      if (it != send_buff_.end()) send_buff_.erase(it);
-      mu_.unlock();
+      uint32_t base = msg.meta.control.msg_sig >> 32;
+      uint32_t bits = msg.meta.control.msg_sig & 0xffffffff;
+      std::lock_guard<std::mutex> lk(mu_);
+      auto it = send_buff_.find(msg.meta.sender);
+      if (it == send_buff_.end()) return true;
+      auto& buff = it->second;
+      buff.erase(buff.begin(), buff.lower_bound(base));
+      for (int i = 0; bits; ++i, bits >>= 1) {
+        if (bits & 1) buff.erase(base + 1 + i);
+      }
       return true;
+    } else if (msg.meta.seq == Meta::kEmpty) {
+      // sent before the resender started
+      return false;
     } else {
+      int sender = msg.meta.sender;
+      bool duplicated, send_ack;
+      uint64_t sig;
       mu_.lock();
-      auto key = GetKey(msg);
-      auto it = acked_.find(key);
-      bool duplicated = it != acked_.end();
-      if (!duplicated) acked_.insert(key);
+      auto& win = recv_win_[sender];
+      duplicated = !Mark(&win, msg.meta.seq);
+      // the ack of a duplicated message was lost, resend it at once
+      send_ack = duplicated || ++win.unacked >= kAckBatch;
+      sig = AckSig(win);
+      if (send_ack) win.unacked = 0;
       mu_.unlock();
-      // send back ack message (even if it is duplicated)
-      Message ack;
-      ack.meta.recver = msg.meta.sender;
-      ack.meta.sender = msg.meta.recver;
-      ack.meta.control.cmd = Control::ACK;
-      ack.meta.control.msg_sig = key;
-      van_->Send(ack);
+      if (send_ack) SendAck(sender, sig);
       // warning
       if (duplicated) LOG(WARNING) << "Duplicated message: " << msg.DebugString();
       return duplicated;
@@ -85,53 +107,139 @@ class Resender {
 
  private:
   using Time = std::chrono::milliseconds;
+  /** the number of sequence numbers tracked per sender */
+  static const int kWindow = 4096;
+  /** send an ack after receiving this many messages */
+  static const int kAckBatch = 32;
+  static const int kWheelSlots = 256;
   // the buffer entry
   struct Entry {
     Message msg;
     Time send;
     int num_retry = 0;
   };
-  std::unordered_map<uint64_t, Entry> send_buff_;
+  /** receiving window of a sender */
+  struct Window {
+    uint32_t base = 0;
+    uint64_t bits[kWindow / 64] = {0};
+    int unacked = 0;
+  };
+  /** a retransmission deadline */
+  struct Timer {
+    int recver;
+    int seq;
+    int64_t tick;
+  };
+  /** recver -> seq -> message not acked yet */
+  std::unordered_map<int, std::map<uint32_t, Entry>> send_buff_;
+  std::unordered_map<int, int> next_seq_;
+  std::unordered_map<int, Window> recv_win_;
+  std::vector<Timer> wheel_[kWheelSlots];
+  int64_t last_tick_;
+  int tick_;
 
-  uint64_t GetKey(const Message& msg) {
-    CHECK_NE(msg.meta.timestamp, Meta::kEmpty) << msg.DebugString();
-    uint16_t id = msg.meta.customer_id;
-    uint8_t sender = msg.meta.sender == Node::kEmpty ?
-                     van_->my_node().id : msg.meta.sender;
-    uint8_t recver = msg.meta.recver;
-    return (static_cast<uint64_t>(id) << 48) |
-        (static_cast<uint64_t>(sender) << 40) |
-        (static_cast<uint64_t>(recver) << 32) |
-        (msg.meta.timestamp << 1) | msg.meta.request;
-  }
   Time Now() {
     return std::chrono::duration_cast<Time>(
         std::chrono::high_resolution_clock::now().time_since_epoch());
   }
 
+  /** \brief must hold mu_ */
+  void Schedule(int recver, int seq, Time deadline) {
+    int64_t tick = deadline.count() / tick_;
+    if (tick <= last_tick_) tick = last_tick_ + 1;
+    wheel_[tick % kWheelSlots].push_back(Timer{recver, seq, tick});
+  }
+
+  bool Test(const Window& win, uint32_t seq) {
+    return win.bits[(seq % kWindow) / 64] & (1ULL << (seq % 64));
+  }
+
+  /**
+   * \brief mark seq as received
+   * \return false if it was received before
+   */
+  bool Mark(Window* win, uint32_t seq) {
+    if (seq < win->base) return false;
+    if (seq >= win->base + kWindow) {
+      // too far ahead, give up on the oldest missing ones
+      LOG(WARNING) << "resend window overflow, skip "
+                   << seq - kWindow + 1 - win->base << " messages";
+      while (win->base <= seq - kWindow) {
+        win->bits[(win->base % kWindow) / 64] &= ~(1ULL << (win->base % 64));
+        ++win->base;
+      }
+    }
+    if (Test(*win, seq)) return false;
+    win->bits[(seq % kWindow) / 64] |= 1ULL << (seq % 64);
+    while (Test(*win, win->base)) {
+      win->bits[(win->base % kWindow) / 64] &= ~(1ULL << (win->base % 64));
+      ++win->base;
+    }
+    return true;
+  }
+
+  uint64_t AckSig(const Window& win) {
+    uint64_t sig = static_cast<uint64_t>(win.base) << 32;
+    for (uint32_t i = 0; i < 32; ++i) {
+      if (Test(win, win.base + 1 + i)) sig |= 1ULL << i;
+    }
+    return sig;
+  }
+
+  void SendAck(int recver, uint64_t sig) {
+    Message ack;
+    ack.meta.recver = recver;
+    ack.meta.control.cmd = Control::ACK;
+    ack.meta.control.msg_sig = sig;
+    van_->Send(ack);
+  }
+
   void Monitoring() {
     while (!exit_) {
-      std::this_thread::sleep_for(Time(timeout_));
+      std::this_thread::sleep_for(Time(tick_));
       std::vector<Message> resend;
+      std::vector<std::pair<int, uint64_t>> acks;
       Time now = Now();
+      int64_t cur = now.count() / tick_;
       mu_.lock();
-      for (auto& it : send_buff_) {
-        if (it.second.send + Time(timeout_) * (1+it.second.num_retry) < now) {
-          resend.push_back(it.second.msg);
-          ++it.second.num_retry;
+      for (; last_tick_ < cur; ++last_tick_) {
+        auto& slot = wheel_[(last_tick_ + 1) % kWheelSlots];
+        std::vector<Timer> timers;
+        timers.swap(slot);
+        for (const auto& t : timers) {
+          // one round later
+          if (t.tick > last_tick_ + 1) {
+            slot.push_back(t);
+            continue;
+          }
+          auto buff = send_buff_.find(t.recver);
+          if (buff == send_buff_.end()) continue;
+          auto it = buff->second.find(t.seq);
+          // acked already
+          if (it == buff->second.end()) continue;
+          auto& ent = it->second;
+          resend.push_back(ent.msg);
+          ++ent.num_retry;
           LOG(WARNING) << van_->my_node().ShortDebugString()
                        << ": Timeout to get the ACK message. Resend (retry="
-                       << it.second.num_retry << ") " << it.second.msg.DebugString();
-          CHECK_LT(it.second.num_retry, max_num_retry_);
+                       << ent.num_retry << ") " << ent.msg.DebugString();
+          CHECK_LT(ent.num_retry, max_num_retry_);
+          Schedule(t.recver, t.seq, now + Time(timeout_) * (1 + ent.num_retry));
         }
       }
+      // flush the batched acks
+      for (auto& it : recv_win_) {
+        if (it.second.unacked == 0) continue;
+        acks.push_back(std::make_pair(it.first, AckSig(it.second)));
+        it.second.unacked = 0;
+      }
       mu_.unlock();
 
+      for (const auto& ack : acks) SendAck(ack.first, ack.second);
       for (const auto& msg : resend) van_->Send(msg);
     }
   }
   std::thread* monitor_;
-  std::unordered_set<uint64_t> acked_;
   std::atomic<bool> exit_{false};
   std::mutex mu_;
   int timeout_;
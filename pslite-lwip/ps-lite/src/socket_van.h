@@ -0,0 +1,628 @@
+/**
+ *  Copyright (c) 2015 by Contributors
+ */
+#ifndef PS_SOCKET_VAN_H_
+#define PS_SOCKET_VAN_H_
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <netdb.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <deque>
+#include <condition_variable>
+#include <thread>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <unordered_map>
+#include "ps/internal/van.h"
+
+namespace ps {
+
+class Postoffice;
+
+/**
+ * \brief Linux kernel TCP + epoll based implementation
+ *
+ * It needs no DPDK NIC, so it is used as a fallback and as the baseline when
+ * measuring the lwip/dpdk van. Select it with PS_VAN_TYPE=socket.
+ *
+ * Every message keeps the zmq van framing, i.e. identity (sender id), meta
+ * and data frames, but goes out in a single sendmsg() call. Data messages are
+ * sent directly to the peer instead of through the switch.
+ *
+ * The receiving threads never block on a peer: connections are dialed by a
+ * thread of their own and the hello of an accepted connection is read as
+ * it arrives, so a slow or dead peer only delays the messages to it.
+ */
+class SocketVan : public Van {
+ public:
+  SocketVan(Postoffice *po) : Van(po) { }
+  virtual ~SocketVan() { }
+
+ protected:
+  void Start() override {
+    ctrl_.epfd = epoll_create1(EPOLL_CLOEXEC);
+    CHECK_GE(ctrl_.epfd, 0) << "epoll_create failed: " << strerror(errno);
+    data_.epfd = epoll_create1(EPOLL_CLOEXEC);
+    CHECK_GE(data_.epfd, 0) << "epoll_create failed: " << strerror(errno);
+    Van::Start();
+  }
+
+  void Stop() override {
+    PS_VLOG(1) << my_node_.ShortDebugString() << " is stopping";
+    Van::Stop();
+
+	dial_stop_ = true;
+	{
+		std::lock_guard<std::mutex> lk(dial_mu_);
+		for (auto& t : dialers_)
+			t.join();
+		dialers_.clear();
+	}
+
+	{
+		std::lock_guard<std::mutex> lk(mu_);
+		senders_.clear();
+	}
+	{
+		std::lock_guard<std::mutex> lk(conn_mu_);
+		for (auto& it : conns_)
+			close(it.first);
+		conns_.clear();
+	}
+	if (listener_ >= 0) {
+		close(listener_);
+		listener_ = -1;
+	}
+	close(ctrl_.epfd);
+	close(data_.epfd);
+  }
+
+  int Bind(const Node& node, int max_retry) override {
+	int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	int one = 1;
+
+	CHECK_GE(fd, 0) << "create receiver socket failed: " << strerror(errno);
+	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+    int port = node.port;
+    unsigned seed = static_cast<unsigned>(time(NULL)+port);
+    for (int i = 0; i < max_retry+1; ++i) {
+	  struct sockaddr_in addr;
+
+	  memset(&addr, 0, sizeof(addr));
+	  addr.sin_family = AF_INET;
+	  addr.sin_addr.s_addr = htonl(INADDR_ANY);
+	  addr.sin_port = htons(port);
+	  fprintf(stdout, "[%s][%d]: bind to port %d, retry %d.\n",
+					  __FILE__, __LINE__, port, i);
+      if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0 &&
+		  listen(fd, SOMAXCONN) == 0) break;
+      if (i == max_retry) {
+		close(fd);
+        return -1;
+      } else {
+        port = 10000 + rand_r(&seed) % 40000;
+      }
+    }
+
+	struct epoll_event ev;
+
+	ev.events = EPOLLIN;
+	ev.data.ptr = nullptr;
+	CHECK_EQ(epoll_ctl(ctrl_.epfd, EPOLL_CTL_ADD, fd, &ev), 0)
+			<< "epoll_ctl failed: " << strerror(errno);
+	listener_ = fd;
+    return port;
+  }
+
+  int Connect(const Node &node) override {
+	// no switch on this van, data goes to the peer directly
+	if (node.role == Node::SWITCH)
+		return 0;
+	// servers only talk to workers and vice versa
+	if (my_node_.role != Node::SCHEDULER && node.role != Node::SCHEDULER &&
+					node.role == my_node_.role)
+		return 0;
+
+    CHECK_NE(node.id, node.kEmpty);
+    CHECK_NE(node.port, node.kEmpty);
+    CHECK(node.hostname.size());
+
+	// the peer may not be listening yet, the retries run in a dialer so
+	// that the receiving thread goes on, SendMsg waits for the link
+	std::shared_ptr<Link> link(new Link);
+	{
+		std::lock_guard<std::mutex> lk(mu_);
+		senders_[node.id] = link;
+	}
+	uint32_t channel = (is_scheduler_ || node.role == Node::SCHEDULER) ?
+			kCtrlChannel : kDataChannel;
+	std::lock_guard<std::mutex> lk(dial_mu_);
+	dialers_.emplace_back(&SocketVan::Dial, this, node, channel, link);
+	return 0;
+  }
+
+  bool PeerToPeer() const override { return true; }
+
+  int SendMsg(const Message& msg) override {
+    int id = msg.meta.recver;
+    CHECK_NE(id, Meta::kEmpty);
+
+	std::shared_ptr<Link> link;
+	{
+		std::lock_guard<std::mutex> lk(mu_);
+		auto it = senders_.find(id);
+
+		if (it == senders_.end()) {
+			LOG(WARNING) << "there is no socket to node " << id;
+			return -1;
+		}
+		link = it->second;
+	}
+	if (link->Wait() < 0) {
+		LOG(WARNING) << "there is no connection to node " << id;
+		return -1;
+	}
+
+    int meta_size; char* meta_buf;
+    PackMeta(msg.meta, &meta_buf, &meta_size);
+
+	size_t n = msg.data.size();
+	FrameHead head;
+	std::vector<uint32_t> sizes(n);
+	std::vector<struct iovec> iov(n + 3);
+
+	head.magic = kFrameMagic;
+	head.sender = my_node_.id;
+	head.meta_size = meta_size;
+	head.num_data = n;
+
+	iov[0].iov_base = &head;
+	iov[0].iov_len = sizeof(head);
+	iov[1].iov_base = sizes.data();
+	iov[1].iov_len = n * sizeof(uint32_t);
+	iov[2].iov_base = meta_buf;
+	iov[2].iov_len = meta_size;
+	int send_bytes = meta_size;
+	for (size_t i = 0; i < n; ++i) {
+		sizes[i] = msg.data[i].size();
+		iov[i + 3].iov_base = msg.data[i].data();
+		iov[i + 3].iov_len = msg.data[i].size();
+		send_bytes += msg.data[i].size();
+	}
+
+	int rc;
+	{
+		std::lock_guard<std::mutex> lk(link->mu);
+		rc = WriteAll(link->fd, iov.data(), iov.size());
+	}
+	delete [] meta_buf;
+
+	if (rc < 0) {
+		LOG(WARNING) << "failed to send message to node [" << id
+				<< "] errno: " << errno << " " << strerror(errno);
+		return -1;
+	}
+    return send_bytes;
+  }
+
+  int RecvMsg(Message* msg, bool is_data) override {
+	Channel *ch = (!is_scheduler_ && is_data) ? &data_ : &ctrl_;
+	struct epoll_event events[kMaxEvents];
+
+	while (ch->ready.empty()) {
+		// wake up to drop the connections whose hello never came
+		int timeout = -1;
+		if (ch == &ctrl_) {
+			std::lock_guard<std::mutex> lk(conn_mu_);
+			if (hello_pending_ > 0)
+				timeout = 1000;
+		}
+		int nev = epoll_wait(ch->epfd, events, kMaxEvents, timeout);
+
+		if (nev < 0) {
+			if (errno == EINTR) continue;
+			LOG(WARNING) << "failed to receive message. errno: "
+					<< errno << " " << strerror(errno);
+			return -1;
+		}
+		for (int i = 0; i < nev; ++i) {
+			Conn *conn = static_cast<Conn *>(events[i].data.ptr);
+
+			if (!conn)
+				Accept();
+			else if (conn->hello_left > 0)
+				ReadHello(conn);
+			else
+				ReadConn(conn, ch);
+		}
+		if (timeout >= 0)
+			ExpireHellos();
+	}
+
+	*msg = std::move(ch->ready.front().first);
+	int recv_bytes = ch->ready.front().second;
+	ch->ready.pop_front();
+	return recv_bytes;
+  }
+
+ private:
+  enum {
+	kFrameMagic = 0x70736d67,
+	kHelloMagic = 0x7073686c,
+	kCtrlChannel = 0,
+	kDataChannel = 1,
+	kConnectRetry = 600,
+	kHelloTimeoutMs = 10000,
+	kMaxEvents = 64,
+	kRecvChunk = 1 << 18
+  };
+
+  /** \brief first bytes on every connection */
+  struct Hello {
+	uint32_t magic;
+	uint32_t channel;
+  };
+  /**
+   * \brief message head on the wire, followed by num_data uint32_t data
+   * sizes, the meta and then the data frames
+   */
+  struct FrameHead {
+	uint32_t magic;
+	int32_t sender;
+	uint32_t meta_size;
+	uint32_t num_data;
+  };
+  /** \brief sending side of a connection, fd is set once it is dialed */
+  struct Link {
+	int fd = -1;
+	bool dialed = false;
+	std::mutex mu;
+	std::condition_variable cv;
+
+	~Link() {
+		if (fd >= 0)
+			close(fd);
+	}
+
+	/** \brief wait for the dialer, the fd or -1 if it failed */
+	int Wait() {
+		std::unique_lock<std::mutex> lk(mu);
+		cv.wait(lk, [this] { return dialed; });
+		return fd;
+	}
+	void Dialed(int dialed_fd) {
+		std::lock_guard<std::mutex> lk(mu);
+		fd = dialed_fd;
+		dialed = true;
+		cv.notify_all();
+	}
+  };
+  /**
+   * \brief receiving side of a connection. received data frames are
+   * zero-copy segments of buf, so a chunk is only reused once no message
+   * holds it anymore
+   */
+  struct Conn {
+	int fd = -1;
+	/** \brief bytes of the hello still to read, then it is moved to its
+	 * channel */
+	size_t hello_left = sizeof(Hello);
+	Hello hello;
+	std::chrono::steady_clock::time_point accepted;
+	SArray<char> buf;
+	size_t head = 0;
+	size_t tail = 0;
+	size_t need = 0;
+  };
+  /** \brief per receiving thread state */
+  struct Channel {
+	int epfd = -1;
+	std::deque<std::pair<Message, int>> ready;
+  };
+
+  int WriteAll(int fd, struct iovec *iov, int cnt) {
+	size_t total = 0;
+
+	while (cnt > 0) {
+		struct msghdr mh;
+
+		memset(&mh, 0, sizeof(mh));
+		mh.msg_iov = iov;
+		mh.msg_iovlen = std::min(cnt, IOV_MAX);
+		ssize_t n = sendmsg(fd, &mh, MSG_NOSIGNAL);
+		if (n < 0) {
+			if (errno == EINTR) continue;
+			return -1;
+		}
+		total += n;
+		while (cnt > 0 && (size_t)n >= iov->iov_len) {
+			n -= iov->iov_len;
+			++iov;
+			--cnt;
+		}
+		if (cnt > 0) {
+			iov->iov_base = (char *)iov->iov_base + n;
+			iov->iov_len -= n;
+		}
+	}
+	return total;
+  }
+
+  /**
+   * \brief connect to node, retrying for kConnectRetry * 100ms, and hand
+   * the connection to link
+   */
+  void Dial(Node node, uint32_t channel, std::shared_ptr<Link> link) {
+	int fd = -1;
+	struct addrinfo hints, *res = NULL;
+	std::string port = std::to_string(node.port);
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_INET;
+	hints.ai_socktype = SOCK_STREAM;
+	if (getaddrinfo(node.hostname.c_str(), port.c_str(), &hints, &res) != 0) {
+		fprintf(stderr, "[%s][%d]: cannot resolve %s\n",
+						__FILE__, __LINE__, node.hostname.c_str());
+		link->Dialed(-1);
+		return;
+	}
+
+	for (int i = 0; i < kConnectRetry && !dial_stop_; ++i) {
+		fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+		if (fd < 0)
+			break;
+		if (connect(fd, res->ai_addr, res->ai_addrlen) == 0)
+			break;
+		close(fd);
+		fd = -1;
+		std::this_thread::sleep_for(std::chrono::milliseconds(100));
+	}
+	freeaddrinfo(res);
+
+	if (fd < 0) {
+		fprintf(stderr, "[%s][%d]: host %s failed to connect to %s:%d\n",
+						__FILE__, __LINE__, my_node_.hostname.c_str(),
+						node.hostname.c_str(), node.port);
+		link->Dialed(-1);
+		return;
+	}
+
+	int one = 1;
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+	// tell the acceptor which receiving thread owns this connection
+	Hello hello;
+
+	hello.magic = kHelloMagic;
+	hello.channel = channel;
+	if (send(fd, &hello, sizeof(hello), MSG_NOSIGNAL) != sizeof(hello)) {
+		close(fd);
+		fd = -1;
+	}
+	link->Dialed(fd);
+  }
+
+  void Accept() {
+	while (true) {
+		int fd = accept4(listener_, NULL, NULL, SOCK_CLOEXEC);
+
+		if (fd < 0) {
+			if (errno == EINTR) continue;
+			if (errno != EAGAIN && errno != EWOULDBLOCK)
+				LOG(WARNING) << "accept failed: " << strerror(errno);
+			return;
+		}
+
+		// the connector writes hello right after connect(), ReadHello
+		// takes it from this thread once it is there
+		fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+		Conn *conn = new Conn;
+		conn->fd = fd;
+		conn->accepted = std::chrono::steady_clock::now();
+		{
+			std::lock_guard<std::mutex> lk(conn_mu_);
+			conns_[fd].reset(conn);
+			++hello_pending_;
+		}
+
+		struct epoll_event ev;
+
+		ev.events = EPOLLIN;
+		ev.data.ptr = conn;
+		CHECK_EQ(epoll_ctl(ctrl_.epfd, EPOLL_CTL_ADD, fd, &ev), 0)
+				<< "epoll_ctl failed: " << strerror(errno);
+	}
+  }
+
+  /**
+   * \brief read the hello of an accepted connection, then move it to the
+   * receiving thread of its channel
+   */
+  void ReadHello(Conn *conn) {
+	ssize_t n = recv(conn->fd, (char *)&conn->hello + sizeof(Hello) -
+					conn->hello_left, conn->hello_left, 0);
+
+	if (n < 0 && (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK))
+		return;
+	if (n > 0)
+		conn->hello_left -= n;
+	if (n <= 0 || (conn->hello_left == 0 && conn->hello.magic != kHelloMagic)) {
+		LOG(WARNING) << "bad hello on new connection";
+		CloseConn(conn, &ctrl_);
+		return;
+	}
+	if (conn->hello_left > 0)
+		return;
+	{
+		std::lock_guard<std::mutex> lk(conn_mu_);
+		--hello_pending_;
+	}
+	if (conn->hello.channel != kDataChannel || is_scheduler_)
+		return;
+
+	struct epoll_event ev;
+
+	ev.events = EPOLLIN;
+	ev.data.ptr = conn;
+	epoll_ctl(ctrl_.epfd, EPOLL_CTL_DEL, conn->fd, NULL);
+	CHECK_EQ(epoll_ctl(data_.epfd, EPOLL_CTL_ADD, conn->fd, &ev), 0)
+			<< "epoll_ctl failed: " << strerror(errno);
+  }
+
+  /**
+   * \brief drop the accepted connections without a hello after
+   * kHelloTimeoutMs
+   */
+  void ExpireHellos() {
+	auto now = std::chrono::steady_clock::now();
+	std::vector<Conn *> expired;
+	{
+		std::lock_guard<std::mutex> lk(conn_mu_);
+		for (auto& it : conns_) {
+			Conn *conn = it.second.get();
+			if (conn->hello_left > 0 && now - conn->accepted >
+					std::chrono::milliseconds(kHelloTimeoutMs))
+				expired.push_back(conn);
+		}
+	}
+	for (Conn *conn : expired) {
+		LOG(WARNING) << "no hello on new connection";
+		CloseConn(conn, &ctrl_);
+	}
+  }
+
+  void CloseConn(Conn *conn, Channel *ch) {
+	epoll_ctl(ch->epfd, EPOLL_CTL_DEL, conn->fd, NULL);
+	close(conn->fd);
+	std::lock_guard<std::mutex> lk(conn_mu_);
+	if (conn->hello_left > 0)
+		--hello_pending_;
+	conns_.erase(conn->fd);
+  }
+
+  /**
+   * \brief drain a connection and parse every complete message in it
+   */
+  void ReadConn(Conn *conn, Channel *ch) {
+	while (true) {
+		if (conn->tail == conn->buf.size())
+			Refill(conn);
+
+		ssize_t n = recv(conn->fd, conn->buf.data() + conn->tail,
+						conn->buf.size() - conn->tail, 0);
+		if (n == 0) {
+			CloseConn(conn, ch);
+			return;
+		}
+		if (n < 0) {
+			if (errno == EINTR) continue;
+			if (errno != EAGAIN && errno != EWOULDBLOCK) {
+				LOG(WARNING) << "failed to receive message. errno: "
+						<< errno << " " << strerror(errno);
+				CloseConn(conn, ch);
+			}
+			return;
+		}
+		conn->tail += n;
+		Parse(conn, ch);
+	}
+  }
+
+  /**
+   * \brief make room at the tail of the receive buffer
+   */
+  void Refill(Conn *conn) {
+	size_t left = conn->tail - conn->head;
+	size_t chunk = static_cast<size_t>(kRecvChunk);
+	size_t size = conn->need > chunk ? conn->need : chunk;
+
+	if (conn->buf.size() >= size && conn->buf.ptr().use_count() == 1) {
+		memmove(conn->buf.data(), conn->buf.data() + conn->head, left);
+	} else {
+		SArray<char> buf(new char[size], size, true);
+		if (left)
+			memcpy(buf.data(), conn->buf.data() + conn->head, left);
+		conn->buf = buf;
+	}
+	conn->head = 0;
+	conn->tail = left;
+  }
+
+  void Parse(Conn *conn, Channel *ch) {
+	while (true) {
+		char *p = conn->buf.data() + conn->head;
+		size_t left = conn->tail - conn->head;
+
+		conn->need = sizeof(FrameHead);
+		if (left < sizeof(FrameHead))
+			return;
+
+		FrameHead *head = (FrameHead *)p;
+		CHECK(head->magic == kFrameMagic) << "corrupted stream";
+
+		size_t off = sizeof(FrameHead) + head->num_data * sizeof(uint32_t);
+		conn->need = off;
+		if (left < off)
+			return;
+
+		uint32_t *sizes = (uint32_t *)(p + sizeof(FrameHead));
+		size_t total = off + head->meta_size;
+		for (uint32_t i = 0; i < head->num_data; ++i)
+			total += sizes[i];
+		conn->need = total;
+		if (left < total)
+			return;
+
+		ch->ready.emplace_back();
+		Message& msg = ch->ready.back().first;
+		UnpackMeta(p + off, head->meta_size, &(msg.meta));
+		msg.meta.sender = head->sender;
+		msg.meta.recver = my_node_.id;
+		off += head->meta_size;
+		for (uint32_t i = 0; i < head->num_data; ++i) {
+			size_t begin = conn->head + off;
+			msg.data.push_back(conn->buf.segment(begin, begin + sizes[i]));
+			off += sizes[i];
+		}
+		ch->ready.back().second = total - sizeof(FrameHead) -
+				head->num_data * sizeof(uint32_t);
+		conn->head += total;
+		conn->need = 0;
+	}
+  }
+
+  /** \brief protects senders_ */
+  std::mutex mu_;
+  /** \brief node_id to the connection for sending to this node */
+  std::unordered_map<int, std::shared_ptr<Link>> senders_;
+  int listener_ = -1;
+
+  /** \brief the threads dialing the peers of Connect */
+  std::mutex dial_mu_;
+  std::vector<std::thread> dialers_;
+  std::atomic<bool> dial_stop_{false};
+
+  std::mutex conn_mu_;
+  std::unordered_map<int, std::unique_ptr<Conn>> conns_;
+  /** \brief accepted connections still waiting for their hello */
+  int hello_pending_ = 0;
+  Channel ctrl_;
+  Channel data_;
+};
+
+}  // namespace ps
+
+#endif  // PS_SOCKET_VAN_H_
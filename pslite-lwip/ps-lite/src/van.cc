@@ -11,9 +11,11 @@
 #include "ps/sarray.h"
 #include "ps/internal/postoffice.h"
 #include "ps/internal/customer.h"
+#include "ps/internal/metrics.h"
 #include "./network_utils.h"
 #include "./meta.pb.h"
 #include "./zmq_van.h"
+#include "./socket_van.h"
 #include "./resender.h"
 namespace ps {
 
@@ -23,12 +25,20 @@ namespace ps {
 // problem.
 static const int kDefaultHeartbeatInterval = 0;
 
+// meta.head of a message carrying a batch of small data messages
+static const int kBatchHead = 0x62617463;
+
+// records and data frames in a batch start at 8-byte boundaries
+static inline size_t BatchAlign(size_t n) { return (n + 7) & ~(size_t)7; }
+
 static long start_sec = 0;
 static long start_usec = 0;
 
 Van* Van::Create(const std::string& type, Postoffice *po) {
   if (type == "zmq") {
     return new ZMQVan(po);
+  } else if (type == "socket") {
+    return new SocketVan(po);
   } else {
     LOG(FATAL) << "unsupported van type: " << type;
     return nullptr;
@@ -116,10 +126,13 @@ void Van::Start() {
 
   if (office->is_server())
 	is_server_ready = 1;
+  // the next local task may start now
+  Postctl::Get()->TaskStarted();
 
   // wait until ready
-  while (!ready_) {
-    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  {
+    std::unique_lock<std::mutex> lk(ready_mu_);
+    ready_cond_.wait(lk, [this] { return ready_.load(); });
   }
 
   if (!is_scheduler_) {
@@ -137,6 +150,15 @@ void Van::Start() {
     resender_ = new Resender(timeout, 10, this);
   }
 
+  // batching of small data messages
+  if (!is_scheduler_ && GetEnv("PS_BATCH_BYTES", 0) > 0) {
+    batch_bytes_ = GetEnv("PS_BATCH_BYTES", 0);
+    batch_delay_ = std::chrono::microseconds(GetEnv("PS_BATCH_DELAY_US", 50));
+    batch_stop_ = false;
+    flush_thread_ = std::unique_ptr<std::thread>(
+      new std::thread(&Van::Flushing, this));
+  }
+
   if (!is_scheduler_) {
     // start heartbeat thread
     heartbeat_thread_ = std::unique_ptr<std::thread>(
@@ -145,6 +167,14 @@ void Van::Start() {
 
 }
 
+void Van::SetReady(bool ready) {
+  {
+    std::lock_guard<std::mutex> lk(ready_mu_);
+    ready_ = ready;
+  }
+  ready_cond_.notify_all();
+}
+
 void Van::Stop() {
   // stop threads
 //  fprintf(stdout, "[%d][%s][%d]: van stop\n",
@@ -158,6 +188,18 @@ void Van::Stop() {
 		fprintf(stdout, "[%s][%d]: total second %lf\n", __FILE__, __LINE__, cost);
 	}
 
+	if (flush_thread_) {
+		{
+			std::lock_guard<std::mutex> lk(batch_mu_);
+			batch_stop_ = true;
+			for (auto& it : batches_)
+				FlushBatch(it.first);
+		}
+		batch_cond_.notify_all();
+		flush_thread_->join();
+		flush_thread_.reset();
+	}
+
 
 	Message exit;
   exit.meta.control.cmd = Control::TERMINATE;
@@ -177,10 +219,42 @@ void Van::Stop() {
 }
 
 int Van::Send(const Message& msg) {
-  int send_bytes = SendMsg(msg);
+  if (resender_ && msg.meta.seq == Meta::kEmpty &&
+      msg.meta.control.cmd != Control::ACK) {
+    // number it and keep a copy until it is acked
+    Message seq_msg = msg;
+    resender_->AddOutgoing(&seq_msg);
+    return Send(seq_msg);
+  }
+  int send_bytes = 0;
+  bool batched = false;
+  uint64_t start = Metrics::Get()->enabled() ? Metrics::Now() : 0;
+  if (batch_bytes_ && msg.meta.control.empty()) {
+    std::lock_guard<std::mutex> lk(batch_mu_);
+    send_bytes = AddToBatch(msg);
+    batched = send_bytes > 0;
+    if (!batched) {
+      // keep the order with the messages already batched for this node
+      FlushBatch(msg.meta.recver);
+      send_bytes = SendMsg(msg);
+    }
+  } else {
+    send_bytes = SendMsg(msg);
+  }
   CHECK_NE(send_bytes, -1);
   send_bytes_ += send_bytes;
-  if (resender_) resender_->AddOutgoing(msg);
+  if (start) {
+    Metrics* m = Metrics::Get();
+    if (msg.meta.push && msg.meta.request) m->FirstPush();
+    if (!batched) m->Add(Metrics::kSendDelay, Metrics::Now() - start);
+    m->Add(Metrics::kSendSize, send_bytes);
+    m->Inc(Metrics::kSendMsgs);
+    m->Inc(Metrics::kSendBytes, send_bytes);
+    if (msg.meta.control.empty()) {
+      m->Inc(msg.meta.is_hot ? Metrics::kHotMsgs : Metrics::kColdMsgs);
+      m->Inc(msg.meta.is_hot ? Metrics::kHotBytes : Metrics::kColdBytes, send_bytes);
+    }
+  }
   if (Postctl::Get()->verbose() >= 2) {
     PS_VLOG(2) << msg.DebugString();
   }
@@ -335,16 +409,20 @@ void Van::Receiving() {
             }
             nodes.control.node.push_back(my_node_);
             nodes.control.cmd = Control::ADD_NODE;
-            Message back; back.meta = nodes;
-            for (int r : office->GetNodeIDs(
-                     kWorkerGroup + kServerGroup)) {
-              back.meta.recver = r;
+            // every node only gets the entries it needs instead of the
+            // whole table, which is O(N^2) bytes in total
+            for (const auto& node : nodes.control.node) {
+              if (node.role == Node::SCHEDULER) continue;
+              Message back;
+              back.meta.control.cmd = Control::ADD_NODE;
+              NodeTable(nodes.control.node, node, &back.meta.control.node);
+              back.meta.recver = node.id;
               back.meta.timestamp = timestamp_++;
               Send(back);
             }
             PS_VLOG(1) << "the scheduler is connected to "
                     << num_workers_ << " workers and " << num_servers_ << " servers";
-            ready_ = true;
+            SetReady(true);
 
 			struct timeval tv;
 
@@ -374,20 +452,23 @@ void Van::Receiving() {
           }
         } else {
           for (const auto& node : ctrl.node) {
-//            Connect(node);
-            if (!node.is_recovery && node.role == Node::SERVER) ++num_servers_;
-            if (!node.is_recovery && node.role == Node::WORKER) ++num_workers_;
+            // zmq van goes through the switch and ignores this, the socket
+            // van connects to its peers directly
+            if (node.role != Node::SCHEDULER) Connect(node);
           }
           PS_VLOG(1) << my_node_.ShortDebugString() << " is connected to others";
-          ready_ = true;
+          SetReady(true);
         }
       } else if (ctrl.cmd == Control::BARRIER) {
         if (msg.meta.request) {
           if (barrier_count_.empty()) {
             barrier_count_.resize(8, 0);
+            barrier_reps_.resize(8);
           }
+          // a request stands for all the nodes of a process in this group
           int group = ctrl.barrier_group;
-          ++barrier_count_[group];
+          barrier_count_[group] += ctrl.barrier_count;
+          barrier_reps_[group].push_back(msg.meta.sender);
           PS_VLOG(1) << "Barrier count for " << group << " : " << barrier_count_[group];
           if (barrier_count_[group] ==
               static_cast<int>(office->GetNodeIDs(group).size())) {
@@ -395,11 +476,14 @@ void Van::Receiving() {
             Message res;
             res.meta.request = false;
             res.meta.control.cmd = Control::BARRIER;
-            for (int r : office->GetNodeIDs(group)) {
+            res.meta.control.barrier_group = group;
+            // each sender releases the other nodes of its process
+            for (int r : barrier_reps_[group]) {
               res.meta.recver = r;
               res.meta.timestamp = timestamp_++;
               CHECK_GT(Send(res), 0);
             }
+            barrier_reps_[group].clear();
           }
         } else {
           office->Manage(msg);
@@ -432,43 +516,200 @@ void Van::Receiving() {
 void Van::ReceivingData() {
 //	fprintf(stdout, "[%s][%d]: enter data receiving thread\n", __FILE__, __LINE__);
 	while (true) {
-		Message msg;
-		int recv_bytes = RecvMsg(&msg, true);
+		Message batch;
+		int recv_bytes = RecvMsg(&batch, true);
 
 //		std::cout << my_node_.role << " (DATA) receive:"
-//				<< msg.meta.DebugString() <<std::endl;
+//				<< batch.meta.DebugString() <<std::endl;
 
 		CHECK_NE(recv_bytes, -1);
 		recv_bytes_ += recv_bytes;
 
-		if (office->verbose() >= 2)
-			PS_VLOG(2) << msg.DebugString();
+		std::vector<Message> msgs;
+		if (batch.meta.control.empty() && batch.meta.head == kBatchHead)
+			Unbatch(batch, &msgs);
+		else
+			msgs.push_back(batch);
+
+		if (Metrics::Get()->enabled()) {
+			Metrics* m = Metrics::Get();
+			uint64_t now = Metrics::Now();
+
+			m->Inc(Metrics::kRecvMsgs, msgs.size());
+			m->Inc(Metrics::kRecvBytes, recv_bytes);
+			m->Add(Metrics::kRecvSize, recv_bytes);
+			for (auto& msg : msgs)
+				msg.meta.arrival = now;
+		}
+
+		for (auto& msg : msgs) {
+			if (office->verbose() >= 2)
+				PS_VLOG(2) << msg.DebugString();
 
-		// duplicated message
-		if (resender_ && resender_->AddIncomming(msg))
-			continue;
+			// duplicated message
+			if (resender_ && resender_->AddIncomming(msg))
+				continue;
 
-		// control message
-		if (!msg.meta.control.empty()) {
-			fprintf(stdout, "[%s][%d]: Node %d data path received control message ??\n",
-							__FILE__, __LINE__, my_node_.id);
-		}
-		// data message
-		else {
-			CHECK_NE(msg.meta.sender, Meta::kEmpty);
-			CHECK_NE(msg.meta.recver, Meta::kEmpty);
-			CHECK_NE(msg.meta.customer_id, Meta::kEmpty);
+			// control message
+			if (!msg.meta.control.empty()) {
+				fprintf(stdout, "[%s][%d]: Node %d data path received control message ??\n",
+								__FILE__, __LINE__, my_node_.id);
+			}
+			// data message
+			else {
+				CHECK_NE(msg.meta.sender, Meta::kEmpty);
+				CHECK_NE(msg.meta.recver, Meta::kEmpty);
+				CHECK_NE(msg.meta.customer_id, Meta::kEmpty);
 
-			int id = msg.meta.customer_id;
-			auto* obj = office->GetCustomer(id, 5);
+				int id = msg.meta.customer_id;
+				auto* obj = office->GetCustomer(id, 5);
 
-			CHECK(obj) << "timeout (5 sec) to wait App " << id << " ready";
-			obj->Accept(msg);
-		} // end of if (!msg.meta.control.empty())
+				CHECK(obj) << "timeout (5 sec) to wait App " << id << " ready";
+				obj->Accept(msg);
+			} // end of if (!msg.meta.control.empty())
+		}
 	}
 //	fprintf(stdout, "[%s][%d]: exit data receiving thread\n", __FILE__, __LINE__);
 }
 
+/*
+ * A batch is a data message with head kBatchHead and a single data frame
+ * holding one record per packed message:
+ *   uint16 meta size, uint16 number of data frames, uint32 size of each
+ *   data frame, the packed meta, then the data frames
+ */
+int Van::AddToBatch(const Message& msg) {
+	// the switch aggregates hot messages packet by packet
+	if (msg.meta.is_hot)
+		return 0;
+
+	size_t n = msg.data.size();
+	size_t head_size = 2 * sizeof(uint16_t) + n * sizeof(uint32_t);
+	size_t size = 0;
+	int meta_size;
+	char *meta_buf;
+
+	PackMeta(msg.meta, &meta_buf, &meta_size);
+	// drop the padding of data metas
+	meta_size = ((uint16_t *)meta_buf)[0] + sizeof(uint16_t);
+	size = BatchAlign(head_size + meta_size);
+	for (const auto& d : msg.data)
+		size += BatchAlign(d.size());
+
+	if (size > batch_bytes_) {
+		delete [] meta_buf;
+		return 0;
+	}
+
+	int recver = msg.meta.recver;
+	Batch& batch = batches_[recver];
+
+	if (!batch.buf) {
+		batch.buf.reset(new std::vector<char>());
+		batch.buf->reserve(batch_bytes_);
+	}
+	if (batch.buf->size() + size > batch_bytes_)
+		FlushBatch(recver);
+
+	bool first = batch.buf->empty();
+	size_t off = batch.buf->size();
+
+	batch.buf->resize(off + size);
+	char *p = batch.buf->data() + off;
+	uint16_t *hdr = (uint16_t *)p;
+	uint32_t *sizes = (uint32_t *)(p + 2 * sizeof(uint16_t));
+
+	hdr[0] = meta_size;
+	hdr[1] = n;
+	for (size_t i = 0; i < n; ++i)
+		sizes[i] = msg.data[i].size();
+	memcpy(p + head_size, meta_buf, meta_size);
+	delete [] meta_buf;
+
+	p += BatchAlign(head_size + meta_size);
+	for (const auto& d : msg.data) {
+		memcpy(p, d.data(), d.size());
+		p += BatchAlign(d.size());
+	}
+
+	if (first) {
+		batch.deadline = std::chrono::steady_clock::now() + batch_delay_;
+		batch_cond_.notify_one();
+	}
+	if (batch.buf->size() >= batch_bytes_)
+		FlushBatch(recver);
+	return size;
+}
+
+void Van::FlushBatch(int recver) {
+	auto it = batches_.find(recver);
+
+	if (it == batches_.end() || !it->second.buf || it->second.buf->empty())
+		return;
+
+	Message msg;
+	msg.meta.recver = recver;
+	msg.meta.head = kBatchHead;
+	msg.data.push_back(SArray<char>(it->second.buf));
+
+	it->second.buf.reset(new std::vector<char>());
+	it->second.buf->reserve(batch_bytes_);
+	CHECK_NE(SendMsg(msg), -1);
+
+	if (Metrics::Get()->enabled()) {
+		auto first = it->second.deadline - batch_delay_;
+		Metrics::Get()->Add(Metrics::kBatchDelay,
+				std::chrono::duration_cast<std::chrono::nanoseconds>(
+				std::chrono::steady_clock::now() - first).count());
+	}
+}
+
+void Van::Flushing() {
+	std::unique_lock<std::mutex> lk(batch_mu_);
+
+	while (!batch_stop_) {
+		auto now = std::chrono::steady_clock::now();
+		auto next = now + std::chrono::seconds(1);
+
+		for (auto& it : batches_) {
+			if (!it.second.buf || it.second.buf->empty())
+				continue;
+			if (it.second.deadline <= now)
+				FlushBatch(it.first);
+			else if (it.second.deadline < next)
+				next = it.second.deadline;
+		}
+		batch_cond_.wait_until(lk, next);
+	}
+}
+
+void Van::Unbatch(const Message& batch, std::vector<Message>* msgs) {
+	CHECK_EQ(batch.data.size(), (size_t)1) << "bad batch";
+
+	const SArray<char>& buf = batch.data[0];
+	size_t pos = 0;
+
+	while (pos < buf.size()) {
+		const char *p = buf.data() + pos;
+		const uint16_t *hdr = (const uint16_t *)p;
+		const uint32_t *sizes = (const uint32_t *)(p + 2 * sizeof(uint16_t));
+		size_t n = hdr[1];
+		size_t head_size = 2 * sizeof(uint16_t) + n * sizeof(uint32_t);
+		Message msg;
+
+		UnpackMeta(p + head_size, hdr[0], &(msg.meta));
+		msg.meta.sender = batch.meta.sender;
+		msg.meta.recver = batch.meta.recver;
+		pos += BatchAlign(head_size + hdr[0]);
+		for (size_t i = 0; i < n; ++i) {
+			CHECK_LE(pos + sizes[i], buf.size()) << "bad batch";
+			msg.data.push_back(buf.segment(pos, pos + sizes[i]));
+			pos += BatchAlign(sizes[i]);
+		}
+		msgs->push_back(msg);
+	}
+}
+
 void Van::PackMeta(const Meta& meta, char** meta_buf, int* buf_size) {
   // convert into protobuf
   PBMeta pb;
@@ -481,12 +722,16 @@ void Van::PackMeta(const Meta& meta, char** meta_buf, int* buf_size) {
   pb.set_push(meta.push);
   pb.set_request(meta.request);
   pb.set_simple_app(meta.simple_app);
+  if (meta.seq != Meta::kEmpty) pb.set_seq(meta.seq);
   for (auto d : meta.data_type) pb.add_data_type(d);
   if (!meta.control.empty()) {
     auto ctrl = pb.mutable_control();
     ctrl->set_cmd(meta.control.cmd);
     if (meta.control.cmd == Control::BARRIER) {
       ctrl->set_barrier_group(meta.control.barrier_group);
+      if (meta.control.barrier_count != 1) {
+        ctrl->set_barrier_count(meta.control.barrier_count);
+      }
     } else if (meta.control.cmd == Control::ACK) {
       ctrl->set_msg_sig(meta.control.msg_sig);
     }
@@ -539,6 +784,7 @@ void Van::UnpackMeta(const char* meta_buf, int buf_size, Meta* meta) {
   meta->request = pb.request();
   meta->push = pb.push();
   meta->simple_app = pb.simple_app();
+  meta->seq = pb.has_seq() ? pb.seq() : Meta::kEmpty;
   meta->body = pb.body();
   meta->data_type.resize(pb.data_type_size());
   for (int i = 0; i < pb.data_type_size(); ++i) {
@@ -548,6 +794,7 @@ void Van::UnpackMeta(const char* meta_buf, int buf_size, Meta* meta) {
     const auto& ctrl = pb.control();
     meta->control.cmd = static_cast<Control::Command>(ctrl.cmd());
     meta->control.barrier_group = ctrl.barrier_group();
+    meta->control.barrier_count = ctrl.barrier_count();
     meta->control.msg_sig = ctrl.msg_sig();
     for (int i = 0; i < ctrl.node_size(); ++i) {
       const auto& p = ctrl.node(i);
@@ -564,6 +811,17 @@ void Van::UnpackMeta(const char* meta_buf, int buf_size, Meta* meta) {
   }
 }
 
+void Van::NodeTable(const std::vector<Node>& all, const Node& node,
+                    std::vector<Node>* table) {
+  for (const auto& n : all) {
+    if (n.role == Node::SCHEDULER ||
+        (n.hostname == node.hostname && n.port == node.port) ||
+        (PeerToPeer() && n.role != node.role)) {
+      table->push_back(n);
+    }
+  }
+}
+
 void Van::Heartbeat() {
 
   const char* val = Environment::Get()->find("PS_HEARTBEAT_INTERVAL");
@@ -7,6 +7,7 @@
 #include <stdlib.h>
 #include <thread>
 #include <string>
+#include <algorithm>
 #include "ps/internal/van.h"
 #if _MSC_VER
 #define rand_r(x) rand()
@@ -49,7 +50,9 @@ class ZMQVan : public Van {
     context_ = zmq_ctx_new();
     CHECK(context_ != NULL) << "create 0mq context failed";
     zmq_ctx_set(context_, ZMQ_MAX_SOCKETS, 65536);
-    // zmq_ctx_set(context_, ZMQ_IO_THREADS, 4);
+    // at most 64, one affinity bit each
+    io_threads_ = std::min(64, std::max(1, GetEnv("PS_ZMQ_IO_THREADS", 1)));
+    zmq_ctx_set(context_, ZMQ_IO_THREADS, io_threads_);
     Van::Start();
   }
 
@@ -92,6 +95,7 @@ class ZMQVan : public Van {
     recver = zmq_socket(context_, ZMQ_ROUTER);
     CHECK(recver != NULL)
         << "create receiver socket failed: " << zmq_strerror(errno);
+    SetAffinity(recver, 0);
 //    int local = GetEnv("DMLC_LOCAL", 0);
 	int local = 0;
     std::string hostname = node.hostname.empty() ? "*" : node.hostname;
@@ -156,6 +160,8 @@ class ZMQVan : public Van {
 
 	if (node.role == Node::SCHEDULER)
 		zmq_set_remoteid(sock, node.id);
+	// keep the data and control connections off the receiver's I/O thread
+	SetAffinity(sock, node.role == Node::SCHEDULER ? 1 : 2);
     // connect
     std::string addr = "tcp://" + node.hostname + ":" + std::to_string(node.port);
     if (zmq_connect(sock, addr.c_str()) != 0) {
@@ -198,6 +204,7 @@ class ZMQVan : public Van {
 	  zmq_set_remoteid(sender, node.id);
 	  // TODO set bypass
     }
+    SetAffinity(sender, id);
 
     // connect
     std::string addr = "tcp://" + node.hostname + ":" + std::to_string(node.port);
@@ -421,7 +428,19 @@ class ZMQVan : public Van {
     return Meta::kEmpty;
   }
 
+  /**
+   * \brief pin the connections of a socket to I/O thread i % io_threads_,
+   * must be called before it binds or connects
+   */
+  void SetAffinity(void* socket, int i) {
+    uint64_t affinity = 1ULL << (i % io_threads_);
+    CHECK_EQ(zmq_setsockopt(socket, ZMQ_AFFINITY, &affinity, sizeof(affinity)), 0)
+        << zmq_strerror(errno);
+  }
+
   void *context_ = nullptr;
+  /** \brief the number of zmq I/O threads */
+  int io_threads_ = 1;
   /**
    * \brief node_id to the socket for sending data to this node
    */
@@ -0,0 +1,40 @@
+#!/bin/bash
+# node throughput of the zmq van with 1 to 8 zmq I/O threads. the DMLC_*
+# variables of this node and the switch must be set already, every node of
+# the job runs this script with the same thread counts
+if [ $# -lt 3 ]; then
+    echo "usage: $0 bin train_data test_data [io_threads...]"
+    exit -1;
+fi
+bin=$1
+train=$2
+test=$3
+shift 3
+threads="$@"
+if [ -z "${threads}" ]; then
+    threads="1 2 4 8"
+fi
+
+export PS_VAN_TYPE=zmq
+export PS_METRICS_INTERVAL=1
+
+for n in ${threads}; do
+    export PS_ZMQ_IO_THREADS=${n}
+    export PS_METRICS_FILE=/tmp/bench_io_threads_${n}.json
+    rm -f ${PS_METRICS_FILE}
+
+    ${bin} ${train} ${test} 0 0 > /dev/null
+
+    python3 - ${n} ${PS_METRICS_FILE} <<'PY'
+import json, sys
+m = [json.loads(l) for l in open(sys.argv[2])]
+first, last = m[0], m[-1]
+sec = max(last['time'] - first['time'], 1) / 1e3
+tx = (last['send_bytes'] - first['send_bytes']) / sec
+rx = (last['recv_bytes'] - first['recv_bytes']) / sec
+msgs = (last['send_msgs'] - first['send_msgs'] +
+        last['recv_msgs'] - first['recv_msgs']) / sec
+print('%d I/O threads: tx %.1f MB/s, rx %.1f MB/s, %.0f msgs/s' %
+      (int(sys.argv[1]), tx / 1e6, rx / 1e6, msgs))
+PY
+done
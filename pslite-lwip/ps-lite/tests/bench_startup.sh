@@ -0,0 +1,51 @@
+#!/bin/bash
+# startup time and barrier latency with 8, 64 and 256 simulated nodes, all
+# running as tasks of a single process over the socket van
+if [ $# -lt 3 ]; then
+    echo "usage: $0 bin train_data test_data [num_nodes...]"
+    exit -1;
+fi
+bin=$1
+train=$2
+test=$3
+shift 3
+sizes="$@"
+if [ -z "${sizes}" ]; then
+    sizes="8 64 256"
+fi
+
+export PS_VAN_TYPE=socket
+export DMLC_PS_ROOT_URI='127.0.0.1'
+export DMLC_PS_ROOT_PORT=8000
+export DMLC_PS_SWITCH_URI='127.0.0.1'
+export DMLC_PS_SWITCH_PORT=8001
+export DMLC_PS_LOCAL_URI='127.0.0.1'
+export DMLC_PS_LOCAL_GW='127.0.0.1'
+export DMLC_PS_LOCAL_MASK='255.0.0.0'
+export PS_METRICS_INTERVAL=0
+
+for n in ${sizes}; do
+    # one scheduler, one server, the rest are workers
+    export DMLC_NUM_SERVER=1
+    export DMLC_NUM_WORKER=$((n - 2))
+    role="scheduler,server"
+    for ((i=0; i<${DMLC_NUM_WORKER}; ++i)); do
+        role="${role},worker"
+    done
+    export DMLC_ROLE=${role}
+    export PS_METRICS_FILE=/tmp/bench_startup_${n}.json
+    rm -f ${PS_METRICS_FILE}
+
+    ${bin} ${train} ${test} 0 0 > /dev/null
+
+    python3 - ${n} ${PS_METRICS_FILE} <<'PY'
+import json, sys
+m = json.loads(open(sys.argv[2]).readlines()[-1])
+def ms(h, k): return h[k] / 1e6 if h['count'] else 0
+s, b, f = m['start_ns'], m['barrier_ns'], m['first_push_ns']
+print('%4s nodes: start max %.1f ms, barrier avg %.2f ms max %.2f ms, '
+      'first push %.1f ms' %
+      (sys.argv[1], ms(s, 'max'), ms(b, 'sum') / max(b['count'], 1), ms(b, 'max'),
+       ms(f, 'max')))
+PY
+done